@@ -0,0 +1,201 @@
+/*
+    Streaming change-point detection on per-interface signal series
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Page's CUSUM, in the Page-Hinkley form with a learned baseline: after
+ * CHANGE_WARMUP samples fix a series' mean and standard deviation, each
+ * sample adds its deviation less an allowance of CHANGE_DRIFT sigmas to
+ * an upward and a downward sum clamped at zero.  A sum passing
+ * CHANGE_THRESHOLD sigmas is a shift, of the mean deviation since the
+ * sum last left zero; the series then warms up again on its new level.
+ * A fixed threshold on the value would need to be set per site; this
+ * one adapts to each series' own spread.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "clock.h"
+#include "changepoint.h"
+
+static const char *series_names[CHANGE_SERIES_COUNT] = {
+  "noise", "level", "retries"
+};
+
+/* Least standard deviation assumed; the first two are in dB, readings
+   that are often constant for long stretches */
+static const double series_floor[CHANGE_SERIES_COUNT] = {
+  1.0, 1.0, 1.0
+};
+
+/*
+ * Name of a series as printed and journaled
+ */
+const char *change_series_name(enum change_series series)
+{
+  return series_names[series];
+}
+
+/*
+ * Forgets all baselines; the next samples are a new warm-up
+ */
+void change_reset(struct change_detect *d)
+{
+  memset(d->series, 0, sizeof(d->series));
+}
+
+/*
+ * Feeds one value into a series.  Returns 1 and fills ev when a shift
+ * is detected.
+ */
+static int cusum_add(struct cusum *c, enum change_series series, double x,
+                     unsigned long long now_ns, struct change_event *ev)
+{
+  double dev, k, h, delta;
+
+  if (c->n < CHANGE_WARMUP) {
+    /* Welford's running mean and variance */
+    c->n++;
+    delta = x - c->mean;
+    c->mean += delta / c->n;
+    c->m2 += delta * (x - c->mean);
+    if (c->n == CHANGE_WARMUP) {
+      c->sigma = sqrt(c->m2 / (c->n - 1));
+      if (c->sigma < series_floor[series])
+        c->sigma = series_floor[series];
+    }
+    return 0;
+  }
+
+  dev = x - c->mean;
+  k = CHANGE_DRIFT * c->sigma;
+  h = CHANGE_THRESHOLD * c->sigma;
+
+  if (c->up == 0) {
+    c->up_n = 0;
+    c->up_sum = 0;
+    c->up_onset_ns = now_ns;
+  }
+  c->up = fmax(0, c->up + dev - k);
+  if (c->up > 0) {
+    c->up_n++;
+    c->up_sum += dev;
+  }
+
+  if (c->down == 0) {
+    c->down_n = 0;
+    c->down_sum = 0;
+    c->down_onset_ns = now_ns;
+  }
+  c->down = fmax(0, c->down - dev - k);
+  if (c->down > 0) {
+    c->down_n++;
+    c->down_sum += dev;
+  }
+
+  if (c->up <= h && c->down <= h)
+    return 0;
+
+  ev->series = series;
+  ev->before = c->mean;
+  ev->detect_ns = now_ns;
+  if (c->up > h) {
+    ev->direction = 1;
+    ev->after = c->mean + c->up_sum / c->up_n;
+    ev->onset_ns = c->up_onset_ns;
+    ev->samples = c->up_n;
+  } else {
+    ev->direction = -1;
+    ev->after = c->mean + c->down_sum / c->down_n;
+    ev->onset_ns = c->down_onset_ns;
+    ev->samples = c->down_n;
+  }
+
+  /* the estimate rests on a few samples; learn the new level properly */
+  memset(c, 0, sizeof(*c));
+  return 1;
+}
+
+/*
+ * Feeds one snapshot to the interface's detectors, calling emit for
+ * each shift found.  Losing or changing the association starts over.
+ */
+void change_sample(struct change_detect *d, const char *ifname,
+                   const struct wireless_snapshot *snap,
+                   unsigned long long now_ns, change_emit_t emit, void *arg)
+{
+  struct change_event ev;
+  unsigned int delta;
+
+  if (snap->valid & WS_AP) {
+    if (!snap->associated) {
+      change_reset(d);
+      d->ap_valid = 0;
+      return;
+    }
+    if (d->ap_valid && memcmp(&d->ap, &snap->ap, sizeof(d->ap)))
+      change_reset(d);
+    d->ap = snap->ap;
+    d->ap_valid = 1;
+  }
+
+  if (!(snap->valid & WS_STATS))
+    return;
+
+  if (!(snap->updated & IW_QUAL_NOISE_INVALID) &&
+      cusum_add(&d->series[CHANGE_NOISE], CHANGE_NOISE, snap->noise, now_ns, &ev))
+    emit(ifname, &ev, arg);
+  if (!(snap->updated & IW_QUAL_LEVEL_INVALID) &&
+      cusum_add(&d->series[CHANGE_LEVEL], CHANGE_LEVEL, snap->level, now_ns, &ev))
+    emit(ifname, &ev, arg);
+
+  /* the driver counter is cumulative; a drop means it was reset */
+  if (d->retries_valid && now_ns > d->retries_ns) {
+    delta = snap->discard_retries >= d->retries_last ?
+            snap->discard_retries - d->retries_last : snap->discard_retries;
+    if (cusum_add(&d->series[CHANGE_RETRIES], CHANGE_RETRIES,
+                  (double)delta * NSEC_PER_SEC / (now_ns - d->retries_ns),
+                  now_ns, &ev))
+      emit(ifname, &ev, arg);
+  }
+  d->retries_last = snap->discard_retries;
+  d->retries_ns = now_ns;
+  d->retries_valid = 1;
+}
+
+/*
+ * Prints a detected shift, with the onset on the wall clock
+ */
+void change_print(const char *ifname, const struct change_event *ev, FILE *fp)
+{
+  unsigned long long onset = clock_realtime_ns() -
+                             (clock_monotonic_ns() - ev->onset_ns);
+
+  fprintf(fp, "change ifname=%s series=%s shift=%+.1f before=%.1f after=%.1f "
+          "onset=%llu.%03llu delay=%.3f samples=%lu\n",
+          ifname, series_names[ev->series], ev->after - ev->before,
+          ev->before, ev->after,
+          onset / NSEC_PER_SEC, (onset % NSEC_PER_SEC) / NSEC_PER_MSEC,
+          (double)(ev->detect_ns - ev->onset_ns) / NSEC_PER_SEC, ev->samples);
+  fflush(fp);
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
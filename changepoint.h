@@ -0,0 +1,103 @@
+/*
+    Streaming change-point detection on per-interface signal series
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef CHANGEPOINT_H
+#define CHANGEPOINT_H
+
+#include <stdio.h>
+#include "sample.h"
+
+/* Samples used to learn a series' mean and spread before detecting */
+#define CHANGE_WARMUP    16
+
+/* CUSUM allowance and decision threshold, in standard deviations */
+#define CHANGE_DRIFT     0.5
+#define CHANGE_THRESHOLD 5.0
+
+/*
+ * Series watched on every interface
+ */
+enum change_series {
+  CHANGE_NOISE,                 /* dBm */
+  CHANGE_LEVEL,                 /* dBm */
+  CHANGE_RETRIES,               /* per second */
+  CHANGE_SERIES_COUNT
+};
+
+/*
+ * Two-sided CUSUM of one series against its baseline.  Each side
+ * remembers when it last left zero, which is the estimated onset, and
+ * the deviations summed since, whose mean is the estimated shift.
+ */
+struct cusum {
+  unsigned long n;              /* warm-up samples seen */
+  double mean;                  /* baseline once warmed up */
+  double m2;
+  double sigma;
+
+  double up, down;
+  unsigned long up_n, down_n;
+  double up_sum, down_sum;
+  unsigned long long up_onset_ns, down_onset_ns;
+};
+
+/*
+ * A detected shift
+ */
+struct change_event {
+  enum change_series series;
+  int direction;                /* 1 up, -1 down */
+  double before;                /* baseline mean */
+  double after;                 /* mean since the onset */
+  unsigned long long onset_ns;  /* CLOCK_MONOTONIC */
+  unsigned long long detect_ns;
+  unsigned long samples;        /* since the onset */
+};
+
+/*
+ * Detectors of one interface.  Every update is constant time.  The
+ * baselines are relearned after a shift and when the interface
+ * associates elsewhere.
+ */
+struct change_detect {
+  struct cusum series[CHANGE_SERIES_COUNT];
+
+  int ap_valid;
+  struct ether_addr ap;
+
+  int retries_valid;
+  unsigned int retries_last;
+  unsigned long long retries_ns;
+};
+
+typedef void (*change_emit_t)(const char *ifname, const struct change_event *ev,
+                              void *arg);
+
+void change_sample(struct change_detect *d, const char *ifname,
+                   const struct wireless_snapshot *snap,
+                   unsigned long long now_ns, change_emit_t emit, void *arg);
+void change_reset(struct change_detect *d);
+const char *change_series_name(enum change_series series);
+void change_print(const char *ifname, const struct change_event *ev, FILE *fp);
+
+#endif /* CHANGEPOINT_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,559 @@
+/*
+    Expressions over snapshot fields
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * A small expression language over the fields of a sample, e.g.
+ *
+ *   level < -70 and retry_rate > 10
+ *   snr >= 25 || !associated
+ *   max(level, -90) - noise
+ *
+ * compiled once into a flat array of instructions for a stack machine,
+ * so that running it per interface per sample is a loop over a few
+ * instructions with no parsing, allocation or calls through pointers.
+ * and and or short-circuit by jumping over the right side.
+ *
+ * Values are doubles.  An absent field reads as NaN, and NaN carries
+ * through arithmetic, comparisons and not; it is false as a condition,
+ * so a rule on a field the driver does not report never holds, negated
+ * or not.  and and or still decide on a known side: 'x or true' holds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "clock.h"
+#include "expr.h"
+
+enum expr_op {
+  OP_CONST,
+  OP_FIELD,
+  OP_NEG,
+  OP_NOT,
+  OP_BOOL,
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_LT,
+  OP_LE,
+  OP_GT,
+  OP_GE,
+  OP_EQ,
+  OP_NE,
+  OP_MIN,
+  OP_MAX,
+  OP_ABS,
+  OP_AND,
+  OP_OR,
+  OP_JFALSE,                    /* and: false ends it, else keep it and go on */
+  OP_JTRUE                      /* or: true ends it, else keep it and go on */
+};
+
+static const char *expr_fields[EXPR_FIELDS] = {
+  "level", "noise", "snr", "qual", "bitrate", "txpower", "associated",
+  "retries", "retry_rate", "missed_beacons"
+};
+
+/* Other names fields go by */
+static const struct {
+  const char *name;
+  int field;
+} expr_aliases[] = {
+  { "signal", EXPR_LEVEL },
+  { "quality", EXPR_QUAL },
+};
+
+/* Words that end an expression in a query */
+static const char *expr_reserved[] = {
+  "and", "or", "not", "select", "where", "sort", "by", "asc", "desc", "limit"
+};
+
+struct expr_parser {
+  const char *src;
+  const char *p;
+  struct expr *e;
+  int depth;                    /* values on the stack at this point */
+  char *err;
+  size_t errlen;
+  int failed;
+};
+
+/*
+ * Name of a field
+ */
+const char *expr_field_name(int field)
+{
+  return field >= 0 && field < EXPR_FIELDS ? expr_fields[field] : "?";
+}
+
+/*
+ * Tells whether s starts with the word, in any case, and not as part
+ * of a longer name
+ */
+int expr_keyword(const char *s, const char *word)
+{
+  size_t len = strlen(word);
+
+  return strncasecmp(s, word, len) == 0 &&
+         !isalnum((unsigned char)s[len]) && s[len] != '_';
+}
+
+/*
+ * Records the first error, with where it was found
+ */
+static void expr_error(struct expr_parser *ps, const char *what)
+{
+  if (ps->failed)
+    return;
+  ps->failed = 1;
+  if (*ps->p)
+    snprintf(ps->err, ps->errlen, "%s at offset %d, near '%.12s'",
+             what, (int)(ps->p - ps->src), ps->p);
+  else
+    snprintf(ps->err, ps->errlen, "%s at the end", what);
+}
+
+static void expr_space(struct expr_parser *ps)
+{
+  while (isspace((unsigned char)*ps->p))
+    ps->p++;
+}
+
+/*
+ * Consumes an operator or word if it comes next
+ */
+static int expr_accept(struct expr_parser *ps, const char *tok)
+{
+  expr_space(ps);
+  if (isalpha((unsigned char)*tok)) {
+    if (!expr_keyword(ps->p, tok))
+      return 0;
+  } else if (strncmp(ps->p, tok, strlen(tok)) != 0) {
+    return 0;
+  }
+  ps->p += strlen(tok);
+  return 1;
+}
+
+/*
+ * Appends an instruction, accounting for what it does to the stack;
+ * returns its index, or -1
+ */
+static int expr_emit(struct expr_parser *ps, int op, int field, double value, int pushes)
+{
+  struct expr_insn *in;
+
+  if (ps->failed)
+    return -1;
+  if (ps->e->len == EXPR_CODE_MAX) {
+    expr_error(ps, "expression too long");
+    return -1;
+  }
+  ps->depth += pushes;
+  if (ps->depth > EXPR_STACK_MAX) {
+    expr_error(ps, "expression nested too deeply");
+    return -1;
+  }
+  in = &ps->e->code[ps->e->len];
+  in->op = op;
+  in->field = field;
+  in->jump = 0;
+  in->value = value;
+  return ps->e->len++;
+}
+
+static void expr_or(struct expr_parser *ps);
+
+/*
+ * Looks a name up among the fields and their aliases
+ */
+static int expr_lookup(const char *name, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < EXPR_FIELDS; i++)
+    if (strlen(expr_fields[i]) == len && strncasecmp(expr_fields[i], name, len) == 0)
+      return i;
+  for (i = 0; i < sizeof(expr_aliases) / sizeof(expr_aliases[0]); i++)
+    if (strlen(expr_aliases[i].name) == len &&
+        strncasecmp(expr_aliases[i].name, name, len) == 0)
+      return expr_aliases[i].field;
+  return -1;
+}
+
+/*
+ * number | field | abs(e) | min(e, e) | max(e, e) | (e)
+ */
+static void expr_primary(struct expr_parser *ps)
+{
+  const char *name;
+  char *end;
+  double value;
+  size_t len, i;
+  int field;
+
+  expr_space(ps);
+  if (expr_accept(ps, "(")) {
+    expr_or(ps);
+    if (!expr_accept(ps, ")"))
+      expr_error(ps, "expected ')'");
+    return;
+  }
+  if (isdigit((unsigned char)*ps->p) || *ps->p == '.') {
+    value = strtod(ps->p, &end);
+    ps->p = end;
+    expr_emit(ps, OP_CONST, 0, value, 1);
+    return;
+  }
+  if (!isalpha((unsigned char)*ps->p)) {
+    expr_error(ps, "expected a value");
+    return;
+  }
+  for (i = 0; i < sizeof(expr_reserved) / sizeof(expr_reserved[0]); i++)
+    if (expr_keyword(ps->p, expr_reserved[i])) {
+      expr_error(ps, "expected a value");
+      return;
+    }
+
+  name = ps->p;
+  while (isalnum((unsigned char)*ps->p) || *ps->p == '_')
+    ps->p++;
+  len = ps->p - name;
+
+  if ((len == 3 && strncasecmp(name, "abs", 3) == 0) ||
+      (len == 3 && strncasecmp(name, "min", 3) == 0) ||
+      (len == 3 && strncasecmp(name, "max", 3) == 0)) {
+    int op = tolower((unsigned char)name[1]) == 'b' ? OP_ABS :
+             tolower((unsigned char)name[1]) == 'i' ? OP_MIN : OP_MAX;
+
+    if (!expr_accept(ps, "(")) {
+      expr_error(ps, "expected '('");
+      return;
+    }
+    expr_or(ps);
+    if (op != OP_ABS) {
+      if (!expr_accept(ps, ","))
+        expr_error(ps, "expected ','");
+      expr_or(ps);
+    }
+    if (!expr_accept(ps, ")"))
+      expr_error(ps, "expected ')'");
+    expr_emit(ps, op, 0, 0, op == OP_ABS ? 0 : -1);
+    return;
+  }
+
+  if ((field = expr_lookup(name, len)) < 0) {
+    ps->p = name;
+    expr_error(ps, "unknown field");
+    return;
+  }
+  ps->e->fields |= 1u << field;
+  expr_emit(ps, OP_FIELD, field, 0, 1);
+}
+
+/*
+ * -e | e
+ */
+static void expr_unary(struct expr_parser *ps)
+{
+  if (expr_accept(ps, "-")) {
+    expr_unary(ps);
+    expr_emit(ps, OP_NEG, 0, 0, 0);
+  } else {
+    expr_primary(ps);
+  }
+}
+
+/*
+ * e * e | e / e
+ */
+static void expr_term(struct expr_parser *ps)
+{
+  expr_unary(ps);
+  while (!ps->failed) {
+    if (expr_accept(ps, "*")) {
+      expr_unary(ps);
+      expr_emit(ps, OP_MUL, 0, 0, -1);
+    } else if (expr_accept(ps, "/")) {
+      expr_unary(ps);
+      expr_emit(ps, OP_DIV, 0, 0, -1);
+    } else {
+      break;
+    }
+  }
+}
+
+/*
+ * e + e | e - e
+ */
+static void expr_sum(struct expr_parser *ps)
+{
+  expr_term(ps);
+  while (!ps->failed) {
+    if (expr_accept(ps, "+")) {
+      expr_term(ps);
+      expr_emit(ps, OP_ADD, 0, 0, -1);
+    } else if (expr_accept(ps, "-")) {
+      expr_term(ps);
+      expr_emit(ps, OP_SUB, 0, 0, -1);
+    } else {
+      break;
+    }
+  }
+}
+
+/*
+ * e < e and the other comparisons; they do not chain
+ */
+static void expr_compare(struct expr_parser *ps)
+{
+  static const struct {
+    const char *tok;
+    int op;
+  } ops[] = {
+    { "<=", OP_LE }, { ">=", OP_GE }, { "==", OP_EQ }, { "!=", OP_NE },
+    { "<", OP_LT }, { ">", OP_GT }, { "=", OP_EQ },
+  };
+  size_t i;
+
+  expr_sum(ps);
+  for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+    if (expr_accept(ps, ops[i].tok)) {
+      expr_sum(ps);
+      expr_emit(ps, ops[i].op, 0, 0, -1);
+      return;
+    }
+}
+
+/*
+ * not e | !e
+ */
+static void expr_not(struct expr_parser *ps)
+{
+  expr_space(ps);
+  if (expr_accept(ps, "not") || (*ps->p == '!' && ps->p[1] != '=' && expr_accept(ps, "!"))) {
+    expr_not(ps);
+    expr_emit(ps, OP_NOT, 0, 0, 0);
+  } else {
+    expr_compare(ps);
+  }
+}
+
+/*
+ * A short-circuit chain of and or or: each left side jumps to the end
+ * when it decides the result, else stays on the stack for comb to fold
+ * the right side into
+ */
+static void expr_chain(struct expr_parser *ps, void (*side)(struct expr_parser *),
+                       const char *word, const char *sym, int op, int comb)
+{
+  int jumps[EXPR_CODE_MAX], n = 0, at, i;
+
+  side(ps);
+  while (!ps->failed && (expr_accept(ps, word) || expr_accept(ps, sym))) {
+    if ((at = expr_emit(ps, op, 0, 0, 0)) >= 0)
+      jumps[n++] = at;
+    side(ps);
+    expr_emit(ps, comb, 0, 0, -1);
+  }
+  if (!n)
+    return;
+  expr_emit(ps, OP_BOOL, 0, 0, 0);
+  for (i = 0; i < n; i++)
+    ps->e->code[jumps[i]].jump = ps->e->len - jumps[i];
+}
+
+static void expr_and(struct expr_parser *ps)
+{
+  expr_chain(ps, expr_not, "and", "&&", OP_JFALSE, OP_AND);
+}
+
+static void expr_or(struct expr_parser *ps)
+{
+  expr_chain(ps, expr_and, "or", "||", OP_JTRUE, OP_OR);
+}
+
+/*
+ * Compiles src into e.  With end, stops at the first word that cannot
+ * go on the expression and points end at it; without, anything left
+ * over is an error.  On error returns -1 with a message in err.
+ */
+int expr_compile(struct expr *e, const char *src, const char **end,
+                 char *err, size_t errlen)
+{
+  struct expr_parser ps;
+
+  memset(e, 0, sizeof(*e));
+  memset(&ps, 0, sizeof(ps));
+  ps.src = ps.p = src;
+  ps.e = e;
+  ps.err = err;
+  ps.errlen = errlen;
+
+  expr_or(&ps);
+  expr_space(&ps);
+  if (!end && *ps.p)
+    expr_error(&ps, "unexpected text");
+  if (end)
+    *end = ps.p;
+  return ps.failed ? -1 : 0;
+}
+
+static inline int expr_truth(double v)
+{
+  return v != 0 && !isnan(v);
+}
+
+/*
+ * Runs a compiled expression on a row
+ */
+double expr_eval(const struct expr *e, const struct expr_row *row)
+{
+  double stack[EXPR_STACK_MAX + 1], a, b;
+  const struct expr_insn *in;
+  int sp = -1, pc;
+
+  for (pc = 0; pc < e->len; pc++) {
+    in = &e->code[pc];
+    switch (in->op) {
+      case OP_CONST:
+        stack[++sp] = in->value;
+        continue;
+      case OP_FIELD:
+        stack[++sp] = row->valid & (1u << in->field) ? row->v[in->field] : NAN;
+        continue;
+      case OP_NEG:
+        stack[sp] = -stack[sp];
+        continue;
+      case OP_NOT:
+        if (!isnan(stack[sp]))
+          stack[sp] = stack[sp] == 0;
+        continue;
+      case OP_BOOL:
+        if (!isnan(stack[sp]))
+          stack[sp] = stack[sp] != 0;
+        continue;
+      case OP_ABS:
+        stack[sp] = fabs(stack[sp]);
+        continue;
+      case OP_JFALSE:
+        if (stack[sp] == 0)
+          pc += in->jump - 1;
+        continue;
+      case OP_JTRUE:
+        if (expr_truth(stack[sp]))
+          pc += in->jump - 1;
+        continue;
+    }
+
+    b = stack[sp--];
+    a = stack[sp];
+    if (in->op == OP_AND) {
+      /* false if either side is, else unknown if either side is */
+      stack[sp] = a == 0 || b == 0 ? 0 : isnan(a) || isnan(b) ? NAN : 1;
+      continue;
+    }
+    if (in->op == OP_OR) {
+      stack[sp] = expr_truth(a) || expr_truth(b) ? 1 : isnan(a) || isnan(b) ? NAN : 0;
+      continue;
+    }
+    if (isnan(a) || isnan(b)) {
+      stack[sp] = NAN;
+      continue;
+    }
+    switch (in->op) {
+      case OP_ADD: a += b; break;
+      case OP_SUB: a -= b; break;
+      case OP_MUL: a *= b; break;
+      case OP_DIV: a = b != 0 ? a / b : NAN; break;
+      case OP_MIN: a = a < b ? a : b; break;
+      case OP_MAX: a = a > b ? a : b; break;
+      case OP_LT: a = a < b; break;
+      case OP_LE: a = a <= b; break;
+      case OP_GT: a = a > b; break;
+      case OP_GE: a = a >= b; break;
+      case OP_EQ: a = a == b; break;
+      case OP_NE: a = a != b; break;
+    }
+    stack[sp] = a;
+  }
+  return sp == 0 ? stack[0] : NAN;
+}
+
+/*
+ * Tells whether an expression holds for a row
+ */
+int expr_true(const struct expr *e, const struct expr_row *row)
+{
+  return expr_truth(expr_eval(e, row));
+}
+
+/*
+ * Works out a row's fields from a snapshot taken at now_ns.  rate, if
+ * given, carries the interface's counters from its last row.
+ */
+void expr_row_fill(struct expr_row *row, const char *ifname,
+                   const struct wireless_snapshot *snap,
+                   struct expr_rate *rate, unsigned long long now_ns)
+{
+  unsigned int delta;
+
+  memset(row, 0, sizeof(*row));
+  strncpy(row->ifname, ifname, sizeof(row->ifname) - 1);
+
+#define SET(f, x) (row->v[f] = (x), row->valid |= 1u << (f))
+  if (snap->valid & WS_STATS) {
+    if (!(snap->updated & IW_QUAL_LEVEL_INVALID))
+      SET(EXPR_LEVEL, snap->level);
+    if (!(snap->updated & IW_QUAL_NOISE_INVALID))
+      SET(EXPR_NOISE, snap->noise);
+    if (!(snap->updated & (IW_QUAL_LEVEL_INVALID | IW_QUAL_NOISE_INVALID)))
+      SET(EXPR_SNR, snap->level - snap->noise);
+    SET(EXPR_QUAL, snap->qual);
+    SET(EXPR_RETRIES, snap->discard_retries);
+    SET(EXPR_MISSED_BEACONS, snap->miss_beacon);
+    if (rate && rate->valid && now_ns > rate->retries_ns) {
+      delta = snap->discard_retries >= rate->retries_last ?
+              snap->discard_retries - rate->retries_last : snap->discard_retries;
+      SET(EXPR_RETRY_RATE, (double)delta * NSEC_PER_SEC / (now_ns - rate->retries_ns));
+    }
+    if (rate) {
+      rate->valid = 1;
+      rate->retries_last = snap->discard_retries;
+      rate->retries_ns = now_ns;
+    }
+  }
+  if (snap->valid & WS_BITRATE)
+    SET(EXPR_BITRATE, snap->bitrate / 1e6);
+  if ((snap->valid & WS_TXPOWER) && !snap->txpower.disabled &&
+      !(snap->txpower.flags & IW_TXPOW_RELATIVE))
+    SET(EXPR_TXPOWER, snap->txpower.flags & IW_TXPOW_MWATT ?
+                      10 * log10(snap->txpower.value) : snap->txpower.value);
+  if (snap->valid & WS_AP)
+    SET(EXPR_ASSOCIATED, snap->associated != 0);
+#undef SET
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,107 @@
+/*
+    Expressions over snapshot fields
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sample.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Instructions in a compiled expression, and values it may stack */
+#define EXPR_CODE_MAX   64
+#define EXPR_STACK_MAX  16
+
+/*
+ * Fields an expression can name, worked out from a snapshot
+ */
+enum expr_field {
+  EXPR_LEVEL,                   /* dBm */
+  EXPR_NOISE,                   /* dBm */
+  EXPR_SNR,                     /* level - noise, dB */
+  EXPR_QUAL,
+  EXPR_BITRATE,                 /* Mb/s */
+  EXPR_TXPOWER,                 /* dBm */
+  EXPR_ASSOCIATED,              /* 0 or 1 */
+  EXPR_RETRIES,                 /* the driver's counter */
+  EXPR_RETRY_RATE,              /* retries a second since the last sample */
+  EXPR_MISSED_BEACONS,
+  EXPR_FIELDS
+};
+
+/*
+ * One interface's fields at one sample; valid has bit 1 << field for
+ * each field present.  An expression that depends on an absent field
+ * never holds, not even negated.
+ */
+struct expr_row {
+  char ifname[16];
+  unsigned valid;
+  double v[EXPR_FIELDS];
+};
+
+/*
+ * What expr_row_fill() keeps between samples of an interface to work
+ * out rates
+ */
+struct expr_rate {
+  int valid;
+  unsigned int retries_last;
+  unsigned long long retries_ns;
+};
+
+struct expr_insn {
+  uint8_t op;
+  uint8_t field;
+  int16_t jump;                 /* relative, for the short-circuit ops */
+  double value;
+};
+
+/*
+ * A compiled expression, run on a stack of doubles
+ */
+struct expr {
+  int len;
+  unsigned fields;              /* 1 << field for each field it reads */
+  struct expr_insn code[EXPR_CODE_MAX];
+};
+
+int expr_compile(struct expr *e, const char *src, const char **end,
+                 char *err, size_t errlen);
+double expr_eval(const struct expr *e, const struct expr_row *row);
+int expr_true(const struct expr *e, const struct expr_row *row);
+int expr_keyword(const char *s, const char *word);
+const char *expr_field_name(int field);
+void expr_row_fill(struct expr_row *row, const char *ifname,
+                   const struct wireless_snapshot *snap,
+                   struct expr_rate *rate, unsigned long long now_ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EXPR_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,359 @@
+/*
+    Flight recorder: high-rate samples kept in memory until a trigger
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Periodic samples are printed, journaled and logged, so their rate is
+ * what the output can afford.  The flight recorder samples faster, on
+ * a thread of its own, into a fixed ring per interface that nothing
+ * reads until a trigger: a sharp drop in level or an association change
+ * seen by the recorder itself, or a link going down or a shift detector
+ * firing, reported by the monitor.  The ring then records for another
+ * FLIGHT_POST_NS and freezes, and the loop thread writes the
+ * FLIGHT_PRE_NS before the trigger and everything after it to the
+ * sample log.
+ *
+ * Rings are handed between the two threads by their state word alone:
+ * the recorder writes a ring until it stores FLIGHT_FROZEN, the loop
+ * reads it until it stores FLIGHT_RECORDING, and neither takes a lock.
+ * New rings reach the recorder through a lock-free stack, and released
+ * ones are freed by the recorder once it no longer holds them.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "clock.h"
+#include "flight.h"
+#include "mem.h"
+#include "trace.h"
+#include "rtnlgate.h"
+
+static struct wireless_loop *flight_loop;
+static struct samplelog *flight_log;
+static flight_dump_t flight_fn;
+static void *flight_arg;
+static unsigned long long flight_period_ns;
+static size_t flight_size;              /* records per ring, 0 if stopped */
+static pthread_t flight_thread;
+static int flight_stopping;             /* atomic */
+static struct flight *flight_fresh;     /* atomic, rings not yet listed */
+static struct flight *flight_list;      /* the recorder's */
+
+/*
+ * Prints a dump written to the sample log
+ */
+void flight_print(const struct flight_dump *d, FILE *fp)
+{
+  fprintf(fp, "flight ifname=%s trigger=%s time=%llu.%03llu pre=%zu post=%zu\n",
+          d->ifname, samplelog_trigger_name(d->reason),
+          d->trigger_ns / NSEC_PER_SEC, d->trigger_ns % NSEC_PER_SEC / NSEC_PER_MSEC,
+          d->pre, d->post);
+}
+
+/*
+ * Starts a dump of the ring unless one is under way.  Safe from any
+ * thread while the ring's owner holds it; -1 if already triggered.
+ */
+int flight_trigger(struct flight *f, int reason)
+{
+  int expect = FLIGHT_RECORDING;
+
+  if (!f || !__atomic_compare_exchange_n(&f->state, &expect, FLIGHT_ARMING, 0,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return -1;
+  f->reason = reason;
+  f->trigger_ns = clock_realtime_ns();
+  f->trigger_mono_ns = clock_monotonic_ns();
+  __atomic_store_n(&f->state, FLIGHT_TRIGGERED, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/*
+ * Appends a sample to the ring and looks for a drop in level or a
+ * change of association in it
+ */
+static void flight_record(struct flight *f)
+{
+  struct wireless_snapshot snap;
+  struct samplelog_record *rec;
+  int reason = 0;
+
+  if (rtnlgate_admit() < 0 ||
+      route_snapshot(&f->route, f->ifname, FLIGHT_FIELDS, &snap) < 0)
+    return;
+  rec = &f->ring[f->head++ & (f->size - 1)];
+  memset(rec, 0, sizeof(*rec));
+  rec->time_ns = clock_realtime_ns();
+  samplelog_fill(rec, f->ifname, f->ifindex, &snap);
+  rec->type = SAMPLELOG_FLIGHT;
+
+  if (rec->valid & WS_STATS) {
+    if (f->level_samples >= FLIGHT_WARMUP && rec->level < f->level_avg - FLIGHT_DROP_DB)
+      reason = SAMPLELOG_TRIGGER_SIGNAL;
+    if (f->level_samples++)
+      f->level_avg += (rec->level - f->level_avg) / FLIGHT_WARMUP;
+    else
+      f->level_avg = rec->level;
+  }
+  if (rec->valid & WS_AP) {
+    if (f->ap_seen && (rec->associated != f->associated ||
+                       memcmp(rec->ap, f->ap, sizeof(f->ap))))
+      reason = SAMPLELOG_TRIGGER_AP;
+    f->ap_seen = 1;
+    f->associated = rec->associated;
+    memcpy(f->ap, rec->ap, sizeof(f->ap));
+  }
+  if (reason)
+    flight_trigger(f, reason);
+}
+
+/*
+ * One round of the recorder: takes in new rings, samples each, freezes
+ * those whose post-trigger window is over and frees released ones
+ */
+static void flight_pass(void)
+{
+  struct flight *f, **pp, *fresh;
+  unsigned long long now;
+  int state, released;
+
+  fresh = __atomic_exchange_n(&flight_fresh, NULL, __ATOMIC_ACQUIRE);
+  while ((f = fresh) != NULL) {
+    fresh = f->next;
+    f->next = flight_list;
+    flight_list = f;
+  }
+
+  for (pp = &flight_list; (f = *pp) != NULL; ) {
+    state = __atomic_load_n(&f->state, __ATOMIC_ACQUIRE);
+    released = __atomic_load_n(&f->released, __ATOMIC_ACQUIRE);
+    if (state == FLIGHT_FROZEN) {
+      pp = &f->next;
+      continue;
+    }
+    if (released && state == FLIGHT_RECORDING) {
+      *pp = f->next;
+      mem_free(f);
+      continue;
+    }
+    if (!released)
+      flight_record(f);
+
+    now = clock_monotonic_ns();
+    pp = &f->next;
+    if (__atomic_load_n(&f->state, __ATOMIC_ACQUIRE) == FLIGHT_TRIGGERED &&
+        (released || now >= f->trigger_mono_ns + FLIGHT_POST_NS)) {
+      __atomic_store_n(&f->state, FLIGHT_FROZEN, __ATOMIC_RELEASE);
+      wireless_loop_post(flight_loop, &f->dump);
+    }
+  }
+}
+
+/*
+ * Recorder thread: a pass every period until stopped
+ */
+static void *flight_run(void *arg)
+{
+  struct timespec next;
+  unsigned long long due = clock_monotonic_ns(), now, traced;
+
+  trace_thread("flight");
+  while (!__atomic_load_n(&flight_stopping, __ATOMIC_ACQUIRE)) {
+    traced = trace_begin();
+    flight_pass();
+    trace_end(traced, "flight pass", NULL);
+
+    /* after a pass longer than the period, start afresh from now */
+    now = clock_monotonic_ns();
+    due += flight_period_ns;
+    if (due < now)
+      due = now + flight_period_ns;
+    next.tv_sec = due / NSEC_PER_SEC;
+    next.tv_nsec = due % NSEC_PER_SEC;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+      ;
+  }
+  return NULL;
+}
+
+/*
+ * Writes a frozen or triggered ring to the sample log: the trigger,
+ * then the records from FLIGHT_PRE_NS before it on, and empties it
+ */
+static void flight_write(struct flight *f)
+{
+  struct samplelog_record trigger;
+  struct flight_dump d;
+  unsigned long long first, i, from;
+  size_t n = f->head < f->size ? f->head : f->size;
+  size_t start, len;
+
+  from = f->trigger_ns > FLIGHT_PRE_NS ? f->trigger_ns - FLIGHT_PRE_NS : 0;
+  first = f->head - n;
+  while (first < f->head && f->ring[first & (f->size - 1)].time_ns < from)
+    first++;
+
+  memset(&d, 0, sizeof(d));
+  d.ifname = f->ifname;
+  d.reason = f->reason;
+  d.trigger_ns = f->trigger_ns;
+  for (i = first; i < f->head; i++) {
+    if (f->ring[i & (f->size - 1)].time_ns < f->trigger_ns)
+      d.pre++;
+    else
+      d.post++;
+  }
+
+  memset(&trigger, 0, sizeof(trigger));
+  trigger.time_ns = f->trigger_ns;
+  memcpy(trigger.ifname, f->ifname, sizeof(trigger.ifname));
+  trigger.type = SAMPLELOG_TRIGGER;
+  trigger.ifindex = f->ifindex;
+  trigger.trigger = f->reason;
+  samplelog_append(flight_log, &trigger, 1);
+
+  /* the ring wraps at most once */
+  n = f->head - first;
+  start = first & (f->size - 1);
+  len = n < f->size - start ? n : f->size - start;
+  samplelog_append(flight_log, &f->ring[start], len);
+  samplelog_append(flight_log, f->ring, n - len);
+
+  f->head = 0;
+  f->level_samples = 0;
+  f->ap_seen = 0;
+  if (flight_fn)
+    flight_fn(&d, flight_arg);
+}
+
+/*
+ * Loop side of a frozen ring: dumps it and hands it back to the
+ * recorder
+ */
+static void flight_dump(void *arg)
+{
+  struct flight *f = arg;
+
+  flight_write(f);
+  __atomic_store_n(&f->state, FLIGHT_RECORDING, __ATOMIC_RELEASE);
+}
+
+/*
+ * Starts the recorder sampling at hz, dumping to log and posting the
+ * dumps to the loop, which calls fn for each after writing it
+ */
+int flight_start(struct wireless_loop *loop, struct samplelog *log, double hz,
+                 flight_dump_t fn, void *arg)
+{
+  size_t records;
+
+  if (hz <= 0 || hz > 1000) {
+    fprintf(stderr, "flight recorder: rate out of range\n");
+    return -1;
+  }
+  flight_loop = loop;
+  flight_log = log;
+  flight_fn = fn;
+  flight_arg = arg;
+  flight_period_ns = NSEC_PER_SEC / hz;
+
+  records = (FLIGHT_PRE_NS + FLIGHT_POST_NS) / flight_period_ns + 1;
+  for (flight_size = 16; flight_size < records; flight_size *= 2)
+    ;
+  if (pthread_create(&flight_thread, NULL, flight_run, NULL) != 0) {
+    perror("flight recorder");
+    flight_size = 0;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Stops the recorder.  Rings that were triggered are dumped with what
+ * they hold, then every ring is freed, released or not.
+ */
+void flight_stop(void)
+{
+  struct flight *f, *next;
+  int state;
+
+  if (!flight_size)
+    return;
+  __atomic_store_n(&flight_stopping, 1, __ATOMIC_RELEASE);
+  pthread_join(flight_thread, NULL);
+
+  for (f = flight_fresh; f != NULL; f = next) {
+    next = f->next;
+    f->next = flight_list;
+    flight_list = f;
+  }
+  for (f = flight_list; f != NULL; f = next) {
+    next = f->next;
+    state = __atomic_load_n(&f->state, __ATOMIC_ACQUIRE);
+    if (state == FLIGHT_TRIGGERED || state == FLIGHT_FROZEN)
+      flight_write(f);
+    mem_free(f);
+  }
+  flight_fresh = flight_list = NULL;
+  flight_size = 0;
+}
+
+/*
+ * Gives an interface a ring; NULL if the recorder is not running or
+ * the memory is not there.  Loop thread only.
+ */
+struct flight *flight_new(const char *ifname, int ifindex)
+{
+  struct flight *f;
+
+  if (!flight_size)
+    return NULL;
+  if ((f = mem_alloc(MEM_FLIGHT, sizeof(*f) + flight_size * sizeof(f->ring[0]))) == NULL)
+    return NULL;
+  strncpy(f->ifname, ifname, sizeof(f->ifname) - 1);
+  f->ifindex = ifindex;
+  f->size = flight_size;
+  f->dump.fn = flight_dump;
+  f->dump.arg = f;
+
+  f->next = __atomic_load_n(&flight_fresh, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&flight_fresh, &f->next, f, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  return f;
+}
+
+/*
+ * Lets go of a ring.  A triggered one is still dumped, with what it
+ * has; the recorder frees it after.  The caller must not use it again.
+ */
+void flight_release(struct flight *f)
+{
+  if (f)
+    __atomic_store_n(&f->released, 1, __ATOMIC_RELEASE);
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
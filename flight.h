@@ -0,0 +1,109 @@
+/*
+    Flight recorder: high-rate samples kept in memory until a trigger
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stdio.h>
+#include <linux/if.h>
+#include "clock.h"
+#include "loop.h"
+#include "route.h"
+#include "samplelog.h"
+
+/* Kept from before a trigger, and recorded after it before the dump */
+#define FLIGHT_PRE_NS   (10ULL * NSEC_PER_SEC)
+#define FLIGHT_POST_NS  (5ULL * NSEC_PER_SEC)
+
+/* Fields of every recorded sample */
+#define FLIGHT_FIELDS   (WS_AP | WS_STATS | WS_BITRATE)
+
+/* A level this far below its recent average is a drop */
+#define FLIGHT_DROP_DB  10
+
+/* Samples that set the average before drops are looked for */
+#define FLIGHT_WARMUP   16
+
+/*
+ * Who owns a ring.  The recorder thread writes it while RECORDING and
+ * TRIGGERED; once it sets FROZEN the loop thread owns it until the dump
+ * is written and it sets RECORDING again.
+ */
+enum flight_state {
+  FLIGHT_RECORDING,
+  FLIGHT_ARMING,                /* a trigger is filling in its reason */
+  FLIGHT_TRIGGERED,             /* recording the post-trigger window */
+  FLIGHT_FROZEN                 /* waiting for the loop to dump it */
+};
+
+/*
+ * One interface's ring of records, newest at head - 1
+ */
+struct flight {
+  struct flight *next;          /* recorder's list, or the new stack */
+  char ifname[IFNAMSIZ];
+  int ifindex;
+  int state;                    /* enum flight_state, atomic */
+  int released;                 /* atomic; the owner let go of it */
+
+  /* set by the trigger */
+  int reason;                   /* SAMPLELOG_TRIGGER_* */
+  unsigned long long trigger_ns;      /* CLOCK_REALTIME */
+  unsigned long long trigger_mono_ns;
+
+  /* recorder only, or the loop while FROZEN */
+  struct route_table route;
+  unsigned long long head;      /* records written */
+  double level_avg;
+  unsigned level_samples;
+  int ap_seen;
+  uint8_t associated;
+  uint8_t ap[6];
+
+  struct loop_work dump;
+  size_t size;                  /* power of two */
+  struct samplelog_record ring[];
+};
+
+/*
+ * A dump written to the sample log
+ */
+struct flight_dump {
+  const char *ifname;
+  int reason;
+  unsigned long long trigger_ns;
+  size_t pre;                   /* records from before the trigger */
+  size_t post;
+};
+
+typedef void (*flight_dump_t)(const struct flight_dump *d, void *arg);
+
+int flight_start(struct wireless_loop *loop, struct samplelog *log, double hz,
+                 flight_dump_t fn, void *arg);
+void flight_stop(void);
+struct flight *flight_new(const char *ifname, int ifindex);
+void flight_release(struct flight *f);
+int flight_trigger(struct flight *f, int reason);
+void flight_print(const struct flight_dump *d, FILE *fp);
+
+#endif /* FLIGHT_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,108 @@
+/*
+    CPU budget governor for the monitor
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Keeps the monitor under a share of one CPU.  Once per window the
+ * process's CPU time (all threads, user and system) is compared with
+ * the wall time that passed; over budget, the monitor steps to a
+ * cheaper level at once.  It steps back only after several windows
+ * under half the budget: each level halves the sampling rate, so
+ * under half the budget means the previous level would fit.
+ */
+
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "clock.h"
+#include "sample.h"
+#include "governor.h"
+
+static const struct governor_level governor_levels[GOVERNOR_LEVELS] = {
+  /* stretch  slack                 dropped fields                        details */
+  {  1,       0,                    0,                                    1 },
+  {  2,       100 * NSEC_PER_MSEC,  0,                                    1 },
+  {  4,       250 * NSEC_PER_MSEC,  WS_ESSID | WS_BITRATE,                1 },
+  {  8,       NSEC_PER_SEC,         WS_ESSID | WS_BITRATE | WS_TXPOWER,   0 },
+};
+
+/*
+ * CPU time used by the process so far
+ */
+static unsigned long long governor_cpu_ns(void)
+{
+  struct rusage ru;
+
+  if (getrusage(RUSAGE_SELF, &ru) < 0)
+    return 0;
+  return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * NSEC_PER_SEC +
+         (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * NSEC_PER_USEC;
+}
+
+/*
+ * Starts at full fidelity with a budget given as a share of one CPU
+ */
+void governor_init(struct governor *g, double budget, unsigned long long now_ns)
+{
+  memset(g, 0, sizeof(*g));
+  g->budget = budget;
+  g->cpu_ns = governor_cpu_ns();
+  g->wall_ns = now_ns;
+}
+
+/*
+ * Ends a measuring window; returns 1 if the level changed
+ */
+int governor_update(struct governor *g, unsigned long long now_ns)
+{
+  unsigned long long cpu = governor_cpu_ns();
+  int level = g->level;
+
+  if (now_ns <= g->wall_ns)
+    return 0;
+  g->share = (double)(cpu - g->cpu_ns) / (now_ns - g->wall_ns);
+  g->cpu_ns = cpu;
+  g->wall_ns = now_ns;
+
+  if (g->share > g->budget) {
+    g->calm = 0;
+    if (g->level < GOVERNOR_LEVELS - 1)
+      g->level++;
+  } else if (g->share < g->budget / 2) {
+    if (++g->calm >= GOVERNOR_CALM_WINDOWS && g->level > 0) {
+      g->level--;
+      g->calm = 0;
+    }
+  } else {
+    g->calm = 0;
+  }
+  return g->level != level;
+}
+
+/*
+ * Settings of the current level
+ */
+const struct governor_level *governor_level(const struct governor *g)
+{
+  return &governor_levels[g->level];
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,59 @@
+/*
+    CPU budget governor for the monitor
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+/* Degradation steps, from full fidelity to the cheapest monitor */
+#define GOVERNOR_LEVELS        4
+
+/* How often CPU use is measured */
+#define GOVERNOR_WINDOW_NS     NSEC_PER_SEC
+
+/* Windows well under budget before a step back to more fidelity */
+#define GOVERNOR_CALM_WINDOWS  3
+
+/*
+ * What the monitor does at one level
+ */
+struct governor_level {
+  unsigned int stretch;         /* sampling interval multiplier */
+  unsigned long long slack_ns;  /* least timer slack, to share wakeups */
+  unsigned int drop_fields;     /* WS_* bits left out of samples */
+  int link_details;             /* print wireless info on link up */
+};
+
+struct governor {
+  double budget;                /* CPU share allowed, 0.05 for 5% */
+  int level;
+  int calm;                     /* consecutive windows well under budget */
+  double share;                 /* CPU share of the last window */
+  unsigned long long cpu_ns;    /* at the start of the window */
+  unsigned long long wall_ns;
+};
+
+void governor_init(struct governor *g, double budget, unsigned long long now_ns);
+int governor_update(struct governor *g, unsigned long long now_ns);
+const struct governor_level *governor_level(const struct governor *g);
+
+#endif /* GOVERNOR_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
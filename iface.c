@@ -0,0 +1,117 @@
+/*
+    Table of tracked wireless interfaces
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "iface.h"
+#include "mem.h"
+
+#define IFACE_HASH_SIZE 1024
+
+static struct iface *iface_hash[IFACE_HASH_SIZE];
+static struct iface *iface_list;
+
+/*
+ * Hashes an interface name (djb2)
+ */
+static unsigned int iface_hashfn(const char *name)
+{
+  unsigned int h = 5381;
+
+  while (*name)
+    h = h * 33 + (unsigned char)*name++;
+  return h % IFACE_HASH_SIZE;
+}
+
+/*
+ * Looks up a tracked interface, NULL if not tracked
+ */
+struct iface *iface_find(const char *name)
+{
+  struct iface *ifp;
+
+  for (ifp = iface_hash[iface_hashfn(name)]; ifp != NULL; ifp = ifp->next)
+    if (strncmp(ifp->name, name, IFNAMSIZ) == 0)
+      return ifp;
+  return NULL;
+}
+
+/*
+ * Looks up a tracked interface, starting to track it if needed
+ */
+struct iface *iface_get(const char *name)
+{
+  struct iface *ifp;
+  unsigned int h;
+
+  if ((ifp = iface_find(name)) != NULL)
+    return ifp;
+
+  if ((ifp = mem_alloc(MEM_IFACE, sizeof(*ifp))) == NULL)
+    return NULL;
+  mem_assign(ifp, &ifp->mem);
+  strncpy(ifp->name, name, IFNAMSIZ - 1);
+
+  h = iface_hashfn(ifp->name);
+  ifp->next = iface_hash[h];
+  iface_hash[h] = ifp;
+
+  ifp->list_next = iface_list;
+  if (iface_list)
+    iface_list->list_prev = ifp;
+  iface_list = ifp;
+  return ifp;
+}
+
+/*
+ * Stops tracking an interface and frees its state
+ */
+void iface_remove(struct iface *ifp)
+{
+  struct iface **pp;
+
+  for (pp = &iface_hash[iface_hashfn(ifp->name)]; *pp; pp = &(*pp)->next) {
+    if (*pp == ifp) {
+      *pp = ifp->next;
+      break;
+    }
+  }
+
+  if (ifp->list_prev)
+    ifp->list_prev->list_next = ifp->list_next;
+  else
+    iface_list = ifp->list_next;
+  if (ifp->list_next)
+    ifp->list_next->list_prev = ifp->list_prev;
+
+  mem_free(ifp);
+}
+
+/*
+ * First tracked interface, for iface_foreach()
+ */
+struct iface *iface_first(void)
+{
+  return iface_list;
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
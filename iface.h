@@ -0,0 +1,77 @@
+/*
+    Table of tracked wireless interfaces
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef IFACE_H
+#define IFACE_H
+
+#include <linux/if.h>
+#include "session.h"
+#include "changepoint.h"
+#include "route.h"
+#include "expr.h"
+#include "loop.h"
+#include "mem.h"
+
+struct worker_job;
+struct flight;
+struct rt_slot;
+
+/*
+ * Per-interface sampler state, looked up by name
+ */
+struct iface {
+  struct iface *next;           /* hash chain */
+  struct iface *list_next;      /* all interfaces */
+  struct iface *list_prev;
+  char name[IFNAMSIZ];
+  int ifindex;
+  int down;                     /* link left IF_OPER_UP, may be evicted */
+
+  struct loop_timer timer;       /* next periodic sample */
+  unsigned long long interval_ns;
+  unsigned long long next_ns;
+
+  struct session session;
+  struct change_detect change;  /* shifts in noise, level, retries */
+  struct route_table route;     /* backend of each field, unless the
+                                   job's is used */
+
+  struct worker_job *job;       /* with -A, samples it on its worker */
+  struct flight *flight;        /* with -F, its flight recorder ring */
+  struct rt_slot *rt;           /* with -R, its slot on the real-time sampler */
+
+  struct expr_rate rate;        /* counters for -Q and -E rates */
+  unsigned alerting;            /* bit i: -E rule i holds */
+
+  struct mem_owner mem;         /* accounted memory held for it */
+};
+
+struct iface *iface_find(const char *name);
+struct iface *iface_get(const char *name);
+void iface_remove(struct iface *ifp);
+struct iface *iface_first(void);
+
+#define iface_foreach(ifp) \
+  for ((ifp) = iface_first(); (ifp) != NULL; (ifp) = (ifp)->list_next)
+
+#endif /* IFACE_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,254 @@
+/*
+    Interface name patterns compiled for matching netlink messages
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Shell-style patterns (*, ?, [a-z], [!0-9], \ to escape) are compiled
+ * once into a few ops.  Names are matched as the bytes they arrive in,
+ * so a link message can be judged from its IFLA_IFNAME attribute found
+ * on a scan of the attributes, before anything is parsed or copied.
+ */
+
+#include <string.h>
+#include <linux/rtnetlink.h>
+
+#include "ifmatch.h"
+
+/*
+ * Compiles the inside of a [...] class into a bitmap; returns what
+ * follows the closing bracket, NULL if there is none
+ */
+static const unsigned char *ifmatch_class(uint32_t *bits, const unsigned char *s)
+{
+  int negate = 0;
+  int lo, hi, c, i;
+
+  if (*s == '!' || *s == '^') {
+    negate = 1;
+    s++;
+  }
+  /* a leading ] is a member */
+  do {
+    if (!*s)
+      return NULL;
+    lo = hi = *s++;
+    if (s[0] == '-' && s[1] && s[1] != ']') {
+      hi = s[1];
+      s += 2;
+    }
+    for (c = lo; c <= hi; c++)
+      bits[c / 32] |= 1U << (c % 32);
+  } while (*s != ']');
+
+  if (negate)
+    for (i = 0; i < 8; i++)
+      bits[i] = ~bits[i];
+  return s + 1;
+}
+
+/*
+ * Compiles one pattern
+ */
+static int ifmatch_compile(struct ifmatch_pattern *p, const char *pattern)
+{
+  const unsigned char *s = (const unsigned char *)pattern;
+  int classes = 0, fixed = 0, star = 0;
+  struct ifmatch_op *op;
+
+  memset(p, 0, sizeof(*p));
+  while (*s) {
+    if (p->count == IFMATCH_OPS)
+      return -1;
+    op = &p->ops[p->count];
+
+    switch (*s) {
+      case '*':
+        s++;
+        star = 1;
+        if (p->count && op[-1].type == IFMATCH_OP_STAR)
+          continue;
+        op->type = IFMATCH_OP_STAR;
+        break;
+      case '?':
+        s++;
+        op->type = IFMATCH_OP_ANY;
+        fixed++;
+        break;
+      case '[':
+        if (classes == IFMATCH_CLASSES ||
+            (s = ifmatch_class(p->classes[classes], s + 1)) == NULL)
+          return -1;
+        op->type = IFMATCH_OP_CLASS;
+        op->arg = classes++;
+        fixed++;
+        break;
+      case '\\':
+        if (s[1])
+          s++;
+        /* fall through */
+      default:
+        op->type = IFMATCH_OP_BYTE;
+        op->arg = *s++;
+        fixed++;
+        break;
+    }
+    p->count++;
+  }
+
+  p->min_len = fixed;
+  p->max_len = star ? 255 : fixed;
+  while (p->prefix_len < p->count && p->ops[p->prefix_len].type == IFMATCH_OP_BYTE)
+    p->prefix_len++;
+  return 0;
+}
+
+/*
+ * Adds an include or exclude pattern; -1 if it is malformed or there
+ * is no room for it
+ */
+int ifmatch_add(struct ifmatch *m, const char *pattern, int exclude)
+{
+  struct ifmatch_pattern *p;
+
+  if (exclude) {
+    if (m->exclude_count == IFMATCH_PATTERNS)
+      return -1;
+    p = &m->exclude[m->exclude_count];
+  } else {
+    if (m->include_count == IFMATCH_PATTERNS)
+      return -1;
+    p = &m->include[m->include_count];
+  }
+  if (!*pattern || ifmatch_compile(p, pattern) < 0)
+    return -1;
+
+  if (exclude)
+    m->exclude_count++;
+  else
+    m->include_count++;
+  return 0;
+}
+
+/*
+ * Whether one op takes the byte
+ */
+static inline int ifmatch_op_matches(const struct ifmatch_pattern *p,
+                                     const struct ifmatch_op *op, unsigned char c)
+{
+  switch (op->type) {
+    case IFMATCH_OP_BYTE:
+      return op->arg == c;
+    case IFMATCH_OP_CLASS:
+      return p->classes[op->arg][c / 32] >> (c % 32) & 1;
+    default:
+      return 1;
+  }
+}
+
+/*
+ * Matches a name against one pattern.  A mismatch after a * retries
+ * from one byte further into the name; only the last * needs
+ * revisiting, so this never backtracks further.
+ */
+static int ifmatch_run(const struct ifmatch_pattern *p, const unsigned char *s,
+                       size_t len)
+{
+  size_t i, o, star_o = 0, star_i = 0;
+  int starred = 0;
+
+  if (len < p->min_len || len > p->max_len)
+    return 0;
+  for (i = 0; i < p->prefix_len; i++)
+    if (s[i] != p->ops[i].arg)
+      return 0;
+
+  o = i;
+  while (i < len) {
+    if (o < p->count) {
+      if (p->ops[o].type == IFMATCH_OP_STAR) {
+        starred = 1;
+        star_o = o++;
+        star_i = i;
+        continue;
+      }
+      if (ifmatch_op_matches(p, &p->ops[o], s[i])) {
+        o++;
+        i++;
+        continue;
+      }
+    }
+    if (!starred)
+      return 0;
+    o = star_o + 1;
+    i = ++star_i;
+  }
+  while (o < p->count && p->ops[o].type == IFMATCH_OP_STAR)
+    o++;
+  return o == p->count;
+}
+
+/*
+ * Whether an interface name of len bytes, not necessarily terminated,
+ * passes the patterns
+ */
+int ifmatch_name(const struct ifmatch *m, const char *name, size_t len)
+{
+  const unsigned char *s = (const unsigned char *)name;
+  int i;
+
+  if (m->include_count) {
+    for (i = 0; i < m->include_count; i++)
+      if (ifmatch_run(&m->include[i], s, len))
+        break;
+    if (i == m->include_count)
+      return 0;
+  }
+  for (i = 0; i < m->exclude_count; i++)
+    if (ifmatch_run(&m->exclude[i], s, len))
+      return 0;
+  return 1;
+}
+
+/*
+ * Whether a netlink message passes.  For link messages the attributes
+ * are scanned only as far as IFLA_IFNAME, whose bytes are matched in
+ * place; other messages, and link messages without a name, pass.
+ */
+int ifmatch_msg(const struct ifmatch *m, const struct nlmsghdr *n)
+{
+  const struct rtattr *rta;
+  int len;
+
+  if (!m->include_count && !m->exclude_count)
+    return 1;
+  if (n->nlmsg_type != RTM_NEWLINK && n->nlmsg_type != RTM_DELLINK)
+    return 1;
+
+  len = n->nlmsg_len - NLMSG_LENGTH(sizeof(struct ifinfomsg));
+  rta = (const struct rtattr *)((const char *)NLMSG_DATA(n) +
+                                NLMSG_ALIGN(sizeof(struct ifinfomsg)));
+  for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+    if (rta->rta_type == IFLA_IFNAME)
+      return ifmatch_name(m, RTA_DATA(rta), strnlen(RTA_DATA(rta), RTA_PAYLOAD(rta)));
+  }
+  return 1;
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,85 @@
+/*
+    Interface name patterns compiled for matching netlink messages
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef IFMATCH_H
+#define IFMATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/netlink.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IFMATCH_PATTERNS 16     /* of each kind */
+#define IFMATCH_OPS      32     /* per pattern, after compiling */
+#define IFMATCH_CLASSES  4      /* [...] per pattern */
+
+/*
+ * One step of a compiled pattern
+ */
+struct ifmatch_op {
+  uint8_t type;                 /* IFMATCH_OP_* */
+  uint8_t arg;                  /* the byte, or the class */
+};
+
+#define IFMATCH_OP_BYTE  0
+#define IFMATCH_OP_ANY   1      /* ? */
+#define IFMATCH_OP_CLASS 2      /* [a-z], [!0-9] */
+#define IFMATCH_OP_STAR  3      /* * */
+
+/*
+ * A glob pattern compiled once.  Names are rejected on their length or
+ * literal prefix before the ops are run.
+ */
+struct ifmatch_pattern {
+  struct ifmatch_op ops[IFMATCH_OPS];
+  uint8_t count;
+  uint8_t min_len;              /* bytes a name needs at least */
+  uint8_t max_len;              /* and at most, 255 if unbounded */
+  uint8_t prefix_len;           /* leading IFMATCH_OP_BYTE ops */
+  uint32_t classes[IFMATCH_CLASSES][8];
+};
+
+/*
+ * Include and exclude patterns.  A name passes if it matches some
+ * include pattern, or there are none, and no exclude pattern.  Zeroed
+ * it passes everything.
+ */
+struct ifmatch {
+  struct ifmatch_pattern include[IFMATCH_PATTERNS];
+  struct ifmatch_pattern exclude[IFMATCH_PATTERNS];
+  int include_count;
+  int exclude_count;
+};
+
+int ifmatch_add(struct ifmatch *m, const char *pattern, int exclude);
+int ifmatch_name(const struct ifmatch *m, const char *name, size_t len);
+int ifmatch_msg(const struct ifmatch *m, const struct nlmsghdr *n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IFMATCH_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
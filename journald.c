@@ -0,0 +1,374 @@
+/*
+    Native systemd journal sink
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Speaks the journald native protocol: each record is one datagram of
+ * FIELD=value lines sent to the journal socket.  The protocol has no
+ * way to put several entries in one datagram, so records are queued
+ * and handed to the kernel together with sendmmsg(); a record too big
+ * for a datagram is passed as a sealed memfd instead, as sd_journal
+ * does.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "clock.h"
+#include "journald.h"
+#include "mem.h"
+
+/* Records up to this size may go to a journald_drain() writer */
+#define JOURNALD_DRAIN_MAX 16384
+
+struct journald {
+  int fd;
+  struct sockaddr_un addr;
+  socklen_t addrlen;
+
+  /* encoded records back to back, record i is start[i]..start[i + 1] */
+  char *buf;
+  size_t len;
+  size_t size;
+  size_t start[JOURNALD_BATCH + 1];
+  int count;
+  int truncated;                /* the record being built lost a field */
+  int pressure;                 /* send early rather than grow the buffer */
+
+  unsigned long long dropped;
+};
+
+/*
+ * Opens the journal socket; path may point at a stand-in socket
+ */
+struct journald *journald_open(const char *path)
+{
+  struct journald *j;
+  int sndbuf = 8 * 1024 * 1024;
+
+  if (strlen(path) >= sizeof(j->addr.sun_path)) {
+    fprintf(stderr, "journal socket path too long: %s\n", path);
+    return NULL;
+  }
+
+  if ((j = mem_alloc(MEM_JOURNAL, sizeof(*j))) == NULL) {
+    perror("journald");
+    return NULL;
+  }
+
+  /* non-blocking: a journal that falls behind costs records, not the loop */
+  if ((j->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+    perror("journald socket");
+    mem_free(j);
+    return NULL;
+  }
+
+  /* a larger send buffer lets bigger records go out as plain datagrams */
+  setsockopt(j->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+  j->addr.sun_family = AF_UNIX;
+  strcpy(j->addr.sun_path, path);
+  j->addrlen = offsetof(struct sockaddr_un, sun_path) + strlen(path) + 1;
+  return j;
+}
+
+/*
+ * Flushes what is queued and releases the sink
+ */
+void journald_close(struct journald *j)
+{
+  if (!j)
+    return;
+  journald_flush(j);
+  if (j->dropped)
+    fprintf(stderr, "journald: %llu records dropped\n", j->dropped);
+  close(j->fd);
+  mem_free(j->buf);
+  mem_free(j);
+}
+
+/*
+ * Appends raw bytes to the record being built.  If the buffer cannot
+ * grow, e.g. at the journal's memory cap, the record is marked to be
+ * dropped when it ends.
+ */
+static void journald_append(struct journald *j, const void *data, size_t len)
+{
+  if (j->len + len > j->size) {
+    size_t size = j->size ? j->size : 4096;
+    char *buf;
+
+    while (size < j->len + len)
+      size *= 2;
+    if ((buf = mem_realloc(MEM_JOURNAL, j->buf, size)) == NULL) {
+      j->truncated = 1;
+      return;
+    }
+    j->buf = buf;
+    j->size = size;
+  }
+  memcpy(j->buf + j->len, data, len);
+  j->len += len;
+}
+
+/*
+ * Appends one FIELD=value pair, using the length-prefixed form when
+ * the value contains a newline
+ */
+static void journald_vfield(struct journald *j, const char *name,
+                            const char *fmt, va_list ap)
+{
+  char small[256];
+  char *value = small;
+  va_list aq;
+  int len;
+
+  va_copy(aq, ap);
+  len = vsnprintf(small, sizeof(small), fmt, aq);
+  va_end(aq);
+  if (len < 0)
+    return;
+  if ((size_t)len >= sizeof(small)) {
+    if ((value = mem_alloc(MEM_JOURNAL, len + 1)) == NULL) {
+      j->truncated = 1;
+      return;
+    }
+    vsnprintf(value, len + 1, fmt, ap);
+  }
+
+  journald_append(j, name, strlen(name));
+  if (memchr(value, '\n', len)) {
+    uint64_t le = htole64(len);
+
+    journald_append(j, "\n", 1);
+    journald_append(j, &le, sizeof(le));
+  } else {
+    journald_append(j, "=", 1);
+  }
+  journald_append(j, value, len);
+  journald_append(j, "\n", 1);
+
+  if (value != small)
+    mem_free(value);
+}
+
+/*
+ * Starts a record with its MESSAGE and the fields every record carries.
+ * EVENT_REALTIME_USEC keeps the acquisition time, since the journal's
+ * own timestamp is the time of the (possibly batched) send.
+ */
+void journald_begin(struct journald *j, int priority, const char *fmt, ...)
+{
+  va_list ap;
+
+  /* after a record was lost for memory, reuse the buffer instead of
+     growing it */
+  if (j->count == JOURNALD_BATCH || j->pressure)
+    journald_flush(j);
+  j->pressure = 0;
+
+  j->start[j->count] = j->len;
+
+  va_start(ap, fmt);
+  journald_vfield(j, "MESSAGE", fmt, ap);
+  va_end(ap);
+  journald_field(j, "PRIORITY", "%d", priority);
+  journald_field(j, "SYSLOG_IDENTIFIER", "wireless-info");
+  journald_field(j, "EVENT_REALTIME_USEC", "%llu",
+                 clock_realtime_ns() / NSEC_PER_USEC);
+}
+
+/*
+ * Adds a structured field to the record being built
+ */
+void journald_field(struct journald *j, const char *name, const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  journald_vfield(j, name, fmt, ap);
+  va_end(ap);
+}
+
+/*
+ * Queues the record being built, or drops it if it is incomplete
+ */
+void journald_end(struct journald *j)
+{
+  if (j->truncated) {
+    j->truncated = 0;
+    j->pressure = 1;
+    j->len = j->start[j->count];
+    j->dropped++;
+    return;
+  }
+  j->count++;
+  j->start[j->count] = j->len;
+}
+
+/*
+ * Sends one record through a sealed memfd, for payloads the socket
+ * refuses as a datagram
+ */
+static int journald_send_memfd(struct journald *j, const char *data, size_t len)
+{
+  union {
+    struct cmsghdr cmsg;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  size_t done = 0;
+  int mfd, ret = -1;
+
+  if ((mfd = memfd_create("wireless-info-journal",
+                          MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+    return -1;
+
+  while (done < len) {
+    ssize_t n = write(mfd, data + done, len - done);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      goto out;
+    }
+    done += n;
+  }
+
+  if (fcntl(mfd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+    goto out;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  msg.msg_name = &j->addr;
+  msg.msg_namelen = j->addrlen;
+  msg.msg_control = &control;
+  msg.msg_controllen = sizeof(control);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &mfd, sizeof(int));
+
+  ret = sendmsg(j->fd, &msg, MSG_NOSIGNAL) < 0 ? -1 : 0;
+out:
+  close(mfd);
+  return ret;
+}
+
+/*
+ * Sends every queued record, as many per syscall as the kernel takes.
+ * Records the journal cannot take are counted as dropped; returns -1
+ * if anything was dropped.
+ */
+int journald_flush(struct journald *j)
+{
+  struct mmsghdr msgs[JOURNALD_BATCH];
+  struct iovec iov[JOURNALD_BATCH];
+  int i, sent = 0, ret = 0;
+
+  if (!j->count)
+    return 0;
+
+  memset(msgs, 0, sizeof(msgs[0]) * j->count);
+  for (i = 0; i < j->count; i++) {
+    iov[i].iov_base = j->buf + j->start[i];
+    iov[i].iov_len = j->start[i + 1] - j->start[i];
+    msgs[i].msg_hdr.msg_name = &j->addr;
+    msgs[i].msg_hdr.msg_namelen = j->addrlen;
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  while (sent < j->count) {
+    int n = sendmmsg(j->fd, msgs + sent, j->count - sent, MSG_NOSIGNAL);
+
+    if (n > 0) {
+      sent += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EMSGSIZE || errno == ENOBUFS) &&
+        journald_send_memfd(j, iov[sent].iov_base, iov[sent].iov_len) == 0) {
+      sent++;
+      continue;
+    }
+
+    /* journal gone or overloaded (EAGAIN), do not block the monitor on it */
+    j->dropped += j->count - sent;
+    ret = -1;
+    break;
+  }
+
+  j->count = 0;
+  j->len = 0;
+  return ret;
+}
+
+/*
+ * Passes every queued record to send, which writes it later on the
+ * caller's behalf.  Records it refuses, and those too big for it to be
+ * sure of a datagram, are sent here as by journald_flush().
+ */
+int journald_drain(struct journald *j, journald_send_t send, void *arg)
+{
+  int i, ret = 0;
+
+  for (i = 0; i < j->count; i++) {
+    const char *data = j->buf + j->start[i];
+    size_t len = j->start[i + 1] - j->start[i];
+    ssize_t n;
+
+    if (len <= JOURNALD_DRAIN_MAX &&
+        send(j->fd, data, len, (struct sockaddr *)&j->addr, j->addrlen, arg) == 0)
+      continue;
+
+    do {
+      n = sendto(j->fd, data, len, MSG_NOSIGNAL,
+                 (struct sockaddr *)&j->addr, j->addrlen);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0 && (errno == EMSGSIZE || errno == ENOBUFS))
+      n = journald_send_memfd(j, data, len);
+    if (n < 0) {
+      j->dropped++;
+      ret = -1;
+    }
+  }
+
+  j->count = 0;
+  j->len = 0;
+  return ret;
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
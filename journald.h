@@ -0,0 +1,54 @@
+/*
+    Native systemd journal sink
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef JOURNALD_H
+#define JOURNALD_H
+
+/* Where systemd-journald listens for native protocol datagrams */
+#define JOURNALD_SOCKET "/run/systemd/journal/socket"
+
+/* Records queued before a flush is forced */
+#define JOURNALD_BATCH  64
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+struct journald;
+
+/* Hands one record to another writer, e.g. an io_uring; -1 refuses it */
+typedef int (*journald_send_t)(int fd, const void *data, size_t len,
+                               const struct sockaddr *addr, socklen_t addrlen,
+                               void *arg);
+
+struct journald *journald_open(const char *path);
+void journald_close(struct journald *j);
+
+void journald_begin(struct journald *j, int priority, const char *fmt, ...)
+  __attribute__((format(printf, 3, 4)));
+void journald_field(struct journald *j, const char *name, const char *fmt, ...)
+  __attribute__((format(printf, 3, 4)));
+void journald_end(struct journald *j);
+int journald_flush(struct journald *j);
+int journald_drain(struct journald *j, journald_send_t send, void *arg);
+
+#endif /* JOURNALD_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,1285 @@
+/*
+    Event loop shared by the monitor and embedding callers
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Everything the loop waits on (rtnetlink socket, a timerfd armed for
+ * the wheel's next expiry and an eventfd for posted work) sits in one
+ * epoll set.  Embedding callers watch that single descriptor from their
+ * own executor and call wireless_loop_dispatch() when it is readable;
+ * the command line monitor just blocks in wireless_loop_run().  No
+ * threads are created.
+ *
+ * The io_uring engine replaces the three descriptors with requests on
+ * one ring: a multishot receive into provided buffers for netlink, an
+ * absolute timeout for the wheel and a read of the eventfd.  Output
+ * queued with wireless_loop_write()/wireless_loop_sendto() during a
+ * dispatch is submitted as linked writes, so the monitor makes one
+ * io_uring_enter() per wakeup instead of a syscall per message and per
+ * flush.  The epoll set then only holds the ring descriptor.
+ *
+ * A dispatch handles its lanes in order: link messages and work posted
+ * as urgent, then routine posted work, then due timers.  Routine items
+ * check the clock as they go, and when input was last looked for more
+ * than LOOP_YIELD_NS ago they stop to read the netlink socket (or reap
+ * the ring) and run urgent work, so a DELLINK does not wait behind a
+ * burst of sample completions.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <linux/sock_diag.h>
+#include <libnetlink.h>
+
+#include "clock.h"
+#include "uring.h"
+#include "mem.h"
+#include "sample.h"
+#include "snapcache.h"
+#include "ifmatch.h"
+#include "loop.h"
+#include "trace.h"
+
+/* ring size and provided netlink receive buffers for the io_uring engine */
+#define LOOP_RING_ENTRIES 256
+#define LOOP_RECV_BUFS    64
+#define LOOP_RECV_BUF_LEN 16384
+
+/* output descriptors one loop writes to */
+#define LOOP_SINKS        8
+
+/* longest routine work runs without looking for link messages */
+#define LOOP_YIELD_NS     (500 * NSEC_PER_USEC)
+
+/* lanes that take posted work */
+#define LOOP_POSTED_LANES (LOOP_LANE_WORK + 1)
+
+/* what a completion belongs to, in the low byte of its user_data */
+#define LOOP_OP_RECV      1
+#define LOOP_OP_EVENTFD   2
+#define LOOP_OP_TIMEOUT   3
+#define LOOP_OP_CANCEL    4
+#define LOOP_OP_SINK      5
+
+/*
+ * Output queued for one descriptor.  While one batch is in flight the
+ * next one collects behind it, so writes reach the descriptor in order.
+ */
+struct loop_sink {
+  int fd;
+  int dgram;
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+
+  /* queued bytes; for datagrams ends[i] is where record i stops */
+  char *buf;
+  size_t len;
+  size_t size;
+  size_t *ends;
+  int count;
+  int ends_size;
+
+  /* batch in flight */
+  char *out;
+  size_t out_len;
+  size_t out_size;
+  size_t out_done;
+  size_t *out_ends;
+  int out_count;
+  int out_ends_size;
+  unsigned long long out_ns;    /* when submitted, if tracing */
+  struct msghdr *msgs;
+  struct iovec *iov;
+  int inflight;                 /* requests not completed yet */
+
+  unsigned long long dropped;
+};
+
+struct wireless_loop {
+  enum loop_engine engine;
+  int epfd;
+  int timerfd;
+  int eventfd;
+  struct rtnl_handle rth;
+
+  struct wheel wheel;
+  unsigned long long armed_ns;  /* timer expiry, 0 when disarmed */
+  unsigned long long looked_ns; /* last look for link messages */
+  int dispatching;
+
+  /* io_uring engine */
+  struct uring ring;
+  int recv_flags;               /* IORING_RECV_MULTISHOT unless refused */
+  unsigned int recv_drops;      /* socket drop count at the last ENOBUFS */
+  uint64_t eventfd_count;
+  struct __kernel_timespec timeout;
+  unsigned int timeout_gen;
+  int failed;
+
+  struct loop_sink sinks[LOOP_SINKS];
+  int sink_count;
+
+  struct wireless_loop_stats stats;
+  struct snapcache *cache;
+  const struct ifmatch *filter;
+
+  loop_msg_fn_t msg_fn;
+  void *msg_arg;
+  loop_fn_t dispatch_fn;
+  void *dispatch_arg;
+
+  /* shared with other threads */
+  pthread_mutex_t lock;
+  struct loop_work *work_head[LOOP_POSTED_LANES];
+  struct loop_work **work_tail[LOOP_POSTED_LANES];
+  unsigned long long queued[LOOP_POSTED_LANES];
+  struct loop_link_waiter *waiters;
+};
+
+static void loop_uring_recv(struct wireless_loop *loop);
+static void loop_uring_eventfd(struct wireless_loop *loop);
+static void loop_yield(struct wireless_loop *loop, unsigned long long now);
+
+/*
+ * Adds a descriptor to the loop's epoll set
+ */
+static int loop_watch(struct wireless_loop *loop, int fd)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*
+ * Sets up the ring and its standing requests; on failure the caller
+ * falls back to epoll
+ */
+static int loop_uring_init(struct wireless_loop *loop)
+{
+  if (uring_init(&loop->ring, LOOP_RING_ENTRIES) < 0)
+    return -1;
+  if (uring_bufs_init(&loop->ring, LOOP_RECV_BUFS, LOOP_RECV_BUF_LEN) < 0 ||
+      loop_watch(loop, loop->ring.fd) < 0) {
+    uring_exit(&loop->ring);
+    return -1;
+  }
+
+  loop->recv_flags = IORING_RECV_MULTISHOT;
+  loop_uring_recv(loop);
+  loop_uring_eventfd(loop);
+  if (uring_enter(&loop->ring, 0) < 0) {
+    uring_exit(&loop->ring);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Creates a loop subscribed to link events, with a timer wheel of the
+ * given tick and slack
+ */
+struct wireless_loop *wireless_loop_new(unsigned long long tick_ns,
+                                        unsigned long long slack_ns)
+{
+  return wireless_loop_new_engine(tick_ns, slack_ns, LOOP_ENGINE_EPOLL);
+}
+
+/*
+ * Like wireless_loop_new(), choosing how the loop waits.  If io_uring
+ * is not available the loop says so and uses epoll.
+ */
+struct wireless_loop *wireless_loop_new_engine(unsigned long long tick_ns,
+                                               unsigned long long slack_ns,
+                                               enum loop_engine engine)
+{
+  struct wireless_loop *loop;
+  int i;
+
+  if ((loop = mem_alloc(MEM_LOOP, sizeof(*loop))) == NULL)
+    return NULL;
+
+  loop->epfd = loop->timerfd = loop->eventfd = loop->rth.fd = -1;
+  loop->ring.fd = -1;
+  pthread_mutex_init(&loop->lock, NULL);
+  for (i = 0; i < LOOP_POSTED_LANES; i++)
+    loop->work_tail[i] = &loop->work_head[i];
+  wheel_init(&loop->wheel, tick_ns, slack_ns, clock_monotonic_ns());
+
+  if ((loop->cache = snapcache_new()) == NULL)
+    goto fail;
+
+  if (rtnl_open(&loop->rth, RTMGRP_LINK) < 0) {
+    fprintf(stderr, "rtnl_open() failed in %s %s\n", __FUNCTION__, __FILE__);
+    goto fail;
+  }
+  fcntl(loop->rth.fd, F_SETFL, fcntl(loop->rth.fd, F_GETFL) | O_NONBLOCK);
+
+  if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+      (loop->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+    perror("wireless_loop_new");
+    goto fail;
+  }
+
+  if (engine == LOOP_ENGINE_URING) {
+    if (loop_uring_init(loop) == 0) {
+      loop->engine = LOOP_ENGINE_URING;
+      return loop;
+    }
+    perror("io_uring unavailable, using epoll");
+  }
+
+  if ((loop->timerfd = timerfd_create(CLOCK_MONOTONIC,
+                                      TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+    perror("wireless_loop_new");
+    goto fail;
+  }
+
+  if (loop_watch(loop, loop->rth.fd) < 0 ||
+      loop_watch(loop, loop->timerfd) < 0 ||
+      loop_watch(loop, loop->eventfd) < 0) {
+    perror("epoll_ctl");
+    goto fail;
+  }
+  return loop;
+
+fail:
+  wireless_loop_free(loop);
+  return NULL;
+}
+
+/*
+ * Waits for queued output, then closes the loop's descriptors.  Pending
+ * work and waiters are dropped without being called.
+ */
+void wireless_loop_free(struct wireless_loop *loop)
+{
+  int i;
+
+  if (!loop)
+    return;
+
+  loop->msg_fn = NULL;
+  if (loop->ring.fd >= 0) {
+    wireless_loop_flush(loop);
+    uring_exit(&loop->ring);
+  }
+  for (i = 0; i < loop->sink_count; i++) {
+    struct loop_sink *s = &loop->sinks[i];
+
+    if (s->dropped)
+      fprintf(stderr, "output to descriptor %d: %llu writes dropped\n",
+              s->fd, s->dropped);
+    mem_free(s->buf);
+    mem_free(s->ends);
+    mem_free(s->out);
+    mem_free(s->out_ends);
+    mem_free(s->msgs);
+    mem_free(s->iov);
+  }
+
+  if (loop->rth.fd >= 0)
+    rtnl_close(&loop->rth);
+  if (loop->epfd >= 0)
+    close(loop->epfd);
+  if (loop->timerfd >= 0)
+    close(loop->timerfd);
+  if (loop->eventfd >= 0)
+    close(loop->eventfd);
+  snapcache_free(loop->cache);
+  pthread_mutex_destroy(&loop->lock);
+  mem_free(loop);
+}
+
+/*
+ * Descriptor that becomes readable when the loop has work to dispatch
+ */
+int wireless_loop_fd(struct wireless_loop *loop)
+{
+  return loop->epfd;
+}
+
+/*
+ * Engine the loop ended up with
+ */
+enum loop_engine wireless_loop_engine(const struct wireless_loop *loop)
+{
+  return loop->engine;
+}
+
+/*
+ * Copies the loop's counters
+ */
+void wireless_loop_stats(const struct wireless_loop *loop,
+                         struct wireless_loop_stats *st)
+{
+  pthread_mutex_t *lock = (pthread_mutex_t *)&loop->lock;
+  int i;
+
+  *st = loop->stats;
+  st->syscalls += loop->ring.enters;
+  pthread_mutex_lock(lock);
+  for (i = 0; i < LOOP_POSTED_LANES; i++)
+    st->lanes[i].depth = loop->queued[i];
+  pthread_mutex_unlock(lock);
+}
+
+/*
+ * Name of a lane, as the monitor prints it
+ */
+const char *wireless_loop_lane_name(enum loop_lane lane)
+{
+  static const char *names[LOOP_LANES] = { "link", "work", "timer" };
+
+  return lane < LOOP_LANES ? names[lane] : "unknown";
+}
+
+/*
+ * Reads an interface's snapshot through the loop's cache.  Call it from
+ * the loop's thread, like everything else that is not marked otherwise.
+ */
+int wireless_loop_snapshot(struct wireless_loop *loop, const char *ifname,
+                           unsigned fields, struct wireless_snapshot *snap)
+{
+  return snapcache_get(loop->cache, ifname, fields, snap);
+}
+
+/*
+ * Sets how long wireless_loop_snapshot() may serve the given WS_* fields
+ * from the cache; 0, the default, always reads them
+ */
+void wireless_loop_cache_ttl(struct wireless_loop *loop, unsigned fields,
+                             unsigned long long ttl_ns)
+{
+  snapcache_ttl(loop->cache, fields, ttl_ns);
+}
+
+/*
+ * Copies the cache's hit and miss counters
+ */
+void wireless_loop_cache_stats(const struct wireless_loop *loop,
+                               struct snapcache_stats *st)
+{
+  snapcache_stats(loop->cache, st);
+}
+
+/*
+ * Sets the handler for every rtnetlink message received
+ */
+void wireless_loop_on_message(struct wireless_loop *loop,
+                              loop_msg_fn_t fn, void *arg)
+{
+  loop->msg_fn = fn;
+  loop->msg_arg = arg;
+}
+
+/*
+ * Drops link messages for interfaces the patterns reject before the
+ * handler, the cache or any waiter sees them.  The patterns are not
+ * copied; NULL passes everything.
+ */
+void wireless_loop_filter(struct wireless_loop *loop, const struct ifmatch *m)
+{
+  loop->filter = m;
+}
+
+/*
+ * Sets a function called at the end of every dispatch, e.g. to flush
+ * output batched while dispatching
+ */
+void wireless_loop_on_dispatch(struct wireless_loop *loop,
+                               loop_fn_t fn, void *arg)
+{
+  loop->dispatch_fn = fn;
+  loop->dispatch_arg = arg;
+}
+
+/*
+ * Points the ring's timeout at the wheel's earliest timer, replacing
+ * the one in flight
+ */
+static void loop_uring_arm(struct wireless_loop *loop, long long next)
+{
+  struct io_uring_sqe *sqe;
+
+  if (loop->armed_ns && (sqe = uring_sqe(&loop->ring)) != NULL) {
+    sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = LOOP_OP_TIMEOUT | (uint64_t)loop->timeout_gen << 8;
+    sqe->user_data = LOOP_OP_CANCEL;
+  }
+  loop->armed_ns = 0;
+  if (next < 0 || (sqe = uring_sqe(&loop->ring)) == NULL)
+    return;
+
+  loop->timeout_gen++;
+  loop->timeout.tv_sec = next / NSEC_PER_SEC;
+  loop->timeout.tv_nsec = next % NSEC_PER_SEC;
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = (unsigned long)&loop->timeout;
+  sqe->len = 1;
+  sqe->timeout_flags = IORING_TIMEOUT_ABS;
+  sqe->user_data = LOOP_OP_TIMEOUT | (uint64_t)loop->timeout_gen << 8;
+  loop->armed_ns = next;
+}
+
+/*
+ * Points the timer at the wheel's earliest timer
+ */
+static void loop_arm(struct wireless_loop *loop)
+{
+  long long next = wheel_next_ns(&loop->wheel);
+  struct itimerspec its;
+
+  if (next < 0 && !loop->armed_ns)
+    return;
+  if (next == 0)
+    next = 1;
+  if (next >= 0 && (unsigned long long)next == loop->armed_ns)
+    return;
+
+  if (loop->engine == LOOP_ENGINE_URING) {
+    loop_uring_arm(loop, next);
+    return;
+  }
+
+  memset(&its, 0, sizeof(its));
+  if (next >= 0) {
+    its.it_value.tv_sec = next / NSEC_PER_SEC;
+    its.it_value.tv_nsec = next % NSEC_PER_SEC;
+  }
+  timerfd_settime(loop->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+  loop->stats.syscalls++;
+  loop->armed_ns = next >= 0 ? next : 0;
+}
+/*
+ * Schedules a timer; loop thread only
+ */
+void wireless_loop_timer_add(struct wireless_loop *loop, struct loop_timer *t,
+                             unsigned long long expires_ns)
+{
+  wheel_add(&loop->wheel, &t->timer, expires_ns);
+  if (!loop->dispatching)
+    loop_arm(loop);
+}
+
+/*
+ * Cancels a timer; loop thread only
+ */
+void wireless_loop_timer_del(struct wireless_loop *loop, struct loop_timer *t)
+{
+  wheel_del(&loop->wheel, &t->timer);
+  if (!loop->dispatching)
+    loop_arm(loop);
+}
+
+/*
+ * Changes how far timers added from now on may be delayed so that they
+ * share wakeups
+ */
+void wireless_loop_set_slack(struct wireless_loop *loop,
+                             unsigned long long slack_ns)
+{
+  wheel_set_slack(&loop->wheel, slack_ns);
+}
+
+/*
+ * Tells whether a timer is scheduled
+ */
+int wireless_loop_timer_pending(const struct loop_timer *t)
+{
+  return wheel_pending(&t->timer);
+}
+
+/*
+ * Counts one event of a lane
+ */
+static void loop_lane_event(struct wireless_loop *loop, enum loop_lane lane,
+                            unsigned long long wait_ns)
+{
+  struct loop_lane_stats *ls = &loop->stats.lanes[lane];
+
+  ls->events++;
+  ls->wait_ns += wait_ns;
+  if (wait_ns > ls->max_wait_ns)
+    ls->max_wait_ns = wait_ns;
+}
+
+/*
+ * Notes how many events of a lane were waiting together
+ */
+static void loop_lane_depth(struct wireless_loop *loop, enum loop_lane lane,
+                            unsigned long long depth)
+{
+  if (depth > loop->stats.lanes[lane].max_depth)
+    loop->stats.lanes[lane].max_depth = depth;
+}
+
+/*
+ * Wheel callback, hands the timer to its owner.  Link messages are
+ * only handled once fn has returned: a DELLINK may free the timer's
+ * owner, and a fired timer is no longer pending for its owner to
+ * cancel.  Timers still due in this run stay on the wheel's list,
+ * from which deleting them is safe.
+ */
+static void loop_timer_fire(struct wheel_timer *wt, void *arg)
+{
+  struct wireless_loop *loop = arg;
+  struct loop_timer *t = wheel_entry(wt, struct loop_timer, timer);
+  unsigned long long now = clock_monotonic_ns();
+  unsigned long long due = loop->wheel.origin_ns + wt->expires * loop->wheel.tick_ns;
+
+  loop_lane_event(loop, LOOP_LANE_TIMER, now > due ? now - due : 0);
+  trace_wait("queue wait", "timer", due < now ? due : now, now);
+  t->fn(t, t->arg);
+  loop_yield(loop, clock_monotonic_ns());
+}
+
+/*
+ * Queues routine work for the next dispatch and wakes the loop
+ */
+void wireless_loop_post(struct wireless_loop *loop, struct loop_work *work)
+{
+  wireless_loop_post_lane(loop, work, LOOP_LANE_WORK);
+}
+
+/*
+ * Like wireless_loop_post(); work in LOOP_LANE_LINK runs ahead of
+ * routine work, e.g. a sample that found the association changed
+ */
+void wireless_loop_post_lane(struct wireless_loop *loop, struct loop_work *work,
+                             enum loop_lane lane)
+{
+  uint64_t one = 1;
+
+  if (lane != LOOP_LANE_LINK)
+    lane = LOOP_LANE_WORK;
+  work->next = NULL;
+  work->queued_ns = clock_monotonic_ns();
+  pthread_mutex_lock(&loop->lock);
+  *loop->work_tail[lane] = work;
+  loop->work_tail[lane] = &work->next;
+  loop->queued[lane]++;
+  pthread_mutex_unlock(&loop->lock);
+
+  if (write(loop->eventfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    perror("wireless_loop_post");
+}
+
+/*
+ * Makes the loop dispatch soon even with nothing to do, e.g. so that
+ * the dispatch function sees a flag set by a signal handler.  Safe to
+ * call from one.
+ */
+void wireless_loop_wake(struct wireless_loop *loop)
+{
+  uint64_t one = 1;
+  int saved = errno;
+
+  if (write(loop->eventfd, &one, sizeof(one)) < 0) {
+    /* only with the counter full, which keeps the loop awake anyway */
+  }
+  errno = saved;
+}
+
+/*
+ * Registers a one-shot wait for the next link event
+ */
+void wireless_loop_next_link(struct wireless_loop *loop,
+                             struct loop_link_waiter *waiter)
+{
+  pthread_mutex_lock(&loop->lock);
+  waiter->next = loop->waiters;
+  loop->waiters = waiter;
+  pthread_mutex_unlock(&loop->lock);
+}
+
+/*
+ * Runs the work queued so far in one lane; work posted meanwhile waits
+ * for the next dispatch.  Routine work yields to link messages after
+ * each item, never between taking one and running it, so a DELLINK
+ * cannot free what an item is about to use.  Items still queued must
+ * outlive their owner's removal, as worker jobs and flight dumps do.
+ */
+static void loop_run_work(struct wireless_loop *loop, enum loop_lane lane)
+{
+  struct loop_work *work, *next;
+  unsigned long long now;
+
+  pthread_mutex_lock(&loop->lock);
+  work = loop->work_head[lane];
+  loop->work_head[lane] = NULL;
+  loop->work_tail[lane] = &loop->work_head[lane];
+  loop_lane_depth(loop, lane, loop->queued[lane]);
+  loop->queued[lane] = 0;
+  pthread_mutex_unlock(&loop->lock);
+
+  for (; work != NULL; work = next) {
+    next = work->next;
+    now = clock_monotonic_ns();
+    loop_lane_event(loop, lane, now > work->queued_ns ? now - work->queued_ns : 0);
+    trace_wait("queue wait", wireless_loop_lane_name(lane), work->queued_ns, now);
+    work->fn(work->arg);
+    if (lane != LOOP_LANE_LINK)
+      loop_yield(loop, clock_monotonic_ns());
+  }
+}
+
+/*
+ * Passes one rtnetlink message to the handler and, for link messages,
+ * to everyone waiting for the next link event after dropping what the
+ * cache holds for the interface
+ */
+static void loop_message(struct wireless_loop *loop,
+                         const struct sockaddr_nl *who, struct nlmsghdr *n)
+{
+  struct ifinfomsg *ifi = NLMSG_DATA(n);
+  struct rtattr *tb[IFLA_MAX + 1];
+  struct wireless_link_event ev;
+  struct loop_link_waiter *w, *next;
+  int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+  unsigned long long traced;
+
+  loop->stats.messages++;
+  if (loop->filter && !ifmatch_msg(loop->filter, n)) {
+    loop->stats.filtered++;
+    return;
+  }
+  traced = trace_begin();
+  loop_lane_event(loop, LOOP_LANE_LINK, clock_monotonic_ns() - loop->looked_ns);
+  if (loop->msg_fn)
+    loop->msg_fn(who, n, loop->msg_arg);
+
+  if ((n->nlmsg_type != RTM_NEWLINK && n->nlmsg_type != RTM_DELLINK) ||
+      len < 0) {
+    trace_end(traced, "netlink message", NULL);
+    return;
+  }
+
+  parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+
+  memset(&ev, 0, sizeof(ev));
+  ev.type = n->nlmsg_type;
+  ev.ifindex = ifi->ifi_index;
+  ev.operstate = tb[IFLA_OPERSTATE] ? rta_getattr_u8(tb[IFLA_OPERSTATE]) : -1;
+  if (tb[IFLA_IFNAME])
+    strncpy(ev.ifname, rta_getattr_str(tb[IFLA_IFNAME]), IFNAMSIZ - 1);
+
+  /* whatever changed, cached values of the interface may be stale */
+  if (ev.ifname[0])
+    snapcache_invalidate(loop->cache, ev.ifname);
+
+  pthread_mutex_lock(&loop->lock);
+  w = loop->waiters;
+  loop->waiters = NULL;
+  pthread_mutex_unlock(&loop->lock);
+
+  for (; w != NULL; w = next) {
+    next = w->next;
+    w->fn(&ev, w->arg);
+  }
+  trace_end(traced, "netlink message", ev.ifname);
+}
+
+/*
+ * Reads every pending netlink datagram without blocking
+ */
+static int loop_receive(struct wireless_loop *loop)
+{
+  char buf[16384];
+  struct sockaddr_nl nladdr;
+  struct iovec iov = { buf, sizeof(buf) };
+  struct msghdr msg;
+  struct nlmsghdr *h;
+  unsigned long long traced;
+  int status;
+
+  for (;;) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &nladdr;
+    msg.msg_namelen = sizeof(nladdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    traced = trace_begin();
+    status = recvmsg(loop->rth.fd, &msg, 0);
+    trace_end(traced, "netlink recv", NULL);
+    loop->stats.syscalls++;
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN)
+        return 0;
+      if (errno == ENOBUFS) {
+        fprintf(stderr, "netlink receive buffer overrun, events lost\n");
+        continue;
+      }
+      perror("netlink receive error");
+      return -1;
+    }
+    if (status == 0) {
+      fprintf(stderr, "EOF on netlink\n");
+      return -1;
+    }
+
+    for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, (unsigned int)status);
+         h = NLMSG_NEXT(h, status))
+      loop_message(loop, &nladdr, h);
+  }
+}
+
+/*
+ * Finds or adds the sink for a descriptor
+ */
+static struct loop_sink *loop_sink(struct wireless_loop *loop, int fd)
+{
+  struct loop_sink *s;
+  int i;
+
+  for (i = 0; i < loop->sink_count; i++)
+    if (loop->sinks[i].fd == fd)
+      return &loop->sinks[i];
+  if (loop->sink_count == LOOP_SINKS) {
+    errno = EMFILE;
+    return NULL;
+  }
+  s = &loop->sinks[loop->sink_count++];
+  memset(s, 0, sizeof(*s));
+  s->fd = fd;
+  return s;
+}
+
+/*
+ * Appends one write to a sink's queue
+ */
+static int loop_sink_queue(struct loop_sink *s, const void *data, size_t len)
+{
+  if (s->len + len > s->size) {
+    size_t size = s->size ? s->size : 65536;
+    char *buf;
+
+    while (size < s->len + len)
+      size *= 2;
+    if ((buf = mem_realloc(MEM_LOOP, s->buf, size)) == NULL)
+      return -1;
+    s->buf = buf;
+    s->size = size;
+  }
+  if (s->dgram && s->count == s->ends_size) {
+    int n = s->ends_size ? s->ends_size * 2 : 64;
+    size_t *ends = mem_realloc(MEM_LOOP, s->ends, n * sizeof(*ends));
+
+    if (ends == NULL)
+      return -1;
+    s->ends = ends;
+    s->ends_size = n;
+  }
+
+  memcpy(s->buf + s->len, data, len);
+  s->len += len;
+  if (s->dgram)
+    s->ends[s->count++] = s->len;
+  return 0;
+}
+
+/*
+ * Submits a sink's stream batch from where the last write stopped
+ */
+static void loop_sink_write(struct wireless_loop *loop, struct loop_sink *s)
+{
+  struct io_uring_sqe *sqe;
+
+  if ((sqe = uring_sqe(&loop->ring)) == NULL) {
+    s->dropped++;
+    s->out_len = s->out_done = 0;
+    return;
+  }
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = s->fd;
+  sqe->addr = (unsigned long)(s->out + s->out_done);
+  sqe->len = s->out_len - s->out_done;
+  sqe->off = -1;
+  sqe->user_data = LOOP_OP_SINK | (uint64_t)(s - loop->sinks) << 8;
+  s->inflight = 1;
+}
+
+/*
+ * Moves a sink's queue in flight: a stream as one write, datagrams as
+ * a chain of linked sends that completes in order
+ */
+static void loop_sink_submit(struct wireless_loop *loop, struct loop_sink *s)
+{
+  struct io_uring_sqe *prev;
+  char *buf;
+  size_t size, *ends;
+  int i, n;
+
+  if (s->inflight || !s->len)
+    return;
+
+  buf = s->out, s->out = s->buf, s->buf = buf;
+  size = s->out_size, s->out_size = s->size, s->size = size;
+  ends = s->out_ends, s->out_ends = s->ends, s->ends = ends;
+  n = s->out_ends_size, s->out_ends_size = s->ends_size, s->ends_size = n;
+  s->out_len = s->len;
+  s->out_count = s->count;
+  s->out_done = 0;
+  s->len = 0;
+  s->count = 0;
+  s->out_ns = trace_begin();
+
+  if (!s->dgram) {
+    loop_sink_write(loop, s);
+    return;
+  }
+
+  mem_free(s->msgs);
+  mem_free(s->iov);
+  s->msgs = mem_alloc(MEM_LOOP, s->out_count * sizeof(*s->msgs));
+  s->iov = mem_alloc(MEM_LOOP, s->out_count * sizeof(*s->iov));
+  if (!s->msgs || !s->iov) {
+    s->dropped += s->out_count;
+    return;
+  }
+
+  /*
+   * Each datagram is linked to the one after it, so they go out in
+   * order.  The link is only set once that one is queued: a link on
+   * the last sqe queued would chain it to whatever is queued next.
+   * Should uring_sqe() submit to make room, the chain just breaks there.
+   */
+  for (i = 0, prev = NULL; i < s->out_count; i++) {
+    struct io_uring_sqe *sqe = uring_sqe(&loop->ring);
+    size_t start = i ? s->out_ends[i - 1] : 0;
+
+    if (sqe == NULL) {
+      s->dropped += s->out_count - i;
+      break;
+    }
+    if (prev)
+      prev->flags |= IOSQE_IO_LINK;
+    prev = sqe;
+    s->iov[i].iov_base = s->out + start;
+    s->iov[i].iov_len = s->out_ends[i] - start;
+    s->msgs[i].msg_name = s->addrlen ? &s->addr : NULL;
+    s->msgs[i].msg_namelen = s->addrlen;
+    s->msgs[i].msg_iov = &s->iov[i];
+    s->msgs[i].msg_iovlen = 1;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = s->fd;
+    sqe->addr = (unsigned long)&s->msgs[i];
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = LOOP_OP_SINK | (uint64_t)(s - loop->sinks) << 8;
+    s->inflight++;
+  }
+}
+
+/*
+ * Accounts a completed sink request; a short stream write is resumed
+ */
+static void loop_sink_complete(struct wireless_loop *loop,
+                               struct loop_sink *s, int res)
+{
+  char target[16];
+
+  if (--s->inflight == 0 && s->out_ns) {
+    snprintf(target, sizeof(target), "fd %d", s->fd);
+    trace_wait("sink in flight", target, s->out_ns, clock_monotonic_ns());
+    s->out_ns = 0;
+  }
+  if (s->dgram) {
+    if (res < 0)
+      s->dropped++;
+    else
+      loop->stats.writes++;
+    return;
+  }
+
+  if (res < 0) {
+    s->dropped++;
+    return;
+  }
+  loop->stats.writes++;
+  s->out_done += res;
+  if (res > 0 && s->out_done < s->out_len)
+    loop_sink_write(loop, s);
+}
+
+/*
+ * Writes len bytes to fd.  With io_uring the data is copied and sent
+ * after the current dispatch, behind earlier writes to the same fd;
+ * otherwise it is written now.
+ */
+int wireless_loop_write(struct wireless_loop *loop, int fd,
+                        const void *data, size_t len)
+{
+  struct loop_sink *s;
+  size_t done = 0;
+
+  if (loop->engine == LOOP_ENGINE_URING) {
+    if ((s = loop_sink(loop, fd)) == NULL)
+      return -1;
+    return loop_sink_queue(s, data, len);
+  }
+
+  while (done < len) {
+    unsigned long long traced = trace_begin();
+    ssize_t n = write(fd, (const char *)data + done, len - done);
+
+    trace_end(traced, "sink write", NULL);
+    loop->stats.syscalls++;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    done += n;
+    loop->stats.writes++;
+  }
+  return 0;
+}
+
+/*
+ * Sends one datagram to addr (NULL if fd is connected), queued like
+ * wireless_loop_write().  A descriptor keeps the address it was first
+ * given.
+ */
+int wireless_loop_sendto(struct wireless_loop *loop, int fd,
+                         const void *data, size_t len,
+                         const struct sockaddr *addr, socklen_t addrlen)
+{
+  struct loop_sink *s;
+  ssize_t n;
+
+  if (loop->engine == LOOP_ENGINE_URING) {
+    if ((s = loop_sink(loop, fd)) == NULL)
+      return -1;
+    if (!s->dgram) {
+      s->dgram = 1;
+      if (addr && addrlen <= sizeof(s->addr)) {
+        memcpy(&s->addr, addr, addrlen);
+        s->addrlen = addrlen;
+      }
+    }
+    return loop_sink_queue(s, data, len);
+  }
+
+  do {
+    n = sendto(fd, data, len, MSG_NOSIGNAL, addr, addrlen);
+    loop->stats.syscalls++;
+  } while (n < 0 && errno == EINTR);
+  if (n < 0)
+    return -1;
+  loop->stats.writes++;
+  return 0;
+}
+
+/*
+ * Queues the multishot netlink receive
+ */
+static void loop_uring_recv(struct wireless_loop *loop)
+{
+  struct io_uring_sqe *sqe = uring_sqe(&loop->ring);
+
+  if (sqe == NULL)
+    return;
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = loop->rth.fd;
+  sqe->ioprio = loop->recv_flags;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BGID;
+  sqe->user_data = LOOP_OP_RECV;
+}
+
+/*
+ * Queues a read of the eventfd, completing when work is posted
+ */
+static void loop_uring_eventfd(struct wireless_loop *loop)
+{
+  struct io_uring_sqe *sqe = uring_sqe(&loop->ring);
+
+  if (sqe == NULL)
+    return;
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = loop->eventfd;
+  sqe->addr = (unsigned long)&loop->eventfd_count;
+  sqe->len = sizeof(loop->eventfd_count);
+  sqe->user_data = LOOP_OP_EVENTFD;
+}
+
+/*
+ * Tells an ENOBUFS completion caused by a netlink overrun, which the
+ * socket counts as drops, from one caused by running out of provided
+ * buffers, which loses nothing
+ */
+static int loop_uring_overrun(struct wireless_loop *loop)
+{
+  unsigned int meminfo[SK_MEMINFO_VARS];
+  socklen_t len = sizeof(meminfo);
+
+  loop->stats.syscalls++;
+  if (getsockopt(loop->rth.fd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) < 0 ||
+      len <= SK_MEMINFO_DROPS * sizeof(meminfo[0]))
+    return 1;
+  if (meminfo[SK_MEMINFO_DROPS] == loop->recv_drops)
+    return 0;
+  loop->recv_drops = meminfo[SK_MEMINFO_DROPS];
+  return 1;
+}
+
+/*
+ * Handles a netlink receive completion.  The multishot receive ends
+ * when the kernel runs out of provided buffers or hits an error and is
+ * queued again; a kernel without multishot receives gets one-shot ones.
+ */
+static void loop_uring_received(struct wireless_loop *loop,
+                                struct io_uring_cqe *cqe)
+{
+  static const struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+  int status = cqe->res;
+
+  if (status > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+    unsigned int id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    struct nlmsghdr *h;
+
+    for (h = uring_buf(&loop->ring, id); NLMSG_OK(h, (unsigned int)status);
+         h = NLMSG_NEXT(h, status))
+      loop_message(loop, &kernel, h);
+    uring_buf_return(&loop->ring, id);
+  } else if (status == -EINVAL && loop->recv_flags) {
+    loop->recv_flags = 0;
+  } else if (status == -ENOBUFS) {
+    if (loop_uring_overrun(loop))
+      fprintf(stderr, "netlink receive buffer overrun, events lost\n");
+  } else if (status == 0) {
+    fprintf(stderr, "EOF on netlink\n");
+    loop->failed = 1;
+    return;
+  } else if (status < 0 && status != -EINTR && status != -EAGAIN) {
+    errno = -status;
+    perror("netlink receive error");
+    loop->failed = 1;
+    return;
+  }
+
+  if (!(cqe->flags & IORING_CQE_F_MORE))
+    loop_uring_recv(loop);
+}
+
+/*
+ * Handles every completion posted so far
+ */
+static void loop_uring_reap(struct wireless_loop *loop)
+{
+  struct io_uring_cqe *cqe;
+
+  while ((cqe = uring_cqe(&loop->ring)) != NULL) {
+    uint64_t ud = cqe->user_data;
+
+    switch (ud & 0xff) {
+      case LOOP_OP_RECV:
+        loop_uring_received(loop, cqe);
+        break;
+      case LOOP_OP_EVENTFD:
+        loop_uring_eventfd(loop);
+        break;
+      case LOOP_OP_TIMEOUT:
+        if ((ud >> 8) == loop->timeout_gen)
+          loop->armed_ns = 0;
+        break;
+      case LOOP_OP_SINK:
+        loop_sink_complete(loop, &loop->sinks[ud >> 8], cqe->res);
+        break;
+    }
+    uring_cqe_seen(&loop->ring);
+  }
+}
+
+/*
+ * Looks for link messages and handles those that came, counting them
+ * as the link lane's depth
+ */
+static void loop_input(struct wireless_loop *loop)
+{
+  unsigned long long before = loop->stats.lanes[LOOP_LANE_LINK].events;
+
+  if (loop->engine == LOOP_ENGINE_URING)
+    loop_uring_reap(loop);
+  else if (loop_receive(loop) < 0)
+    loop->failed = 1;
+  loop_lane_depth(loop, LOOP_LANE_LINK,
+                  loop->stats.lanes[LOOP_LANE_LINK].events - before);
+  loop->looked_ns = clock_monotonic_ns();
+}
+
+/*
+ * Between routine items: once input was last looked for LOOP_YIELD_NS
+ * ago, handles link messages and urgent work before going on
+ */
+static void loop_yield(struct wireless_loop *loop, unsigned long long now)
+{
+  if (now < loop->looked_ns + LOOP_YIELD_NS || loop->failed)
+    return;
+  loop->stats.yields++;
+  loop_input(loop);
+  loop_run_work(loop, LOOP_LANE_LINK);
+}
+
+/*
+ * One dispatch without the final submission, which the caller makes
+ * (alone, or together with its next wait)
+ */
+static int loop_dispatch(struct wireless_loop *loop)
+{
+  uint64_t count;
+  unsigned long long traced = trace_begin();
+  int i, ret = 0;
+
+  loop->dispatching = 1;
+  loop->stats.dispatches++;
+
+  if (loop->engine == LOOP_ENGINE_EPOLL) {
+    if (read(loop->eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+      perror("eventfd");
+    if (read(loop->timerfd, &count, sizeof(count)) == sizeof(count))
+      loop->armed_ns = 0;
+    loop->stats.syscalls += 2;
+  }
+
+  loop->looked_ns = clock_monotonic_ns();
+  loop_input(loop);
+  loop_run_work(loop, LOOP_LANE_LINK);
+  loop_run_work(loop, LOOP_LANE_WORK);
+  loop_lane_depth(loop, LOOP_LANE_TIMER,
+                  wheel_run(&loop->wheel, clock_monotonic_ns(), loop_timer_fire, loop));
+  if (loop->failed)
+    ret = -1;
+
+  if (loop->dispatch_fn)
+    loop->dispatch_fn(loop->dispatch_arg);
+
+  loop->dispatching = 0;
+  loop_arm(loop);
+  for (i = 0; i < loop->sink_count; i++)
+    loop_sink_submit(loop, &loop->sinks[i]);
+  trace_end(traced, "dispatch", NULL);
+  return ret;
+}
+
+/*
+ * Handles everything that is ready without blocking: posted work,
+ * netlink messages and due timers.  Returns -1 if the netlink socket
+ * failed.
+ */
+int wireless_loop_dispatch(struct wireless_loop *loop)
+{
+  int ret = loop_dispatch(loop);
+
+  if (loop->engine == LOOP_ENGINE_URING && uring_enter(&loop->ring, 0) < 0) {
+    perror("io_uring_enter");
+    ret = -1;
+  }
+  return ret;
+}
+
+/*
+ * Tells whether any sink still has output queued or in flight
+ */
+static int loop_sinks_busy(struct wireless_loop *loop)
+{
+  int i;
+
+  for (i = 0; i < loop->sink_count; i++)
+    if (loop->sinks[i].len || loop->sinks[i].inflight)
+      return 1;
+  return 0;
+}
+
+/*
+ * Waits until output queued with wireless_loop_write() and
+ * wireless_loop_sendto() has been written.  Link messages arriving
+ * meanwhile are handled as by a dispatch.
+ */
+int wireless_loop_flush(struct wireless_loop *loop)
+{
+  int i;
+
+  if (loop->engine != LOOP_ENGINE_URING)
+    return 0;
+
+  while (loop_sinks_busy(loop)) {
+    for (i = 0; i < loop->sink_count; i++)
+      loop_sink_submit(loop, &loop->sinks[i]);
+    if (uring_enter(&loop->ring, 1) < 0 && errno != EINTR) {
+      perror("io_uring_enter");
+      return -1;
+    }
+    loop->looked_ns = clock_monotonic_ns();
+    loop_uring_reap(loop);
+  }
+  return 0;
+}
+
+/*
+ * Dispatches until *stop is set (e.g. from a signal handler) or the
+ * netlink socket fails
+ */
+int wireless_loop_run(struct wireless_loop *loop, volatile sig_atomic_t *stop)
+{
+  struct epoll_event ev[4];
+
+  while (!*stop) {
+    if (loop->engine == LOOP_ENGINE_URING) {
+      /* submits what the last dispatch queued and waits in one call */
+      if (uring_enter(&loop->ring, 1) < 0 && errno != EINTR &&
+          errno != ETIME) {
+        perror("io_uring_enter");
+        return -1;
+      }
+    } else {
+      loop->stats.syscalls++;
+      if (epoll_wait(loop->epfd, ev, 4, -1) < 0) {
+        if (errno == EINTR)
+          continue;
+        perror("epoll_wait");
+        return -1;
+      }
+    }
+    if (loop_dispatch(loop) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,186 @@
+/*
+    Event loop shared by the monitor and embedding callers
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <linux/if.h>
+#include <linux/netlink.h>
+#include "wheel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct wireless_loop;
+struct wireless_snapshot;
+struct snapcache_stats;
+struct ifmatch;
+
+typedef void (*loop_fn_t)(void *arg);
+
+/*
+ * Timer on the loop's wheel, embedded in its owner
+ */
+struct loop_timer {
+  struct wheel_timer timer;
+  void (*fn)(struct loop_timer *t, void *arg);
+  void *arg;
+};
+
+/*
+ * Dispatch lanes, most urgent first.  A dispatch handles link messages
+ * and urgent work before routine work and due timers, and routine work
+ * stops now and then to handle link messages that arrived meanwhile.
+ */
+enum loop_lane {
+  LOOP_LANE_LINK,               /* link messages, work posted as urgent */
+  LOOP_LANE_WORK,               /* posted work, e.g. sample completions */
+  LOOP_LANE_TIMER,              /* due timers, e.g. periodic samples */
+  LOOP_LANES
+};
+
+/*
+ * Deferred call, run by the next wireless_loop_dispatch()
+ */
+struct loop_work {
+  struct loop_work *next;
+  loop_fn_t fn;
+  void *arg;
+  unsigned long long queued_ns; /* set when posted */
+};
+
+/*
+ * The interesting part of an RTM_NEWLINK/RTM_DELLINK message
+ */
+struct wireless_link_event {
+  int type;
+  int ifindex;
+  int operstate;                /* IF_OPER_*, -1 if not reported */
+  char ifname[IFNAMSIZ];
+};
+
+/*
+ * One-shot wait for the next link event
+ */
+struct loop_link_waiter {
+  struct loop_link_waiter *next;
+  void (*fn)(const struct wireless_link_event *ev, void *arg);
+  void *arg;
+};
+
+/*
+ * How the loop waits for netlink messages, timers and posted work
+ */
+enum loop_engine {
+  LOOP_ENGINE_EPOLL,
+  LOOP_ENGINE_URING,            /* one io_uring, output in linked writes */
+};
+
+/*
+ * Per-lane counters.  The wait of posted work runs from its posting, a
+ * timer's from its expiry and a link message's from when the loop last
+ * looked for input, which it arrived before.  Depth is work queued, or
+ * messages and timers handled in one go.
+ */
+struct loop_lane_stats {
+  unsigned long long events;
+  unsigned long long depth;     /* queued now */
+  unsigned long long max_depth;
+  unsigned long long wait_ns;   /* total */
+  unsigned long long max_wait_ns;
+};
+
+/*
+ * Counters kept by the loop
+ */
+struct wireless_loop_stats {
+  unsigned long long dispatches;
+  unsigned long long messages;  /* netlink messages received */
+  unsigned long long filtered;  /* of which dropped by the name filter */
+  unsigned long long syscalls;  /* made by the loop itself */
+  unsigned long long writes;    /* completed output writes and sends */
+  unsigned long long yields;    /* routine work stopped to look for input */
+  struct loop_lane_stats lanes[LOOP_LANES];
+};
+
+typedef int (*loop_msg_fn_t)(const struct sockaddr_nl *who,
+                             struct nlmsghdr *n, void *arg);
+
+struct wireless_loop *wireless_loop_new(unsigned long long tick_ns,
+                                        unsigned long long slack_ns);
+struct wireless_loop *wireless_loop_new_engine(unsigned long long tick_ns,
+                                               unsigned long long slack_ns,
+                                               enum loop_engine engine);
+void wireless_loop_free(struct wireless_loop *loop);
+
+int wireless_loop_fd(struct wireless_loop *loop);
+enum loop_engine wireless_loop_engine(const struct wireless_loop *loop);
+void wireless_loop_stats(const struct wireless_loop *loop,
+                         struct wireless_loop_stats *st);
+const char *wireless_loop_lane_name(enum loop_lane lane);
+int wireless_loop_snapshot(struct wireless_loop *loop, const char *ifname,
+                           unsigned fields, struct wireless_snapshot *snap);
+void wireless_loop_cache_ttl(struct wireless_loop *loop, unsigned fields,
+                             unsigned long long ttl_ns);
+void wireless_loop_cache_stats(const struct wireless_loop *loop,
+                               struct snapcache_stats *st);
+int wireless_loop_dispatch(struct wireless_loop *loop);
+int wireless_loop_run(struct wireless_loop *loop, volatile sig_atomic_t *stop);
+
+void wireless_loop_on_message(struct wireless_loop *loop,
+                              loop_msg_fn_t fn, void *arg);
+void wireless_loop_on_dispatch(struct wireless_loop *loop,
+                               loop_fn_t fn, void *arg);
+void wireless_loop_filter(struct wireless_loop *loop, const struct ifmatch *m);
+
+void wireless_loop_timer_add(struct wireless_loop *loop, struct loop_timer *t,
+                             unsigned long long expires_ns);
+void wireless_loop_timer_del(struct wireless_loop *loop, struct loop_timer *t);
+int wireless_loop_timer_pending(const struct loop_timer *t);
+void wireless_loop_set_slack(struct wireless_loop *loop,
+                             unsigned long long slack_ns);
+
+int wireless_loop_write(struct wireless_loop *loop, int fd,
+                        const void *data, size_t len);
+int wireless_loop_sendto(struct wireless_loop *loop, int fd,
+                         const void *data, size_t len,
+                         const struct sockaddr *addr, socklen_t addrlen);
+int wireless_loop_flush(struct wireless_loop *loop);
+
+/* these may be called from any thread */
+void wireless_loop_post(struct wireless_loop *loop, struct loop_work *work);
+void wireless_loop_post_lane(struct wireless_loop *loop, struct loop_work *work,
+                             enum loop_lane lane);
+void wireless_loop_wake(struct wireless_loop *loop);
+void wireless_loop_next_link(struct wireless_loop *loop,
+                             struct loop_link_waiter *waiter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOOP_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,294 @@
+/*
+    Accounted memory of the monitor's subsystems
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Every subsystem of the monitor allocates through mem_alloc() and
+ * friends, which keep a header in front of each block naming its
+ * subsystem, its size and, optionally, the owner (an interface) it is
+ * held for.  That gives live byte and object counts per subsystem and
+ * per owner at the cost of a few atomic adds.  A subsystem may have a
+ * hard cap; an allocation that would go over it first asks the
+ * subsystem's evictor to free memory, and fails only if that was not
+ * enough, so the monitor sheds state instead of running out.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "mem.h"
+
+/*
+ * In front of every accounted block; keeps the block max_align_t
+ * aligned
+ */
+struct mem_header {
+  size_t size;
+  struct mem_owner *owner;
+  unsigned int subsys;
+} __attribute__((aligned(16)));
+
+struct mem_account {
+  size_t bytes;
+  size_t objects;
+  size_t peak;
+  size_t cap;
+  unsigned long long evictions;
+  unsigned long long evicted;
+  unsigned long long failures;
+  mem_evict_t evict_fn;
+  void *evict_arg;
+  int evicting;
+};
+
+static const char *mem_names[MEM_SUBSYS_COUNT] = {
+  "iface", "worker", "loop", "uring", "journal", "samplelog", "cache",
+  "flight", "trace", "scan"
+};
+
+static struct mem_account accounts[MEM_SUBSYS_COUNT];
+
+/*
+ * Adds to a subsystem's counts
+ */
+static void mem_count(struct mem_account *a, long long bytes, int objects)
+{
+  size_t now = __atomic_add_fetch(&a->bytes, bytes, __ATOMIC_RELAXED);
+
+  __atomic_add_fetch(&a->objects, objects, __ATOMIC_RELAXED);
+  if (now > a->peak)
+    a->peak = now;
+}
+
+/*
+ * Adds to an owner's counts only, for memory whose subsystem has it
+ * accounted in bulk, e.g. one object of a slab
+ */
+void mem_owner_charge(struct mem_owner *owner, long long bytes, int objects)
+{
+  if (!owner)
+    return;
+  __atomic_add_fetch(&owner->bytes, bytes, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&owner->objects, objects, __ATOMIC_RELAXED);
+}
+
+/*
+ * Makes room for size more bytes under the cap, evicting if needed.
+ * The evictor is not re-entered by allocations it makes itself.
+ */
+static int mem_admit(struct mem_account *a, size_t size)
+{
+  if (!a->cap || a->bytes + size <= a->cap)
+    return 0;
+  if (a->evict_fn && !a->evicting) {
+    a->evicting = 1;
+    a->evictions++;
+    a->evicted += a->evict_fn(a->bytes + size - a->cap, a->evict_arg);
+    a->evicting = 0;
+  }
+  if (a->bytes + size <= a->cap)
+    return 0;
+  a->failures++;
+  return -1;
+}
+
+/*
+ * Allocates zeroed memory for a subsystem; NULL if out of memory or
+ * over the subsystem's cap after eviction
+ */
+void *mem_alloc(enum mem_subsys s, size_t size)
+{
+  struct mem_account *a = &accounts[s];
+  struct mem_header *h;
+
+  if (mem_admit(a, size) < 0 || (h = calloc(1, sizeof(*h) + size)) == NULL)
+    return NULL;
+  h->size = size;
+  h->subsys = s;
+  mem_count(a, size, 1);
+  return h + 1;
+}
+
+/*
+ * Resizes a block, or allocates one if p is NULL; like realloc() the
+ * new part is not zeroed and p is left alone on failure
+ */
+void *mem_realloc(enum mem_subsys s, void *p, size_t size)
+{
+  struct mem_header *h;
+  struct mem_account *a;
+  size_t old;
+
+  if (!p)
+    return mem_alloc(s, size);
+
+  h = (struct mem_header *)p - 1;
+  a = &accounts[h->subsys];
+  old = h->size;
+  if (size > old && mem_admit(a, size - old) < 0)
+    return NULL;
+  if ((h = realloc(h, sizeof(*h) + size)) == NULL)
+    return NULL;
+  h->size = size;
+  mem_count(a, (long long)size - (long long)old, 0);
+  mem_owner_charge(h->owner, (long long)size - (long long)old, 0);
+  return h + 1;
+}
+
+/*
+ * Frees a block from mem_alloc() or mem_realloc()
+ */
+void mem_free(void *p)
+{
+  struct mem_header *h;
+
+  if (!p)
+    return;
+  h = (struct mem_header *)p - 1;
+  mem_count(&accounts[h->subsys], -(long long)h->size, -1);
+  mem_owner_charge(h->owner, -(long long)h->size, -1);
+  free(h);
+}
+
+/*
+ * Charges a block to an owner as well as its subsystem.  The owner must
+ * outlive the block, or take it back with a NULL owner.
+ */
+void mem_assign(void *p, struct mem_owner *owner)
+{
+  struct mem_header *h = (struct mem_header *)p - 1;
+
+  mem_owner_charge(h->owner, -(long long)h->size, -1);
+  h->owner = owner;
+  mem_owner_charge(owner, h->size, 1);
+}
+
+/*
+ * Accounts memory that is not from mem_alloc(), e.g. mappings, to a
+ * subsystem and optionally an owner.  Positive charges are held to the
+ * cap like allocations; returns -1 if refused.
+ */
+int mem_charge(enum mem_subsys s, struct mem_owner *owner, long long bytes,
+               int objects)
+{
+  struct mem_account *a = &accounts[s];
+
+  if (bytes > 0 && mem_admit(a, bytes) < 0)
+    return -1;
+  mem_count(a, bytes, objects);
+  mem_owner_charge(owner, bytes, objects);
+  return 0;
+}
+
+/*
+ * Sets a subsystem's hard cap in bytes, 0 for none
+ */
+void mem_set_cap(enum mem_subsys s, size_t cap)
+{
+  accounts[s].cap = cap;
+}
+
+/*
+ * Parses name=size, with an optional k, m or g suffix, and sets that
+ * subsystem's cap
+ */
+int mem_parse_cap(const char *arg)
+{
+  const char *eq = strchr(arg, '=');
+  unsigned long long cap;
+  char *end;
+  int s;
+
+  if (!eq)
+    return -1;
+  for (s = 0; s < MEM_SUBSYS_COUNT; s++)
+    if (strlen(mem_names[s]) == (size_t)(eq - arg) &&
+        strncmp(mem_names[s], arg, eq - arg) == 0)
+      break;
+  if (s == MEM_SUBSYS_COUNT)
+    return -1;
+
+  cap = strtoull(eq + 1, &end, 10);
+  if (end == eq + 1)
+    return -1;
+  switch (*end) {
+    case 'g': case 'G':
+      cap *= 1024;
+      /* fall through */
+    case 'm': case 'M':
+      cap *= 1024;
+      /* fall through */
+    case 'k': case 'K':
+      cap *= 1024;
+      end++;
+      break;
+  }
+  if (*end)
+    return -1;
+  mem_set_cap(s, cap);
+  return 0;
+}
+
+/*
+ * Sets the function that frees memory of a subsystem at its cap
+ */
+void mem_on_evict(enum mem_subsys s, mem_evict_t fn, void *arg)
+{
+  accounts[s].evict_fn = fn;
+  accounts[s].evict_arg = arg;
+}
+
+/*
+ * Current counts of a subsystem
+ */
+void mem_stats(enum mem_subsys s, struct mem_stats *st)
+{
+  const struct mem_account *a = &accounts[s];
+
+  st->name = mem_names[s];
+  st->bytes = __atomic_load_n(&a->bytes, __ATOMIC_RELAXED);
+  st->objects = __atomic_load_n(&a->objects, __ATOMIC_RELAXED);
+  st->peak = a->peak;
+  st->cap = a->cap;
+  st->evictions = a->evictions;
+  st->evicted = a->evicted;
+  st->failures = a->failures;
+}
+
+/*
+ * Prints one line of counts per subsystem
+ */
+void mem_print(FILE *fp)
+{
+  struct mem_stats st;
+  int s;
+
+  for (s = 0; s < MEM_SUBSYS_COUNT; s++) {
+    mem_stats(s, &st);
+    fprintf(fp, "memory subsys=%s bytes=%zu objects=%zu peak=%zu cap=%zu "
+                "evictions=%llu evicted=%llu failures=%llu\n",
+            st.name, st.bytes, st.objects, st.peak, st.cap,
+            st.evictions, st.evicted, st.failures);
+  }
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,95 @@
+/*
+    Accounted memory of the monitor's subsystems
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef MEM_H
+#define MEM_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Subsystems memory is accounted to
+ */
+enum mem_subsys {
+  MEM_IFACE,                    /* tracked interfaces */
+  MEM_WORKER,                   /* sampling workers and their jobs */
+  MEM_LOOP,                     /* event loop and its output queues */
+  MEM_URING,                    /* io_uring receive buffers */
+  MEM_JOURNAL,                  /* journal records waiting to be sent */
+  MEM_SAMPLELOG,                /* sample log buffer and keyframe state */
+  MEM_CACHE,                    /* cached snapshots and proc listing */
+  MEM_FLIGHT,                   /* flight recorder rings */
+  MEM_TRACE,                    /* per-thread trace buffers */
+  MEM_SCAN,                     /* scan results and their buffers */
+  MEM_SUBSYS_COUNT
+};
+
+/*
+ * Memory held on behalf of one owner, e.g. an interface, across
+ * subsystems
+ */
+struct mem_owner {
+  size_t bytes;
+  size_t objects;
+};
+
+/*
+ * Live counts of one subsystem
+ */
+struct mem_stats {
+  const char *name;
+  size_t bytes;
+  size_t objects;
+  size_t peak;
+  size_t cap;                   /* 0 if none */
+  unsigned long long evictions; /* times the evictor was asked */
+  unsigned long long evicted;   /* bytes it freed */
+  unsigned long long failures;  /* allocations refused at the cap */
+};
+
+/* Frees at least need bytes of the subsystem if it can; returns how many */
+typedef size_t (*mem_evict_t)(size_t need, void *arg);
+
+void *mem_alloc(enum mem_subsys s, size_t size);
+void *mem_realloc(enum mem_subsys s, void *p, size_t size);
+void mem_free(void *p);
+void mem_assign(void *p, struct mem_owner *owner);
+int mem_charge(enum mem_subsys s, struct mem_owner *owner, long long bytes,
+               int objects);
+void mem_owner_charge(struct mem_owner *owner, long long bytes, int objects);
+
+void mem_set_cap(enum mem_subsys s, size_t cap);
+int mem_parse_cap(const char *arg);
+void mem_on_evict(enum mem_subsys s, mem_evict_t fn, void *arg);
+void mem_stats(enum mem_subsys s, struct mem_stats *st);
+void mem_print(FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MEM_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,357 @@
+/*
+    CPU and memory placement near a wireless device
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Finds where a wireless device's interrupts are handled so that the
+ * work of sampling it can run next to them.  The device behind
+ * /sys/class/net/IFNAME/device is followed up towards the bus until a
+ * level lists interrupts (msi_irqs/ or irq), which also finds the host
+ * controller of USB and SDIO adapters; failing that, /proc/interrupts
+ * is searched for the interface or driver name.  The CPUs each
+ * interrupt is delivered to come from /proc/irq/N, and the cache domain
+ * around them from the last level cache's shared_cpu_list.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "placement.h"
+
+/*
+ * Reads the first line of a sysfs or procfs file, without the newline
+ */
+static int read_line(const char *path, char *buf, size_t len)
+{
+  FILE *f = fopen(path, "r");
+  char *nl;
+
+  if (f == NULL)
+    return -1;
+  if (fgets(buf, len, f) == NULL) {
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+  if ((nl = strchr(buf, '\n')) != NULL)
+    *nl = '\0';
+  return 0;
+}
+
+/*
+ * Parses a kernel CPU list such as "0-3,8,10-11" into a set
+ */
+int placement_parse_cpulist(const char *list, cpu_set_t *set)
+{
+  const char *p = list;
+
+  CPU_ZERO(set);
+  while (*p) {
+    char *end;
+    long first = strtol(p, &end, 10), last;
+
+    if (end == p || first < 0)
+      return -1;
+    last = first;
+    if (*end == '-') {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      if (end == p || last < first)
+        return -1;
+    }
+    for (; first <= last && first < CPU_SETSIZE; first++)
+      CPU_SET(first, set);
+    p = end;
+    if (*p == ',')
+      p++;
+    else if (*p)
+      return -1;
+  }
+  return 0;
+}
+
+/*
+ * Formats a set as a kernel CPU list; "-" when it is empty
+ */
+int placement_format_cpulist(const cpu_set_t *set, char *buf, size_t len)
+{
+  size_t used = 0;
+  int cpu, first = -1;
+
+  buf[0] = '\0';
+  for (cpu = 0; cpu <= CPU_SETSIZE; cpu++) {
+    int in = cpu < CPU_SETSIZE && CPU_ISSET(cpu, set);
+
+    if (in && first < 0)
+      first = cpu;
+    if (in || first < 0)
+      continue;
+    if (first == cpu - 1)
+      used += snprintf(buf + used, used < len ? len - used : 0, "%s%d",
+                       used ? "," : "", first);
+    else
+      used += snprintf(buf + used, used < len ? len - used : 0, "%s%d-%d",
+                       used ? "," : "", first, cpu - 1);
+    first = -1;
+  }
+  if (!used)
+    snprintf(buf, len, "-");
+  return used < len ? 0 : -1;
+}
+
+/*
+ * Adds the CPUs an interrupt is delivered to; the effective affinity
+ * where the kernel reports it, else the requested one
+ */
+static int irq_add_cpus(int irq, cpu_set_t *cpus)
+{
+  char path[64], list[1024];
+  cpu_set_t set;
+
+  snprintf(path, sizeof(path), "/proc/irq/%d/effective_affinity_list", irq);
+  if (read_line(path, list, sizeof(list)) < 0 || !list[0]) {
+    snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irq);
+    if (read_line(path, list, sizeof(list)) < 0)
+      return -1;
+  }
+  if (placement_parse_cpulist(list, &set) < 0)
+    return -1;
+  CPU_OR(cpus, cpus, &set);
+  return 0;
+}
+
+/*
+ * Interrupts of a device directory: its MSI vectors, or its legacy irq
+ */
+static int device_irqs(const char *dev, int *irqs)
+{
+  char path[PATH_MAX + 16], line[32];
+  struct dirent *d;
+  DIR *dir;
+  int n = 0;
+
+  snprintf(path, sizeof(path), "%s/msi_irqs", dev);
+  if ((dir = opendir(path)) != NULL) {
+    while ((d = readdir(dir)) != NULL && n < PLACEMENT_MAX_IRQS)
+      if (d->d_name[0] >= '0' && d->d_name[0] <= '9')
+        irqs[n++] = atoi(d->d_name);
+    closedir(dir);
+    if (n)
+      return n;
+  }
+
+  snprintf(path, sizeof(path), "%s/irq", dev);
+  if (read_line(path, line, sizeof(line)) == 0 && atoi(line) > 0) {
+    irqs[0] = atoi(line);
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Interrupts whose handler names mention the interface or its driver,
+ * from /proc/interrupts
+ */
+static int proc_interrupts_irqs(const char *ifname, int *irqs)
+{
+  char path[PATH_MAX], driver[PATH_MAX], line[1024];
+  const char *drv = NULL;
+  ssize_t len;
+  FILE *f;
+  int n = 0;
+
+  snprintf(path, sizeof(path), "/sys/class/net/%s/device/driver", ifname);
+  if ((len = readlink(path, driver, sizeof(driver) - 1)) > 0) {
+    driver[len] = '\0';
+    drv = strrchr(driver, '/') ? strrchr(driver, '/') + 1 : driver;
+  }
+
+  if ((f = fopen("/proc/interrupts", "r")) == NULL)
+    return 0;
+  while (fgets(line, sizeof(line), f) != NULL && n < PLACEMENT_MAX_IRQS) {
+    char *colon = strchr(line, ':');
+
+    if (colon == NULL || line[strspn(line, " ")] < '0' || line[strspn(line, " ")] > '9')
+      continue;
+    if (strstr(colon, ifname) || (drv && strstr(colon, drv)))
+      irqs[n++] = atoi(line);
+  }
+  fclose(f);
+  return n;
+}
+
+/*
+ * Collects the CPUs the interface's device interrupts are delivered
+ * to.  Returns how many interrupts were found.
+ */
+int placement_irq_cpus(const char *ifname, cpu_set_t *cpus)
+{
+  char path[PATH_MAX], dev[PATH_MAX];
+  int irqs[PLACEMENT_MAX_IRQS];
+  int i, n = 0;
+
+  CPU_ZERO(cpus);
+  snprintf(path, sizeof(path), "/sys/class/net/%s/device", ifname);
+  if (realpath(path, dev) != NULL) {
+    /* up from the device to the bus it hangs off */
+    while (!(n = device_irqs(dev, irqs)) && strcmp(dev, "/sys/devices") != 0) {
+      char *slash = strrchr(dev, '/');
+
+      if (slash == NULL || slash == dev)
+        break;
+      *slash = '\0';
+    }
+  }
+  if (!n)
+    n = proc_interrupts_irqs(ifname, irqs);
+
+  for (i = 0; i < n; i++)
+    irq_add_cpus(irqs[i], cpus);
+  return CPU_COUNT(cpus) ? n : 0;
+}
+
+/*
+ * CPUs sharing the last level cache with cpu
+ */
+int placement_cache_domain(int cpu, cpu_set_t *domain)
+{
+  char path[128], list[1024];
+  int index, level, best = -1;
+
+  CPU_ZERO(domain);
+  for (index = 0; ; index++) {
+    cpu_set_t set;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level",
+             cpu, index);
+    if (read_line(path, list, sizeof(list)) < 0)
+      break;
+    level = atoi(list);
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+    if (level <= best || read_line(path, list, sizeof(list)) < 0 ||
+        placement_parse_cpulist(list, &set) < 0)
+      continue;
+    best = level;
+    CPU_ZERO(domain);
+    CPU_OR(domain, domain, &set);
+  }
+  if (best < 0)
+    CPU_SET(cpu, domain);
+  return best;
+}
+
+/*
+ * NUMA node of a device, looked up the same way as its interrupts
+ */
+static int device_node(const char *ifname)
+{
+  char path[PATH_MAX + 16], dev[PATH_MAX], line[32];
+
+  snprintf(path, sizeof(path), "/sys/class/net/%s/device", ifname);
+  if (realpath(path, dev) == NULL)
+    return -1;
+  for (;;) {
+    char *slash;
+
+    snprintf(path, sizeof(path), "%s/numa_node", dev);
+    if (read_line(path, line, sizeof(line)) == 0)
+      return atoi(line);
+    if ((slash = strrchr(dev, '/')) == NULL || slash == dev ||
+        strcmp(dev, "/sys/devices") == 0)
+      return -1;
+    *slash = '\0';
+  }
+}
+
+/*
+ * NUMA node of a CPU
+ */
+static int cpu_node(int cpu)
+{
+  char path[64];
+  struct dirent *d;
+  DIR *dir;
+  int node = -1;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  if ((dir = opendir(path)) == NULL)
+    return -1;
+  while ((d = readdir(dir)) != NULL)
+    if (strncmp(d->d_name, "node", 4) == 0 && d->d_name[4] >= '0' && d->d_name[4] <= '9')
+      node = atoi(d->d_name + 4);
+  closedir(dir);
+  return node;
+}
+
+/*
+ * Works out where to run and allocate for an interface.  Without any
+ * interrupt to go by the placement is every CPU the process may use.
+ */
+int placement_for(const char *ifname, struct placement *p)
+{
+  int cpu;
+
+  p->irqs = placement_irq_cpus(ifname, &p->irq_cpus);
+  p->node = device_node(ifname);
+  CPU_ZERO(&p->cpus);
+  if (!p->irqs) {
+    if (sched_getaffinity(0, sizeof(p->cpus), &p->cpus) < 0)
+      return -1;
+    return 0;
+  }
+
+  for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    cpu_set_t domain;
+
+    if (!CPU_ISSET(cpu, &p->irq_cpus))
+      continue;
+    placement_cache_domain(cpu, &domain);
+    CPU_OR(&p->cpus, &p->cpus, &domain);
+    if (p->node < 0)
+      p->node = cpu_node(cpu);
+  }
+  return 0;
+}
+
+/*
+ * Asks for a range of memory to come from a node; it keeps the default
+ * policy if the node is unknown or the kernel refuses
+ */
+int placement_bind(void *addr, size_t len, int node)
+{
+  unsigned long mask[4] = { 0 };
+
+  if (node < 0 || node >= (int)(sizeof(mask) * CHAR_BIT))
+    return -1;
+  mask[node / (sizeof(mask[0]) * CHAR_BIT)] = 1UL << node % (sizeof(mask[0]) * CHAR_BIT);
+  return syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask,
+                 sizeof(mask) * CHAR_BIT, 0);
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
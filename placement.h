@@ -0,0 +1,52 @@
+/*
+    CPU and memory placement near a wireless device
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <sched.h>
+#include <stddef.h>
+
+/* Most IRQs looked at per device */
+#define PLACEMENT_MAX_IRQS 64
+
+/*
+ * Where work on one interface should run: the CPUs that share a cache
+ * with those its device's interrupts are delivered to, and the memory
+ * node of the device
+ */
+struct placement {
+  int irqs;                     /* interrupts found, 0 if none */
+  cpu_set_t irq_cpus;           /* their effective affinity */
+  cpu_set_t cpus;               /* cache domain around irq_cpus */
+  int node;                     /* -1 if unknown */
+};
+
+int placement_parse_cpulist(const char *list, cpu_set_t *set);
+int placement_format_cpulist(const cpu_set_t *set, char *buf, size_t len);
+int placement_irq_cpus(const char *ifname, cpu_set_t *cpus);
+int placement_cache_domain(int cpu, cpu_set_t *domain);
+int placement_for(const char *ifname, struct placement *p);
+int placement_bind(void *addr, size_t len, int node);
+
+#endif /* PLACEMENT_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
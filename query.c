@@ -0,0 +1,340 @@
+/*
+    Queries over interface samples
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Queries pick, order and sum up interfaces by expressions over their
+ * latest sample, e.g.
+ *
+ *   level < -70 and retry_rate > 10 sort noise desc
+ *   select ifname, snr where associated sort snr limit 3
+ *   select count, avg(level), min(snr) where bitrate < 54
+ *
+ * Every expression is compiled by expr_compile() when the query is,
+ * so running one is a pass of the where clause over the rows, a sort
+ * on the precomputed keys and a pass to print or aggregate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "query.h"
+
+/*
+ * A row that passed the where clause, with its sort key
+ */
+struct query_hit {
+  double key;
+  const struct expr_row *row;
+};
+
+static const struct {
+  const char *name;
+  int agg;
+} query_aggs[] = {
+  { "count", QUERY_COUNT },
+  { "min", QUERY_MIN },
+  { "max", QUERY_MAX },
+  { "avg", QUERY_AVG },
+  { "sum", QUERY_SUM },
+};
+
+static const char *query_space(const char *p)
+{
+  while (isspace((unsigned char)*p))
+    p++;
+  return p;
+}
+
+/*
+ * Consumes a word if it comes next
+ */
+static int query_word(const char **p, const char *word)
+{
+  *p = query_space(*p);
+  if (!expr_keyword(*p, word))
+    return 0;
+  *p += strlen(word);
+  return 1;
+}
+
+/*
+ * Names an item by its source text
+ */
+static void query_name(struct query_item *it, const char *start, const char *end)
+{
+  size_t len = 0;
+
+  /* without spaces, so the output stays name=value */
+  for (; start < end && len < sizeof(it->name) - 1; start++)
+    if (!isspace((unsigned char)*start))
+      it->name[len++] = *start;
+  it->name[len] = 0;
+}
+
+/*
+ * Compiles one select item: an aggregate of one expression, count, or
+ * a plain expression.  min() and max() of two arguments are the
+ * functions, not the aggregates.
+ */
+static const char *query_item(struct query *q, const char *p, char *err, size_t errlen)
+{
+  struct query_item *it = &q->item[q->items];
+  const char *start = query_space(p), *end;
+  size_t i;
+
+  memset(it, 0, sizeof(*it));
+  if (expr_keyword(start, "ifname")) {
+    /* every row starts with it anyway; alone it selects nothing more */
+    return start + strlen("ifname");
+  }
+  for (i = 0; i < sizeof(query_aggs) / sizeof(query_aggs[0]); i++) {
+    p = start;
+    if (!query_word(&p, query_aggs[i].name))
+      continue;
+    p = query_space(p);
+    if (query_aggs[i].agg == QUERY_COUNT) {
+      if (*p == '(' && *query_space(p + 1) == ')')
+        p = query_space(p + 1) + 1;
+      it->agg = QUERY_COUNT;
+      query_name(it, start, p);
+      q->items++;
+      return p;
+    }
+    if (*p != '(')
+      break;
+    if (expr_compile(&it->expr, p + 1, &end, err, errlen) < 0)
+      return NULL;
+    end = query_space(end);
+    if (*end != ')')
+      break;
+    it->agg = query_aggs[i].agg;
+    query_name(it, start, end + 1);
+    q->fields |= it->expr.fields;
+    q->items++;
+    return end + 1;
+  }
+
+  if (expr_compile(&it->expr, start, &end, err, errlen) < 0)
+    return NULL;
+  it->agg = QUERY_VALUE;
+  query_name(it, start, end);
+  q->fields |= it->expr.fields;
+  q->items++;
+  return end;
+}
+
+/*
+ * Compiles a query.  On error returns -1 with a message in err.
+ */
+int query_compile(struct query *q, const char *src, char *err, size_t errlen)
+{
+  const char *p = src, *end;
+  char *num;
+  int i, values = 0;
+
+  memset(q, 0, sizeof(*q));
+  if (query_word(&p, "select")) {
+    q->selected = 1;
+    do {
+      if (q->items == QUERY_ITEMS) {
+        snprintf(err, errlen, "more than %d items selected", QUERY_ITEMS);
+        return -1;
+      }
+      if ((p = query_item(q, p, err, errlen)) == NULL)
+        return -1;
+      p = query_space(p);
+    } while (*p == ',' && p++);
+  }
+
+  p = query_space(p);
+  if (query_word(&p, "where") ||
+      (*p && !expr_keyword(p, "sort") && !expr_keyword(p, "limit"))) {
+    if (expr_compile(&q->where, p, &end, err, errlen) < 0)
+      return -1;
+    q->filtered = 1;
+    q->fields |= q->where.fields;
+    p = end;
+  }
+  if (query_word(&p, "sort")) {
+    query_word(&p, "by");
+    if (expr_compile(&q->sort, p, &end, err, errlen) < 0)
+      return -1;
+    q->sorted = 1;
+    q->fields |= q->sort.fields;
+    p = end;
+    if (query_word(&p, "desc"))
+      q->descending = 1;
+    else
+      query_word(&p, "asc");
+  }
+  if (query_word(&p, "limit")) {
+    q->limit = strtol(p, &num, 10);
+    if (num == p || q->limit <= 0) {
+      snprintf(err, errlen, "limit needs a positive count");
+      return -1;
+    }
+    p = num;
+  }
+  p = query_space(p);
+  if (*p) {
+    snprintf(err, errlen, "unexpected text at offset %d, near '%.12s'",
+             (int)(p - src), p);
+    return -1;
+  }
+
+  for (i = 0; i < q->items; i++)
+    if (q->item[i].agg == QUERY_VALUE)
+      values++;
+  if (values && values != q->items) {
+    snprintf(err, errlen, "aggregates and plain values cannot be mixed");
+    return -1;
+  }
+  q->aggregate = q->items && !values;
+  return 0;
+}
+
+/*
+ * Tells whether a row passes the where clause
+ */
+int query_match(const struct query *q, const struct expr_row *row)
+{
+  return !q->filtered || expr_true(&q->where, row);
+}
+
+static void query_value(FILE *fp, const char *name, double v)
+{
+  if (isnan(v))
+    fprintf(fp, " %s=na", name);
+  else
+    fprintf(fp, " %s=%.6g", name, v);
+}
+
+/*
+ * Prints a row: the items selected, or every field it has if there was
+ * no select list
+ */
+void query_print_row(const struct query *q, const struct expr_row *row,
+                     const char *tag, FILE *fp)
+{
+  int i;
+
+  fprintf(fp, "%s ifname=%s", tag, row->ifname);
+  if (q->selected) {
+    for (i = 0; i < q->items; i++)
+      query_value(fp, q->item[i].name, expr_eval(&q->item[i].expr, row));
+  } else {
+    for (i = 0; i < EXPR_FIELDS; i++)
+      if (row->valid & (1u << i))
+        query_value(fp, expr_field_name(i), row->v[i]);
+  }
+  fputc('\n', fp);
+}
+
+/*
+ * Orders hits by key, absent keys last, then by name
+ */
+static int query_hit_cmp(const void *a, const void *b)
+{
+  const struct query_hit *x = a, *y = b;
+
+  if (isnan(x->key) != isnan(y->key))
+    return isnan(x->key) ? 1 : -1;
+  if (x->key != y->key && !isnan(x->key))
+    return x->key < y->key ? -1 : 1;
+  return strcmp(x->row->ifname, y->row->ifname);
+}
+
+/*
+ * Prints the aggregates over the hits
+ */
+static void query_aggregate(const struct query *q, const struct query_hit *hits,
+                            size_t n, FILE *fp)
+{
+  const struct query_item *it;
+  double v, acc;
+  size_t j, seen;
+  int i;
+
+  fprintf(fp, "aggregate rows=%zu", n);
+  for (i = 0; i < q->items; i++) {
+    it = &q->item[i];
+    if (it->agg == QUERY_COUNT) {
+      fprintf(fp, " %s=%zu", it->name, n);
+      continue;
+    }
+    acc = NAN;
+    for (j = seen = 0; j < n; j++) {
+      if (isnan(v = expr_eval(&it->expr, hits[j].row)))
+        continue;
+      if (!seen++)
+        acc = v;
+      else if (it->agg == QUERY_MIN)
+        acc = v < acc ? v : acc;
+      else if (it->agg == QUERY_MAX)
+        acc = v > acc ? v : acc;
+      else
+        acc += v;
+    }
+    if (it->agg == QUERY_AVG && seen)
+      acc /= seen;
+    query_value(fp, it->name, acc);
+  }
+  fputc('\n', fp);
+}
+
+/*
+ * Runs a query over rows: filters, sorts, limits, then prints each
+ * row left or their aggregates.  Returns the rows left, or -1 if out
+ * of memory.
+ */
+int query_run(const struct query *q, const struct expr_row *rows, size_t n, FILE *fp)
+{
+  struct query_hit *hits;
+  size_t i, count = 0;
+
+  if ((hits = malloc((n + 1) * sizeof(*hits))) == NULL)
+    return -1;
+  for (i = 0; i < n; i++) {
+    if (!query_match(q, &rows[i]))
+      continue;
+    hits[count].row = &rows[i];
+    hits[count].key = q->sorted ? expr_eval(&q->sort, &rows[i]) : 0;
+    if (q->descending)
+      hits[count].key = -hits[count].key;
+    count++;
+  }
+  qsort(hits, count, sizeof(*hits), query_hit_cmp);
+  if (q->limit && count > (size_t)q->limit)
+    count = q->limit;
+
+  if (q->aggregate)
+    query_aggregate(q, hits, count, fp);
+  else
+    for (i = 0; i < count; i++)
+      query_print_row(q, hits[i].row, "row", fp);
+  free(hits);
+  return count;
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
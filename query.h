@@ -0,0 +1,84 @@
+/*
+    Queries over interface samples
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stdio.h>
+#include "expr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Items a select list can hold */
+#define QUERY_ITEMS 16
+
+enum query_agg {
+  QUERY_VALUE,                  /* a plain expression, one per row */
+  QUERY_COUNT,
+  QUERY_MIN,
+  QUERY_MAX,
+  QUERY_AVG,
+  QUERY_SUM
+};
+
+struct query_item {
+  char name[32];                /* as written, for the output */
+  int agg;                      /* enum query_agg */
+  struct expr expr;             /* not used by count */
+};
+
+/*
+ * A compiled query:
+ *
+ *   [select item, ...] [[where] expr] [sort [by] expr [asc|desc]] [limit n]
+ *
+ * Items are expressions, or all aggregates: count, min(e), max(e),
+ * avg(e), sum(e).
+ */
+struct query {
+  int selected;                 /* a select list was given, if only ifname */
+  int items;
+  struct query_item item[QUERY_ITEMS];
+  int aggregate;                /* the items are aggregates: one row out */
+  int filtered;
+  struct expr where;
+  int sorted;
+  int descending;
+  struct expr sort;
+  long limit;                   /* 0 for no limit */
+  unsigned fields;              /* 1 << field of every field read */
+};
+
+int query_compile(struct query *q, const char *src, char *err, size_t errlen);
+int query_match(const struct query *q, const struct expr_row *row);
+void query_print_row(const struct query *q, const struct expr_row *row,
+                     const char *tag, FILE *fp);
+int query_run(const struct query *q, const struct expr_row *rows, size_t n, FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QUERY_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,297 @@
+/*
+    Per-field choice of the backend a snapshot is read from
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Drivers differ in what they answer cheaply: some lack an ioctl, some
+ * are slow to answer one, some report statistics only in
+ * WIRELESS_PROC_PATH.  Each interface keeps, per field and backend, a
+ * moving average of the latency and failure rate seen while sampling,
+ * and reads each field from the cheapest backend that answers reliably.
+ * Every ROUTE_EVAL_NS one sample tries every backend, so that a choice
+ * is revisited when things change; a field nothing answers is skipped
+ * until then.
+ *
+ * The proc listing holds every interface, so one read is kept for
+ * ROUTE_PROC_FRESH_NS and shared by all interfaces sampled meanwhile,
+ * as timer slack tends to group them.  Each interface is charged the
+ * time of a read divided by the interfaces the previous one served.
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include <net/if.h>
+
+#include "mem.h"
+#include "route.h"
+#include "trace.h"
+#include "rtnlgate.h"
+
+static const char *field_names[WS_FIELDS] = {
+  "essid", "ap", "bitrate", "txpower", "stats"
+};
+
+static const char *backend_names[ROUTE_BACKENDS + 1] = {
+  "wext", "proc", "none"
+};
+
+/* WS_* fields each backend can read */
+static const unsigned backend_fields[ROUTE_BACKENDS] = {
+  WS_ALL, WS_STATS
+};
+
+/*
+ * Last read of the proc listing, hashed by interface name
+ */
+struct proc_entry {
+  char ifname[IFNAMSIZ];
+  struct wireless_snapshot snap;
+};
+
+static pthread_mutex_t proc_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct proc_entry *proc_slots;
+static size_t proc_size;        /* slots, a power of two */
+static size_t proc_count;
+static unsigned long long proc_read_ns;
+static unsigned long long proc_share_ns;  /* a read's cost per user */
+static unsigned long proc_users;          /* served by the current read */
+static int proc_ok;
+
+/*
+ * Hashes an interface name (FNV-1a)
+ */
+static size_t proc_hash(const char *name)
+{
+  unsigned int h = 2166136261u;
+
+  while (*name)
+    h = (h ^ (unsigned char)*name++) * 16777619u;
+  return h;
+}
+
+/*
+ * Slot of an interface, or the empty one it would go to
+ */
+static struct proc_entry *proc_slot(const char *ifname)
+{
+  size_t i = proc_hash(ifname) & (proc_size - 1);
+
+  while (proc_slots[i].ifname[0] && strcmp(proc_slots[i].ifname, ifname))
+    i = (i + 1) & (proc_size - 1);
+  return &proc_slots[i];
+}
+
+/*
+ * Stores one interface of the listing, growing the table at half full
+ */
+static void proc_store(const char *ifname, const struct wireless_snapshot *snap,
+                       void *arg)
+{
+  struct proc_entry *e, *old = proc_slots;
+  size_t old_size = proc_size, i;
+
+  if ((proc_count + 1) * 2 > proc_size) {
+    size_t size = proc_size ? proc_size * 2 : 64;
+    struct proc_entry *slots = mem_alloc(MEM_CACHE, size * sizeof(*slots));
+
+    if (!slots)
+      return;
+    proc_slots = slots;
+    proc_size = size;
+    for (i = 0; i < old_size; i++)
+      if (old[i].ifname[0])
+        *proc_slot(old[i].ifname) = old[i];
+    mem_free(old);
+  }
+
+  e = proc_slot(ifname);
+  if (!e->ifname[0]) {
+    strncpy(e->ifname, ifname, IFNAMSIZ - 1);
+    proc_count++;
+  }
+  e->snap = *snap;
+}
+
+/*
+ * Statistics of an interface from the proc listing, read again if the
+ * last read is stale, and the interface's share of the read's cost.
+ * Fails if the interface is not listed.
+ */
+static int proc_stats(const char *ifname, struct wireless_snapshot *snap,
+                      unsigned long long *cost_ns)
+{
+  unsigned long long now = clock_monotonic_ns();
+  unsigned long long gate;
+  struct proc_entry *e;
+  int ret = -1;
+
+  pthread_mutex_lock(&proc_lock);
+  if (now - proc_read_ns >= ROUTE_PROC_FRESH_NS) {
+    if (proc_slots)
+      memset(proc_slots, 0, proc_size * sizeof(*proc_slots));
+    proc_count = 0;
+    gate = rtnlgate_enter();  /* the kernel lists them under RTNL */
+    proc_ok = wireless_proc_stats(WIRELESS_PROC_PATH, proc_store, NULL) >= 0;
+    rtnlgate_leave(gate);
+    proc_read_ns = clock_monotonic_ns();
+    trace_span("read " WIRELESS_PROC_PATH, NULL, now, proc_read_ns);
+    proc_share_ns = (proc_read_ns - now) / (proc_users ? proc_users : 1);
+    proc_users = 0;
+  }
+  proc_users++;
+  *cost_ns = proc_share_ns;
+  if (proc_ok && proc_size && (e = proc_slot(ifname))->ifname[0]) {
+    wireless_snapshot_merge(snap, &e->snap, WS_STATS);
+    ret = 0;
+  }
+  pthread_mutex_unlock(&proc_lock);
+  return ret;
+}
+
+/*
+ * Folds one try of a backend into its averages
+ */
+static void route_account(struct route_stat *st, unsigned long long cost_ns,
+                          int failed)
+{
+  if (!st->calls) {
+    st->cost_ns = cost_ns;
+    st->errors = failed;
+  } else {
+    st->cost_ns += (cost_ns - st->cost_ns) / 8;
+    st->errors += (failed - st->errors) / 8;
+  }
+  st->calls++;
+}
+
+/*
+ * Picks the cheapest reliable backend for one field
+ */
+static void route_choose(struct route_table *t, int field)
+{
+  const struct route_stat *st = t->stat[field];
+  int via = t->via[field], best = ROUTE_NONE, b;
+
+  for (b = 0; b < ROUTE_BACKENDS; b++) {
+    if (!(backend_fields[b] & (1 << field)) || !st[b].calls ||
+        st[b].errors > ROUTE_MAX_ERRORS)
+      continue;
+    if (best == ROUTE_NONE || st[b].cost_ns < st[best].cost_ns)
+      best = b;
+  }
+
+  /* stay put unless the current one fails or the other is clearly cheaper */
+  if (best != ROUTE_NONE && via != ROUTE_NONE && via != best &&
+      st[via].errors <= ROUTE_MAX_ERRORS &&
+      st[best].cost_ns > st[via].cost_ns * ROUTE_HYSTERESIS)
+    best = via;
+
+  if (best != via) {
+    t->via[field] = best;
+    t->changed |= 1 << field;
+  }
+}
+
+/*
+ * Fills a snapshot as wireless_snapshot() would, reading each field
+ * from the backend chosen for it, or from all of them when it is time
+ * to try them again
+ */
+int route_snapshot(struct route_table *t, const char *ifname, unsigned fields,
+                   struct wireless_snapshot *snap)
+{
+  unsigned long long now = clock_monotonic_ns(), cost;
+  unsigned want[ROUTE_BACKENDS] = { 0 }, probe = 0;
+  struct wireless_snapshot wext;
+  int i, b, failed;
+
+  memset(snap, 0, sizeof(*snap));
+
+  for (i = 0; i < WS_FIELDS; i++) {
+    if (!(fields & (1 << i)))
+      continue;
+    for (b = 0; b < ROUTE_BACKENDS; b++)
+      if ((backend_fields[b] & (1 << i)) && t->stat[i][b].calls < ROUTE_MIN_CALLS)
+        probe |= 1 << i;
+  }
+  if (now >= t->eval_ns) {
+    probe = fields;
+    t->eval_ns = now + ROUTE_EVAL_NS;
+  }
+
+  for (i = 0; i < WS_FIELDS; i++) {
+    if (!(fields & (1 << i)))
+      continue;
+    for (b = 0; b < ROUTE_BACKENDS; b++)
+      if ((backend_fields[b] & (1 << i)) && ((probe & (1 << i)) || t->via[i] == b))
+        want[b] |= 1 << i;
+  }
+
+  if (want[ROUTE_WEXT]) {
+    if (wireless_snapshot(ifname, want[ROUTE_WEXT], &wext) < 0)
+      return -1;
+    for (i = 0; i < WS_FIELDS; i++)
+      if (want[ROUTE_WEXT] & (1 << i))
+        route_account(&t->stat[i][ROUTE_WEXT], wext.field_cost_ns[i],
+                      !(wext.valid & (1 << i)));
+    wireless_snapshot_merge(snap, &wext, want[ROUTE_WEXT]);
+  }
+
+  if (want[ROUTE_PROC]) {
+    struct wireless_snapshot proc = *snap;
+
+    failed = proc_stats(ifname, &proc, &cost) < 0;
+    route_account(&t->stat[WS_INDEX(WS_STATS)][ROUTE_PROC], cost, failed);
+    /* when both were read, the chosen one's values are kept */
+    if (!failed && (t->via[WS_INDEX(WS_STATS)] == ROUTE_PROC ||
+                    !(snap->valid & WS_STATS)))
+      wireless_snapshot_merge(snap, &proc, WS_STATS);
+  }
+
+  for (i = 0; i < WS_FIELDS; i++)
+    if (fields & (1 << i))
+      route_choose(t, i);
+  return 0;
+}
+
+/*
+ * Prints the backend of each of the given fields, with its figures
+ */
+void route_print(const char *ifname, const struct route_table *t,
+                 unsigned fields, FILE *fp)
+{
+  const struct route_stat *st;
+  int i;
+
+  for (i = 0; i < WS_FIELDS; i++) {
+    if (!(fields & (1 << i)))
+      continue;
+    fprintf(fp, "route ifname=%s field=%s via=%s", ifname, field_names[i],
+            backend_names[t->via[i]]);
+    if (t->via[i] != ROUTE_NONE) {
+      st = &t->stat[i][t->via[i]];
+      fprintf(fp, " cost_us=%.1f errors=%.2f", st->cost_ns / NSEC_PER_USEC,
+              st->errors);
+    }
+    fprintf(fp, "\n");
+  }
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,82 @@
+/*
+    Per-field choice of the backend a snapshot is read from
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include <stdio.h>
+#include "clock.h"
+#include "sample.h"
+
+/*
+ * Where a field can be read from
+ */
+enum route_backend {
+  ROUTE_WEXT,                   /* one SIOCGIW* ioctl per field */
+  ROUTE_PROC,                   /* WIRELESS_PROC_PATH, statistics only */
+  ROUTE_BACKENDS,
+  ROUTE_NONE = ROUTE_BACKENDS   /* nothing answers; the field is skipped */
+};
+
+/* Every field is tried on every backend this often */
+#define ROUTE_EVAL_NS       (30ULL * NSEC_PER_SEC)
+
+/* Tries of a backend before its figures are trusted */
+#define ROUTE_MIN_CALLS     3
+
+/* Failure rate above which a backend is not used for a field */
+#define ROUTE_MAX_ERRORS    0.2
+
+/* A backend replaces the current one only if this much cheaper */
+#define ROUTE_HYSTERESIS    0.8
+
+/* One read of WIRELESS_PROC_PATH serves every interface sampled within */
+#define ROUTE_PROC_FRESH_NS (20 * NSEC_PER_MSEC)
+
+/*
+ * Latency and failure rate of one backend for one field, both moving
+ * averages
+ */
+struct route_stat {
+  double cost_ns;
+  double errors;                /* 0 to 1 */
+  unsigned long calls;
+};
+
+/*
+ * Backend choices of one interface.  Only the thread sampling the
+ * interface uses it.
+ */
+struct route_table {
+  struct route_stat stat[WS_FIELDS][ROUTE_BACKENDS];
+  unsigned char via[WS_FIELDS];  /* enum route_backend */
+  unsigned long long eval_ns;   /* next time every backend is tried */
+  unsigned changed;             /* WS_* whose backend changed, for the owner */
+};
+
+int route_snapshot(struct route_table *t, const char *ifname, unsigned fields,
+                   struct wireless_snapshot *snap);
+void route_print(const char *ifname, const struct route_table *t,
+                 unsigned fields, FILE *fp);
+
+#endif /* ROUTE_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
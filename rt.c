@@ -0,0 +1,364 @@
+/*
+    Real-time sampler thread
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * With -R the loop thread takes no samples.  A thread of its own at a
+ * SCHED_FIFO priority sleeps to each interface's due time on an
+ * absolute clock, reads the snapshot over a socket it keeps open, and
+ * queues it for the loop thread, which records, formats and writes it
+ * as any other sample.  Nothing the sampler touches is allocated after
+ * start: the interface slots, the queue and the jitter histogram are
+ * static, all memory is locked, and the heap and the sampler's stack
+ * are faulted in before the first sample.
+ *
+ * Slots are handed over by their state word and the queue is a single
+ * producer, single consumer ring, so the two threads share no lock.  A
+ * full queue drops the sample and counts it rather than block.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "rt.h"
+#include "trace.h"
+#include "rtnlgate.h"
+
+static struct wireless_loop *rt_loop;
+static unsigned rt_fields;
+static int rt_sock = -1;
+static int rt_running;
+static int rt_priority;
+static int rt_locked;
+static pthread_t rt_thread;
+static int rt_stopping;                 /* atomic */
+
+static struct rt_slot rt_slots[RT_MAX_IFACES];
+
+static struct rt_sample rt_queue[RT_QUEUE];
+static unsigned long long rt_head;      /* atomic, written by the sampler */
+static unsigned long long rt_tail;      /* atomic, written by the loop */
+
+/* the sampler's, read once it is stopped */
+static unsigned long long rt_jitter[RT_JITTER_BINS];
+static unsigned long long rt_samples;
+static unsigned long long rt_dropped;
+static unsigned long long rt_overruns;
+static unsigned long long rt_max_ns;
+
+/*
+ * Touches the top of the sampler's stack so that it never faults
+ */
+static void rt_prefault_stack(void)
+{
+  volatile char stack[RT_STACK_PREFAULT];
+
+  memset((char *)stack, 0, sizeof(stack));
+}
+
+/*
+ * Takes one due sample and queues it for the loop thread; 1 if queued
+ */
+static int rt_sample(struct rt_slot *slot)
+{
+  unsigned long long wake = clock_monotonic_ns(), late, head, missed, gate;
+  struct rt_sample *s;
+  int queued = 0;
+
+  late = wake - slot->due_ns;
+  rt_jitter[late / NSEC_PER_USEC < RT_JITTER_BINS ?
+            late / NSEC_PER_USEC : RT_JITTER_BINS - 1]++;
+  if (late > rt_max_ns)
+    rt_max_ns = late;
+  rt_samples++;
+
+  head = rt_head;
+  if (head - __atomic_load_n(&rt_tail, __ATOMIC_ACQUIRE) >= RT_QUEUE) {
+    rt_dropped++;
+  } else if (rtnlgate_try_enter(&gate) < 0) {
+    /* over the -L budget, or it would wait on other threads; counted there */
+  } else {
+    s = &rt_queue[head & (RT_QUEUE - 1)];
+    memcpy(s->ifname, slot->ifname, sizeof(s->ifname));
+    s->late_ns = late;
+    wireless_snapshot_sock(rt_sock, slot->ifname, rt_fields, &s->snap);
+    rtnlgate_try_leave(gate);
+    __atomic_store_n(&rt_head, head + 1, __ATOMIC_RELEASE);
+    queued = 1;
+  }
+
+  /* stay on the interval's grid, skipping the periods already missed */
+  slot->due_ns += slot->interval_ns;
+  if (slot->due_ns <= wake) {
+    missed = (wake - slot->due_ns) / slot->interval_ns + 1;
+    rt_overruns += missed;
+    slot->due_ns += missed * slot->interval_ns;
+  }
+  return queued;
+}
+
+/*
+ * Sampler thread: samples every slot that is due, wakes the loop if
+ * any were queued and sleeps to the next due time
+ */
+static void *rt_run(void *arg)
+{
+  struct timespec next;
+  struct rt_slot *slot;
+  unsigned long long now, soonest;
+  int i, state, queued;
+
+  rt_prefault_stack();
+  trace_thread("rt sampler");
+  while (!__atomic_load_n(&rt_stopping, __ATOMIC_ACQUIRE)) {
+    now = clock_monotonic_ns();
+    soonest = now + RT_IDLE_NS;
+    queued = 0;
+    for (i = 0; i < RT_MAX_IFACES; i++) {
+      slot = &rt_slots[i];
+      state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+      if (state == RT_REMOVING) {
+        __atomic_store_n(&slot->state, RT_FREE, __ATOMIC_RELEASE);
+        continue;
+      }
+      if (state != RT_ACTIVE)
+        continue;
+      if (!slot->due_ns)
+        slot->due_ns = now;
+      if (slot->due_ns <= now)
+        queued |= rt_sample(slot);
+      if (slot->due_ns < soonest)
+        soonest = slot->due_ns;
+    }
+    if (queued)
+      wireless_loop_wake(rt_loop);
+
+    next.tv_sec = soonest / NSEC_PER_SEC;
+    next.tv_nsec = soonest % NSEC_PER_SEC;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+      ;
+  }
+  return NULL;
+}
+
+/*
+ * Locks all memory, present and future, and faults in a heap the
+ * monitor can grow into without going back to the kernel.  Failing to
+ * lock is reported but not fatal.
+ */
+static void rt_lock(void)
+{
+  char *heap;
+
+  /* freed memory stays in the heap, and large blocks come from it too */
+  mallopt(M_TRIM_THRESHOLD, -1);
+  mallopt(M_MMAP_MAX, 0);
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+    perror("real-time sampler: mlockall");
+  else
+    rt_locked = 1;
+  if ((heap = malloc(RT_HEAP_PREFAULT)) != NULL) {
+    memset(heap, 0, RT_HEAP_PREFAULT);
+    free(heap);
+  }
+}
+
+/*
+ * Starts the sampler at the SCHED_FIFO priority given, reading fields
+ * and waking loop when it queues samples.  If the priority is refused
+ * it samples at the normal one, and says so.
+ */
+int rt_start(struct wireless_loop *loop, int priority, unsigned fields)
+{
+  pthread_attr_t attr;
+  struct sched_param param;
+  int err;
+
+  if (priority < sched_get_priority_min(SCHED_FIFO) ||
+      priority > sched_get_priority_max(SCHED_FIFO)) {
+    fprintf(stderr, "real-time sampler: priority out of range\n");
+    return -1;
+  }
+  if ((rt_sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+    perror("real-time sampler");
+    return -1;
+  }
+  rt_loop = loop;
+  rt_fields = fields;
+  rt_lock();
+
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = priority;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, RT_STACK_SIZE);
+  pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+  pthread_attr_setschedparam(&attr, &param);
+  rt_priority = priority;
+  if ((err = pthread_create(&rt_thread, &attr, rt_run, NULL)) == EPERM) {
+    fprintf(stderr, "real-time sampler: SCHED_FIFO not permitted, "
+                    "sampling at normal priority\n");
+    pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+    rt_priority = 0;
+    err = pthread_create(&rt_thread, &attr, rt_run, NULL);
+  }
+  pthread_attr_destroy(&attr);
+  if (err) {
+    errno = err;
+    perror("real-time sampler");
+    close(rt_sock);
+    rt_sock = -1;
+    return -1;
+  }
+  rt_running = 1;
+  return 0;
+}
+
+/*
+ * Stops the sampler.  Samples still queued stay there for rt_drain().
+ */
+void rt_stop(void)
+{
+  if (!rt_running)
+    return;
+  __atomic_store_n(&rt_stopping, 1, __ATOMIC_RELEASE);
+  pthread_join(rt_thread, NULL);
+  close(rt_sock);
+  rt_sock = -1;
+  rt_running = 0;
+}
+
+/*
+ * Puts an interface on the sampler, to be sampled every interval_ns
+ * from now on; NULL if the sampler is not running or full.  Loop
+ * thread only.
+ */
+struct rt_slot *rt_add(const char *ifname, unsigned long long interval_ns)
+{
+  struct rt_slot *slot;
+  int i;
+
+  if (!rt_running)
+    return NULL;
+  for (i = 0; i < RT_MAX_IFACES; i++) {
+    slot = &rt_slots[i];
+    if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != RT_FREE)
+      continue;
+    memset(slot->ifname, 0, sizeof(slot->ifname));
+    strncpy(slot->ifname, ifname, sizeof(slot->ifname) - 1);
+    slot->interval_ns = interval_ns;
+    slot->due_ns = 0;
+    __atomic_store_n(&slot->state, RT_ACTIVE, __ATOMIC_RELEASE);
+    return slot;
+  }
+  fprintf(stderr, "real-time sampler: no room for %s\n", ifname);
+  return NULL;
+}
+
+/*
+ * Takes an interface off the sampler.  Samples of it already queued
+ * are still drained.
+ */
+void rt_remove(struct rt_slot *slot)
+{
+  if (slot)
+    __atomic_store_n(&slot->state, RT_REMOVING, __ATOMIC_RELEASE);
+}
+
+/*
+ * Hands every queued sample to fn, oldest first; returns how many.
+ * Loop thread only.
+ */
+int rt_drain(rt_sample_t fn, void *arg)
+{
+  unsigned long long tail = rt_tail;
+  unsigned long long head = __atomic_load_n(&rt_head, __ATOMIC_ACQUIRE);
+  int n = 0;
+
+  for (; tail != head; tail++, n++)
+    fn(&rt_queue[tail & (RT_QUEUE - 1)], arg);
+  __atomic_store_n(&rt_tail, tail, __ATOMIC_RELEASE);
+  return n;
+}
+
+/*
+ * Percentile of the jitter histogram, as the upper edge of its bin;
+ * the largest wakeup if it falls in the last, open one
+ */
+static unsigned long long rt_percentile(double p)
+{
+  unsigned long long want = rt_samples * p, seen = 0;
+  int i;
+
+  for (i = 0; i < RT_JITTER_BINS - 1; i++) {
+    seen += rt_jitter[i];
+    if (seen > want)
+      return (i + 1) * NSEC_PER_USEC < rt_max_ns ? (i + 1) * NSEC_PER_USEC : rt_max_ns;
+  }
+  return rt_max_ns;
+}
+
+/*
+ * Sampler counters and jitter percentiles; exact once it is stopped
+ */
+void rt_stats(struct rt_stats *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  stats->samples = rt_samples;
+  stats->dropped = rt_dropped;
+  stats->overruns = rt_overruns;
+  stats->priority = rt_priority;
+  stats->locked = rt_locked;
+  if (!rt_samples)
+    return;
+  stats->p50_ns = rt_percentile(0.50);
+  stats->p90_ns = rt_percentile(0.90);
+  stats->p99_ns = rt_percentile(0.99);
+  stats->p999_ns = rt_percentile(0.999);
+  stats->max_ns = rt_max_ns;
+}
+
+/*
+ * Prints how late the sampler woke for its samples
+ */
+void rt_print(FILE *fp)
+{
+  struct rt_stats st;
+
+  rt_stats(&st);
+  fprintf(fp, "jitter samples=%llu p50_us=%.1f p90_us=%.1f p99_us=%.1f "
+              "p999_us=%.1f max_us=%.1f overruns=%llu dropped=%llu "
+              "priority=%d locked=%s\n",
+          st.samples, st.p50_ns / 1e3, st.p90_ns / 1e3, st.p99_ns / 1e3,
+          st.p999_ns / 1e3, st.max_ns / 1e3, st.overruns, st.dropped,
+          st.priority, st.locked ? "yes" : "no");
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
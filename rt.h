@@ -0,0 +1,99 @@
+/*
+    Real-time sampler thread
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef RT_H
+#define RT_H
+
+#include <stdio.h>
+#include <linux/if.h>
+#include "clock.h"
+#include "loop.h"
+#include "sample.h"
+
+/* Interfaces the sampler can hold */
+#define RT_MAX_IFACES   64
+
+/* Samples in flight to the loop thread; a power of two */
+#define RT_QUEUE        1024
+
+/* Longest the sampler sleeps, and so how late it sees a new interface */
+#define RT_IDLE_NS      (10 * NSEC_PER_MSEC)
+
+/* Jitter histogram: 1 us bins up to 10 ms, later wakeups in the last */
+#define RT_JITTER_BINS  10000
+
+/* Sampler stack, and how much of it and of the heap is touched at start */
+#define RT_STACK_SIZE     (256 * 1024)
+#define RT_STACK_PREFAULT (64 * 1024)
+#define RT_HEAP_PREFAULT  (8 * 1024 * 1024)
+
+/*
+ * An interface on the sampler.  The loop thread fills one in and sets
+ * it RT_ACTIVE; the sampler frees a removed one once it no longer looks
+ * at it.
+ */
+enum rt_state {
+  RT_FREE,
+  RT_ACTIVE,
+  RT_REMOVING
+};
+
+struct rt_slot {
+  int state;                    /* enum rt_state, atomic */
+  char ifname[IFNAMSIZ];
+  unsigned long long interval_ns;
+  unsigned long long due_ns;    /* sampler's, 0 until first seen */
+};
+
+/*
+ * A sample on its way to the loop thread
+ */
+struct rt_sample {
+  char ifname[IFNAMSIZ];
+  unsigned long long late_ns;   /* woke this long after it was due */
+  struct wireless_snapshot snap;
+};
+
+/*
+ * What the sampler reports at exit
+ */
+struct rt_stats {
+  unsigned long long samples;
+  unsigned long long dropped;   /* the queue was full */
+  unsigned long long overruns;  /* a whole interval was missed */
+  unsigned long long p50_ns, p90_ns, p99_ns, p999_ns, max_ns;
+  int priority;                 /* 0 if SCHED_FIFO was refused */
+  int locked;                   /* memory was locked */
+};
+
+typedef void (*rt_sample_t)(const struct rt_sample *s, void *arg);
+
+int rt_start(struct wireless_loop *loop, int priority, unsigned fields);
+void rt_stop(void);
+struct rt_slot *rt_add(const char *ifname, unsigned long long interval_ns);
+void rt_remove(struct rt_slot *slot);
+int rt_drain(rt_sample_t fn, void *arg);
+void rt_stats(struct rt_stats *stats);
+void rt_print(FILE *fp);
+
+#endif /* RT_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,299 @@
+/*
+    Budget for operations that take the RTNL lock
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Every wireless extension ioctl and every read of the proc listing
+ * holds the kernel's RTNL lock while the driver answers, and so does
+ * everything else that changes the network configuration: routes,
+ * addresses, veth pairs.  Sampling many interfaces often can hold it
+ * enough to delay those.  With -L the monitor's part is bounded:
+ *
+ * - at most a few of its operations hold the lock at once, whatever
+ *   thread they run on, and the rest wait their turn;
+ * - the time they hold it is charged to a token bucket filled at the
+ *   given share of wall time, and samples are refused while it is
+ *   overdrawn, so the share holds over any stretch longer than
+ *   RTNLGATE_BURST_NS;
+ * - the monitor spreads interfaces over their sampling period rather
+ *   than sampling them together.
+ *
+ * The real-time sampler must not wait behind normal-priority threads,
+ * so it never blocks here.  It tries the gate's mutex, and a sample that
+ * would have to wait for the mutex or for a slot is skipped and counted
+ * as busy.  It holds one slot for a whole sample.  It frees the slot and
+ * leaves the time held in atomics, without taking the mutex, and the next
+ * thread through folds that time into the bucket.  Threads waiting for a
+ * slot recheck every RTNLGATE_RECHECK_NS, as freeing the sampler's slot
+ * does not wake them.
+ *
+ * Each operation is timed; totals are printed on exit.  Without -L
+ * the gate is open and only a flag is tested.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "rtnlgate.h"
+
+static int gate_enabled;
+static double gate_share;
+static int gate_concurrent;
+static unsigned long long gate_start_ns;
+
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static int gate_active;                 /* operations holding a slot */
+static double gate_tokens_ns;           /* lock time that may still be spent */
+static unsigned long long gate_fill_ns; /* tokens last added */
+static struct rtnlgate_stats gate_stats;
+
+/* the real-time sampler's share, kept without the mutex */
+static int gate_rt_active;                  /* atomic, slots it holds */
+static unsigned long long gate_rt_held_ns;  /* atomic, not yet charged */
+static unsigned long long gate_rt_ops;      /* atomic, not yet counted */
+static unsigned long long gate_rt_max_ns;   /* atomic */
+static unsigned long long gate_rt_busy;     /* atomic, not yet counted */
+static __thread int gate_nowait;            /* holds a slot for a sample */
+
+/*
+ * Opens the gate to at most concurrent operations at a time, holding
+ * the lock for at most share of the time
+ */
+int rtnlgate_init(double share, int concurrent)
+{
+  pthread_condattr_t attr;
+
+  if (share <= 0 || share > 1 || concurrent < 1) {
+    fprintf(stderr, "rtnl budget: share or concurrency out of range\n");
+    return -1;
+  }
+  /* waits recheck on the monotonic clock, whatever happens to the wall */
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&gate_cond, &attr);
+  pthread_condattr_destroy(&attr);
+  gate_share = share;
+  gate_concurrent = concurrent;
+  gate_start_ns = gate_fill_ns = clock_monotonic_ns();
+  gate_tokens_ns = share * RTNLGATE_BURST_NS;
+  gate_enabled = 1;
+  return 0;
+}
+
+/*
+ * Charges what the real-time sampler left without the mutex; called
+ * with it held
+ */
+static void gate_fold(void)
+{
+  unsigned long long held, max;
+
+  held = __atomic_exchange_n(&gate_rt_held_ns, 0, __ATOMIC_RELAXED);
+  gate_tokens_ns -= held;
+  gate_stats.held_ns += held;
+  gate_stats.ops += __atomic_exchange_n(&gate_rt_ops, 0, __ATOMIC_RELAXED);
+  gate_stats.busy += __atomic_exchange_n(&gate_rt_busy, 0, __ATOMIC_RELAXED);
+  max = __atomic_load_n(&gate_rt_max_ns, __ATOMIC_RELAXED);
+  if (max > gate_stats.max_ns)
+    gate_stats.max_ns = max;
+}
+
+/*
+ * Fills the bucket up to now; -1, counted, if it is overdrawn.  Called
+ * with the mutex held.
+ */
+static int gate_refill(void)
+{
+  unsigned long long now = clock_monotonic_ns();
+
+  gate_fold();
+  gate_tokens_ns += gate_share * (now - gate_fill_ns);
+  if (gate_tokens_ns > gate_share * RTNLGATE_BURST_NS)
+    gate_tokens_ns = gate_share * RTNLGATE_BURST_NS;
+  gate_fill_ns = now;
+  if (gate_tokens_ns <= 0) {
+    gate_stats.throttled++;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Slots in use, the real-time sampler's included
+ */
+static inline int gate_in_use(void)
+{
+  return gate_active + __atomic_load_n(&gate_rt_active, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Asks whether a sample may be taken now; -1 if the budget is spent
+ * and the sample should be skipped
+ */
+int rtnlgate_admit(void)
+{
+  int ret;
+
+  if (!gate_enabled)
+    return 0;
+  pthread_mutex_lock(&gate_lock);
+  ret = gate_refill();
+  pthread_mutex_unlock(&gate_lock);
+  return ret;
+}
+
+/*
+ * For the real-time sampler: admits a sample and takes a slot for all
+ * of it, or returns -1 at once if the budget is spent, or the mutex or
+ * every slot is taken.  start is when the sample starts, 0 if the gate
+ * is open; the operations in the sample go through without waiting.
+ */
+int rtnlgate_try_enter(unsigned long long *start)
+{
+  int ret;
+
+  *start = 0;
+  if (!gate_enabled)
+    return 0;
+  if (pthread_mutex_trylock(&gate_lock)) {
+    __atomic_add_fetch(&gate_rt_busy, 1, __ATOMIC_RELAXED);
+    return -1;
+  }
+  if ((ret = gate_refill()) == 0) {
+    if (gate_in_use() >= gate_concurrent) {
+      gate_stats.busy++;
+      ret = -1;
+    } else {
+      __atomic_add_fetch(&gate_rt_active, 1, __ATOMIC_RELEASE);
+    }
+  }
+  pthread_mutex_unlock(&gate_lock);
+  if (ret < 0)
+    return -1;
+  gate_nowait = 1;
+  *start = clock_monotonic_ns();
+  return 0;
+}
+
+/*
+ * Ends a sample started by rtnlgate_try_enter(), without taking the
+ * mutex: its time is charged by whoever takes it next
+ */
+void rtnlgate_try_leave(unsigned long long start_ns)
+{
+  unsigned long long held;
+
+  if (!start_ns)
+    return;
+  held = clock_monotonic_ns() - start_ns;
+  gate_nowait = 0;
+  __atomic_add_fetch(&gate_rt_held_ns, held, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&gate_rt_ops, 1, __ATOMIC_RELAXED);
+  if (held > __atomic_load_n(&gate_rt_max_ns, __ATOMIC_RELAXED))
+    __atomic_store_n(&gate_rt_max_ns, held, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&gate_rt_active, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Waits for a turn at the lock; returns when the operation starts, 0
+ * if the gate is open or the thread holds a slot for its whole sample
+ */
+unsigned long long rtnlgate_enter(void)
+{
+  unsigned long long before, until;
+  struct timespec ts;
+
+  if (!gate_enabled || gate_nowait)
+    return 0;
+  pthread_mutex_lock(&gate_lock);
+  if (gate_in_use() >= gate_concurrent) {
+    before = clock_monotonic_ns();
+    while (gate_in_use() >= gate_concurrent) {
+      until = clock_monotonic_ns() + RTNLGATE_RECHECK_NS;
+      ts.tv_sec = until / NSEC_PER_SEC;
+      ts.tv_nsec = until % NSEC_PER_SEC;
+      pthread_cond_timedwait(&gate_cond, &gate_lock, &ts);
+    }
+    gate_stats.waits++;
+    gate_stats.wait_ns += clock_monotonic_ns() - before;
+  }
+  gate_active++;
+  pthread_mutex_unlock(&gate_lock);
+  return clock_monotonic_ns();
+}
+
+/*
+ * Ends an operation started by rtnlgate_enter(), charging its time
+ */
+void rtnlgate_leave(unsigned long long start_ns)
+{
+  unsigned long long held;
+
+  if (!start_ns)
+    return;
+  held = clock_monotonic_ns() - start_ns;
+  pthread_mutex_lock(&gate_lock);
+  gate_fold();
+  gate_active--;
+  gate_tokens_ns -= held;
+  gate_stats.ops++;
+  gate_stats.held_ns += held;
+  if (held > gate_stats.max_ns)
+    gate_stats.max_ns = held;
+  pthread_cond_signal(&gate_cond);
+  pthread_mutex_unlock(&gate_lock);
+}
+
+/*
+ * Totals so far
+ */
+void rtnlgate_stats(struct rtnlgate_stats *st)
+{
+  pthread_mutex_lock(&gate_lock);
+  gate_fold();
+  *st = gate_stats;
+  pthread_mutex_unlock(&gate_lock);
+  st->elapsed_ns = gate_enabled ? clock_monotonic_ns() - gate_start_ns : 0;
+  st->share = gate_share;
+  st->concurrent = gate_concurrent;
+}
+
+/*
+ * Prints the totals, and the share of the time the lock was held
+ */
+void rtnlgate_print(FILE *fp)
+{
+  struct rtnlgate_stats st;
+
+  if (!gate_enabled)
+    return;
+  rtnlgate_stats(&st);
+  fprintf(fp, "rtnl ops=%llu held_ms=%.1f share_pct=%.3f budget_pct=%.3f "
+              "mean_us=%.1f max_us=%.1f waits=%llu wait_ms=%.1f throttled=%llu busy=%llu\n",
+          st.ops, st.held_ns / 1e6,
+          st.elapsed_ns ? 100.0 * st.held_ns / st.elapsed_ns : 0, st.share * 100,
+          st.ops ? st.held_ns / 1e3 / st.ops : 0, st.max_ns / 1e3,
+          st.waits, st.wait_ns / 1e6, st.throttled, st.busy);
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
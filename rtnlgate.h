@@ -0,0 +1,69 @@
+/*
+    Budget for operations that take the RTNL lock
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef RTNLGATE_H
+#define RTNLGATE_H
+
+#include <stdio.h>
+#include "clock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Unused budget is saved up for at most this long */
+#define RTNLGATE_BURST_NS (1 * NSEC_PER_SEC)
+
+/* How often a thread waiting for a slot looks again */
+#define RTNLGATE_RECHECK_NS (1 * NSEC_PER_MSEC)
+
+/*
+ * Time spent holding the lock, and waiting for a turn at it
+ */
+struct rtnlgate_stats {
+  unsigned long long ops;
+  unsigned long long held_ns;
+  unsigned long long max_ns;
+  unsigned long long waits;     /* had to wait for a slot */
+  unsigned long long wait_ns;
+  unsigned long long throttled; /* samples refused for the budget */
+  unsigned long long busy;      /* real-time samples skipped, not to wait */
+  unsigned long long elapsed_ns;
+  double share;                 /* the budget, a fraction of wall time */
+  int concurrent;
+};
+
+int rtnlgate_init(double share, int concurrent);
+int rtnlgate_admit(void);
+int rtnlgate_try_enter(unsigned long long *start);
+void rtnlgate_try_leave(unsigned long long start_ns);
+unsigned long long rtnlgate_enter(void);
+void rtnlgate_leave(unsigned long long start_ns);
+void rtnlgate_stats(struct rtnlgate_stats *st);
+void rtnlgate_print(FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RTNLGATE_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
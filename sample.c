@@ -0,0 +1,440 @@
+/*
+    Point-in-time wireless snapshot, filled without printing
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "clock.h"
+#include "sample.h"
+#include "trace.h"
+#include "rtnlgate.h"
+
+/*
+ * Tells whether an access point address is a real association,
+ * using the same special values as iw_sawap_ntop()
+ */
+static int ap_is_associated(const struct ether_addr *ap)
+{
+  static const struct ether_addr ether_zero = {{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }};
+  static const struct ether_addr ether_bcast = {{ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }};
+  static const struct ether_addr ether_hack = {{ 0x44, 0x44, 0x44, 0x44, 0x44, 0x44 }};
+
+  return memcmp(ap, &ether_zero, sizeof(*ap)) &&
+         memcmp(ap, &ether_bcast, sizeof(*ap)) &&
+         memcmp(ap, &ether_hack, sizeof(*ap));
+}
+
+/*
+ * Name of a wireless ioctl in a trace
+ */
+static const char *snapshot_ioctl_name(int request)
+{
+  switch (request) {
+    case SIOCGIWESSID: return "SIOCGIWESSID";
+    case SIOCGIWAP: return "SIOCGIWAP";
+    case SIOCGIWRATE: return "SIOCGIWRATE";
+    case SIOCGIWTXPOW: return "SIOCGIWTXPOW";
+    case SIOCGIWSTATS: return "SIOCGIWSTATS";
+  }
+  return "ioctl";
+}
+
+/*
+ * Issues one wireless ioctl on an already open socket, noting when it
+ * read the field.  The kernel holds the RTNL lock for it, so it waits
+ * for a turn under the -L budget.
+ */
+static int snapshot_ioctl(int sock, const char *ifname, int request,
+                          struct iwreq *wrq, struct wireless_snapshot *snap,
+                          unsigned field)
+{
+  unsigned long long before, gate;
+  int ret;
+
+  strncpy(wrq->ifr_name, ifname, IFNAMSIZ);
+  gate = rtnlgate_enter();
+  before = clock_monotonic_ns();
+  ret = ioctl(sock, request, wrq);
+  rtnlgate_leave(gate);
+  snap->field_cost_ns[WS_INDEX(field)] = clock_monotonic_ns() - before;
+  snap->field_ns[WS_INDEX(field)] = before + snap->field_cost_ns[WS_INDEX(field)] / 2;
+  trace_span(snapshot_ioctl_name(request), ifname, before,
+             before + snap->field_cost_ns[WS_INDEX(field)]);
+  return ret;
+}
+
+/*
+ * Drops the read times of fields that are not present and works out
+ * the skew of those that are
+ */
+static void snapshot_settle(struct wireless_snapshot *snap)
+{
+  unsigned long long first = 0, last = 0;
+  int i;
+
+  /* times of fields that failed are dropped with them */
+  for (i = 0; i < WS_FIELDS; i++) {
+    if (!(snap->valid & (1 << i))) {
+      snap->field_ns[i] = 0;
+      continue;
+    }
+    if (!first || snap->field_ns[i] < first)
+      first = snap->field_ns[i];
+    if (snap->field_ns[i] > last)
+      last = snap->field_ns[i];
+  }
+  snap->skew_ns = last - first;
+}
+
+/*
+ * Fills a snapshot with the requested WS_* fields of an interface.
+ * Unlike the wireless_*() printers this shares one socket between all
+ * ioctls and reports nothing; fields that could not be read are left
+ * out of snap->valid.  Returns -1 only if no socket could be opened.
+ */
+int wireless_snapshot(const char *ifname, unsigned fields,
+                      struct wireless_snapshot *snap)
+{
+  int sock;
+
+  if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+    memset(snap, 0, sizeof(*snap));
+    return -1;
+  }
+  wireless_snapshot_sock(sock, ifname, fields, snap);
+  close(sock);
+  return 0;
+}
+
+/*
+ * Like wireless_snapshot(), on a socket the caller keeps open; saves
+ * opening and closing one per snapshot
+ */
+int wireless_snapshot_sock(int sock, const char *ifname, unsigned fields,
+                           struct wireless_snapshot *snap)
+{
+  struct iwreq wrq;
+
+  memset(snap, 0, sizeof(*snap));
+
+  if (fields & WS_ESSID) {
+    memset(&wrq, 0, sizeof(wrq));
+    wrq.u.essid.pointer = snap->essid;
+    wrq.u.essid.length  = IW_ESSID_MAX_SIZE;
+    if (snapshot_ioctl(sock, ifname, SIOCGIWESSID, &wrq, snap, WS_ESSID) >= 0) {
+      if (wrq.u.essid.length > IW_ESSID_MAX_SIZE)
+        wrq.u.essid.length = IW_ESSID_MAX_SIZE;
+      snap->essid[wrq.u.essid.length] = 0;
+      snap->valid |= WS_ESSID;
+    }
+  }
+
+  if (fields & WS_AP) {
+    memset(&wrq, 0, sizeof(wrq));
+    if (snapshot_ioctl(sock, ifname, SIOCGIWAP, &wrq, snap, WS_AP) >= 0) {
+      memcpy(&snap->ap, wrq.u.ap_addr.sa_data, sizeof(snap->ap));
+      snap->associated = ap_is_associated(&snap->ap);
+      snap->valid |= WS_AP;
+    }
+  }
+
+  if (fields & WS_BITRATE) {
+    memset(&wrq, 0, sizeof(wrq));
+    if (snapshot_ioctl(sock, ifname, SIOCGIWRATE, &wrq, snap, WS_BITRATE) >= 0) {
+      snap->bitrate = wrq.u.bitrate.value;
+      snap->valid |= WS_BITRATE;
+    }
+  }
+
+  if (fields & WS_TXPOWER) {
+    memset(&wrq, 0, sizeof(wrq));
+    if (snapshot_ioctl(sock, ifname, SIOCGIWTXPOW, &wrq, snap, WS_TXPOWER) >= 0) {
+      snap->txpower = wrq.u.txpower;
+      snap->valid |= WS_TXPOWER;
+    }
+  }
+
+  if (fields & WS_STATS) {
+    struct iw_statistics stats;
+
+    memset(&wrq, 0, sizeof(wrq));
+    memset(&stats, 0, sizeof(stats));
+    wrq.u.data.pointer = &stats;
+    wrq.u.data.length  = sizeof(struct iw_statistics);
+    wrq.u.data.flags   = 1;
+    if (snapshot_ioctl(sock, ifname, SIOCGIWSTATS, &wrq, snap, WS_STATS) >= 0) {
+      snap->status = stats.status;
+      snap->qual = stats.qual.qual;
+      snap->level = stats.qual.level - 0x100;
+      snap->noise = stats.qual.noise - 0x100;
+      snap->updated = stats.qual.updated;
+      snap->discard_nwid = stats.discard.nwid;
+      snap->discard_code = stats.discard.code;
+      snap->discard_fragment = stats.discard.fragment;
+      snap->discard_retries = stats.discard.retries;
+      snap->discard_misc = stats.discard.misc;
+      snap->miss_beacon = stats.miss.beacon;
+      snap->valid |= WS_STATS;
+    }
+  }
+
+  snapshot_settle(snap);
+  return 0;
+}
+
+/*
+ * Parses one interface line of /proc/net/wireless into the statistics
+ * of a snapshot:
+ *
+ *   wlan0: 0000   54.  -56.  -95.       0      0      0     12      0        0
+ *
+ * A dot after quality, level or noise means it was updated.  Returns
+ * the interface name, terminated in place, or NULL for header lines.
+ */
+static char *proc_parse_line(char *line, struct wireless_snapshot *snap)
+{
+  static const int updated[3] = {
+    IW_QUAL_QUAL_UPDATED, IW_QUAL_LEVEL_UPDATED, IW_QUAL_NOISE_UPDATED
+  };
+  unsigned int *discards[6] = {
+    &snap->discard_nwid, &snap->discard_code, &snap->discard_fragment,
+    &snap->discard_retries, &snap->discard_misc, &snap->miss_beacon
+  };
+  char *name, *colon, *p, *end;
+  long v[3];
+  int i;
+
+  for (name = line; *name == ' '; name++)
+    ;
+  if ((colon = strchr(name, ':')) == NULL)
+    return NULL;
+  *colon = 0;
+
+  snap->status = strtoul(colon + 1, &p, 16);
+  if (p == colon + 1)
+    return NULL;
+  snap->updated = 0;
+  for (i = 0; i < 3; i++) {
+    v[i] = strtol(p, &end, 10);
+    if (end == p)
+      return NULL;
+    if (*end == '.')
+      snap->updated |= updated[i];
+    p = end + (*end != 0);
+  }
+  for (i = 0; i < 6; i++) {
+    *discards[i] = strtoul(p, &end, 10);
+    if (end == p)
+      return NULL;
+    p = end;
+  }
+
+  /* in dBm the kernel has already taken off the 0x100 */
+  snap->qual = v[0];
+  snap->level = v[1];
+  snap->noise = v[2];
+  if (snap->level < 0)
+    snap->updated |= IW_QUAL_DBM;
+  if (snap->noise == -256)
+    snap->updated |= IW_QUAL_NOISE_INVALID;
+  return name;
+}
+
+/*
+ * Reads the statistics of every wireless interface from one listing
+ * in the /proc/net/wireless format, calling fn with a WS_STATS snapshot
+ * for each.  This costs a few reads for all interfaces where the ioctl
+ * costs one call per interface.  Returns the number of interfaces, -1
+ * if the file could not be read.
+ */
+int wireless_proc_stats(const char *path, wireless_proc_fn_t fn, void *arg)
+{
+  char buf[65536];
+  size_t len = 0;
+  struct wireless_snapshot snap;
+  char *line, *nl, *name;
+  unsigned long long read_ns;
+  ssize_t n;
+  int fd, count = 0;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+    return -1;
+
+  memset(&snap, 0, sizeof(snap));
+  snap.valid = WS_STATS;
+  for (;;) {
+    n = read(fd, buf + len, sizeof(buf) - 1 - len);
+    if (n < 0) {
+      close(fd);
+      return -1;
+    }
+    read_ns = clock_monotonic_ns();
+    len += n;
+    buf[len] = 0;
+
+    /* whole lines only; a partial one waits for the next read */
+    for (line = buf; (nl = strchr(line, '\n')) != NULL || (n == 0 && *line);
+         line = nl + 1) {
+      if (nl)
+        *nl = 0;
+      if ((name = proc_parse_line(line, &snap)) != NULL) {
+        snap.field_ns[WS_INDEX(WS_STATS)] = read_ns;
+        fn(name, &snap, arg);
+        count++;
+      }
+      if (!nl) {
+        line += strlen(line);
+        break;
+      }
+    }
+    len -= line - buf;
+    memmove(buf, line, len);
+    if (n == 0)
+      break;
+  }
+
+  close(fd);
+  return count;
+}
+
+/*
+ * Copies the given fields of src, present or not, over those of dst;
+ * the skew is that of the fields dst ends up with
+ */
+void wireless_snapshot_merge(struct wireless_snapshot *dst,
+                             const struct wireless_snapshot *src,
+                             unsigned fields)
+{
+  int i;
+
+  if (fields & WS_ESSID)
+    memcpy(dst->essid, src->essid, sizeof(dst->essid));
+  if (fields & WS_AP) {
+    dst->ap = src->ap;
+    dst->associated = src->associated;
+  }
+  if (fields & WS_BITRATE)
+    dst->bitrate = src->bitrate;
+  if (fields & WS_TXPOWER)
+    dst->txpower = src->txpower;
+  if (fields & WS_STATS) {
+    dst->status = src->status;
+    dst->qual = src->qual;
+    dst->level = src->level;
+    dst->noise = src->noise;
+    dst->updated = src->updated;
+    dst->discard_nwid = src->discard_nwid;
+    dst->discard_code = src->discard_code;
+    dst->discard_fragment = src->discard_fragment;
+    dst->discard_retries = src->discard_retries;
+    dst->discard_misc = src->discard_misc;
+    dst->miss_beacon = src->miss_beacon;
+  }
+  for (i = 0; i < WS_FIELDS; i++) {
+    if (fields & (1 << i)) {
+      dst->field_ns[i] = src->field_ns[i];
+      dst->field_cost_ns[i] = src->field_cost_ns[i];
+    }
+  }
+  dst->valid = (dst->valid & ~fields) | (src->valid & fields);
+  snapshot_settle(dst);
+}
+
+/*
+ * Time between the reads of two fields (WS_* bits), -1 unless both
+ * were read
+ */
+long long wireless_snapshot_skew(const struct wireless_snapshot *snap,
+                                 unsigned a, unsigned b)
+{
+  unsigned long long ta = snap->field_ns[WS_INDEX(a)];
+  unsigned long long tb = snap->field_ns[WS_INDEX(b)];
+
+  if ((snap->valid & a) != a || (snap->valid & b) != b)
+    return -1;
+  return ta > tb ? ta - tb : tb - ta;
+}
+
+/*
+ * Counts one skew
+ */
+void skew_hist_add(struct skew_hist *h, unsigned long long ns)
+{
+  unsigned long long us = ns / NSEC_PER_USEC;
+  int i = 0;
+
+  while (i < SKEW_BUCKETS - 1 && us >= (1ULL << i))
+    i++;
+  h->buckets[i]++;
+  h->count++;
+  h->sum_ns += ns;
+  if (ns > h->max_ns)
+    h->max_ns = ns;
+}
+
+/*
+ * Upper bound in microseconds of the bucket holding quantile q, capped
+ * at the largest skew seen
+ */
+unsigned long long skew_hist_quantile(const struct skew_hist *h, double q)
+{
+  unsigned long long seen = 0, rank = q * h->count;
+  unsigned long long max_us = (h->max_ns + NSEC_PER_USEC - 1) / NSEC_PER_USEC;
+  int i;
+
+  for (i = 0; i < SKEW_BUCKETS - 1; i++) {
+    seen += h->buckets[i];
+    if (seen > rank)
+      return (1ULL << i) < max_us ? (1ULL << i) : max_us;
+  }
+  return max_us;
+}
+
+/*
+ * Prints a histogram as one line of key=value pairs; buckets lists the
+ * counts up to the last non-empty bucket
+ */
+void skew_hist_print(const struct skew_hist *h, const char *name, FILE *f)
+{
+  int i, last = 0;
+
+  for (i = 0; i < SKEW_BUCKETS; i++)
+    if (h->buckets[i])
+      last = i;
+
+  fprintf(f, "skew fields=%s count=%llu", name, h->count);
+  if (h->count)
+    fprintf(f, " mean_us=%.1f p50_us=%llu p99_us=%llu max_us=%.1f",
+            (double)h->sum_ns / h->count / NSEC_PER_USEC,
+            skew_hist_quantile(h, 0.5), skew_hist_quantile(h, 0.99),
+            (double)h->max_ns / NSEC_PER_USEC);
+  fprintf(f, " buckets=");
+  for (i = 0; i <= last; i++)
+    fprintf(f, "%s%llu", i ? "," : "", h->buckets[i]);
+  fprintf(f, "\n");
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,122 @@
+/*
+    Point-in-time wireless snapshot, filled without printing
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdio.h>
+#include <net/ethernet.h>
+#include <linux/wireless.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Snapshot field bits, set in wireless_snapshot.valid when fetched */
+#define WS_ESSID    0x01
+#define WS_AP       0x02
+#define WS_BITRATE  0x04
+#define WS_TXPOWER  0x08
+#define WS_STATS    0x10
+#define WS_ALL      0x1f
+
+/* Fields, and the index of a field bit in wireless_snapshot.field_ns[] */
+#define WS_FIELDS   5
+#define WS_INDEX(bit) __builtin_ctz(bit)
+
+/* Skew histogram buckets: bucket i counts skews under 2^i us, the last
+   everything longer */
+#define SKEW_BUCKETS 24
+
+/*
+ * Everything wireless_info() prints, captured in one pass so the
+ * sampler can work with values instead of text
+ */
+struct wireless_snapshot {
+  unsigned valid;
+
+  /* CLOCK_MONOTONIC midpoint of the ioctl that read each field, by
+     WS_INDEX(); the fields are read one after the other */
+  unsigned long long field_ns[WS_FIELDS];
+  unsigned long long field_cost_ns[WS_FIELDS];  /* how long each read took,
+                                                   failed or not */
+  unsigned long long skew_ns;   /* first to last field read */
+
+  char essid[IW_ESSID_MAX_SIZE + 1];
+  struct ether_addr ap;
+  int associated;
+
+  int bitrate;                  /* b/s */
+  struct iw_param txpower;      /* raw, see iw_print_txpower() */
+
+  /* from SIOCGIWSTATS */
+  int status;
+  int qual;
+  int level;                    /* dBm */
+  int noise;                    /* dBm */
+  int updated;
+  unsigned int discard_nwid;
+  unsigned int discard_code;
+  unsigned int discard_fragment;
+  unsigned int discard_retries;
+  unsigned int discard_misc;
+  unsigned int miss_beacon;
+};
+
+/*
+ * Distribution of acquisition skews, in power of two microsecond buckets
+ */
+struct skew_hist {
+  unsigned long long count;
+  unsigned long long sum_ns;
+  unsigned long long max_ns;
+  unsigned long long buckets[SKEW_BUCKETS];
+};
+
+/* Statistics of every wireless interface, as text */
+#define WIRELESS_PROC_PATH "/proc/net/wireless"
+
+typedef void (*wireless_proc_fn_t)(const char *ifname,
+                                   const struct wireless_snapshot *snap,
+                                   void *arg);
+
+int wireless_snapshot(const char *ifname, unsigned fields,
+                      struct wireless_snapshot *snap);
+int wireless_snapshot_sock(int sock, const char *ifname, unsigned fields,
+                           struct wireless_snapshot *snap);
+int wireless_proc_stats(const char *path, wireless_proc_fn_t fn, void *arg);
+long long wireless_snapshot_skew(const struct wireless_snapshot *snap,
+                                 unsigned a, unsigned b);
+void wireless_snapshot_merge(struct wireless_snapshot *dst,
+                             const struct wireless_snapshot *src,
+                             unsigned fields);
+
+void skew_hist_add(struct skew_hist *h, unsigned long long ns);
+unsigned long long skew_hist_quantile(const struct skew_hist *h, double q);
+void skew_hist_print(const struct skew_hist *h, const char *name, FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SAMPLE_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
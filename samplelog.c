@@ -0,0 +1,658 @@
+/*
+    Binary sample log written by the monitor
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * The monitor appends every sample and link event as a fixed-size
+ * record, so a log can be mapped and split at any record boundary for
+ * offline analysis.  Records are buffered and written once per
+ * dispatch, like the journal.
+ *
+ * Every SAMPLELOG_KEYFRAME_NS or SAMPLELOG_KEYFRAME_RECORDS the writer
+ * also emits a keyframe, one SAMPLELOG_STATE record per live interface
+ * holding its last sample and operstate, and appends an entry per
+ * interface to the index file beside the log.  A reader looking for an
+ * interface's state at some time binary searches the index for the last
+ * keyframe before it and replays only the records since, instead of the
+ * whole log.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <net/if.h>
+
+#include "clock.h"
+#include "sample.h"
+#include "samplelog.h"
+#include "mem.h"
+
+/* Records buffered at first; the buffer grows up to SAMPLELOG_BATCH_MAX */
+#define SAMPLELOG_BATCH     64
+#define SAMPLELOG_BATCH_MAX 65536
+
+typedef char samplelog_record_is_64_bytes[sizeof(struct samplelog_record) == 64 ? 1 : -1];
+
+struct samplelog {
+  int fd;
+  int index_fd;                 /* -1 if the log has no index */
+  struct samplelog_record *buf;
+  size_t count;
+  size_t size;
+  uint64_t records;             /* in the file and buffered */
+  unsigned long long dropped;
+
+  /* Last state of each interface, open addressing on the name */
+  struct samplelog_record *state;
+  size_t state_size;            /* power of two */
+  size_t state_used;
+  uint64_t keyframe_ns;
+  uint64_t keyframe_records;
+  int keyframing;
+};
+
+/*
+ * Checks that a header describes records this build can read
+ */
+static int samplelog_header_ok(const struct samplelog_header *h)
+{
+  return memcmp(h->magic, SAMPLELOG_MAGIC, sizeof(h->magic)) == 0 &&
+         h->version == SAMPLELOG_VERSION &&
+         h->record_size == sizeof(struct samplelog_record) &&
+         h->byte_order == 0x01020304;
+}
+
+/*
+ * Checks an index header the same way
+ */
+static int samplelog_index_header_ok(const struct samplelog_index_header *h)
+{
+  return memcmp(h->magic, SAMPLELOG_INDEX_MAGIC, sizeof(h->magic)) == 0 &&
+         h->version == SAMPLELOG_VERSION &&
+         h->entry_size == sizeof(struct samplelog_index_entry) &&
+         h->byte_order == 0x01020304;
+}
+
+/*
+ * Opens the index of the log at path for appending.  Without an index
+ * the log is still complete, only slower to seek, so failures are
+ * reported and otherwise ignored.
+ */
+static int samplelog_index_open(const char *path)
+{
+  struct samplelog_index_header h;
+  char index_path[PATH_MAX];
+  struct stat st;
+  int fd;
+
+  snprintf(index_path, sizeof(index_path), "%s%s", path, SAMPLELOG_INDEX_SUFFIX);
+  if ((fd = open(index_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0 ||
+      fstat(fd, &st) < 0) {
+    perror(index_path);
+    goto fail;
+  }
+
+  if (st.st_size == 0) {
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SAMPLELOG_INDEX_MAGIC, sizeof(h.magic));
+    h.version = SAMPLELOG_VERSION;
+    h.entry_size = sizeof(struct samplelog_index_entry);
+    h.byte_order = 0x01020304;
+    if (write(fd, &h, sizeof(h)) != sizeof(h)) {
+      perror(index_path);
+      goto fail;
+    }
+    return fd;
+  }
+
+  if (pread(fd, &h, sizeof(h), 0) != sizeof(h) || !samplelog_index_header_ok(&h)) {
+    fprintf(stderr, "%s: not a sample log index of this version\n", index_path);
+    goto fail;
+  }
+  if ((st.st_size - sizeof(h)) % sizeof(struct samplelog_index_entry))
+    ftruncate(fd, st.st_size - (st.st_size - sizeof(h)) %
+                               sizeof(struct samplelog_index_entry));
+  return fd;
+
+fail:
+  if (fd >= 0)
+    close(fd);
+  return -1;
+}
+
+/*
+ * Opens a log for appending, creating it with a header if it is new.
+ * A record torn by a crash at the end of an existing log is cut off.
+ */
+struct samplelog *samplelog_open(const char *path)
+{
+  struct samplelog *log;
+  struct samplelog_header h;
+  struct stat st;
+
+  if ((log = mem_alloc(MEM_SAMPLELOG, sizeof(*log))) == NULL ||
+      (log->buf = mem_alloc(MEM_SAMPLELOG, SAMPLELOG_BATCH * sizeof(*log->buf))) == NULL) {
+    perror("samplelog");
+    mem_free(log);
+    return NULL;
+  }
+  log->size = SAMPLELOG_BATCH;
+  if ((log->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0 ||
+      fstat(log->fd, &st) < 0) {
+    perror(path);
+    goto fail;
+  }
+
+  if (st.st_size == 0) {
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SAMPLELOG_MAGIC, sizeof(h.magic));
+    h.version = SAMPLELOG_VERSION;
+    h.record_size = sizeof(struct samplelog_record);
+    h.byte_order = 0x01020304;
+    h.start_ns = clock_realtime_ns();
+    if (write(log->fd, &h, sizeof(h)) != sizeof(h)) {
+      perror(path);
+      goto fail;
+    }
+    log->index_fd = samplelog_index_open(path);
+    return log;
+  }
+
+  if (pread(log->fd, &h, sizeof(h), 0) != sizeof(h) || !samplelog_header_ok(&h)) {
+    fprintf(stderr, "%s: not a sample log of this version\n", path);
+    goto fail;
+  }
+  if ((st.st_size - sizeof(h)) % sizeof(struct samplelog_record))
+    ftruncate(log->fd, st.st_size - (st.st_size - sizeof(h)) %
+                                    sizeof(struct samplelog_record));
+  log->records = (st.st_size - sizeof(h)) / sizeof(struct samplelog_record);
+  log->index_fd = samplelog_index_open(path);
+  return log;
+
+fail:
+  if (log->fd >= 0)
+    close(log->fd);
+  mem_free(log->buf);
+  mem_free(log);
+  return NULL;
+}
+
+/*
+ * Writes what is buffered and closes the log
+ */
+void samplelog_close(struct samplelog *log)
+{
+  if (!log)
+    return;
+  samplelog_flush(log);
+  if (log->dropped)
+    fprintf(stderr, "sample log: %llu records dropped\n", log->dropped);
+  close(log->fd);
+  if (log->index_fd >= 0)
+    close(log->index_fd);
+  mem_free(log->state);
+  mem_free(log->buf);
+  mem_free(log);
+}
+
+/*
+ * Folds a record into the state of its interface: samples replace the
+ * measured fields, link events the operstate, keyframes everything
+ */
+static void samplelog_apply(struct samplelog_record *state,
+                            const struct samplelog_record *r)
+{
+  uint8_t operstate = state->operstate;
+
+  switch (r->type) {
+    case SAMPLELOG_SAMPLE:
+      *state = *r;
+      state->operstate = operstate;
+      break;
+    case SAMPLELOG_LINK:
+      memcpy(state->ifname, r->ifname, sizeof(state->ifname));
+      state->time_ns = r->time_ns;
+      state->operstate = r->operstate;
+      break;
+    case SAMPLELOG_DELLINK:
+      state->time_ns = r->time_ns;
+      state->type = SAMPLELOG_DELLINK;
+      return;
+    case SAMPLELOG_STATE:
+      *state = *r;
+      return;
+    default:
+      return;
+  }
+  if (r->ifindex)
+    state->ifindex = r->ifindex;
+  state->type = SAMPLELOG_STATE;
+}
+
+/*
+ * FNV-1a over an interface name
+ */
+static size_t samplelog_hash(const char *ifname)
+{
+  uint64_t h = 14695981039346656037ULL;
+  size_t i;
+
+  for (i = 0; i < IFNAMSIZ && ifname[i]; i++)
+    h = (h ^ (unsigned char)ifname[i]) * 1099511628211ULL;
+  return h;
+}
+
+/*
+ * Slot of an interface's state, or the free slot it would take
+ */
+static struct samplelog_record *samplelog_slot(struct samplelog_record *state,
+                                               size_t size, const char *ifname)
+{
+  size_t i = samplelog_hash(ifname) & (size - 1);
+
+  while (state[i].type && strncmp(state[i].ifname, ifname, IFNAMSIZ) != 0)
+    i = (i + 1) & (size - 1);
+  return &state[i];
+}
+
+/*
+ * Updates the state kept for keyframes with a record just logged
+ */
+static void samplelog_track(struct samplelog *log, const struct samplelog_record *r)
+{
+  struct samplelog_record *slot;
+  size_t i;
+
+  if (log->state_used * 2 >= log->state_size) {
+    size_t size = log->state_size ? log->state_size * 2 : 64;
+    struct samplelog_record *state = mem_alloc(MEM_SAMPLELOG, size * sizeof(*state));
+
+    if (state == NULL)
+      return;
+    for (i = 0; i < log->state_size; i++)
+      if (log->state[i].type)
+        *samplelog_slot(state, size, log->state[i].ifname) = log->state[i];
+    mem_free(log->state);
+    log->state = state;
+    log->state_size = size;
+  }
+
+  slot = samplelog_slot(log->state, log->state_size, r->ifname);
+  if (!slot->type) {
+    if (r->type == SAMPLELOG_DELLINK)
+      return;
+    log->state_used++;
+  }
+  samplelog_apply(slot, r);
+}
+
+static struct samplelog_record *samplelog_next(struct samplelog *log);
+
+/*
+ * Writes a keyframe of every interface not deleted, and indexes it
+ */
+static void samplelog_keyframe(struct samplelog *log, uint64_t now)
+{
+  struct samplelog_index_entry *entries = NULL;
+  size_t i, n = 0;
+
+  log->keyframing = 1;
+  log->keyframe_ns = now;
+  log->keyframe_records = log->records;
+  if (log->index_fd >= 0 && log->state_used)
+    entries = mem_alloc(MEM_SAMPLELOG, log->state_used * sizeof(*entries));
+
+  for (i = 0; i < log->state_size; i++) {
+    struct samplelog_record *rec;
+
+    if (log->state[i].type != SAMPLELOG_STATE)
+      continue;
+    if (entries) {
+      entries[n].time_ns = now;
+      entries[n].record = log->records;
+      entries[n].ifindex = log->state[i].ifindex;
+      n++;
+    }
+    rec = samplelog_next(log);
+    *rec = log->state[i];
+    rec->time_ns = now;
+  }
+  log->keyframing = 0;
+
+  if (n && write(log->index_fd, entries, n * sizeof(*entries)) !=
+           (ssize_t)(n * sizeof(*entries))) {
+    perror("sample log index");
+    close(log->index_fd);
+    log->index_fd = -1;
+  }
+  mem_free(entries);
+}
+
+/*
+ * Next free record, after a keyframe if one is due.  The buffer grows
+ * rather than being written early so that a batch handed to the loop is
+ * never overtaken by a synchronous write, which would leave the index
+ * pointing at the wrong records.
+ */
+static struct samplelog_record *samplelog_next(struct samplelog *log)
+{
+  struct samplelog_record *rec;
+  uint64_t now = clock_realtime_ns();
+
+  if (!log->keyframing &&
+      (now - log->keyframe_ns >= SAMPLELOG_KEYFRAME_NS ||
+       log->records - log->keyframe_records >= SAMPLELOG_KEYFRAME_RECORDS))
+    samplelog_keyframe(log, now);
+
+  if (log->count == log->size) {
+    struct samplelog_record *buf = NULL;
+
+    if (log->size < SAMPLELOG_BATCH_MAX)
+      buf = mem_realloc(MEM_SAMPLELOG, log->buf, log->size * 2 * sizeof(*buf));
+    if (buf) {
+      log->buf = buf;
+      log->size *= 2;
+    } else {
+      samplelog_flush(log);
+    }
+  }
+  rec = &log->buf[log->count++];
+  log->records++;
+  memset(rec, 0, sizeof(*rec));
+  rec->time_ns = now;
+  return rec;
+}
+
+/*
+ * Fills in a SAMPLE record from a snapshot, leaving its time alone
+ */
+void samplelog_fill(struct samplelog_record *rec, const char *ifname, int ifindex,
+                    const struct wireless_snapshot *snap)
+{
+  strncpy(rec->ifname, ifname, sizeof(rec->ifname) - 1);
+  rec->type = SAMPLELOG_SAMPLE;
+  rec->ifindex = ifindex;
+  rec->valid = snap->valid;
+  memcpy(rec->ap, &snap->ap, sizeof(rec->ap));
+  rec->associated = snap->associated;
+  rec->qual = snap->qual;
+  rec->level = snap->level;
+  rec->noise = snap->noise;
+  if ((snap->updated & IW_QUAL_LEVEL_INVALID))
+    rec->valid &= ~WS_STATS;
+  rec->bitrate_kbps = snap->bitrate / 1000;
+  rec->retries = snap->discard_retries;
+  rec->skew_us = snap->skew_ns / NSEC_PER_USEC;
+}
+
+/*
+ * Records a snapshot
+ */
+void samplelog_sample(struct samplelog *log, const char *ifname, int ifindex,
+                      const struct wireless_snapshot *snap)
+{
+  struct samplelog_record *rec = samplelog_next(log);
+
+  samplelog_fill(rec, ifname, ifindex, snap);
+  samplelog_track(log, rec);
+}
+
+/*
+ * Name of a SAMPLELOG_TRIGGER_* reason as printed
+ */
+const char *samplelog_trigger_name(int trigger)
+{
+  static const char *names[] = { "none", "signal", "ap", "link", "alert" };
+
+  if (trigger < 0 || trigger >= (int)(sizeof(names) / sizeof(names[0])))
+    return "unknown";
+  return names[trigger];
+}
+
+/*
+ * Appends records made elsewhere, e.g. a flight recorder dump, keeping
+ * their times.  They do not change the state keyframes are made of.
+ */
+void samplelog_append(struct samplelog *log, const struct samplelog_record *recs,
+                      size_t count)
+{
+  size_t i;
+
+  for (i = 0; i < count; i++)
+    *samplelog_next(log) = recs[i];
+}
+
+/*
+ * Records a link message
+ */
+void samplelog_link(struct samplelog *log, const char *ifname, int ifindex,
+                    int type, int operstate)
+{
+  struct samplelog_record *rec = samplelog_next(log);
+
+  strncpy(rec->ifname, ifname, sizeof(rec->ifname) - 1);
+  rec->type = type;
+  rec->ifindex = ifindex;
+  rec->operstate = operstate;
+  samplelog_track(log, rec);
+}
+
+/*
+ * Writes the buffered records
+ */
+int samplelog_flush(struct samplelog *log)
+{
+  size_t len = log->count * sizeof(log->buf[0]);
+  ssize_t n;
+
+  if (!log->count)
+    return 0;
+  do {
+    n = write(log->fd, log->buf, len);
+  } while (n < 0 && errno == EINTR);
+  log->count = 0;
+
+  /* O_APPEND writes to a regular file are whole unless the disk is full */
+  if (n != (ssize_t)len) {
+    log->dropped += len / sizeof(log->buf[0]);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Hands the buffered records to write_fn, e.g. to write them through
+ * the loop; if it refuses they are written here
+ */
+int samplelog_drain(struct samplelog *log, samplelog_write_t write_fn, void *arg)
+{
+  if (!log->count)
+    return 0;
+  if (write_fn(log->fd, log->buf, log->count * sizeof(log->buf[0]), arg) < 0)
+    return samplelog_flush(log);
+  log->count = 0;
+  return 0;
+}
+
+/*
+ * Maps a log read-only; returns its records and their number, and the
+ * mapping for munmap().  NULL if the file is not a readable log.
+ */
+const struct samplelog_record *samplelog_map(const char *path, size_t *count,
+                                             void **map, size_t *map_len)
+{
+  struct stat st;
+  void *p;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    if (fd >= 0)
+      close(fd);
+    return NULL;
+  }
+  if ((size_t)st.st_size < sizeof(struct samplelog_header)) {
+    fprintf(stderr, "%s: not a sample log\n", path);
+    close(fd);
+    return NULL;
+  }
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    perror(path);
+    return NULL;
+  }
+  if (!samplelog_header_ok(p)) {
+    fprintf(stderr, "%s: not a sample log of this version\n", path);
+    munmap(p, st.st_size);
+    return NULL;
+  }
+  madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+  *map = p;
+  *map_len = st.st_size;
+  *count = (st.st_size - sizeof(struct samplelog_header)) /
+           sizeof(struct samplelog_record);
+  return (const struct samplelog_record *)((char *)p + sizeof(struct samplelog_header));
+}
+
+/*
+ * Maps the index of the log at path; NULL with no complaint if there is
+ * none, as logs can be read without one
+ */
+const struct samplelog_index_entry *samplelog_index_map(const char *path, size_t *count,
+                                                        void **map, size_t *map_len)
+{
+  char index_path[PATH_MAX];
+  struct stat st;
+  void *p;
+  int fd;
+
+  *count = 0;
+  snprintf(index_path, sizeof(index_path), "%s%s", path, SAMPLELOG_INDEX_SUFFIX);
+  if ((fd = open(index_path, O_RDONLY | O_CLOEXEC)) < 0)
+    return NULL;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size <= sizeof(struct samplelog_index_header)) {
+    close(fd);
+    return NULL;
+  }
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    perror(index_path);
+    return NULL;
+  }
+  if (!samplelog_index_header_ok(p)) {
+    fprintf(stderr, "%s: not a sample log index of this version\n", index_path);
+    munmap(p, st.st_size);
+    return NULL;
+  }
+
+  *map = p;
+  *map_len = st.st_size;
+  *count = (st.st_size - sizeof(struct samplelog_index_header)) /
+           sizeof(struct samplelog_index_entry);
+  return (const struct samplelog_index_entry *)((char *)p +
+                                                sizeof(struct samplelog_index_header));
+}
+
+/*
+ * Whether an index entry points at the keyframe record it describes;
+ * entries written ahead of a log that was then cut short do not
+ */
+static int samplelog_entry_ok(const struct samplelog_record *recs, size_t count,
+                              const struct samplelog_index_entry *e)
+{
+  return e->record < count && recs[e->record].type == SAMPLELOG_STATE &&
+         recs[e->record].time_ns == e->time_ns;
+}
+
+/*
+ * Reconstructs the state of ifname at time_ns: finds the last keyframe
+ * at or before it in the index, then replays the records from there.
+ * Returns the number of records replayed, or -1 if the interface had no
+ * state by then.  Without an index the replay starts at the beginning.
+ */
+long samplelog_state_at(const struct samplelog_record *recs, size_t count,
+                        const struct samplelog_index_entry *index, size_t entries,
+                        const char *ifname, uint64_t time_ns,
+                        struct samplelog_record *state)
+{
+  size_t lo = 0, hi = entries, start = 0, i;
+  uint32_t ifindex = 0;
+  int keyframe = 0, found = 0;
+
+  memset(state, 0, sizeof(*state));
+
+  /* lo is the number of entries at or before time_ns */
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (index[mid].time_ns <= time_ns)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  /* Walk back a keyframe at a time until one made it into the log */
+  while (lo > 0 && !keyframe) {
+    uint64_t keyframe_ns = index[lo - 1].time_ns;
+
+    for (; lo > 0 && index[lo - 1].time_ns == keyframe_ns; lo--) {
+      const struct samplelog_index_entry *e = &index[lo - 1];
+      const struct samplelog_record *r = &recs[e->record];
+
+      if (!samplelog_entry_ok(recs, count, e))
+        continue;
+      if (!keyframe || e->record < start)
+        start = e->record;
+      keyframe = 1;
+      if (strncmp(r->ifname, ifname, IFNAMSIZ) == 0) {
+        *state = *r;
+        ifindex = r->ifindex;
+        found = 1;
+      }
+    }
+  }
+
+  /* Interfaces are followed by index once known, across renames */
+  for (i = start; i < count && recs[i].time_ns <= time_ns; i++) {
+    const struct samplelog_record *r = &recs[i];
+
+    if (r->type == SAMPLELOG_STATE)
+      continue;
+    if (ifindex && r->ifindex ? r->ifindex != ifindex :
+                                strncmp(r->ifname, ifname, IFNAMSIZ) != 0)
+      continue;
+    samplelog_apply(state, r);
+    if (r->ifindex)
+      ifindex = r->ifindex;
+    found = 1;
+  }
+  return found ? (long)(i - start) : -1;
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
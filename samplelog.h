@@ -0,0 +1,149 @@
+/*
+    Binary sample log written by the monitor
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef SAMPLELOG_H
+#define SAMPLELOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "clock.h"
+
+#define SAMPLELOG_MAGIC   "WISAMPL\n"
+#define SAMPLELOG_VERSION 1
+
+/* Record types */
+#define SAMPLELOG_SAMPLE  1
+#define SAMPLELOG_LINK    2     /* RTM_NEWLINK */
+#define SAMPLELOG_DELLINK 3
+#define SAMPLELOG_STATE   4     /* keyframe: last known state of one interface */
+#define SAMPLELOG_TRIGGER 5     /* flight recorder dump follows */
+#define SAMPLELOG_FLIGHT  6     /* sample from a flight recorder dump */
+
+/* What set off a flight recorder dump, in a TRIGGER record */
+#define SAMPLELOG_TRIGGER_SIGNAL 1  /* level fell sharply */
+#define SAMPLELOG_TRIGGER_AP     2  /* association or access point changed */
+#define SAMPLELOG_TRIGGER_LINK   3  /* link left IF_OPER_UP or was deleted */
+#define SAMPLELOG_TRIGGER_ALERT  4  /* a shift detector or rule fired */
+
+/*
+ * A keyframe is written when this much time or this many records have
+ * gone by since the last one, which bounds the replay of a seek
+ */
+#define SAMPLELOG_KEYFRAME_NS      (60ULL * NSEC_PER_SEC)
+#define SAMPLELOG_KEYFRAME_RECORDS 16384
+
+/* The index sits next to the log, at the log's path plus this */
+#define SAMPLELOG_INDEX_SUFFIX ".idx"
+#define SAMPLELOG_INDEX_MAGIC  "WISINDX\n"
+
+/*
+ * File header; records follow back to back.  Everything is in host
+ * byte order, which the header's byte_order field tells readers.
+ */
+struct samplelog_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t byte_order;          /* 0x01020304 as written */
+  uint32_t reserved;
+  uint64_t start_ns;            /* CLOCK_REALTIME when the log was created */
+};
+
+/*
+ * One sample or link event, 64 bytes.  valid holds the WS_* bits of
+ * the snapshot fields present.  A keyframe record carries both the
+ * last sample and the last operstate of its interface.
+ *
+ * A flight recorder dump is a TRIGGER record at the time of the
+ * trigger, then the interface's FLIGHT records from before and after
+ * it.  These carry the time they were taken, so they are out of order
+ * with the records around them, and replaying state skips them.
+ */
+struct samplelog_record {
+  uint64_t time_ns;             /* CLOCK_REALTIME */
+  char ifname[16];
+  uint8_t type;
+  uint8_t operstate;            /* link events, IF_OPER_* */
+  uint16_t valid;
+  uint8_t ap[6];
+  uint8_t qual;
+  uint8_t associated;
+  int16_t level;                /* dBm */
+  int16_t noise;                /* dBm */
+  uint32_t bitrate_kbps;
+  uint32_t retries;
+  uint32_t skew_us;
+  uint32_t ifindex;
+  uint8_t trigger;              /* TRIGGER records, SAMPLELOG_TRIGGER_* */
+  uint8_t reserved[7];
+};
+
+/*
+ * Index file: a header like the log's, then one entry per interface of
+ * every keyframe, in the order they were written and so by time
+ */
+struct samplelog_index_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_size;
+  uint32_t byte_order;
+  uint32_t reserved;
+};
+
+struct samplelog_index_entry {
+  uint64_t time_ns;             /* of the keyframe */
+  uint64_t record;              /* number of the interface's keyframe record */
+  uint32_t ifindex;
+  uint32_t reserved;
+};
+
+struct samplelog;
+struct wireless_snapshot;
+
+typedef int (*samplelog_write_t)(int fd, const void *data, size_t len, void *arg);
+
+struct samplelog *samplelog_open(const char *path);
+void samplelog_close(struct samplelog *log);
+void samplelog_sample(struct samplelog *log, const char *ifname, int ifindex,
+                      const struct wireless_snapshot *snap);
+void samplelog_fill(struct samplelog_record *rec, const char *ifname, int ifindex,
+                    const struct wireless_snapshot *snap);
+const char *samplelog_trigger_name(int trigger);
+void samplelog_append(struct samplelog *log, const struct samplelog_record *recs,
+                      size_t count);
+void samplelog_link(struct samplelog *log, const char *ifname, int ifindex,
+                    int type, int operstate);
+int samplelog_flush(struct samplelog *log);
+int samplelog_drain(struct samplelog *log, samplelog_write_t write_fn, void *arg);
+
+const struct samplelog_record *samplelog_map(const char *path, size_t *count,
+                                             void **map, size_t *map_len);
+const struct samplelog_index_entry *samplelog_index_map(const char *path, size_t *count,
+                                                        void **map, size_t *map_len);
+long samplelog_state_at(const struct samplelog_record *recs, size_t count,
+                        const struct samplelog_index_entry *index, size_t entries,
+                        const char *ifname, uint64_t time_ns,
+                        struct samplelog_record *state);
+
+#endif /* SAMPLELOG_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
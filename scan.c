@@ -0,0 +1,269 @@
+/*
+    Access point scanning, blocking and on the event loop
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "clock.h"
+#include "mem.h"
+#include "scan.h"
+
+/* SIOCGIWSCAN's length field is 16 bits */
+#define SCAN_MAX_BUFFER 0xFFFF
+
+/*
+ * Asks the driver to start a scan (needs CAP_NET_ADMIN)
+ */
+int wireless_scan_trigger(const char *ifname)
+{
+  struct iwreq wrq;
+  int sock, ret;
+
+  if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+    return -1;
+
+  memset(&wrq, 0, sizeof(wrq));
+  strncpy(wrq.ifr_name, ifname, IFNAMSIZ);
+  ret = ioctl(sock, SIOCSIWSCAN, &wrq);
+  close(sock);
+  return ret;
+}
+
+/*
+ * Appends an empty cell, returns NULL if out of memory or over the
+ * scan cap
+ */
+static struct wireless_bss *scan_new_cell(struct wireless_bss **bss, int *count)
+{
+  struct wireless_bss *cells = mem_realloc(MEM_SCAN, *bss, (*count + 1) * sizeof(**bss));
+
+  if (cells == NULL)
+    return NULL;
+  *bss = cells;
+  memset(&cells[*count], 0, sizeof(cells[0]));
+  return &cells[(*count)++];
+}
+
+/*
+ * Walks the event stream of a scan result.  Events use the kernel's
+ * native layout: a header of IW_EV_LCP_LEN bytes, then the payload,
+ * with point events carrying length/flags before their data.
+ */
+static int scan_parse(const char *buf, int len, struct wireless_bss **bss,
+                      int *count)
+{
+  const char *pos = buf, *end = buf + len;
+  struct wireless_bss *cell = NULL;
+
+  *bss = NULL;
+  *count = 0;
+
+  while (pos + IW_EV_LCP_LEN <= end) {
+    struct iw_event iwe;
+    const char *data = pos + IW_EV_LCP_LEN;
+
+    memcpy(&iwe, pos, IW_EV_LCP_LEN);
+    if (iwe.len <= IW_EV_LCP_LEN || pos + iwe.len > end)
+      break;
+
+    switch (iwe.cmd) {
+      case SIOCGIWAP:
+        if (iwe.len < IW_EV_ADDR_LEN)
+          break;
+        if ((cell = scan_new_cell(bss, count)) == NULL) {
+          mem_free(*bss);
+          *bss = NULL;
+          errno = ENOMEM;
+          return -1;
+        }
+        memcpy(&cell->bssid,
+               data + offsetof(struct sockaddr, sa_data), sizeof(cell->bssid));
+        break;
+      case SIOCGIWESSID:
+        if (cell && iwe.len >= IW_EV_POINT_LEN) {
+          __u16 elen;
+
+          memcpy(&elen, data, sizeof(elen));
+          if (elen > IW_ESSID_MAX_SIZE)
+            elen = IW_ESSID_MAX_SIZE;
+          if (elen > iwe.len - IW_EV_POINT_LEN)
+            elen = iwe.len - IW_EV_POINT_LEN;
+          memcpy(cell->essid, pos + IW_EV_POINT_LEN, elen);
+          cell->essid[elen] = 0;
+        }
+        break;
+      case SIOCGIWFREQ:
+        if (cell && iwe.len >= IW_EV_FREQ_LEN) {
+          struct iw_freq f;
+          double freq;
+
+          memcpy(&f, data, sizeof(f));
+          for (freq = f.m; f.e > 0; f.e--)
+            freq *= 10;
+          /* drivers may send both channel and frequency, prefer the latter */
+          if (freq >= 1e6)
+            cell->freq = freq / 1e6;
+          else if (!cell->freq)
+            cell->freq = freq;
+        }
+        break;
+      case IWEVQUAL:
+        if (cell && iwe.len >= IW_EV_QUAL_LEN) {
+          struct iw_quality q;
+
+          memcpy(&q, data, sizeof(q));
+          cell->qual = q.qual;
+          cell->level = q.level - 0x100;
+        }
+        break;
+    }
+    pos += iwe.len;
+  }
+  return 0;
+}
+
+/*
+ * Reads the result of the last scan.  Returns -1 with errno EAGAIN
+ * while the scan is still running.  The buffer and the cells are
+ * accounted to MEM_SCAN and, if given, to owner.
+ */
+int wireless_scan_results(const char *ifname, struct mem_owner *owner,
+                          struct wireless_bss **bss, int *count)
+{
+  struct iwreq wrq;
+  int size = IW_SCAN_MAX_DATA;
+  char *buf = NULL;
+  int sock, ret;
+
+  if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+    return -1;
+
+  for (;;) {
+    char *nbuf = mem_realloc(MEM_SCAN, buf, size);
+
+    if (nbuf == NULL) {
+      errno = ENOMEM;
+      ret = -1;
+      break;
+    }
+    if (!buf)
+      mem_assign(nbuf, owner);
+    buf = nbuf;
+
+    memset(&wrq, 0, sizeof(wrq));
+    strncpy(wrq.ifr_name, ifname, IFNAMSIZ);
+    wrq.u.data.pointer = buf;
+    wrq.u.data.length = size;
+    if ((ret = ioctl(sock, SIOCGIWSCAN, &wrq)) == 0)
+      break;
+
+    /* result did not fit: grow as the driver asks, or double */
+    if (errno != E2BIG || size == SCAN_MAX_BUFFER)
+      break;
+    size = wrq.u.data.length > size ? wrq.u.data.length : size * 2;
+    if (size > SCAN_MAX_BUFFER)
+      size = SCAN_MAX_BUFFER;
+  }
+  close(sock);
+
+  if (ret == 0 && (ret = scan_parse(buf, wrq.u.data.length, bss, count)) == 0 &&
+      *bss)
+    mem_assign(*bss, owner);
+  mem_free(buf);
+  return ret;
+}
+
+/*
+ * Finishes an asynchronous scan
+ */
+static void scan_complete(struct wireless_scan_req *req, int error)
+{
+  req->error = error;
+  req->done(req, req->arg);
+}
+
+/*
+ * Loop timer: checks whether the scan has finished
+ */
+static void scan_poll(struct loop_timer *t, void *arg)
+{
+  struct wireless_scan_req *req = arg;
+
+  if (wireless_scan_results(req->ifname, req->owner, &req->bss, &req->count) == 0) {
+    scan_complete(req, 0);
+  } else if (errno != EAGAIN) {
+    scan_complete(req, errno);
+  } else if (clock_monotonic_ns() >= req->deadline_ns) {
+    scan_complete(req, ETIMEDOUT);
+  } else {
+    wireless_loop_timer_add(req->loop, &req->timer,
+                            clock_monotonic_ns() + SCAN_POLL_NS);
+  }
+}
+
+/*
+ * Posted work: triggers the scan on the loop thread and starts polling.
+ * Without the privilege to trigger, the driver's last results are read.
+ */
+static void scan_start(void *arg)
+{
+  struct wireless_scan_req *req = arg;
+
+  if (wireless_scan_trigger(req->ifname) < 0 && errno != EPERM &&
+      errno != EBUSY) {
+    scan_complete(req, errno);
+    return;
+  }
+
+  req->deadline_ns = clock_monotonic_ns() + SCAN_TIMEOUT_NS;
+  req->timer.fn = scan_poll;
+  req->timer.arg = req;
+  wireless_loop_timer_add(req->loop, &req->timer,
+                          clock_monotonic_ns() + SCAN_POLL_NS);
+}
+
+/*
+ * Starts a scan on the loop; done runs from wireless_loop_dispatch().
+ * The cells are charged to owner, which may be NULL.  May be called
+ * from any thread.
+ */
+void wireless_loop_scan(struct wireless_loop *loop,
+                        struct wireless_scan_req *req, const char *ifname,
+                        struct mem_owner *owner,
+                        wireless_scan_fn_t done, void *arg)
+{
+  memset(req, 0, sizeof(*req));
+  req->loop = loop;
+  strncpy(req->ifname, ifname, IFNAMSIZ - 1);
+  req->owner = owner;
+  req->done = done;
+  req->arg = arg;
+  req->work.fn = scan_start;
+  req->work.arg = req;
+  wireless_loop_post(loop, &req->work);
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,87 @@
+/*
+    Access point scanning, blocking and on the event loop
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <net/ethernet.h>
+#include <linux/wireless.h>
+#include "clock.h"
+#include "loop.h"
+#include "mem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* How often a pending scan is checked, and when it is given up */
+#define SCAN_POLL_NS    (100 * NSEC_PER_MSEC)
+#define SCAN_TIMEOUT_NS (15 * NSEC_PER_SEC)
+
+/*
+ * One cell of a scan result
+ */
+struct wireless_bss {
+  struct ether_addr bssid;
+  char essid[IW_ESSID_MAX_SIZE + 1];
+  int freq;                     /* MHz, or channel if the driver gives one */
+  int qual;
+  int level;                    /* dBm */
+};
+
+int wireless_scan_trigger(const char *ifname);
+int wireless_scan_results(const char *ifname, struct mem_owner *owner,
+                          struct wireless_bss **bss, int *count);
+
+struct wireless_scan_req;
+typedef void (*wireless_scan_fn_t)(struct wireless_scan_req *req, void *arg);
+
+/*
+ * A scan run on the event loop.  The caller owns the request until
+ * done is called; on success bss holds count cells to be mem_free()d.
+ */
+struct wireless_scan_req {
+  struct loop_work work;
+  struct loop_timer timer;
+  struct wireless_loop *loop;
+  char ifname[IFNAMSIZ];
+  struct mem_owner *owner;      /* charged for the cells, may be NULL */
+  unsigned long long deadline_ns;
+  wireless_scan_fn_t done;
+  void *arg;
+
+  int error;                    /* errno value, 0 on success */
+  struct wireless_bss *bss;
+  int count;
+};
+
+void wireless_loop_scan(struct wireless_loop *loop,
+                        struct wireless_scan_req *req, const char *ifname,
+                        struct mem_owner *owner,
+                        wireless_scan_fn_t done, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
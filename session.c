@@ -0,0 +1,167 @@
+/*
+    Per-association session aggregates
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#include <string.h>
+
+#include "clock.h"
+#include "session.h"
+
+/* Upper bounds of the bitrate buckets, in Mb/s */
+static const int rate_bounds[SESSION_RATE_BUCKETS - 1] = {
+  6, 12, 24, 54, 150, 300, 600
+};
+
+/*
+ * Maps a bitrate in b/s to its distribution bucket
+ */
+static int rate_bucket(int bitrate)
+{
+  int i;
+
+  for (i = 0; i < SESSION_RATE_BUCKETS - 1; i++)
+    if (bitrate < rate_bounds[i] * 1000000)
+      return i;
+  return SESSION_RATE_BUCKETS - 1;
+}
+
+/*
+ * Tells whether a snapshot still belongs to the open session
+ */
+static int session_matches(const struct session *s,
+                           const struct wireless_snapshot *snap)
+{
+  if (memcmp(&s->ap, &snap->ap, sizeof(s->ap)))
+    return 0;
+  if ((snap->valid & WS_ESSID) && strcmp(s->essid, snap->essid))
+    return 0;
+  return 1;
+}
+
+/*
+ * Starts a new session from the first snapshot of an association
+ */
+static void session_open(struct session *s,
+                         const struct wireless_snapshot *snap,
+                         unsigned long long now_ns)
+{
+  memset(s, 0, sizeof(*s));
+  s->active = 1;
+  if (snap->valid & WS_ESSID)
+    strcpy(s->essid, snap->essid);
+  s->ap = snap->ap;
+  s->start_wall_ns = clock_realtime_ns();
+  s->start_ns = now_ns;
+}
+
+/*
+ * Feeds one snapshot into the interface's session.  An association
+ * change closes the open session (emitting its summary) and starts a
+ * new one; a snapshot without AP information is ignored.
+ */
+void session_sample(struct session *s, const char *ifname,
+                    const struct wireless_snapshot *snap,
+                    unsigned long long now_ns, session_emit_t emit, void *arg)
+{
+  if (!(snap->valid & WS_AP))
+    return;
+
+  if (s->active && (!snap->associated || !session_matches(s, snap)))
+    session_close(s, ifname, s->last_ns, emit, arg);
+
+  if (!snap->associated)
+    return;
+
+  if (!s->active)
+    session_open(s, snap, now_ns);
+
+  s->last_ns = now_ns;
+  s->samples++;
+
+  if ((snap->valid & WS_STATS) && !(snap->updated & IW_QUAL_LEVEL_INVALID)) {
+    if (!s->level_samples || snap->level < s->level_min)
+      s->level_min = snap->level;
+    s->level_sum += snap->level;
+    s->level_samples++;
+  }
+
+  if (snap->valid & WS_STATS) {
+    /* the driver counter is cumulative; a drop means it was reset */
+    if (s->retries_valid && snap->discard_retries >= s->retries_last)
+      s->retries += snap->discard_retries - s->retries_last;
+    else if (s->retries_valid)
+      s->retries += snap->discard_retries;
+    s->retries_last = snap->discard_retries;
+    s->retries_valid = 1;
+  }
+
+  if (snap->valid & WS_BITRATE)
+    s->rate_hist[rate_bucket(snap->bitrate)]++;
+}
+
+/*
+ * Closes the open session, if any, handing it to emit
+ */
+void session_close(struct session *s, const char *ifname,
+                   unsigned long long end_ns, session_emit_t emit, void *arg)
+{
+  if (!s->active)
+    return;
+
+  if (end_ns < s->start_ns)
+    end_ns = s->start_ns;
+
+  emit(ifname, s, end_ns, arg);
+  s->active = 0;
+}
+
+/*
+ * Prints the compact summary record of a closed session
+ */
+void session_print(const char *ifname, const struct session *s,
+                   unsigned long long end_ns, FILE *fp)
+{
+  char ap[32];
+  int i;
+
+  sprintf(ap, "%02X:%02X:%02X:%02X:%02X:%02X",
+          s->ap.ether_addr_octet[0], s->ap.ether_addr_octet[1],
+          s->ap.ether_addr_octet[2], s->ap.ether_addr_octet[3],
+          s->ap.ether_addr_octet[4], s->ap.ether_addr_octet[5]);
+
+  fprintf(fp, "session ifname=%s essid=\"%s\" ap=%s start=%llu.%03llu "
+          "duration=%.3f samples=%lu",
+          ifname, s->essid, ap,
+          s->start_wall_ns / NSEC_PER_SEC,
+          (s->start_wall_ns % NSEC_PER_SEC) / NSEC_PER_MSEC,
+          (double)(end_ns - s->start_ns) / NSEC_PER_SEC, s->samples);
+
+  if (s->level_samples)
+    fprintf(fp, " signal_mean=%.1f signal_min=%d",
+            (double)s->level_sum / s->level_samples, s->level_min);
+
+  fprintf(fp, " retries=%llu rates=", s->retries);
+  for (i = 0; i < SESSION_RATE_BUCKETS; i++)
+    fprintf(fp, i ? ",%lu" : "%lu", s->rate_hist[i]);
+  fprintf(fp, "\n");
+  fflush(fp);
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,70 @@
+/*
+    Per-association session aggregates
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdio.h>
+#include "sample.h"
+
+/* Bitrate distribution buckets, upper bounds in Mb/s; last is open */
+#define SESSION_RATE_BUCKETS 8
+
+/*
+ * Running aggregates for one association (ESSID/AP pair) of one
+ * interface.  Every update is constant time; nothing per sample is kept.
+ */
+struct session {
+  int active;
+  char essid[IW_ESSID_MAX_SIZE + 1];
+  struct ether_addr ap;
+
+  unsigned long long start_wall_ns;
+  unsigned long long start_ns;
+  unsigned long long last_ns;
+  unsigned long samples;
+
+  unsigned long level_samples;
+  long long level_sum;
+  int level_min;
+
+  int retries_valid;
+  unsigned int retries_last;
+  unsigned long long retries;
+
+  unsigned long rate_hist[SESSION_RATE_BUCKETS];
+};
+
+/* Called with each session as it closes, before its state is reused */
+typedef void (*session_emit_t)(const char *ifname, const struct session *s,
+                               unsigned long long end_ns, void *arg);
+
+void session_sample(struct session *s, const char *ifname,
+                    const struct wireless_snapshot *snap,
+                    unsigned long long now_ns, session_emit_t emit, void *arg);
+void session_close(struct session *s, const char *ifname,
+                   unsigned long long end_ns, session_emit_t emit, void *arg);
+void session_print(const char *ifname, const struct session *s,
+                   unsigned long long end_ns, FILE *fp);
+
+#endif /* SESSION_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,620 @@
+/*
+    Shared-memory ring of monitor events
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * With -P the monitor publishes every sample and link event, as the
+ * sample log's 64-byte records, into a ring in a file that local
+ * collectors map.  There is one writer, the loop thread, and up to
+ * SHMRING_CONSUMERS readers, each with a cursor of its own in the
+ * ring's header.  Consumers read records in place and never copy them
+ * out of the ring or make a syscall while there is something to read.
+ *
+ * The writer never waits for a consumer.  It stores a record and then
+ * the head, so a consumer that loads the head sees every record before
+ * it.  One that falls more than the ring behind has records overwritten
+ * under it: it notices when it looks at the head, before reading, and
+ * again after, since the writer may have come round while it read.
+ * Both count as lost for that consumer alone; the others go on intact.
+ *
+ * A consumer that has caught up raises its waiting flag, looks at the
+ * head once more and sleeps on an eventfd.  Once per dispatch the
+ * writer wakes those whose flag is up, so a busy consumer costs it
+ * nothing and an idle one one write per dispatch with new records.
+ *
+ * Consumers attach through a Unix socket beside the ring.  A thread of
+ * the monitor's hands each a free slot and its eventfd, and takes the
+ * slot back when the connection closes, so a consumer that dies gives
+ * its slot up.  The socket closing tells consumers the monitor is gone.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include <limits.h>
+
+#include "clock.h"
+#include "sample.h"
+#include "shmring.h"
+
+typedef char shmring_header_fits[sizeof(struct shmring_header) <= SHMRING_HEADER_SIZE ? 1 : -1];
+
+struct shmring_reader {
+  struct shmring_header *h;
+  const struct samplelog_record *recs;
+  struct shmring_consumer *c;
+  uint64_t cursor;
+  uint64_t slots;
+  size_t recs_len;
+  int sock;
+  int efd;
+};
+
+/* The writer's, used by the loop thread */
+static struct shmring_header *ring;
+static struct samplelog_record *ring_recs;
+static size_t ring_len;
+static uint64_t ring_head;
+static uint64_t ring_woken;
+static unsigned long long ring_wakeups;
+static char ring_socket[PATH_MAX];
+
+/* Shared with the control thread */
+static pthread_t ring_thread;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static int ring_listen = -1;
+static int ring_stop = -1;
+static int ring_conn[SHMRING_CONSUMERS];
+static int ring_efd[SHMRING_CONSUMERS];
+static int ring_attached;               /* atomic */
+static unsigned long long ring_served;
+static unsigned long long ring_read;    /* by consumers since gone */
+static unsigned long long ring_lost;
+
+/*
+ * Hands a new connection a free slot and its eventfd; a consumer
+ * finding the connection closed instead knows the ring is full
+ */
+static void shmring_accept(void)
+{
+  struct shmring_consumer *c;
+  struct shmring_hello hello;
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  char cbuf[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = { &hello, sizeof(hello) };
+  struct msghdr msg = { 0 };
+  struct cmsghdr *cmsg;
+  int fd, efd, i;
+
+  if ((fd = accept4(ring_listen, NULL, NULL, SOCK_CLOEXEC)) < 0)
+    return;
+  for (i = 0; i < SHMRING_CONSUMERS && ring_conn[i] >= 0; i++)
+    ;
+  if (i == SHMRING_CONSUMERS) {
+    fprintf(stderr, "ring: no free consumer slot\n");
+    close(fd);
+    return;
+  }
+  if ((efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+    perror("ring: eventfd");
+    close(fd);
+    return;
+  }
+
+  c = &ring->consumer[i];
+  memset(c, 0, sizeof(*c));
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0)
+    c->pid = cred.pid;
+  memset(&hello, 0, sizeof(hello));
+  hello.slot = i;
+  hello.cursor = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  c->cursor = hello.cursor;
+
+  pthread_mutex_lock(&ring_lock);
+  ring_conn[i] = fd;
+  ring_efd[i] = efd;
+  __atomic_store_n(&c->attached, 1, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&ring_attached, 1, __ATOMIC_RELEASE);
+  ring_served++;
+  pthread_mutex_unlock(&ring_lock);
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &efd, sizeof(int));
+  if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(hello)) {
+    perror("ring: sendmsg");
+    shutdown(fd, SHUT_RDWR);
+  }
+}
+
+/*
+ * Takes back the slot of a consumer whose connection closed
+ */
+static void shmring_free(int i)
+{
+  struct shmring_consumer *c = &ring->consumer[i];
+
+  pthread_mutex_lock(&ring_lock);
+  __atomic_store_n(&c->attached, 0, __ATOMIC_RELEASE);
+  __atomic_sub_fetch(&ring_attached, 1, __ATOMIC_RELEASE);
+  ring_read += c->read;
+  ring_lost += c->lost;
+  close(ring_efd[i]);
+  close(ring_conn[i]);
+  ring_efd[i] = ring_conn[i] = -1;
+  pthread_mutex_unlock(&ring_lock);
+}
+
+/*
+ * The control thread: accepts consumers and notices them leave
+ */
+static void *shmring_run(void *arg)
+{
+  struct pollfd pfd[2 + SHMRING_CONSUMERS];
+  int slot[SHMRING_CONSUMERS];
+  char c;
+  int i, n;
+
+  for (;;) {
+    pfd[0].fd = ring_stop;
+    pfd[1].fd = ring_listen;
+    for (i = n = 0; i < SHMRING_CONSUMERS; i++)
+      if (ring_conn[i] >= 0) {
+        slot[n] = i;
+        pfd[2 + n++].fd = ring_conn[i];
+      }
+    for (i = 0; i < 2 + n; i++)
+      pfd[i].events = POLLIN;
+    if (poll(pfd, 2 + n, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("ring: poll");
+      break;
+    }
+    if (pfd[0].revents)
+      break;
+    for (i = 0; i < n; i++)
+      if (pfd[2 + i].revents && recv(pfd[2 + i].fd, &c, 1, MSG_DONTWAIT) <= 0)
+        shmring_free(slot[i]);
+    if (pfd[1].revents)
+      shmring_accept();
+  }
+  return NULL;
+}
+
+/*
+ * Creates the ring file at path and its control socket, and starts
+ * accepting consumers
+ */
+int shmring_open(const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  sigset_t all, old;
+  int fd, err, i;
+
+  ring_len = SHMRING_HEADER_SIZE + SHMRING_SLOTS * sizeof(struct samplelog_record);
+  if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0 ||
+      ftruncate(fd, ring_len) < 0) {
+    perror(path);
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  ring = mmap(NULL, ring_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ring == MAP_FAILED) {
+    perror(path);
+    ring = NULL;
+    return -1;
+  }
+  ring_recs = (struct samplelog_record *)((char *)ring + SHMRING_HEADER_SIZE);
+  memcpy(ring->magic, SHMRING_MAGIC, sizeof(ring->magic));
+  ring->version = SHMRING_VERSION;
+  ring->record_size = sizeof(struct samplelog_record);
+  ring->byte_order = 0x01020304;
+  ring->slots = SHMRING_SLOTS;
+  ring->consumers = SHMRING_CONSUMERS;
+  ring->pid = getpid();
+  ring->start_ns = clock_realtime_ns();
+  for (i = 0; i < SHMRING_CONSUMERS; i++)
+    ring_conn[i] = ring_efd[i] = -1;
+
+  snprintf(ring_socket, sizeof(ring_socket), "%s%s", path, SHMRING_SOCKET_SUFFIX);
+  if (strlen(ring_socket) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "%s: path too long for a socket\n", ring_socket);
+    goto fail;
+  }
+  strcpy(addr.sun_path, ring_socket);
+  unlink(ring_socket);
+  if ((ring_listen = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0 ||
+      bind(ring_listen, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(ring_listen, SHMRING_CONSUMERS) < 0 ||
+      (ring_stop = eventfd(0, EFD_CLOEXEC)) < 0) {
+    perror(ring_socket);
+    goto fail;
+  }
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  err = pthread_create(&ring_thread, NULL, shmring_run, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (err) {
+    fprintf(stderr, "ring: pthread_create: %s\n", strerror(err));
+    goto fail;
+  }
+  return 0;
+
+fail:
+  if (ring_stop >= 0)
+    close(ring_stop);
+  if (ring_listen >= 0) {
+    close(ring_listen);
+    unlink(ring_socket);
+  }
+  ring_stop = ring_listen = -1;
+  munmap(ring, ring_len);
+  ring = NULL;
+  return -1;
+}
+
+/*
+ * Stops accepting consumers, hangs up on the attached ones and unmaps
+ * the ring.  The file stays for a consumer to finish reading.
+ */
+void shmring_close(void)
+{
+  uint64_t one = 1;
+  int i;
+
+  if (!ring)
+    return;
+  if (write(ring_stop, &one, sizeof(one)) == sizeof(one))
+    pthread_join(ring_thread, NULL);
+  for (i = 0; i < SHMRING_CONSUMERS; i++)
+    if (ring_conn[i] >= 0)
+      shmring_free(i);
+  close(ring_stop);
+  close(ring_listen);
+  unlink(ring_socket);
+  ring_stop = ring_listen = -1;
+  munmap(ring, ring_len);
+  ring = NULL;
+}
+
+/*
+ * Whether events are being published
+ */
+int shmring_active(void)
+{
+  return ring != NULL;
+}
+
+/*
+ * Next record to fill; shmring_publish() makes it visible
+ */
+static struct samplelog_record *shmring_next(void)
+{
+  struct samplelog_record *rec = &ring_recs[ring_head & (SHMRING_SLOTS - 1)];
+
+  memset(rec, 0, sizeof(*rec));
+  rec->time_ns = clock_realtime_ns();
+  return rec;
+}
+
+/*
+ * Moves the head past the record just filled
+ */
+static void shmring_publish(void)
+{
+  __atomic_store_n(&ring->head, ++ring_head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Publishes a snapshot
+ */
+void shmring_sample(const char *ifname, int ifindex,
+                    const struct wireless_snapshot *snap)
+{
+  samplelog_fill(shmring_next(), ifname, ifindex, snap);
+  shmring_publish();
+}
+
+/*
+ * Publishes a link message
+ */
+void shmring_link(const char *ifname, int ifindex, int type, int operstate)
+{
+  struct samplelog_record *rec = shmring_next();
+
+  strncpy(rec->ifname, ifname, sizeof(rec->ifname) - 1);
+  rec->type = type;
+  rec->ifindex = ifindex;
+  rec->operstate = operstate;
+  shmring_publish();
+}
+
+/*
+ * Wakes the consumers asleep on records published since the last call;
+ * called once per dispatch
+ */
+void shmring_wake(void)
+{
+  struct shmring_consumer *c;
+  uint64_t one = 1;
+  int i;
+
+  if (!ring || ring_woken == ring_head ||
+      !__atomic_load_n(&ring_attached, __ATOMIC_ACQUIRE))
+    return;
+  ring_woken = ring_head;
+  /* orders the head stores before the flags are looked at */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  pthread_mutex_lock(&ring_lock);
+  for (i = 0; i < SHMRING_CONSUMERS; i++) {
+    c = &ring->consumer[i];
+    if (ring_efd[i] < 0 || !__atomic_load_n(&c->waiting, __ATOMIC_RELAXED) ||
+        !__atomic_exchange_n(&c->waiting, 0, __ATOMIC_ACQ_REL))
+      continue;
+    if (write(ring_efd[i], &one, sizeof(one)) == sizeof(one)) {
+      c->wakeups++;
+      ring_wakeups++;
+    }
+  }
+  pthread_mutex_unlock(&ring_lock);
+}
+
+/*
+ * Prints what was published and what consumers read and lost
+ */
+void shmring_print(FILE *fp)
+{
+  const struct shmring_consumer *c;
+  unsigned long long read, lost;
+  int i;
+
+  if (!ring)
+    return;
+  pthread_mutex_lock(&ring_lock);
+  read = ring_read;
+  lost = ring_lost;
+  for (i = 0; i < SHMRING_CONSUMERS; i++) {
+    c = &ring->consumer[i];
+    if (ring_conn[i] < 0)
+      continue;
+    fprintf(fp, "ring consumer=%d pid=%u read=%llu lost=%llu lag=%llu wakeups=%llu\n",
+            i, c->pid, (unsigned long long)c->read, (unsigned long long)c->lost,
+            (unsigned long long)(ring_head - __atomic_load_n(&c->cursor, __ATOMIC_ACQUIRE)),
+            (unsigned long long)c->wakeups);
+    read += c->read;
+    lost += c->lost;
+  }
+  fprintf(fp, "ring records=%llu consumers=%llu read=%llu lost=%llu wakeups=%llu\n",
+          (unsigned long long)ring_head, ring_served, read, lost, ring_wakeups);
+  pthread_mutex_unlock(&ring_lock);
+}
+
+/*
+ * Maps the ring at path and attaches to the monitor publishing into it
+ * as a consumer; reading starts with the next record published
+ */
+struct shmring_reader *shmring_attach(const char *path)
+{
+  struct shmring_reader *r;
+  struct shmring_hello hello;
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  char cbuf[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = { &hello, sizeof(hello) };
+  struct msghdr msg = { 0 };
+  struct cmsghdr *cmsg;
+  struct stat st;
+  void *p;
+  int fd;
+
+  if ((r = calloc(1, sizeof(*r))) == NULL) {
+    perror("ring");
+    return NULL;
+  }
+  r->sock = r->efd = -1;
+  if ((fd = open(path, O_RDWR | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    goto fail;
+  }
+  if ((size_t)st.st_size < SHMRING_HEADER_SIZE) {
+    fprintf(stderr, "%s: not a ring\n", path);
+    goto fail;
+  }
+  if ((p = mmap(NULL, SHMRING_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0)) == MAP_FAILED) {
+    perror(path);
+    goto fail;
+  }
+  r->h = p;
+  if (memcmp(r->h->magic, SHMRING_MAGIC, sizeof(r->h->magic)) != 0 ||
+      r->h->version != SHMRING_VERSION ||
+      r->h->record_size != sizeof(struct samplelog_record) ||
+      r->h->byte_order != 0x01020304 ||
+      r->h->slots == 0 || (r->h->slots & (r->h->slots - 1)) ||
+      r->h->consumers > SHMRING_CONSUMERS ||
+      (size_t)st.st_size < SHMRING_HEADER_SIZE +
+                           (size_t)r->h->slots * sizeof(struct samplelog_record)) {
+    fprintf(stderr, "%s: not a ring of this version\n", path);
+    goto fail;
+  }
+  r->slots = r->h->slots;
+  r->recs_len = r->slots * sizeof(struct samplelog_record);
+  if ((p = mmap(NULL, r->recs_len, PROT_READ, MAP_SHARED, fd,
+                SHMRING_HEADER_SIZE)) == MAP_FAILED) {
+    perror(path);
+    goto fail;
+  }
+  r->recs = p;
+  close(fd);
+  fd = -1;
+
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s%s", path, SHMRING_SOCKET_SUFFIX);
+  if ((r->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0 ||
+      connect(r->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror(addr.sun_path);
+    goto fail;
+  }
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  if (recvmsg(r->sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(hello) ||
+      (cmsg = CMSG_FIRSTHDR(&msg)) == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+      hello.slot >= r->h->consumers) {
+    fprintf(stderr, "%s: the monitor has no room for another consumer\n", path);
+    goto fail;
+  }
+  memcpy(&r->efd, CMSG_DATA(cmsg), sizeof(int));
+  r->c = &r->h->consumer[hello.slot];
+  r->cursor = hello.cursor;
+  return r;
+
+fail:
+  if (fd >= 0)
+    close(fd);
+  shmring_detach(r);
+  return NULL;
+}
+
+/*
+ * Gives the consumer's slot back and unmaps the ring
+ */
+void shmring_detach(struct shmring_reader *r)
+{
+  if (!r)
+    return;
+  if (r->efd >= 0)
+    close(r->efd);
+  if (r->sock >= 0)
+    close(r->sock);
+  if (r->recs)
+    munmap((void *)r->recs, r->recs_len);
+  if (r->h)
+    munmap(r->h, SHMRING_HEADER_SIZE);
+  free(r);
+}
+
+/*
+ * Points recs at the records published since the cursor, as many as lie
+ * in one piece, and returns their number; 0 if there are none.  Records
+ * already overwritten are skipped and their number stored in lost.
+ * The records are read in place and handed back with shmring_release().
+ */
+size_t shmring_peek(struct shmring_reader *r, const struct samplelog_record **recs,
+                    uint64_t *lost)
+{
+  uint64_t head = __atomic_load_n(&r->h->head, __ATOMIC_ACQUIRE);
+  uint64_t at = r->cursor & (r->slots - 1);
+
+  *lost = 0;
+  if (head - r->cursor > r->slots) {
+    *lost = head - r->slots - r->cursor;
+    r->c->lost += *lost;
+    r->cursor = head - r->slots;
+    at = r->cursor & (r->slots - 1);
+  }
+  *recs = &r->recs[at];
+  return head - r->cursor < r->slots - at ? head - r->cursor : r->slots - at;
+}
+
+/*
+ * Moves the cursor past count records from shmring_peek() once they
+ * have been read.  Returns how many of them, from the first, the writer
+ * overwrote meanwhile; what was read of those must be thrown away.
+ */
+size_t shmring_release(struct shmring_reader *r, size_t count)
+{
+  uint64_t head, bad = 0;
+
+  /* the reads of the records come before the head is looked at again */
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  head = __atomic_load_n(&r->h->head, __ATOMIC_RELAXED);
+  /* the writer may be filling record head, over record head - slots */
+  if (head >= r->cursor + r->slots) {
+    bad = head - r->slots - r->cursor + 1;
+    if (bad > count)
+      bad = count;
+  }
+  r->cursor += count;
+  r->c->read += count - bad;
+  r->c->lost += bad;
+  __atomic_store_n(&r->c->cursor, r->cursor, __ATOMIC_RELEASE);
+  return bad;
+}
+
+/*
+ * Sleeps until records are published, up to timeout_ms or for ever if
+ * it is negative.  Returns 1 if there are records, 0 on timeout or a
+ * signal, -1 if the monitor went away or on error.
+ */
+int shmring_wait(struct shmring_reader *r, int timeout_ms)
+{
+  struct pollfd pfd[2] = { { r->efd, POLLIN, 0 }, { r->sock, POLLIN, 0 } };
+  uint64_t count;
+  int n;
+
+  if (__atomic_load_n(&r->h->head, __ATOMIC_ACQUIRE) != r->cursor)
+    return 1;
+  /* pairs with the writer's fence: it sees the flag or we see the head */
+  __atomic_store_n(&r->c->waiting, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&r->h->head, __ATOMIC_SEQ_CST) != r->cursor) {
+    __atomic_store_n(&r->c->waiting, 0, __ATOMIC_RELAXED);
+    return 1;
+  }
+  n = poll(pfd, 2, timeout_ms);
+  __atomic_store_n(&r->c->waiting, 0, __ATOMIC_RELAXED);
+  if (n < 0) {
+    if (errno == EINTR)
+      return 0;
+    perror("ring: poll");
+    return -1;
+  }
+  if (pfd[1].revents)
+    return -1;
+  if (pfd[0].revents && read(r->efd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    perror("ring: read");
+    return -1;
+  }
+  return __atomic_load_n(&r->h->head, __ATOMIC_ACQUIRE) != r->cursor;
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
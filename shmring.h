@@ -0,0 +1,111 @@
+/*
+    Shared-memory ring of monitor events
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "samplelog.h"
+
+#define SHMRING_MAGIC   "WISHRNG\n"
+#define SHMRING_VERSION 1
+
+/* Records in the ring, 4 MiB of them; a power of two */
+#define SHMRING_SLOTS     65536
+
+/* Consumers attached at once */
+#define SHMRING_CONSUMERS 16
+
+/* The control socket sits next to the ring, at its path plus this */
+#define SHMRING_SOCKET_SUFFIX ".sock"
+
+/*
+ * A consumer's slot in the ring header.  The monitor hands it out and
+ * takes it back; the consumer moves its cursor and raises waiting
+ * before it sleeps on its eventfd.
+ */
+struct shmring_consumer {
+  uint32_t attached;            /* atomic */
+  uint32_t waiting;             /* atomic, the consumer sleeps */
+  uint32_t pid;
+  uint32_t reserved;
+  uint64_t cursor;              /* atomic, sequence of the next record to read */
+  uint64_t read;                /* records read intact */
+  uint64_t lost;                /* records overwritten before they were read */
+  uint64_t wakeups;
+  uint64_t pad[3];
+} __attribute__((aligned(64)));
+
+/*
+ * The first page of the ring file; SHMRING_SLOTS records follow it.
+ * Record seq is at slot seq % slots, and head is the sequence of the
+ * next one to be written.  Consumers map the records read-only.
+ */
+struct shmring_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t byte_order;          /* 0x01020304 as written */
+  uint32_t slots;
+  uint32_t consumers;
+  uint32_t pid;                 /* of the monitor */
+  uint64_t start_ns;            /* CLOCK_REALTIME when the ring was created */
+  uint64_t head __attribute__((aligned(64)));  /* atomic */
+  struct shmring_consumer consumer[SHMRING_CONSUMERS];
+};
+
+#define SHMRING_HEADER_SIZE 4096
+
+/*
+ * What a control socket connection is told, with the consumer's
+ * eventfd attached
+ */
+struct shmring_hello {
+  uint32_t slot;
+  uint32_t reserved;
+  uint64_t cursor;              /* reading starts here */
+};
+
+/* The monitor's side */
+int shmring_open(const char *path);
+void shmring_close(void);
+int shmring_active(void);
+void shmring_sample(const char *ifname, int ifindex,
+                    const struct wireless_snapshot *snap);
+void shmring_link(const char *ifname, int ifindex, int type, int operstate);
+void shmring_wake(void);
+void shmring_print(FILE *fp);
+
+/* A consumer's side */
+struct shmring_reader;
+
+struct shmring_reader *shmring_attach(const char *path);
+void shmring_detach(struct shmring_reader *r);
+size_t shmring_peek(struct shmring_reader *r, const struct samplelog_record **recs,
+                    uint64_t *lost);
+size_t shmring_release(struct shmring_reader *r, size_t count);
+int shmring_wait(struct shmring_reader *r, int timeout_ms);
+
+#endif /* SHMRING_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,270 @@
+/*
+    Read-through cache of interface snapshots
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Embedded callers often ask for the same interface many times a second
+ * from different places.  The cache keeps the last value of every field
+ * of each interface with the time it was read, and serves a field again
+ * for as long as its TTL allows; only the fields that are missing or
+ * stale are read, together, with one wireless_snapshot().  A link event
+ * for an interface drops its entry, since association and rate rarely
+ * survive one.  A field with a TTL of 0 is never served from the cache.
+ *
+ * Entries are accounted to MEM_CACHE; at its cap the least recently
+ * used ones are evicted.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <net/if.h>
+
+#include "clock.h"
+#include "mem.h"
+#include "snapcache.h"
+
+/*
+ * Cached fields of one interface
+ */
+struct snapcache_entry {
+  struct snapcache_entry *next;       /* hash chain */
+  struct snapcache_entry *lru_prev;   /* most recently used first */
+  struct snapcache_entry *lru_next;
+  char ifname[IFNAMSIZ];
+  struct wireless_snapshot snap;      /* field_ns[] are the read times */
+};
+
+struct snapcache {
+  struct snapcache *next;             /* all caches, for eviction */
+  unsigned long long ttl_ns[WS_FIELDS];
+  struct snapcache_entry *hash[SNAPCACHE_HASH_SIZE];
+  struct snapcache_entry *lru_head;
+  struct snapcache_entry *lru_tail;
+  struct snapcache_stats stats;
+};
+
+static struct snapcache *caches;
+
+/*
+ * Hashes an interface name (djb2)
+ */
+static unsigned int snapcache_hashfn(const char *name)
+{
+  unsigned int h = 5381;
+
+  while (*name)
+    h = h * 33 + (unsigned char)*name++;
+  return h % SNAPCACHE_HASH_SIZE;
+}
+
+/*
+ * Takes an entry off the LRU list
+ */
+static void snapcache_unlink(struct snapcache *c, struct snapcache_entry *e)
+{
+  if (e->lru_prev)
+    e->lru_prev->lru_next = e->lru_next;
+  else
+    c->lru_head = e->lru_next;
+  if (e->lru_next)
+    e->lru_next->lru_prev = e->lru_prev;
+  else
+    c->lru_tail = e->lru_prev;
+  e->lru_prev = e->lru_next = NULL;
+}
+
+/*
+ * Puts an entry at the head of the LRU list
+ */
+static void snapcache_touch(struct snapcache *c, struct snapcache_entry *e)
+{
+  if (c->lru_head == e)
+    return;
+  if (e->lru_prev || e->lru_next || c->lru_tail == e)
+    snapcache_unlink(c, e);
+  e->lru_next = c->lru_head;
+  if (c->lru_head)
+    c->lru_head->lru_prev = e;
+  c->lru_head = e;
+  if (!c->lru_tail)
+    c->lru_tail = e;
+}
+
+/*
+ * Drops an entry
+ */
+static void snapcache_remove(struct snapcache *c, struct snapcache_entry *e)
+{
+  struct snapcache_entry **pp;
+
+  for (pp = &c->hash[snapcache_hashfn(e->ifname)]; *pp; pp = &(*pp)->next) {
+    if (*pp == e) {
+      *pp = e->next;
+      break;
+    }
+  }
+  snapcache_unlink(c, e);
+  c->stats.entries--;
+  mem_free(e);
+}
+
+/*
+ * Frees least recently used entries of every cache at the memory cap
+ */
+static size_t snapcache_evict(size_t need, void *arg)
+{
+  struct snapcache *c;
+  size_t freed = 0;
+
+  for (c = caches; c != NULL && freed < need; c = c->next) {
+    while (c->lru_tail && freed < need) {
+      snapcache_remove(c, c->lru_tail);
+      c->stats.evictions++;
+      freed += sizeof(struct snapcache_entry);
+    }
+  }
+  return freed;
+}
+
+/*
+ * Creates an empty cache with every TTL 0
+ */
+struct snapcache *snapcache_new(void)
+{
+  struct snapcache *c;
+
+  if ((c = mem_alloc(MEM_CACHE, sizeof(*c))) == NULL)
+    return NULL;
+  c->next = caches;
+  caches = c;
+  mem_on_evict(MEM_CACHE, snapcache_evict, NULL);
+  return c;
+}
+
+/*
+ * Frees a cache and its entries
+ */
+void snapcache_free(struct snapcache *c)
+{
+  struct snapcache **pp;
+
+  if (!c)
+    return;
+  while (c->lru_head)
+    snapcache_remove(c, c->lru_head);
+  for (pp = &caches; *pp; pp = &(*pp)->next) {
+    if (*pp == c) {
+      *pp = c->next;
+      break;
+    }
+  }
+  mem_free(c);
+}
+
+/*
+ * Sets how long the given WS_* fields are served after being read
+ */
+void snapcache_ttl(struct snapcache *c, unsigned fields, unsigned long long ttl_ns)
+{
+  int i;
+
+  for (i = 0; i < WS_FIELDS; i++)
+    if (fields & (1 << i))
+      c->ttl_ns[i] = ttl_ns;
+}
+
+/*
+ * Fills snap with the requested fields as wireless_snapshot() would,
+ * reading only those not fresh in the cache.  field_ns[] tells when
+ * each was actually read.
+ */
+int snapcache_get(struct snapcache *c, const char *ifname, unsigned fields,
+                  struct wireless_snapshot *snap)
+{
+  unsigned int h = snapcache_hashfn(ifname);
+  unsigned long long now = clock_monotonic_ns();
+  struct snapcache_entry *e;
+  struct wireless_snapshot fresh;
+  unsigned missing = 0;
+  int i;
+
+  for (e = c->hash[h]; e != NULL; e = e->next)
+    if (strncmp(e->ifname, ifname, IFNAMSIZ) == 0)
+      break;
+
+  for (i = 0; i < WS_FIELDS; i++) {
+    if (!(fields & (1 << i)))
+      continue;
+    if (e && (e->snap.valid & (1 << i)) && now - e->snap.field_ns[i] < c->ttl_ns[i]) {
+      c->stats.hits[i]++;
+    } else {
+      c->stats.misses[i]++;
+      missing |= 1 << i;
+    }
+  }
+
+  if (missing) {
+    if (wireless_snapshot(ifname, missing, &fresh) < 0)
+      return -1;
+    if (!e && (e = mem_alloc(MEM_CACHE, sizeof(*e))) != NULL) {
+      strncpy(e->ifname, ifname, IFNAMSIZ - 1);
+      e->next = c->hash[h];
+      c->hash[h] = e;
+      c->stats.entries++;
+    }
+    if (!e) {
+      /* no room to cache it; hand the fresh read over as it is */
+      *snap = fresh;
+      return 0;
+    }
+    wireless_snapshot_merge(&e->snap, &fresh, missing);
+  }
+
+  snapcache_touch(c, e);
+  memset(snap, 0, sizeof(*snap));
+  wireless_snapshot_merge(snap, &e->snap, fields);
+  return 0;
+}
+
+/*
+ * Forgets everything cached about an interface
+ */
+void snapcache_invalidate(struct snapcache *c, const char *ifname)
+{
+  struct snapcache_entry *e;
+
+  for (e = c->hash[snapcache_hashfn(ifname)]; e != NULL; e = e->next) {
+    if (strncmp(e->ifname, ifname, IFNAMSIZ) == 0) {
+      snapcache_remove(c, e);
+      c->stats.invalidations++;
+      return;
+    }
+  }
+}
+
+/*
+ * Copies the counters
+ */
+void snapcache_stats(const struct snapcache *c, struct snapcache_stats *st)
+{
+  *st = c->stats;
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,61 @@
+/*
+    Read-through cache of interface snapshots
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef SNAPCACHE_H
+#define SNAPCACHE_H
+
+#include "sample.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Hash buckets of cached interfaces */
+#define SNAPCACHE_HASH_SIZE 64
+
+/*
+ * Counters to tune the TTLs by, per WS_INDEX() of a field
+ */
+struct snapcache_stats {
+  unsigned long long hits[WS_FIELDS];
+  unsigned long long misses[WS_FIELDS];
+  unsigned long long invalidations;   /* entries dropped on link events */
+  unsigned long long evictions;       /* entries dropped for memory */
+  unsigned long entries;
+};
+
+struct snapcache;
+
+struct snapcache *snapcache_new(void);
+void snapcache_free(struct snapcache *c);
+void snapcache_ttl(struct snapcache *c, unsigned fields, unsigned long long ttl_ns);
+int snapcache_get(struct snapcache *c, const char *ifname, unsigned fields,
+                  struct wireless_snapshot *snap);
+void snapcache_invalidate(struct snapcache *c, const char *ifname);
+void snapcache_stats(const struct snapcache *c, struct snapcache_stats *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SNAPCACHE_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,620 @@
+/*
+    Pipeline span tracer
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * With -T every thread records spans of what it does, e.g. a netlink
+ * receive, a message parsed, an ioctl, a sample formatted or a sink
+ * flushed, into a buffer of its own that no other thread writes, so
+ * recording takes no lock and no atomic.  Buffers are found at exit
+ * through a lock-free list and written, once every thread that wrote
+ * them is stopped, as a Chrome JSON trace or, for a file named
+ * *.pftrace or *.perfetto-trace, as a Perfetto protobuf trace.  Both
+ * open in ui.perfetto.dev.
+ *
+ * Time spent in a queue is not spent on any thread, and waits overlap
+ * each other, so they are spread over tracks of their own, each wait
+ * on the first track free at its start.
+ *
+ * Not tracing costs a test of trace_enabled where a span starts.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "mem.h"
+
+/* Deepest nesting written to a Perfetto track */
+#define TRACE_DEPTH 32
+
+/* Thread ids and track uuids given to the queue wait tracks */
+#define TRACE_WAIT_TID  0x7fff0000
+#define TRACE_UUID_PROCESS 1ULL
+#define TRACE_UUID_WAIT 0x10000ULL
+
+/* Perfetto field numbers, from protos/perfetto/trace */
+#define PB_TRACE_PACKET          1
+#define PB_PACKET_TIMESTAMP      8
+#define PB_PACKET_SEQUENCE_ID    10
+#define PB_PACKET_TRACK_EVENT    11
+#define PB_PACKET_SEQUENCE_FLAGS 13
+#define PB_PACKET_TRACK_DESC     60
+#define PB_DESC_UUID             1
+#define PB_DESC_NAME             2
+#define PB_DESC_PROCESS          3
+#define PB_DESC_THREAD           4
+#define PB_DESC_PARENT_UUID      5
+#define PB_PROCESS_PID           1
+#define PB_PROCESS_NAME          6
+#define PB_THREAD_PID            1
+#define PB_THREAD_TID            2
+#define PB_THREAD_NAME           5
+#define PB_EVENT_ANNOTATION      4
+#define PB_EVENT_TYPE            9
+#define PB_EVENT_TRACK_UUID      11
+#define PB_EVENT_NAME            23
+#define PB_ANNOTATION_STRING     6
+#define PB_ANNOTATION_NAME       10
+#define PB_SLICE_BEGIN           1
+#define PB_SLICE_END             2
+#define PB_INCREMENTAL_CLEARED   1
+
+/*
+ * One thread's spans, newest at head - 1
+ */
+struct trace_buf {
+  struct trace_buf *next;
+  pid_t tid;
+  char name[16];
+  unsigned long long head;      /* spans recorded */
+  struct trace_span spans[TRACE_SPANS];
+};
+
+/*
+ * A protobuf message being put together; packets are small, and one
+ * that does not fit is dropped
+ */
+struct pb {
+  unsigned char buf[512];
+  size_t len;
+  int overflow;
+};
+
+int trace_enabled;
+static const char *trace_path;
+static struct trace_buf *trace_bufs;    /* atomic */
+static __thread struct trace_buf *trace_self;
+static __thread int trace_failed;
+
+/*
+ * The calling thread's buffer, made on first use; NULL if there is no
+ * memory for it
+ */
+static struct trace_buf *trace_buf(void)
+{
+  struct trace_buf *b;
+
+  if (trace_self || trace_failed)
+    return trace_self;
+  if ((b = mem_alloc(MEM_TRACE, sizeof(*b))) == NULL) {
+    trace_failed = 1;
+    return NULL;
+  }
+  b->tid = syscall(SYS_gettid);
+  strcpy(b->name, "thread");
+  b->next = __atomic_load_n(&trace_bufs, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&trace_bufs, &b->next, b, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  return trace_self = b;
+}
+
+/*
+ * Starts tracing, to be written to path at exit
+ */
+int trace_open(const char *path)
+{
+  if (!path || !*path) {
+    fprintf(stderr, "trace: no file given\n");
+    return -1;
+  }
+  trace_path = path;
+  trace_enabled = 1;
+  trace_thread("main");
+  return 0;
+}
+
+/*
+ * Names the calling thread in the trace.  A thread that records spans
+ * should call it first thing, so that its buffer is not made in the
+ * middle of its work.
+ */
+void trace_thread(const char *name)
+{
+  struct trace_buf *b;
+
+  if (!trace_enabled || (b = trace_buf()) == NULL)
+    return;
+  memset(b->name, 0, sizeof(b->name));
+  strncpy(b->name, name, sizeof(b->name) - 1);
+}
+
+/*
+ * Adds a span to the calling thread's buffer, over the oldest if full
+ */
+void trace_record(const char *name, const char *target,
+                  unsigned long long start_ns, unsigned long long end_ns, int flags)
+{
+  struct trace_buf *b;
+  struct trace_span *s;
+
+  if ((b = trace_buf()) == NULL)
+    return;
+  s = &b->spans[b->head++ & (TRACE_SPANS - 1)];
+  s->name = name;
+  memset(s->target, 0, sizeof(s->target));
+  if (target)
+    strncpy(s->target, target, sizeof(s->target) - 1);
+  s->start_ns = start_ns;
+  s->end_ns = end_ns > start_ns ? end_ns : start_ns;
+  s->flags = flags;
+}
+
+/*
+ * Orders spans by start, and an enclosing span before what it encloses
+ */
+static int trace_span_cmp(const void *a, const void *b)
+{
+  const struct trace_span *x = *(const struct trace_span * const *)a;
+  const struct trace_span *y = *(const struct trace_span * const *)b;
+
+  if (x->start_ns != y->start_ns)
+    return x->start_ns < y->start_ns ? -1 : 1;
+  if (x->end_ns != y->end_ns)
+    return x->end_ns > y->end_ns ? -1 : 1;
+  return 0;
+}
+
+/*
+ * Spans of a buffer with the given flags, sorted; count set to how
+ * many.  NULL with count 0 if none or no memory.
+ */
+static struct trace_span **trace_sorted(const struct trace_buf *b, int flags,
+                                        size_t *count)
+{
+  struct trace_span **v;
+  unsigned long long i, first = b->head > TRACE_SPANS ? b->head - TRACE_SPANS : 0;
+  size_t n = 0;
+
+  *count = 0;
+  if ((v = mem_alloc(MEM_TRACE, (b->head - first + 1) * sizeof(*v))) == NULL)
+    return NULL;
+  for (i = first; i < b->head; i++) {
+    const struct trace_span *s = &b->spans[i & (TRACE_SPANS - 1)];
+
+    if ((s->flags & TRACE_WAIT) == flags)
+      v[n++] = (struct trace_span *)s;
+  }
+  qsort(v, n, sizeof(*v), trace_span_cmp);
+  *count = n;
+  return v;
+}
+
+/*
+ * Every queue wait, sorted, with the track each goes on
+ */
+struct trace_waits {
+  struct trace_span **spans;
+  int *track;
+  size_t count;
+  int tracks;
+};
+
+static int trace_collect_waits(struct trace_waits *w)
+{
+  struct trace_buf *b;
+  struct trace_span **v;
+  unsigned long long ends[TRACE_WAIT_TRACKS];
+  size_t i, n, total = 0;
+  int k;
+
+  memset(w, 0, sizeof(*w));
+  for (b = trace_bufs; b != NULL; b = b->next)
+    total += b->head < TRACE_SPANS ? b->head : TRACE_SPANS;
+  w->spans = mem_alloc(MEM_TRACE, (total + 1) * sizeof(*w->spans));
+  w->track = mem_alloc(MEM_TRACE, (total + 1) * sizeof(*w->track));
+  if (!w->spans || !w->track)
+    return -1;
+  for (b = trace_bufs; b != NULL; b = b->next) {
+    if ((v = trace_sorted(b, TRACE_WAIT, &n)) == NULL)
+      continue;
+    memcpy(w->spans + w->count, v, n * sizeof(*v));
+    w->count += n;
+    mem_free(v);
+  }
+  qsort(w->spans, w->count, sizeof(*w->spans), trace_span_cmp);
+
+  /* the last track takes what overlaps all the others */
+  memset(ends, 0, sizeof(ends));
+  for (i = 0; i < w->count; i++) {
+    for (k = 0; k < TRACE_WAIT_TRACKS - 1 && ends[k] > w->spans[i]->start_ns; k++)
+      ;
+    if (w->spans[i]->end_ns > ends[k])
+      ends[k] = w->spans[i]->end_ns;
+    w->track[i] = k;
+    if (k >= w->tracks)
+      w->tracks = k + 1;
+  }
+  return 0;
+}
+
+/*
+ * Writes a string as a JSON string
+ */
+static void trace_json_string(FILE *fp, const char *s)
+{
+  fputc('"', fp);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf(fp, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      fprintf(fp, "\\u%04x", *s);
+    else
+      fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+/*
+ * Writes one span as a Chrome complete event
+ */
+static void trace_json_span(FILE *fp, const struct trace_span *s, int pid, int tid,
+                            int *first)
+{
+  fprintf(fp, "%s{\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"cat\":\"wireless\",\"name\":",
+          *first ? "" : ",\n", pid, tid);
+  trace_json_string(fp, s->name);
+  fprintf(fp, ",\"ts\":%.3f,\"dur\":%.3f", s->start_ns / 1e3,
+          (s->end_ns - s->start_ns) / 1e3);
+  if (s->target[0]) {
+    fprintf(fp, ",\"args\":{\"target\":");
+    trace_json_string(fp, s->target);
+    fputc('}', fp);
+  }
+  fputc('}', fp);
+  *first = 0;
+}
+
+/*
+ * Writes a thread name as Chrome metadata
+ */
+static void trace_json_thread(FILE *fp, int pid, int tid, const char *name, int *first)
+{
+  fprintf(fp, "%s{\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"name\":\"thread_name\","
+              "\"args\":{\"name\":", *first ? "" : ",\n", pid, tid);
+  trace_json_string(fp, name);
+  fprintf(fp, "}}");
+  *first = 0;
+}
+
+/*
+ * Writes the trace in the Chrome JSON trace event format
+ */
+static void trace_json(FILE *fp, const struct trace_waits *w)
+{
+  struct trace_buf *b;
+  unsigned long long i, first_span;
+  char name[32];
+  int pid = getpid(), first = 1, k;
+  size_t j;
+
+  fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  fprintf(fp, "{\"ph\":\"M\",\"pid\":%d,\"name\":\"process_name\",\"args\":{\"name\":",
+          pid);
+  trace_json_string(fp, program_invocation_short_name);
+  fprintf(fp, "}}");
+  first = 0;
+  for (b = trace_bufs; b != NULL; b = b->next) {
+    trace_json_thread(fp, pid, b->tid, b->name, &first);
+    first_span = b->head > TRACE_SPANS ? b->head - TRACE_SPANS : 0;
+    for (i = first_span; i < b->head; i++)
+      if (!(b->spans[i & (TRACE_SPANS - 1)].flags & TRACE_WAIT))
+        trace_json_span(fp, &b->spans[i & (TRACE_SPANS - 1)], pid, b->tid, &first);
+  }
+  for (k = 0; k < w->tracks; k++) {
+    snprintf(name, sizeof(name), "queue wait %d", k);
+    trace_json_thread(fp, pid, TRACE_WAIT_TID + k, name, &first);
+  }
+  for (j = 0; j < w->count; j++)
+    trace_json_span(fp, w->spans[j], pid, TRACE_WAIT_TID + w->track[j], &first);
+  fprintf(fp, "\n]}\n");
+}
+
+/*
+ * Appends bytes to a message
+ */
+static void pb_put(struct pb *p, const void *data, size_t len)
+{
+  if (p->len + len > sizeof(p->buf)) {
+    p->overflow = 1;
+    return;
+  }
+  memcpy(p->buf + p->len, data, len);
+  p->len += len;
+}
+
+static void pb_varint(struct pb *p, uint64_t v)
+{
+  unsigned char b[10];
+  size_t n = 0;
+
+  do {
+    b[n] = v & 0x7f;
+    v >>= 7;
+    if (v)
+      b[n] |= 0x80;
+    n++;
+  } while (v);
+  pb_put(p, b, n);
+}
+
+/*
+ * Appends a varint field
+ */
+static void pb_uint(struct pb *p, int field, uint64_t v)
+{
+  pb_varint(p, (uint64_t)field << 3);
+  pb_varint(p, v);
+}
+
+/*
+ * Appends a length-delimited field
+ */
+static void pb_bytes(struct pb *p, int field, const void *data, size_t len)
+{
+  pb_varint(p, (uint64_t)field << 3 | 2);
+  pb_varint(p, len);
+  pb_put(p, data, len);
+}
+
+static void pb_string(struct pb *p, int field, const char *s)
+{
+  pb_bytes(p, field, s, strlen(s));
+}
+
+static void pb_message(struct pb *p, int field, const struct pb *sub)
+{
+  p->overflow |= sub->overflow;
+  pb_bytes(p, field, sub->buf, sub->len);
+}
+
+/*
+ * Writes a packet to the trace, tagged as the only sequence in it
+ */
+static void pb_packet(FILE *fp, struct pb *packet)
+{
+  struct pb trace;
+
+  pb_uint(packet, PB_PACKET_SEQUENCE_ID, 1);
+  if (packet->overflow)
+    return;
+  memset(&trace, 0, sizeof(trace));
+  pb_message(&trace, PB_TRACE_PACKET, packet);
+  fwrite(trace.buf, 1, trace.len, fp);
+}
+
+/*
+ * Writes the descriptor of a track; tid 0 for one that is not a thread
+ */
+static void pb_track(FILE *fp, uint64_t uuid, int pid, int tid, const char *name)
+{
+  struct pb packet, desc, thread;
+
+  memset(&packet, 0, sizeof(packet));
+  memset(&desc, 0, sizeof(desc));
+  memset(&thread, 0, sizeof(thread));
+  pb_uint(&desc, PB_DESC_UUID, uuid);
+  pb_uint(&desc, PB_DESC_PARENT_UUID, TRACE_UUID_PROCESS);
+  if (tid) {
+    pb_uint(&thread, PB_THREAD_PID, pid);
+    pb_uint(&thread, PB_THREAD_TID, tid);
+    pb_string(&thread, PB_THREAD_NAME, name);
+    pb_message(&desc, PB_DESC_THREAD, &thread);
+  } else {
+    pb_string(&desc, PB_DESC_NAME, name);
+  }
+  pb_message(&packet, PB_PACKET_TRACK_DESC, &desc);
+  pb_packet(fp, &packet);
+}
+
+/*
+ * Writes the start or the end of a slice on a track
+ */
+static void pb_slice(FILE *fp, uint64_t uuid, unsigned long long ts, int type,
+                     const struct trace_span *s)
+{
+  struct pb packet, event, note;
+
+  memset(&packet, 0, sizeof(packet));
+  memset(&event, 0, sizeof(event));
+  memset(&note, 0, sizeof(note));
+  pb_uint(&event, PB_EVENT_TYPE, type);
+  pb_uint(&event, PB_EVENT_TRACK_UUID, uuid);
+  if (type == PB_SLICE_BEGIN) {
+    pb_string(&event, PB_EVENT_NAME, s->name);
+    if (s->target[0]) {
+      pb_string(&note, PB_ANNOTATION_NAME, "target");
+      pb_string(&note, PB_ANNOTATION_STRING, s->target);
+      pb_message(&event, PB_EVENT_ANNOTATION, &note);
+    }
+  }
+  pb_uint(&packet, PB_PACKET_TIMESTAMP, ts);
+  pb_message(&packet, PB_PACKET_TRACK_EVENT, &event);
+  pb_packet(fp, &packet);
+}
+
+/*
+ * Writes sorted spans to a track as nested slices.  A span that is not
+ * inside the one open around it is cut at that one's end.
+ */
+static void pb_spans(FILE *fp, uint64_t uuid, struct trace_span **v, size_t n)
+{
+  unsigned long long ends[TRACE_DEPTH], end;
+  int depth = 0;
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    while (depth && ends[depth - 1] <= v[i]->start_ns)
+      pb_slice(fp, uuid, ends[--depth], PB_SLICE_END, NULL);
+    if (depth == TRACE_DEPTH)
+      continue;
+    end = v[i]->end_ns;
+    if (depth && end > ends[depth - 1])
+      end = ends[depth - 1];
+    pb_slice(fp, uuid, v[i]->start_ns, PB_SLICE_BEGIN, v[i]);
+    ends[depth++] = end;
+  }
+  while (depth)
+    pb_slice(fp, uuid, ends[--depth], PB_SLICE_END, NULL);
+}
+
+/*
+ * Writes the trace as Perfetto TracePackets: a track per thread and
+ * per queue wait track, then begin and end events on each
+ */
+static void trace_perfetto(FILE *fp, const struct trace_waits *w)
+{
+  struct pb packet, desc, process;
+  struct trace_buf *b;
+  struct trace_span **v;
+  char name[32];
+  uint64_t uuid;
+  int pid = getpid(), k;
+  size_t i, n;
+
+  memset(&packet, 0, sizeof(packet));
+  memset(&desc, 0, sizeof(desc));
+  memset(&process, 0, sizeof(process));
+  pb_uint(&process, PB_PROCESS_PID, pid);
+  pb_string(&process, PB_PROCESS_NAME, program_invocation_short_name);
+  pb_uint(&desc, PB_DESC_UUID, TRACE_UUID_PROCESS);
+  pb_message(&desc, PB_DESC_PROCESS, &process);
+  pb_message(&packet, PB_PACKET_TRACK_DESC, &desc);
+  pb_uint(&packet, PB_PACKET_SEQUENCE_FLAGS, PB_INCREMENTAL_CLEARED);
+  pb_packet(fp, &packet);
+
+  for (b = trace_bufs, uuid = TRACE_UUID_PROCESS + 1; b != NULL; b = b->next, uuid++) {
+    pb_track(fp, uuid, pid, b->tid, b->name);
+    if ((v = trace_sorted(b, 0, &n)) == NULL)
+      continue;
+    pb_spans(fp, uuid, v, n);
+    mem_free(v);
+  }
+
+  if ((v = mem_alloc(MEM_TRACE, (w->count + 1) * sizeof(*v))) == NULL)
+    return;
+  for (k = 0; k < w->tracks; k++) {
+    snprintf(name, sizeof(name), "queue wait %d", k);
+    pb_track(fp, TRACE_UUID_WAIT + k, pid, 0, name);
+    for (i = n = 0; i < w->count; i++)
+      if (w->track[i] == k)
+        v[n++] = w->spans[i];
+    pb_spans(fp, TRACE_UUID_WAIT + k, v, n);
+  }
+  mem_free(v);
+}
+
+/*
+ * Tells whether a file name asks for a Perfetto protobuf trace
+ */
+static int trace_is_perfetto(const char *path)
+{
+  static const char *suffixes[] = { ".pftrace", ".perfetto-trace" };
+  size_t len = strlen(path), i;
+
+  for (i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++)
+    if (len >= strlen(suffixes[i]) &&
+        strcmp(path + len - strlen(suffixes[i]), suffixes[i]) == 0)
+      return 1;
+  return 0;
+}
+
+/*
+ * Writes the trace and frees the buffers.  Every thread that recorded
+ * spans must be stopped, or at least done recording.  A summary goes
+ * to fp.
+ */
+int trace_write(FILE *fp)
+{
+  struct trace_waits w;
+  struct trace_buf *b, *next;
+  unsigned long long spans = 0, lost = 0;
+  int threads = 0, ret = 0;
+  FILE *out;
+
+  if (!trace_enabled)
+    return 0;
+  trace_enabled = 0;
+  memset(&w, 0, sizeof(w));
+  for (b = trace_bufs; b != NULL; b = b->next, threads++) {
+    spans += b->head < TRACE_SPANS ? b->head : TRACE_SPANS;
+    lost += b->head > TRACE_SPANS ? b->head - TRACE_SPANS : 0;
+  }
+
+  if ((out = fopen(trace_path, "w")) == NULL) {
+    perror(trace_path);
+    ret = -1;
+  } else if (trace_collect_waits(&w) < 0) {
+    fprintf(stderr, "trace: out of memory\n");
+    fclose(out);
+    ret = -1;
+  } else {
+    if (trace_is_perfetto(trace_path))
+      trace_perfetto(out, &w);
+    else
+      trace_json(out, &w);
+    if (fclose(out) != 0) {
+      perror(trace_path);
+      ret = -1;
+    }
+  }
+  mem_free(w.spans);
+  mem_free(w.track);
+
+  for (b = trace_bufs; b != NULL; b = next) {
+    next = b->next;
+    mem_free(b);
+  }
+  trace_bufs = NULL;
+  trace_self = NULL;
+  if (ret == 0)
+    fprintf(fp, "trace file=%s threads=%d spans=%llu overwritten=%llu\n",
+            trace_path, threads, spans, lost);
+  return ret;
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
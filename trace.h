@@ -0,0 +1,106 @@
+/*
+    Pipeline span tracer
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include "clock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Spans kept per thread; older ones are overwritten */
+#define TRACE_SPANS       16384
+
+/* Tracks the overlapping queue waits are spread over */
+#define TRACE_WAIT_TRACKS 16
+
+/* Span flags */
+#define TRACE_WAIT 1            /* spent in a queue, not on the thread */
+
+/*
+ * One span.  name is a string constant; target names what it was for,
+ * an interface or a lane.
+ */
+struct trace_span {
+  const char *name;
+  char target[16];
+  unsigned long long start_ns;  /* CLOCK_MONOTONIC */
+  unsigned long long end_ns;
+  int flags;
+};
+
+/* set once by trace_open(), before any thread but main is started */
+extern int trace_enabled;
+
+int trace_open(const char *path);
+void trace_thread(const char *name);
+void trace_record(const char *name, const char *target,
+                  unsigned long long start_ns, unsigned long long end_ns, int flags);
+int trace_write(FILE *fp);
+
+/*
+ * Start of a span, 0 when not tracing; the only cost then is the test
+ */
+static inline unsigned long long trace_begin(void)
+{
+  return __builtin_expect(trace_enabled, 0) ? clock_monotonic_ns() : 0;
+}
+
+/*
+ * Ends a span started by trace_begin()
+ */
+static inline void trace_end(unsigned long long start_ns, const char *name,
+                             const char *target)
+{
+  if (__builtin_expect(start_ns != 0, 0))
+    trace_record(name, target, start_ns, clock_monotonic_ns(), 0);
+}
+
+/*
+ * Records a span whose ends the caller already timed
+ */
+static inline void trace_span(const char *name, const char *target,
+                              unsigned long long start_ns, unsigned long long end_ns)
+{
+  if (__builtin_expect(trace_enabled, 0))
+    trace_record(name, target, start_ns, end_ns, 0);
+}
+
+/*
+ * Records time an item waited in a queue before a thread took it
+ */
+static inline void trace_wait(const char *name, const char *target,
+                              unsigned long long queued_ns, unsigned long long now_ns)
+{
+  if (__builtin_expect(trace_enabled, 0))
+    trace_record(name, target, queued_ns, now_ns, TRACE_WAIT);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
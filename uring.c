@@ -0,0 +1,244 @@
+/*
+    Minimal io_uring ring without liburing
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Just enough io_uring for the event loop: set up and map a ring, hand
+ * out sqes, submit and wait in one io_uring_enter(), walk completions,
+ * and register a ring of provided buffers for multishot receives.
+ * Only one thread may use a ring.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+#include "mem.h"
+
+/*
+ * Sets up and maps a ring with room for entries submissions
+ */
+int uring_init(struct uring *u, unsigned int entries)
+{
+  struct io_uring_params p;
+  char *sq, *cq;
+
+  memset(u, 0, sizeof(*u));
+  memset(&p, 0, sizeof(p));
+  if ((u->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+    return -1;
+
+  u->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  u->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (u->cq_map_len > u->sq_map_len)
+      u->sq_map_len = u->cq_map_len;
+    u->cq_map_len = u->sq_map_len;
+  }
+
+  u->sq_map = mmap(NULL, u->sq_map_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (u->sq_map == MAP_FAILED)
+    goto fail;
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    u->cq_map = u->sq_map;
+  } else {
+    u->cq_map = mmap(NULL, u->cq_map_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if (u->cq_map == MAP_FAILED)
+      goto fail;
+  }
+  u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED)
+    goto fail;
+
+  sq = u->sq_map;
+  u->sq_head = (unsigned int *)(sq + p.sq_off.head);
+  u->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+  u->sq_array = (unsigned int *)(sq + p.sq_off.array);
+  u->sq_mask = *(unsigned int *)(sq + p.sq_off.ring_mask);
+  u->sq_entries = p.sq_entries;
+  u->sq_local = *u->sq_tail;
+
+  cq = u->cq_map;
+  u->cq_head = (unsigned int *)(cq + p.cq_off.head);
+  u->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+  u->cq_mask = *(unsigned int *)(cq + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return 0;
+
+fail:
+  if (u->sqes == MAP_FAILED)
+    u->sqes = NULL;
+  if (u->cq_map == MAP_FAILED)
+    u->cq_map = NULL;
+  if (u->sq_map == MAP_FAILED)
+    u->sq_map = NULL;
+  uring_exit(u);
+  return -1;
+}
+
+/*
+ * Unmaps and closes the ring
+ */
+void uring_exit(struct uring *u)
+{
+  if (u->br)
+    munmap(u->br, u->br_len);
+  mem_free(u->bufs);
+  if (u->sqes)
+    munmap(u->sqes, u->sqes_len);
+  if (u->cq_map && u->cq_map != u->sq_map)
+    munmap(u->cq_map, u->cq_map_len);
+  if (u->sq_map)
+    munmap(u->sq_map, u->sq_map_len);
+  if (u->fd >= 0)
+    close(u->fd);
+  memset(u, 0, sizeof(*u));
+  u->fd = -1;
+}
+
+/*
+ * Returns a cleared sqe, submitting what is queued first if the ring is
+ * full.  The sqe goes to the kernel with the next uring_enter().
+ */
+struct io_uring_sqe *uring_sqe(struct uring *u)
+{
+  struct io_uring_sqe *sqe;
+  unsigned int head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+
+  if (u->sq_local - head >= u->sq_entries) {
+    if (uring_enter(u, 0) < 0)
+      return NULL;
+    head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (u->sq_local - head >= u->sq_entries)
+      return NULL;
+  }
+
+  sqe = &u->sqes[u->sq_local & u->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  u->sq_array[u->sq_local & u->sq_mask] = u->sq_local & u->sq_mask;
+  u->sq_local++;
+  return sqe;
+}
+
+/*
+ * Submits the queued sqes and waits for at least wait_nr completions
+ */
+int uring_enter(struct uring *u, unsigned int wait_nr)
+{
+  unsigned int submit = u->sq_local - *u->sq_tail;
+  int ret;
+
+  if (!submit && !wait_nr)
+    return 0;
+
+  __atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+  do {
+    u->enters++;
+    ret = syscall(__NR_io_uring_enter, u->fd, submit, wait_nr,
+                  wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  } while (ret < 0 && errno == EINTR && !wait_nr);
+  return ret;
+}
+
+/*
+ * Next completion, or NULL when there is none
+ */
+struct io_uring_cqe *uring_cqe(struct uring *u)
+{
+  unsigned int head = *u->cq_head;
+
+  if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+    return NULL;
+  return &u->cqes[head & u->cq_mask];
+}
+
+/*
+ * Releases the completion returned by uring_cqe()
+ */
+void uring_cqe_seen(struct uring *u)
+{
+  __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Registers count buffers of size bytes that receives with
+ * IOSQE_BUFFER_SELECT pick from; count must be a power of two
+ */
+int uring_bufs_init(struct uring *u, unsigned int count, unsigned int size)
+{
+  struct io_uring_buf_reg reg;
+  unsigned int i;
+
+  u->br_len = count * sizeof(struct io_uring_buf);
+  u->br = mmap(NULL, u->br_len, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (u->br == MAP_FAILED) {
+    u->br = NULL;
+    return -1;
+  }
+  if ((u->bufs = mem_alloc(MEM_URING, (size_t)count * size)) == NULL)
+    return -1;
+  u->buf_count = count;
+  u->buf_size = size;
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (unsigned long)u->br;
+  reg.ring_entries = count;
+  reg.bgid = URING_BGID;
+  if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING,
+              &reg, 1) < 0)
+    return -1;
+
+  for (i = 0; i < count; i++)
+    uring_buf_return(u, i);
+  return 0;
+}
+
+/*
+ * Data of the provided buffer a completion names
+ */
+void *uring_buf(struct uring *u, unsigned int id)
+{
+  return u->bufs + (size_t)id * u->buf_size;
+}
+
+/*
+ * Gives a provided buffer back to the kernel
+ */
+void uring_buf_return(struct uring *u, unsigned int id)
+{
+  struct io_uring_buf *buf = &u->br->bufs[u->br_tail & (u->buf_count - 1)];
+
+  buf->addr = (unsigned long)uring_buf(u, id);
+  buf->len = u->buf_size;
+  buf->bid = id;
+  u->br_tail++;
+  __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
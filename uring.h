@@ -0,0 +1,79 @@
+/*
+    Minimal io_uring ring without liburing
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+
+/*
+ * One submission/completion ring pair, mapped from the kernel, and an
+ * optional ring of provided receive buffers
+ */
+struct uring {
+  int fd;
+
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_array;
+  unsigned int sq_mask;
+  unsigned int sq_entries;
+  unsigned int sq_local;        /* tail of sqes handed out, not yet published */
+  struct io_uring_sqe *sqes;
+
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_map;
+  size_t sq_map_len;
+  void *cq_map;
+  size_t cq_map_len;
+  size_t sqes_len;
+
+  /* provided buffers, group URING_BGID */
+  struct io_uring_buf_ring *br;
+  size_t br_len;
+  char *bufs;
+  unsigned int buf_count;
+  unsigned int buf_size;
+  unsigned short br_tail;
+
+  unsigned long long enters;    /* io_uring_enter() calls */
+};
+
+#define URING_BGID 0
+
+int uring_init(struct uring *u, unsigned int entries);
+void uring_exit(struct uring *u);
+struct io_uring_sqe *uring_sqe(struct uring *u);
+int uring_enter(struct uring *u, unsigned int wait_nr);
+struct io_uring_cqe *uring_cqe(struct uring *u);
+void uring_cqe_seen(struct uring *u);
+
+int uring_bufs_init(struct uring *u, unsigned int count, unsigned int size);
+void *uring_buf(struct uring *u, unsigned int id);
+void uring_buf_return(struct uring *u, unsigned int id);
+
+#endif /* URING_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,305 @@
+/*
+    Hierarchical timer wheel for per-interface sampling schedules
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Classic hashed hierarchical wheel: level 0 holds the next 64 ticks
+ * one tick per slot, each higher level holds 64 blocks of the level
+ * below and is cascaded down as time reaches the block.  Adding and
+ * removing are O(1); all timers due in the same tick fire from one
+ * wheel_run(), and rounding expiries up to the slack makes timers
+ * with nearby deadlines share a tick, and so a wakeup.
+ */
+
+#include <string.h>
+
+#include "wheel.h"
+
+#define NO_EXPIRY (~0ULL)
+
+/*
+ * Empties a slot list
+ */
+static void slot_init(struct wheel_timer *head)
+{
+  head->next = head->prev = head;
+}
+
+/*
+ * Sets up an empty wheel whose tick 0 is now_ns
+ */
+void wheel_init(struct wheel *w, unsigned long long tick_ns,
+                unsigned long long slack_ns, unsigned long long now_ns)
+{
+  int level, i;
+
+  memset(w, 0, sizeof(*w));
+  w->tick_ns = tick_ns ? tick_ns : 1;
+  wheel_set_slack(w, slack_ns);
+  w->origin_ns = now_ns;
+
+  for (level = 0; level < WHEEL_LEVELS; level++) {
+    for (i = 0; i < WHEEL_SLOTS; i++) {
+      slot_init(&w->slots[level][i]);
+      w->slot_min[level][i] = NO_EXPIRY;
+    }
+  }
+}
+
+/*
+ * Links a timer into the slot matching its expiry
+ */
+static void wheel_place(struct wheel *w, struct wheel_timer *t)
+{
+  struct wheel_timer *head;
+  unsigned long long delta;
+  int level, idx;
+
+  if (t->expires < w->now)
+    t->expires = w->now;
+  delta = t->expires - w->now;
+
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < 1ULL << (WHEEL_BITS * (level + 1)))
+      break;
+  if (delta >= 1ULL << (WHEEL_BITS * WHEEL_LEVELS))
+    t->expires = w->now + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+  idx = (t->expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+  head = &w->slots[level][idx];
+  t->slot = level * WHEEL_SLOTS + idx;
+  t->next = head;
+  t->prev = head->prev;
+  head->prev->next = t;
+  head->prev = t;
+
+  if (t->expires < w->slot_min[level][idx])
+    w->slot_min[level][idx] = t->expires;
+}
+
+/*
+ * Changes the slack expiries are rounded up to; timers already
+ * scheduled keep their expiry
+ */
+void wheel_set_slack(struct wheel *w, unsigned long long slack_ns)
+{
+  w->slack = slack_ns / w->tick_ns;
+  if (!w->slack)
+    w->slack = 1;
+}
+
+/*
+ * Schedules a timer at expires_ns, rounded up to the wheel's tick
+ * and slack.  A pending timer is moved.
+ */
+void wheel_add(struct wheel *w, struct wheel_timer *t,
+               unsigned long long expires_ns)
+{
+  unsigned long long ticks = 0;
+
+  if (wheel_pending(t))
+    wheel_del(w, t);
+
+  if (expires_ns > w->origin_ns)
+    ticks = (expires_ns - w->origin_ns + w->tick_ns - 1) / w->tick_ns;
+  ticks = (ticks + w->slack - 1) / w->slack * w->slack;
+
+  t->expires = ticks;
+  wheel_place(w, t);
+  w->count++;
+}
+
+/*
+ * Unschedules a timer, if pending
+ */
+void wheel_del(struct wheel *w, struct wheel_timer *t)
+{
+  int level = t->slot / WHEEL_SLOTS, idx = t->slot % WHEEL_SLOTS;
+
+  if (!wheel_pending(t))
+    return;
+
+  t->prev->next = t->next;
+  t->next->prev = t->prev;
+  t->next = t->prev = NULL;
+  w->count--;
+
+  if (t->expires == w->slot_min[level][idx])
+    w->slot_dirty[level][idx] = 1;
+}
+
+/*
+ * Tells whether a timer is scheduled
+ */
+int wheel_pending(const struct wheel_timer *t)
+{
+  return t->next != NULL;
+}
+
+/*
+ * Moves a slot's timers onto a private list, leaving the slot empty
+ */
+static void slot_take(struct wheel *w, int level, int idx,
+                      struct wheel_timer *list)
+{
+  struct wheel_timer *head = &w->slots[level][idx];
+
+  if (head->next == head) {
+    slot_init(list);
+  } else {
+    list->next = head->next;
+    list->prev = head->prev;
+    list->next->prev = list;
+    list->prev->next = list;
+    slot_init(head);
+  }
+  w->slot_min[level][idx] = NO_EXPIRY;
+  w->slot_dirty[level][idx] = 0;
+}
+
+/*
+ * Redistributes the block of a higher level that time has reached
+ */
+static void wheel_cascade(struct wheel *w, int level)
+{
+  int idx = (w->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+  struct wheel_timer list, *t;
+
+  slot_take(w, level, idx, &list);
+  while ((t = list.next) != &list) {
+    list.next = t->next;
+    t->next->prev = &list;
+    wheel_place(w, t);
+  }
+
+  if (!idx && level + 1 < WHEEL_LEVELS)
+    wheel_cascade(w, level + 1);
+}
+
+/*
+ * Earliest expiry in a slot, refreshing the cached value if needed
+ */
+static unsigned long long slot_earliest(struct wheel *w, int level, int idx)
+{
+  struct wheel_timer *head = &w->slots[level][idx], *t;
+
+  if (w->slot_dirty[level][idx]) {
+    w->slot_min[level][idx] = NO_EXPIRY;
+    for (t = head->next; t != head; t = t->next)
+      if (t->expires < w->slot_min[level][idx])
+        w->slot_min[level][idx] = t->expires;
+    w->slot_dirty[level][idx] = 0;
+  }
+  return w->slot_min[level][idx];
+}
+
+/*
+ * Time of the earliest pending timer in ns, -1 if there is none.
+ * This is when the caller should next wake up and call wheel_run().
+ */
+long long wheel_next_ns(struct wheel *w)
+{
+  unsigned long long best = NO_EXPIRY;
+  int level, i;
+
+  if (!w->count)
+    return -1;
+
+  for (i = 0; i < WHEEL_SLOTS; i++) {
+    unsigned long long tick = w->now + i;
+    struct wheel_timer *head = &w->slots[0][tick & WHEEL_MASK];
+
+    if (head->next != head) {
+      best = tick;
+      break;
+    }
+  }
+
+  /* each higher slot holds a single block, the first non-empty one
+     from the current block on holds that level's earliest timer; the
+     current block's slot only matters until it has been cascaded */
+  for (level = 1; level < WHEEL_LEVELS; level++) {
+    unsigned long long cur = w->now >> (WHEEL_BITS * level);
+    int first = (w->now & ((1ULL << (WHEEL_BITS * level)) - 1)) ? 1 : 0;
+
+    for (i = first; i < first + WHEEL_SLOTS; i++) {
+      int idx = (cur + i) & WHEEL_MASK;
+      struct wheel_timer *head = &w->slots[level][idx];
+
+      if (head->next != head) {
+        unsigned long long e = slot_earliest(w, level, idx);
+        if (e < best)
+          best = e;
+        break;
+      }
+    }
+  }
+
+  return w->origin_ns + best * w->tick_ns;
+}
+
+/*
+ * Fires every timer due at or before now_ns.  Timers are unscheduled
+ * before fn is called, so fn may add them again.  Returns the number
+ * of timers fired.
+ */
+int wheel_run(struct wheel *w, unsigned long long now_ns,
+              wheel_fn_t fn, void *arg)
+{
+  unsigned long long target;
+  int fired = 0;
+
+  if (now_ns < w->origin_ns)
+    return 0;
+  target = (now_ns - w->origin_ns) / w->tick_ns;
+
+  while (w->now <= target) {
+    struct wheel_timer list, *t;
+    int idx = w->now & WHEEL_MASK;
+
+    if (!w->count) {
+      w->now = target + 1;
+      break;
+    }
+
+    if (!idx)
+      wheel_cascade(w, 1);
+
+    slot_take(w, 0, idx, &list);
+    w->now++;
+
+    while ((t = list.next) != &list) {
+      list.next = t->next;
+      t->next->prev = &list;
+      t->next = t->prev = NULL;
+      w->count--;
+      fn(t, arg);
+      fired++;
+    }
+  }
+
+  if (fired) {
+    w->runs++;
+    w->fired += fired;
+  }
+  return fired;
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
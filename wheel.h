@@ -0,0 +1,80 @@
+/*
+    Hierarchical timer wheel for per-interface sampling schedules
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stddef.h>
+
+/* 4 levels of 64 slots span 2^24 ticks, about 46 hours at 10 ms */
+#define WHEEL_BITS    6
+#define WHEEL_SLOTS   (1 << WHEEL_BITS)
+#define WHEEL_MASK    (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS  4
+
+/*
+ * A timer is embedded in its owner; recover the owner with
+ * wheel_entry(timer, struct owner, member)
+ */
+struct wheel_timer {
+  struct wheel_timer *next;
+  struct wheel_timer *prev;
+  unsigned long long expires;   /* in ticks */
+  unsigned int slot;            /* level * WHEEL_SLOTS + index */
+};
+
+#define wheel_entry(ptr, type, member) \
+  ((type *)((char *)(ptr) - offsetof(type, member)))
+
+typedef void (*wheel_fn_t)(struct wheel_timer *t, void *arg);
+
+struct wheel {
+  unsigned long long tick_ns;
+  unsigned long long slack;     /* in ticks, expiries are rounded up to it */
+  unsigned long long origin_ns;
+  unsigned long long now;       /* next tick to process */
+  unsigned long count;
+
+  /* scheduling statistics */
+  unsigned long long runs;      /* wheel_run() calls that fired something */
+  unsigned long long fired;
+
+  struct wheel_timer slots[WHEEL_LEVELS][WHEEL_SLOTS];
+
+  /* earliest expiry per slot, recomputed lazily after a delete */
+  unsigned long long slot_min[WHEEL_LEVELS][WHEEL_SLOTS];
+  unsigned char slot_dirty[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+void wheel_init(struct wheel *w, unsigned long long tick_ns,
+                unsigned long long slack_ns, unsigned long long now_ns);
+void wheel_set_slack(struct wheel *w, unsigned long long slack_ns);
+void wheel_add(struct wheel *w, struct wheel_timer *t,
+               unsigned long long expires_ns);
+void wheel_del(struct wheel *w, struct wheel_timer *t);
+int wheel_pending(const struct wheel_timer *t);
+long long wheel_next_ns(struct wheel *w);
+int wheel_run(struct wheel *w, unsigned long long now_ns,
+              wheel_fn_t fn, void *arg);
+
+#endif /* WHEEL_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,736 @@
+/*
+    Offline analyzer for recorded sample logs
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Summarises sample logs written with wireless-info -w:
+ *
+ *   wireless-analyze [-t threads] log...
+ *   wireless-analyze -a time -I ifname log...
+ *   wireless-analyze -F [-I ifname] log...
+ *   wireless-analyze -f ring [-I ifname]
+ *
+ * Logs are mapped and cut into chunks of whole records.  Worker threads
+ * take chunks in turn and aggregate into tables of their own, one per
+ * interface of each log and one per access point; the tables are merged
+ * once all chunks are done, so the workers share nothing but the chunk
+ * counter.  Signal quantiles come from exact per-dBm histograms, which
+ * merge by addition.
+ *
+ * With -a the logs are not summarised; instead the state of one
+ * interface at the given time is looked up through each log's keyframe
+ * index, replaying only the records since the keyframe before it.
+ *
+ * With -F the flight recorder dumps in the logs are printed instead,
+ * each sample with its time relative to the trigger.
+ *
+ * With -f no log is read: the records a running monitor publishes into
+ * the ring given to its -P are printed as they come, read in place, and
+ * records lost to the ring overflowing are counted.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <linux/if.h>
+
+#include "clock.h"
+#include "sample.h"
+#include "samplelog.h"
+#include "shmring.h"
+
+/* Records per chunk, 4 MiB */
+#define ANALYZE_CHUNK   65536
+
+/* Signal histogram: bin i is i - 128 dBm */
+#define ANALYZE_LEVELS  256
+
+#define MAX_THREADS     256
+
+/*
+ * A mapped log
+ */
+struct log_file {
+  const char *path;
+  const char *name;             /* path without directories */
+  const struct samplelog_record *recs;
+  size_t count;
+  void *map;
+  size_t map_len;
+};
+
+/*
+ * Running statistics of one interface or access point
+ */
+struct agg {
+  int used;
+  uint32_t file;                /* interfaces only, index into logs */
+  char key[16];                 /* interface name or AP address */
+
+  unsigned long long samples;
+  unsigned long long signal_samples;
+  long long level_sum;
+  int level_min;
+  int level_max;
+  unsigned long long bitrate_sum_kbps;
+  unsigned long long bitrate_samples;
+  unsigned long long up;
+  unsigned long long down;
+  unsigned long long deleted;
+  unsigned long long skew_max_us;
+  uint64_t first_ns;
+  uint64_t last_ns;
+  unsigned long long level_hist[ANALYZE_LEVELS];
+};
+
+/*
+ * Open addressing table of aggregates
+ */
+struct agg_table {
+  struct agg *slots;
+  size_t size;                  /* power of two */
+  size_t used;
+};
+
+/*
+ * One worker's partial results
+ */
+struct worker {
+  pthread_t thread;
+  struct agg_table ifaces;
+  struct agg_table aps;
+  unsigned long long records;
+};
+
+static struct log_file *logs;
+static int log_count;
+
+/* chunk i is chunk_first[i] of log chunk_log[i] */
+static size_t *chunk_first;
+static int *chunk_log;
+static size_t chunk_count;
+static size_t chunk_next;
+
+/*
+ * FNV-1a over a key
+ */
+static uint64_t agg_hash(uint32_t file, const char *key)
+{
+  uint64_t h = 1469598103934665603ULL;
+  int i;
+
+  h = (h ^ file) * 1099511628211ULL;
+  for (i = 0; i < 16; i++)
+    h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+  return h;
+}
+
+/*
+ * Finds or adds the aggregate for a key
+ */
+static struct agg *agg_get(struct agg_table *t, uint32_t file, const char *key)
+{
+  size_t i;
+
+  if ((t->used + 1) * 2 > t->size) {
+    struct agg_table grown;
+    size_t j;
+
+    grown.size = t->size ? t->size * 2 : 64;
+    grown.used = 0;
+    if ((grown.slots = calloc(grown.size, sizeof(struct agg))) == NULL) {
+      perror("wireless-analyze");
+      exit(1);
+    }
+    for (j = 0; j < t->size; j++) {
+      if (!t->slots[j].used)
+        continue;
+      i = agg_hash(t->slots[j].file, t->slots[j].key) & (grown.size - 1);
+      while (grown.slots[i].used)
+        i = (i + 1) & (grown.size - 1);
+      grown.slots[i] = t->slots[j];
+      grown.used++;
+    }
+    free(t->slots);
+    *t = grown;
+  }
+
+  i = agg_hash(file, key) & (t->size - 1);
+  while (t->slots[i].used) {
+    if (t->slots[i].file == file && memcmp(t->slots[i].key, key, 16) == 0)
+      return &t->slots[i];
+    i = (i + 1) & (t->size - 1);
+  }
+
+  t->slots[i].used = 1;
+  t->slots[i].file = file;
+  memcpy(t->slots[i].key, key, 16);
+  t->slots[i].level_min = INT32_MAX;
+  t->slots[i].level_max = INT32_MIN;
+  t->used++;
+  return &t->slots[i];
+}
+
+/*
+ * Counts a record's time and, for samples, its values
+ */
+static void agg_record(struct agg *a, const struct samplelog_record *r)
+{
+  if (!a->first_ns || r->time_ns < a->first_ns)
+    a->first_ns = r->time_ns;
+  if (r->time_ns > a->last_ns)
+    a->last_ns = r->time_ns;
+
+  switch (r->type) {
+    case SAMPLELOG_LINK:
+      if (r->operstate == IF_OPER_UP)
+        a->up++;
+      else
+        a->down++;
+      return;
+    case SAMPLELOG_DELLINK:
+      a->deleted++;
+      return;
+    case SAMPLELOG_SAMPLE:
+      break;
+    default:
+      return;
+  }
+
+  a->samples++;
+  if (r->skew_us > a->skew_max_us)
+    a->skew_max_us = r->skew_us;
+  if (r->valid & WS_BITRATE) {
+    a->bitrate_sum_kbps += r->bitrate_kbps;
+    a->bitrate_samples++;
+  }
+  if (r->valid & WS_STATS) {
+    int bin = r->level + 128;
+
+    a->signal_samples++;
+    a->level_sum += r->level;
+    if (r->level < a->level_min)
+      a->level_min = r->level;
+    if (r->level > a->level_max)
+      a->level_max = r->level;
+    a->level_hist[bin < 0 ? 0 : bin >= ANALYZE_LEVELS ? ANALYZE_LEVELS - 1 : bin]++;
+  }
+}
+
+/*
+ * Worker thread: aggregates chunks until none are left
+ */
+static void *worker_run(void *arg)
+{
+  struct worker *w = arg;
+  size_t c;
+
+  while ((c = __atomic_fetch_add(&chunk_next, 1, __ATOMIC_RELAXED)) < chunk_count) {
+    const struct log_file *log = &logs[chunk_log[c]];
+    size_t i = chunk_first[c];
+    size_t end = i + ANALYZE_CHUNK < log->count ? i + ANALYZE_CHUNK : log->count;
+
+    for (; i < end; i++) {
+      const struct samplelog_record *r = &log->recs[i];
+      char key[16];
+
+      /* Keyframes repeat what the records before them said */
+      if (r->type == SAMPLELOG_STATE)
+        continue;
+      agg_record(agg_get(&w->ifaces, chunk_log[c], r->ifname), r);
+
+      if (r->type == SAMPLELOG_SAMPLE && r->associated) {
+        memset(key, 0, sizeof(key));
+        memcpy(key, r->ap, sizeof(r->ap));
+        agg_record(agg_get(&w->aps, 0, key), r);
+      }
+    }
+    w->records += end - chunk_first[c];
+  }
+  return NULL;
+}
+
+/*
+ * Adds one aggregate into another with the same key
+ */
+static void agg_merge(struct agg *to, const struct agg *from)
+{
+  int i;
+
+  to->samples += from->samples;
+  to->signal_samples += from->signal_samples;
+  to->level_sum += from->level_sum;
+  if (from->level_min < to->level_min)
+    to->level_min = from->level_min;
+  if (from->level_max > to->level_max)
+    to->level_max = from->level_max;
+  to->bitrate_sum_kbps += from->bitrate_sum_kbps;
+  to->bitrate_samples += from->bitrate_samples;
+  to->up += from->up;
+  to->down += from->down;
+  to->deleted += from->deleted;
+  if (from->skew_max_us > to->skew_max_us)
+    to->skew_max_us = from->skew_max_us;
+  if (!to->first_ns || (from->first_ns && from->first_ns < to->first_ns))
+    to->first_ns = from->first_ns;
+  if (from->last_ns > to->last_ns)
+    to->last_ns = from->last_ns;
+  for (i = 0; i < ANALYZE_LEVELS; i++)
+    to->level_hist[i] += from->level_hist[i];
+}
+
+/*
+ * Merges a worker's table into the result
+ */
+static void table_merge(struct agg_table *to, const struct agg_table *from)
+{
+  size_t i;
+
+  for (i = 0; i < from->size; i++)
+    if (from->slots[i].used)
+      agg_merge(agg_get(to, from->slots[i].file, from->slots[i].key),
+                &from->slots[i]);
+}
+
+/*
+ * Signal level at quantile q
+ */
+static int agg_quantile(const struct agg *a, double q)
+{
+  unsigned long long seen = 0, rank = q * a->signal_samples;
+  int i;
+
+  for (i = 0; i < ANALYZE_LEVELS; i++) {
+    seen += a->level_hist[i];
+    if (seen > rank)
+      return i - 128;
+  }
+  return a->level_max;
+}
+
+/*
+ * Orders aggregates by log, then key
+ */
+static int agg_compare(const void *pa, const void *pb)
+{
+  const struct agg *a = *(const struct agg **)pa, *b = *(const struct agg **)pb;
+
+  if (a->file != b->file)
+    return a->file < b->file ? -1 : 1;
+  return memcmp(a->key, b->key, 16);
+}
+
+/*
+ * Table entries in order
+ */
+static struct agg **table_sorted(const struct agg_table *t)
+{
+  struct agg **v = malloc((t->used + 1) * sizeof(*v));
+  size_t i, n = 0;
+
+  if (v == NULL) {
+    perror("wireless-analyze");
+    exit(1);
+  }
+  for (i = 0; i < t->size; i++)
+    if (t->slots[i].used)
+      v[n++] = &t->slots[i];
+  qsort(v, n, sizeof(*v), agg_compare);
+  return v;
+}
+
+/*
+ * Prints the statistics every aggregate has
+ */
+static void agg_print(const struct agg *a)
+{
+  printf(" samples=%llu", a->samples);
+  if (a->signal_samples)
+    printf(" signal_mean=%.1f p10=%d p50=%d p90=%d min=%d max=%d",
+           (double)a->level_sum / a->signal_samples,
+           agg_quantile(a, 0.1), agg_quantile(a, 0.5), agg_quantile(a, 0.9),
+           a->level_min, a->level_max);
+  if (a->bitrate_samples)
+    printf(" bitrate_mean_mbps=%.1f",
+           (double)a->bitrate_sum_kbps / a->bitrate_samples / 1000);
+  printf(" skew_max_us=%llu first=%llu.%03llu last=%llu.%03llu\n",
+         a->skew_max_us,
+         (unsigned long long)(a->first_ns / NSEC_PER_SEC),
+         (unsigned long long)(a->first_ns % NSEC_PER_SEC / NSEC_PER_MSEC),
+         (unsigned long long)(a->last_ns / NSEC_PER_SEC),
+         (unsigned long long)(a->last_ns % NSEC_PER_SEC / NSEC_PER_MSEC));
+}
+
+/*
+ * Prints the usage; returns the exit status
+ */
+static int usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-t threads] log...\n"
+                  "       %s -a time -I ifname log...\n"
+                  "       %s -F [-I ifname] log...\n"
+                  "       %s -f ring [-I ifname]\n", prog, prog, prog, prog);
+  return 1;
+}
+
+/*
+ * Parses a time as seconds since the epoch, as a local date and time,
+ * or as a local time of day on the day the log started
+ */
+static int parse_time(const char *str, uint64_t day_ns, uint64_t *time_ns)
+{
+  static const char *formats[] = {
+    "%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%H:%M:%S"
+  };
+  time_t day = day_ns / NSEC_PER_SEC;
+  struct tm tm;
+  size_t i;
+  const char *end;
+  char *num_end;
+  double secs;
+
+  if (strchr(str, ':') == NULL) {
+    secs = strtod(str, &num_end);
+    if (*num_end || secs < 0)
+      return -1;
+    *time_ns = secs * NSEC_PER_SEC;
+    return 0;
+  }
+
+  /* strptime() fills in what it parsed even when it then fails */
+  for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+    localtime_r(&day, &tm);
+    if ((end = strptime(str, formats[i], &tm)) != NULL && *end == '\0')
+      break;
+  }
+  if (i == sizeof(formats) / sizeof(formats[0]))
+    return -1;
+  tm.tm_isdst = -1;
+  *time_ns = (uint64_t)mktime(&tm) * NSEC_PER_SEC;
+  return 0;
+}
+
+/*
+ * Prints the state of ifname at the time given with -a in every log
+ */
+static int seek_logs(const char *when, const char *ifname)
+{
+  int t;
+
+  for (t = 0; t < log_count; t++) {
+    const struct samplelog_header *h = logs[t].map;
+    const struct samplelog_index_entry *index;
+    struct samplelog_record state;
+    unsigned long long start;
+    uint64_t time_ns;
+    size_t entries;
+    void *map = NULL;
+    size_t map_len = 0;
+    long replayed;
+
+    if (parse_time(when, h->start_ns, &time_ns) < 0) {
+      fprintf(stderr, "%s: not a time\n", when);
+      return 1;
+    }
+    index = samplelog_index_map(logs[t].path, &entries, &map, &map_len);
+
+    start = clock_monotonic_ns();
+    replayed = samplelog_state_at(logs[t].recs, logs[t].count, index, entries,
+                                  ifname, time_ns, &state);
+    fprintf(stderr, "%s: %ld of %zu records replayed, %zu index entries, %.3f ms\n",
+            logs[t].name, replayed < 0 ? 0 : replayed, logs[t].count, entries,
+            (double)(clock_monotonic_ns() - start) / NSEC_PER_MSEC);
+
+    printf("state log=%s ifname=%.16s", logs[t].name, ifname);
+    if (replayed < 0) {
+      printf(" unknown\n");
+    } else {
+      printf(" ifindex=%u time=%llu.%03llu %s operstate=%u",
+             state.ifindex,
+             (unsigned long long)(state.time_ns / NSEC_PER_SEC),
+             (unsigned long long)(state.time_ns % NSEC_PER_SEC / NSEC_PER_MSEC),
+             state.type == SAMPLELOG_DELLINK ? "deleted" : "present",
+             state.operstate);
+      if (state.associated)
+        printf(" ap=%02X:%02X:%02X:%02X:%02X:%02X",
+               state.ap[0], state.ap[1], state.ap[2],
+               state.ap[3], state.ap[4], state.ap[5]);
+      if (state.valid & WS_STATS)
+        printf(" level=%d noise=%d qual=%u", state.level, state.noise, state.qual);
+      if (state.valid & WS_BITRATE)
+        printf(" bitrate_mbps=%.1f", state.bitrate_kbps / 1000.0);
+      printf("\n");
+    }
+    if (map)
+      munmap(map, map_len);
+  }
+  return 0;
+}
+
+/*
+ * Prints the measured fields of a sample record and ends the line
+ */
+static void print_measured(const struct samplelog_record *r)
+{
+  if (r->associated)
+    printf(" ap=%02X:%02X:%02X:%02X:%02X:%02X",
+           r->ap[0], r->ap[1], r->ap[2], r->ap[3], r->ap[4], r->ap[5]);
+  if (r->valid & WS_STATS)
+    printf(" level=%d noise=%d qual=%u", r->level, r->noise, r->qual);
+  if (r->valid & WS_BITRATE)
+    printf(" bitrate_mbps=%.1f", r->bitrate_kbps / 1000.0);
+  printf("\n");
+}
+
+/*
+ * Prints the flight recorder dumps of every log, or of one interface's
+ */
+static int flight_logs(const char *ifname)
+{
+  const struct samplelog_record *r, *trigger = NULL;
+  size_t i;
+  int t;
+
+  for (t = 0; t < log_count; t++) {
+    for (i = 0; i < logs[t].count; i++) {
+      r = &logs[t].recs[i];
+      if (r->type != SAMPLELOG_TRIGGER && r->type != SAMPLELOG_FLIGHT)
+        continue;
+      if (ifname && strncmp(r->ifname, ifname, sizeof(r->ifname)) != 0)
+        continue;
+
+      if (r->type == SAMPLELOG_TRIGGER) {
+        trigger = r;
+        printf("trigger log=%s ifname=%.16s reason=%s time=%llu.%03llu\n",
+               logs[t].name, r->ifname, samplelog_trigger_name(r->trigger),
+               (unsigned long long)(r->time_ns / NSEC_PER_SEC),
+               (unsigned long long)(r->time_ns % NSEC_PER_SEC / NSEC_PER_MSEC));
+        continue;
+      }
+      printf("flight log=%s ifname=%.16s", logs[t].name, r->ifname);
+      if (trigger && strncmp(trigger->ifname, r->ifname, sizeof(r->ifname)) == 0)
+        printf(" offset_ms=%.1f",
+               ((double)r->time_ns - (double)trigger->time_ns) / NSEC_PER_MSEC);
+      print_measured(r);
+    }
+  }
+  return 0;
+}
+
+static volatile sig_atomic_t follow_stop;
+
+/*
+ * Stops following the ring
+ */
+static void follow_signal(int sig)
+{
+  follow_stop = 1;
+}
+
+/*
+ * Prints what a monitor publishes into the ring at path, or what it
+ * publishes of one interface, until interrupted or the monitor exits
+ */
+static int follow_ring(const char *path, const char *ifname)
+{
+  struct shmring_reader *r;
+  const struct samplelog_record *recs, *rec;
+  unsigned long long read = 0, lost = 0;
+  uint64_t skipped;
+  size_t n, bad, i;
+  int ret = 0;
+
+  if ((r = shmring_attach(path)) == NULL)
+    return 1;
+  signal(SIGINT, follow_signal);
+  signal(SIGTERM, follow_signal);
+  while (!follow_stop) {
+    if ((n = shmring_peek(r, &recs, &skipped)) == 0) {
+      if ((ret = shmring_wait(r, -1)) < 0)
+        break;
+      continue;
+    }
+    if (skipped) {
+      printf("lost records=%llu\n", (unsigned long long)skipped);
+      lost += skipped;
+    }
+    for (i = 0; i < n; i++) {
+      rec = &recs[i];
+      if (ifname && strncmp(rec->ifname, ifname, sizeof(rec->ifname)) != 0)
+        continue;
+      printf("%s ifname=%.16s time=%llu.%03llu",
+             rec->type == SAMPLELOG_SAMPLE ? "sample" :
+             rec->type == SAMPLELOG_DELLINK ? "dellink" : "link", rec->ifname,
+             (unsigned long long)(rec->time_ns / NSEC_PER_SEC),
+             (unsigned long long)(rec->time_ns % NSEC_PER_SEC / NSEC_PER_MSEC));
+      if (rec->type == SAMPLELOG_SAMPLE)
+        print_measured(rec);
+      else
+        printf(" operstate=%u\n", rec->operstate);
+    }
+    /* what was printed of overwritten records is already out */
+    if ((bad = shmring_release(r, n))) {
+      printf("lost records=%zu\n", bad);
+      lost += bad;
+    }
+    read += n - bad;
+    fflush(stdout);
+  }
+  fprintf(stderr, "%s: read=%llu lost=%llu%s\n", path, read, lost,
+          ret < 0 ? ", monitor gone" : "");
+  shmring_detach(r);
+  return 0;
+}
+
+/*
+ * Main application
+ */
+int main(int argc, char **argv)
+{
+  static struct worker workers[MAX_THREADS];
+  struct agg_table ifaces = { 0 }, aps = { 0 };
+  struct agg **sorted;
+  unsigned long long records = 0, start;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  const char *when = NULL, *ifname = NULL, *ring = NULL;
+  size_t i, c;
+  int opt, t, flight = 0;
+
+  while ((opt = getopt(argc, argv, "t:a:I:Ff:h")) != -1) {
+    switch (opt) {
+      case 't':
+        threads = atoi(optarg);
+        break;
+      case 'a':
+        when = optarg;
+        break;
+      case 'I':
+        ifname = optarg;
+        break;
+      case 'F':
+        flight = 1;
+        break;
+      case 'f':
+        ring = optarg;
+        break;
+      default:
+        return usage(argv[0]);
+    }
+  }
+  if (ring)
+    return optind == argc && !when && !flight ? follow_ring(ring, ifname) : usage(argv[0]);
+  if (optind == argc || (!flight && !when != !ifname) || (flight && when))
+    return usage(argv[0]);
+  if (threads < 1)
+    threads = 1;
+  if (threads > MAX_THREADS)
+    threads = MAX_THREADS;
+
+  log_count = argc - optind;
+  if ((logs = calloc(log_count, sizeof(*logs))) == NULL) {
+    perror("wireless-analyze");
+    return 1;
+  }
+  for (t = 0; t < log_count; t++) {
+    const char *slash;
+
+    logs[t].path = argv[optind + t];
+    slash = strrchr(logs[t].path, '/');
+    logs[t].name = slash ? slash + 1 : logs[t].path;
+    logs[t].recs = samplelog_map(logs[t].path, &logs[t].count,
+                                 &logs[t].map, &logs[t].map_len);
+    if (logs[t].recs == NULL)
+      return 1;
+    chunk_count += (logs[t].count + ANALYZE_CHUNK - 1) / ANALYZE_CHUNK;
+  }
+  if (when)
+    return seek_logs(when, ifname);
+  if (flight)
+    return flight_logs(ifname);
+
+  chunk_first = malloc((chunk_count + 1) * sizeof(*chunk_first));
+  chunk_log = malloc((chunk_count + 1) * sizeof(*chunk_log));
+  if (!chunk_first || !chunk_log) {
+    perror("wireless-analyze");
+    return 1;
+  }
+  for (t = 0, c = 0; t < log_count; t++) {
+    for (i = 0; i < logs[t].count; i += ANALYZE_CHUNK, c++) {
+      chunk_first[c] = i;
+      chunk_log[c] = t;
+    }
+  }
+
+  start = clock_monotonic_ns();
+  for (t = 0; t < threads; t++) {
+    if (pthread_create(&workers[t].thread, NULL, worker_run, &workers[t]) != 0) {
+      perror("pthread_create");
+      threads = t;
+      break;
+    }
+  }
+  if (threads == 0)
+    worker_run(&workers[threads++]);
+  for (t = 0; t < threads; t++) {
+    pthread_join(workers[t].thread, NULL);
+    table_merge(&ifaces, &workers[t].ifaces);
+    table_merge(&aps, &workers[t].aps);
+    records += workers[t].records;
+  }
+
+  sorted = table_sorted(&ifaces);
+  for (i = 0; i < ifaces.used; i++) {
+    printf("iface log=%s ifname=%.16s up=%llu down=%llu deleted=%llu",
+           logs[sorted[i]->file].name, sorted[i]->key,
+           sorted[i]->up, sorted[i]->down, sorted[i]->deleted);
+    agg_print(sorted[i]);
+  }
+  free(sorted);
+
+  sorted = table_sorted(&aps);
+  for (i = 0; i < aps.used; i++) {
+    const unsigned char *ap = (const unsigned char *)sorted[i]->key;
+
+    printf("ap ap=%02X:%02X:%02X:%02X:%02X:%02X",
+           ap[0], ap[1], ap[2], ap[3], ap[4], ap[5]);
+    agg_print(sorted[i]);
+  }
+  free(sorted);
+
+  printf("total logs=%d records=%llu interfaces=%zu aps=%zu\n",
+         log_count, records, ifaces.used, aps.used);
+  fprintf(stderr, "%llu records in %.3f s with %ld threads\n", records,
+          (double)(clock_monotonic_ns() - start) / NSEC_PER_SEC, threads);
+
+  for (t = 0; t < log_count; t++)
+    munmap(logs[t].map, logs[t].map_len);
+  return 0;
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,252 @@
+/*
+    C++20 coroutine interface to the event loop, for embedding
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Awaitable versions of the snapshot, link event and scan operations.
+ * Each operation is queued on the wireless_loop and completes from
+ * wireless_loop_dispatch(), so nothing blocks the awaiting coroutine
+ * and no thread is started.  An executor of the caller's own drives
+ * the loop by watching event_loop::fd() and calling dispatch(); a
+ * resumer hands completed coroutines back to that executor instead of
+ * resuming them on the dispatching thread.
+ *
+ *   wireless::task<void> watch(wireless::event_loop &loop)
+ *   {
+ *     auto ev = co_await loop.next_link_event();
+ *     auto snap = co_await loop.snapshot(ev.ifname);
+ *     auto cells = co_await loop.scan(ev.ifname);
+ *   }
+ *
+ * The loop's rtnetlink socket and timers belong to the thread calling
+ * dispatch(); the operations themselves may be started from any thread.
+ */
+
+#ifndef WIRELESS_ASYNC_HPP
+#define WIRELESS_ASYNC_HPP
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "loop.h"
+#include "sample.h"
+#include "scan.h"
+
+namespace wireless {
+
+using resumer = std::function<void(std::coroutine_handle<>)>;
+
+class event_loop;
+
+/*
+ * co_await loop.snapshot(ifname[, fields]) -> struct wireless_snapshot
+ */
+class snapshot_op {
+public:
+  snapshot_op(event_loop &loop, std::string ifname, unsigned fields)
+    : loop_(loop), ifname_(std::move(ifname)), fields_(fields) {}
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h);
+  struct wireless_snapshot await_resume()
+  {
+    if (error_)
+      throw std::system_error(error_, std::generic_category(), "wireless_snapshot");
+    return snap_;
+  }
+
+private:
+  static void run(void *arg);
+
+  event_loop &loop_;
+  std::string ifname_;
+  unsigned fields_;
+  loop_work work_ {};
+  struct wireless_snapshot snap_ {};
+  int error_ = 0;
+  std::coroutine_handle<> handle_;
+};
+
+/*
+ * co_await loop.next_link_event() -> wireless_link_event
+ */
+class link_event_op {
+public:
+  explicit link_event_op(event_loop &loop) : loop_(loop) {}
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h);
+  wireless_link_event await_resume() const noexcept { return event_; }
+
+private:
+  static void run(const wireless_link_event *ev, void *arg);
+
+  event_loop &loop_;
+  loop_link_waiter waiter_ {};
+  wireless_link_event event_ {};
+  std::coroutine_handle<> handle_;
+};
+
+/*
+ * co_await loop.scan(ifname) -> std::vector<wireless_bss>
+ */
+class scan_op {
+public:
+  scan_op(event_loop &loop, std::string ifname)
+    : loop_(loop), ifname_(std::move(ifname)) {}
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h);
+  std::vector<wireless_bss> await_resume()
+  {
+    if (req_.error)
+      throw std::system_error(req_.error, std::generic_category(), "wireless scan");
+    std::vector<wireless_bss> cells(req_.bss, req_.bss + req_.count);
+    mem_free(req_.bss);
+    return cells;
+  }
+
+private:
+  static void run(wireless_scan_req *req, void *arg);
+
+  event_loop &loop_;
+  std::string ifname_;
+  wireless_scan_req req_ {};
+  std::coroutine_handle<> handle_;
+};
+
+/*
+ * Owns a wireless_loop and resumes coroutines for it
+ */
+class event_loop {
+public:
+  explicit event_loop(unsigned long long tick_ns = 10 * NSEC_PER_MSEC,
+                      unsigned long long slack_ns = 0)
+    : loop_(wireless_loop_new(tick_ns, slack_ns))
+  {
+    if (!loop_)
+      throw std::system_error(errno, std::generic_category(), "wireless_loop_new");
+  }
+  ~event_loop() { wireless_loop_free(loop_); }
+
+  event_loop(const event_loop &) = delete;
+  event_loop &operator=(const event_loop &) = delete;
+
+  /* readable whenever dispatch() has something to do */
+  int fd() const { return wireless_loop_fd(loop_); }
+  int dispatch() { return wireless_loop_dispatch(loop_); }
+  wireless_loop *get() const { return loop_; }
+
+  /* without a resumer, coroutines resume inside dispatch() */
+  void set_resumer(resumer r) { resumer_ = std::move(r); }
+  void resume(std::coroutine_handle<> h)
+  {
+    if (resumer_)
+      resumer_(h);
+    else
+      h.resume();
+  }
+
+  snapshot_op snapshot(std::string ifname, unsigned fields = WS_ALL)
+  {
+    return snapshot_op(*this, std::move(ifname), fields);
+  }
+  link_event_op next_link_event() { return link_event_op(*this); }
+  scan_op scan(std::string ifname) { return scan_op(*this, std::move(ifname)); }
+
+private:
+  wireless_loop *loop_;
+  resumer resumer_;
+};
+
+inline void snapshot_op::await_suspend(std::coroutine_handle<> h)
+{
+  handle_ = h;
+  work_.fn = &snapshot_op::run;
+  work_.arg = this;
+  wireless_loop_post(loop_.get(), &work_);
+}
+
+inline void snapshot_op::run(void *arg)
+{
+  auto *op = static_cast<snapshot_op *>(arg);
+
+  if (wireless_loop_snapshot(op->loop_.get(), op->ifname_.c_str(), op->fields_,
+                             &op->snap_) < 0)
+    op->error_ = errno;
+  op->loop_.resume(op->handle_);
+}
+
+inline void link_event_op::await_suspend(std::coroutine_handle<> h)
+{
+  handle_ = h;
+  waiter_.fn = &link_event_op::run;
+  waiter_.arg = this;
+  wireless_loop_next_link(loop_.get(), &waiter_);
+}
+
+inline void link_event_op::run(const wireless_link_event *ev, void *arg)
+{
+  auto *op = static_cast<link_event_op *>(arg);
+
+  op->event_ = *ev;
+  op->loop_.resume(op->handle_);
+}
+
+inline void scan_op::await_suspend(std::coroutine_handle<> h)
+{
+  handle_ = h;
+  wireless_loop_scan(loop_.get(), &req_, ifname_.c_str(), nullptr, &scan_op::run, this);
+}
+
+inline void scan_op::run(wireless_scan_req *, void *arg)
+{
+  auto *op = static_cast<scan_op *>(arg);
+
+  op->loop_.resume(op->handle_);
+}
+
+/*
+ * Minimal eagerly started coroutine type for callers without their
+ * own; the frame is freed when the coroutine finishes
+ */
+template <typename T = void>
+struct task;
+
+template <>
+struct task<void> {
+  struct promise_type {
+    task get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+} /* namespace wireless */
+
+#endif /* WIRELESS_ASYNC_HPP */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,1126 @@
+/*
+    Benchmarks for the sampler's building blocks
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Each benchmark is a subcommand:
+ *
+ *   wireless-bench wheel [interfaces] [seconds]
+ *   wireless-bench loop [seconds]
+ *   wireless-bench place [seconds] [ifname...]
+ *   wireless-bench backend [max_interfaces] [ms] [ifname]
+ *
+ * loop needs link events; run it under libwireless-preload.so.  Its
+ * CPU time is the whole process, so it includes the generator thread.
+ * place samples real interfaces, or synthetic ones under the preload.
+ * backend needs neither: what has no hardware behind it is mocked.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <libnetlink.h>
+#include <linux/genetlink.h>
+#include <linux/nl80211.h>
+
+#include "clock.h"
+#include "wheel.h"
+#include "loop.h"
+#include "journald.h"
+#include "sample.h"
+#include "placement.h"
+#include "worker.h"
+
+/* Sampling intervals the simulated interfaces pick from, in seconds */
+static const int bench_intervals[] = { 1, 2, 5, 10, 30, 60 };
+
+/*
+ * One simulated interface of the scheduling benchmark
+ */
+struct bench_iface {
+  struct wheel_timer timer;
+  unsigned long long interval_ns;
+  unsigned long long due_ns;    /* when it asked to be sampled */
+};
+
+/*
+ * Totals for one scheduler run
+ */
+struct bench_result {
+  unsigned long long wakeups;
+  unsigned long long samples;
+  unsigned long long delay_ns;  /* sum of firing time minus due time */
+  unsigned long long cpu_ns;
+};
+
+/*
+ * CPU time of the process, to charge scheduling overhead
+ */
+static unsigned long long cpu_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (unsigned long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Gives every simulated interface an interval and a random phase
+ */
+static void bench_ifaces_init(struct bench_iface *ifs, int n)
+{
+  int i;
+
+  srand(1);
+  for (i = 0; i < n; i++) {
+    int k = rand() % (sizeof(bench_intervals) / sizeof(bench_intervals[0]));
+
+    memset(&ifs[i], 0, sizeof(ifs[i]));
+    ifs[i].interval_ns = bench_intervals[k] * NSEC_PER_SEC;
+    ifs[i].due_ns = (unsigned long long)rand() % ifs[i].interval_ns;
+  }
+}
+
+/* Simulated clock while the wheel callback runs */
+static unsigned long long bench_now;
+static struct bench_result *bench_res;
+
+/*
+ * Wheel callback: account the sample and reschedule
+ */
+static void bench_fire(struct wheel_timer *t, void *arg)
+{
+  struct bench_iface *bi = wheel_entry(t, struct bench_iface, timer);
+  struct wheel *w = arg;
+
+  bench_res->samples++;
+  bench_res->delay_ns += bench_now - bi->due_ns;
+  bi->due_ns += bi->interval_ns;
+  wheel_add(w, t, bi->due_ns);
+}
+
+/*
+ * Runs the wheel over simulated time, waking only when it asks to
+ */
+static void bench_wheel_run(struct bench_iface *ifs, int n,
+                            unsigned long long duration_ns,
+                            unsigned long long slack_ns,
+                            struct bench_result *res)
+{
+  static struct wheel w;
+  unsigned long long start;
+  long long next;
+  int i;
+
+  memset(res, 0, sizeof(*res));
+  bench_res = res;
+  start = cpu_ns();
+
+  wheel_init(&w, 10 * NSEC_PER_MSEC, slack_ns, 0);
+  for (i = 0; i < n; i++)
+    wheel_add(&w, &ifs[i].timer, ifs[i].due_ns);
+
+  while ((next = wheel_next_ns(&w)) >= 0 && (unsigned long long)next < duration_ns) {
+    bench_now = next;
+    res->wakeups++;
+    wheel_run(&w, bench_now, bench_fire, &w);
+  }
+
+  res->cpu_ns = cpu_ns() - start;
+}
+
+/*
+ * Binary min-heap of deadlines, the baseline without coalescing
+ */
+static void heap_sift_down(struct bench_iface **heap, int n, int i)
+{
+  for (;;) {
+    int l = 2 * i + 1, r = l + 1, m = i;
+    struct bench_iface *tmp;
+
+    if (l < n && heap[l]->due_ns < heap[m]->due_ns)
+      m = l;
+    if (r < n && heap[r]->due_ns < heap[m]->due_ns)
+      m = r;
+    if (m == i)
+      return;
+    tmp = heap[i];
+    heap[i] = heap[m];
+    heap[m] = tmp;
+    i = m;
+  }
+}
+
+/*
+ * Runs the heap over simulated time, waking at every distinct deadline
+ */
+static void bench_heap_run(struct bench_iface *ifs, int n,
+                           unsigned long long duration_ns,
+                           struct bench_result *res)
+{
+  struct bench_iface **heap = malloc(n * sizeof(*heap));
+  unsigned long long start;
+  int i;
+
+  memset(res, 0, sizeof(*res));
+  start = cpu_ns();
+
+  for (i = 0; i < n; i++)
+    heap[i] = &ifs[i];
+  for (i = n / 2 - 1; i >= 0; i--)
+    heap_sift_down(heap, n, i);
+
+  while (heap[0]->due_ns < duration_ns) {
+    unsigned long long now = heap[0]->due_ns;
+
+    res->wakeups++;
+    while (heap[0]->due_ns <= now) {
+      res->samples++;
+      heap[0]->due_ns += heap[0]->interval_ns;
+      heap_sift_down(heap, n, 0);
+    }
+  }
+
+  res->cpu_ns = cpu_ns() - start;
+  free(heap);
+}
+
+/*
+ * Prints one result row
+ */
+static void bench_print(const char *name, unsigned long long slack_ns,
+                        double seconds, const struct bench_result *res)
+{
+  printf("%-8s %8llu %12.2f %12.1f %10.1f %14.3f\n",
+         name, slack_ns / NSEC_PER_MSEC,
+         res->wakeups / seconds, res->samples / seconds,
+         res->samples ? (double)res->cpu_ns / res->samples : 0.0,
+         res->samples ? (double)res->delay_ns / res->samples / NSEC_PER_MSEC : 0.0);
+}
+
+/*
+ * Wakeups and scheduling cost of the sampling wheel against a heap
+ */
+static int bench_wheel(int argc, char **argv)
+{
+  static const unsigned long long slacks_ms[] = { 0, 10, 100, 250, 1000 };
+  int n = argc > 0 ? atoi(argv[0]) : 10000;
+  int seconds = argc > 1 ? atoi(argv[1]) : 600;
+  unsigned long long duration_ns = seconds * NSEC_PER_SEC;
+  struct bench_iface *ifs;
+  struct bench_result res;
+  unsigned int i;
+
+  if (n <= 0 || seconds <= 0)
+    return -1;
+  if ((ifs = malloc(n * sizeof(*ifs))) == NULL) {
+    perror("malloc");
+    return -1;
+  }
+
+  printf("%d interfaces, %d s simulated, 10 ms ticks\n", n, seconds);
+  printf("%-8s %8s %12s %12s %10s %14s\n", "sched", "slack_ms",
+         "wakeups/s", "samples/s", "ns/sample", "mean_delay_ms");
+
+  bench_ifaces_init(ifs, n);
+  bench_heap_run(ifs, n, duration_ns, &res);
+  bench_print("heap", 0, seconds, &res);
+
+  for (i = 0; i < sizeof(slacks_ms) / sizeof(slacks_ms[0]); i++) {
+    bench_ifaces_init(ifs, n);
+    bench_wheel_run(ifs, n, duration_ns, slacks_ms[i] * NSEC_PER_MSEC, &res);
+    bench_print("wheel", slacks_ms[i] * NSEC_PER_MSEC, seconds, &res);
+  }
+
+  free(ifs);
+  return 0;
+}
+
+/*
+ * State of one engine run of the loop benchmark: every link event is
+ * formatted to a file and sent as a journal record, as the monitor does
+ */
+struct bench_loop {
+  struct wireless_loop *loop;
+  struct journald *journal;
+  int fd;
+  char out[65536];
+  size_t len;
+  volatile sig_atomic_t stop;
+  struct loop_timer deadline;
+};
+
+/*
+ * Formats a link event for both sinks
+ */
+static int bench_loop_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+                          void *arg)
+{
+  struct bench_loop *b = arg;
+  struct ifinfomsg *ifi = NLMSG_DATA(n);
+  struct rtattr *tb[IFLA_MAX + 1];
+  int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+  const char *ifname;
+  int operstate;
+
+  if (len < 0 || n->nlmsg_type != RTM_NEWLINK)
+    return 0;
+  parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+  ifname = tb[IFLA_IFNAME] ? rta_getattr_str(tb[IFLA_IFNAME]) : "<nil>";
+  operstate = tb[IFLA_OPERSTATE] ? rta_getattr_u8(tb[IFLA_OPERSTATE]) : -1;
+
+  if (sizeof(b->out) - b->len < 128) {
+    wireless_loop_write(b->loop, b->fd, b->out, b->len);
+    b->len = 0;
+  }
+  b->len += snprintf(b->out + b->len, sizeof(b->out) - b->len,
+                     "%llu %s state %d\n",
+                     clock_realtime_ns() / NSEC_PER_USEC, ifname, operstate);
+
+  journald_begin(b->journal, LOG_INFO, "%s state %d", ifname, operstate);
+  journald_field(b->journal, "IFNAME", "%s", ifname);
+  journald_field(b->journal, "OPERSTATE", "%d", operstate);
+  journald_end(b->journal);
+  return 0;
+}
+
+/*
+ * Queues a journal record on the loop
+ */
+static int bench_loop_send(int fd, const void *data, size_t len,
+                           const struct sockaddr *addr, socklen_t addrlen,
+                           void *arg)
+{
+  return wireless_loop_sendto(arg, fd, data, len, addr, addrlen);
+}
+
+/*
+ * End of dispatch: hands the batched output to the loop
+ */
+static void bench_loop_flush(void *arg)
+{
+  struct bench_loop *b = arg;
+
+  if (b->len)
+    wireless_loop_write(b->loop, b->fd, b->out, b->len);
+  b->len = 0;
+  if (wireless_loop_engine(b->loop) == LOOP_ENGINE_URING)
+    journald_drain(b->journal, bench_loop_send, b->loop);
+  else
+    journald_flush(b->journal);
+}
+
+/*
+ * Ends a run
+ */
+static void bench_loop_deadline(struct loop_timer *t, void *arg)
+{
+  struct bench_loop *b = arg;
+
+  b->stop = 1;
+}
+
+/*
+ * Journal stand-in: receives and discards records until *arg is set
+ */
+static void *bench_loop_drain(void *arg)
+{
+  volatile int *fd = arg;
+  char buf[4096];
+
+  while (*fd >= 0)
+    recv(*fd, buf, sizeof(buf), 0);
+  return NULL;
+}
+
+/*
+ * Runs one engine for the given time and prints its row
+ */
+static int bench_loop_run(enum loop_engine engine, const char *name,
+                          const char *journal_path, int seconds)
+{
+  struct bench_loop *b;
+  struct wireless_loop_stats st;
+  unsigned long long cpu, start;
+  double events, elapsed;
+
+  if ((b = calloc(1, sizeof(*b))) == NULL)
+    return -1;
+  if ((b->fd = open("/dev/null", O_WRONLY)) < 0 ||
+      (b->journal = journald_open(journal_path)) == NULL ||
+      (b->loop = wireless_loop_new_engine(10 * NSEC_PER_MSEC, 0, engine)) == NULL) {
+    perror(name);
+    return -1;
+  }
+  if (wireless_loop_engine(b->loop) != engine) {
+    wireless_loop_free(b->loop);
+    journald_close(b->journal);
+    close(b->fd);
+    free(b);
+    return 0;
+  }
+
+  wireless_loop_on_message(b->loop, bench_loop_msg, b);
+  wireless_loop_on_dispatch(b->loop, bench_loop_flush, b);
+  b->deadline.fn = bench_loop_deadline;
+  b->deadline.arg = b;
+  start = clock_monotonic_ns();
+  wireless_loop_timer_add(b->loop, &b->deadline, start + seconds * NSEC_PER_SEC);
+
+  cpu = cpu_ns();
+  wireless_loop_run(b->loop, &b->stop);
+  wireless_loop_flush(b->loop);
+  cpu = cpu_ns() - cpu;
+  elapsed = (double)(clock_monotonic_ns() - start) / NSEC_PER_SEC;
+
+  wireless_loop_stats(b->loop, &st);
+  events = st.messages ? st.messages : 1;
+  printf("%-8s %10.0f %14.2f %12.2f %15.2f\n", name,
+         st.messages / elapsed, st.syscalls / events,
+         cpu / events / NSEC_PER_USEC,
+         st.dispatches ? (double)st.messages / st.dispatches : 0.0);
+
+  wireless_loop_free(b->loop);
+  journald_close(b->journal);
+  close(b->fd);
+  free(b);
+  return 0;
+}
+
+/*
+ * Syscalls and CPU per link event with the epoll and io_uring engines,
+ * each formatting every event to a file and to a journal stand-in
+ */
+static int bench_loop(int argc, char **argv)
+{
+  int seconds = argc > 0 ? atoi(argv[0]) : 5;
+  struct sockaddr_un addr;
+  pthread_t thread;
+  int fd, drain_fd;
+
+  if (seconds <= 0)
+    return -1;
+  if (!getenv("LD_PRELOAD"))
+    fprintf(stderr, "no LD_PRELOAD: events come from the real rtnetlink only\n");
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/wireless-bench-%d.sock",
+           (int)getpid());
+  if ((fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0 ||
+      bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror(addr.sun_path);
+    return -1;
+  }
+  drain_fd = fd;
+  pthread_create(&thread, NULL, bench_loop_drain, &drain_fd);
+
+  printf("%d s per engine, events to a file and a journal socket\n", seconds);
+  printf("%-8s %10s %14s %12s %15s\n", "engine", "events/s",
+         "syscalls/event", "cpu_us/event", "events/dispatch");
+  bench_loop_run(LOOP_ENGINE_EPOLL, "epoll", addr.sun_path, seconds);
+  bench_loop_run(LOOP_ENGINE_URING, "io_uring", addr.sun_path, seconds);
+
+  drain_fd = -1;
+  shutdown(fd, SHUT_RDWR);
+  pthread_join(thread, NULL);
+  close(fd);
+  unlink(addr.sun_path);
+  return 0;
+}
+
+/*
+ * State of one run of the placement benchmark: every interface has one
+ * snapshot out at a time, requested again as soon as it comes back
+ */
+struct bench_place {
+  struct wireless_loop *loop;
+  volatile sig_atomic_t stop;
+  struct loop_timer deadline;
+  struct skew_hist snapshot;    /* the ioctls alone */
+  struct skew_hist total;       /* request to result on the loop thread */
+};
+
+/*
+ * A snapshot came back: counts it and asks for the next
+ */
+static void bench_place_done(struct worker_job *job, void *arg)
+{
+  struct bench_place *b = arg;
+
+  skew_hist_add(&b->snapshot, job->end_ns - job->start_ns);
+  skew_hist_add(&b->total, clock_monotonic_ns() - job->submit_ns);
+  if (!b->stop)
+    worker_submit(job, WS_AP | WS_BITRATE | WS_STATS);
+}
+
+/*
+ * Ends a run
+ */
+static void bench_place_deadline(struct loop_timer *t, void *arg)
+{
+  struct bench_place *b = arg;
+
+  b->stop = 1;
+}
+
+/*
+ * Prints one row of the placement benchmark
+ */
+static void bench_place_print(const char *name, const struct bench_place *b,
+                              int workers, double elapsed)
+{
+  printf("%-9s %7d %10.0f %9.2f %8llu %8llu %9.2f %8llu %8llu\n", name, workers,
+         b->total.count / elapsed,
+         b->snapshot.count ? (double)b->snapshot.sum_ns / b->snapshot.count / NSEC_PER_USEC : 0,
+         skew_hist_quantile(&b->snapshot, 0.5), skew_hist_quantile(&b->snapshot, 0.99),
+         b->total.count ? (double)b->total.sum_ns / b->total.count / NSEC_PER_USEC : 0,
+         skew_hist_quantile(&b->total, 0.5), skew_hist_quantile(&b->total, 0.99));
+}
+
+/*
+ * Samples the interfaces on the loop thread, as the monitor does
+ * without -A
+ */
+static void bench_place_inline(char **ifnames, int n, int seconds)
+{
+  struct bench_place b;
+  struct wireless_snapshot snap;
+  unsigned long long start = clock_monotonic_ns(), end, t;
+  int i;
+
+  memset(&b, 0, sizeof(b));
+  end = start + seconds * NSEC_PER_SEC;
+  do {
+    for (i = 0; i < n; i++) {
+      t = clock_monotonic_ns();
+      wireless_snapshot(ifnames[i], WS_AP | WS_BITRATE | WS_STATS, &snap);
+      t = clock_monotonic_ns() - t;
+      skew_hist_add(&b.snapshot, t);
+      skew_hist_add(&b.total, t);
+    }
+  } while (clock_monotonic_ns() < end);
+  bench_place_print("inline", &b, 0,
+                    (double)(clock_monotonic_ns() - start) / NSEC_PER_SEC);
+}
+
+/*
+ * Samples the interfaces on workers, either pinned near each device or
+ * one left wherever the scheduler puts it
+ */
+static int bench_place_run(char **ifnames, int n, int seconds, int pinned)
+{
+  struct bench_place *b;
+  struct worker_job **jobs;
+  struct worker *w, *seen[WORKER_MAX];
+  unsigned long long start;
+  int i, j, workers = 0;
+
+  if ((b = calloc(1, sizeof(*b))) == NULL ||
+      (jobs = calloc(n, sizeof(*jobs))) == NULL ||
+      (b->loop = wireless_loop_new(10 * NSEC_PER_MSEC, 0)) == NULL) {
+    perror("place");
+    return -1;
+  }
+
+  for (i = 0; i < n; i++) {
+    struct placement p;
+
+    if (placement_for(ifnames[i], &p) < 0)
+      return -1;
+    if (!pinned) {
+      sched_getaffinity(0, sizeof(p.cpus), &p.cpus);
+      p.node = -1;
+    }
+    if ((w = worker_get(b->loop, &p)) == NULL ||
+        (jobs[i] = worker_job_new(w, ifnames[i], NULL, bench_place_done, b)) == NULL)
+      return -1;
+    for (j = 0; j < workers && seen[j] != w; j++)
+      ;
+    if (j == workers)
+      seen[workers++] = w;
+  }
+
+  b->deadline.fn = bench_place_deadline;
+  b->deadline.arg = b;
+  start = clock_monotonic_ns();
+  wireless_loop_timer_add(b->loop, &b->deadline, start + seconds * NSEC_PER_SEC);
+  for (i = 0; i < n; i++)
+    worker_submit(jobs[i], WS_AP | WS_BITRATE | WS_STATS);
+  wireless_loop_run(b->loop, &b->stop);
+
+  worker_stop_all();
+  bench_place_print(pinned ? "pinned" : "unpinned", b, workers,
+                    (double)(clock_monotonic_ns() - start) / NSEC_PER_SEC);
+  wireless_loop_free(b->loop);
+  free(jobs);
+  free(b);
+  return 0;
+}
+
+/*
+ * Per-sample latency on the loop thread, on an unpinned worker and on
+ * workers pinned to the cache domain of each device's interrupts
+ */
+static int bench_place(int argc, char **argv)
+{
+  static char *default_ifnames[] = { "wlan0" };
+  int seconds = argc > 0 ? atoi(argv[0]) : 5;
+  char **ifnames = argc > 1 ? argv + 1 : default_ifnames;
+  int n = argc > 1 ? argc - 1 : 1;
+  int i;
+
+  if (seconds <= 0)
+    return -1;
+
+  for (i = 0; i < n; i++) {
+    struct placement p;
+    char irq_cpus[256], cpus[256];
+
+    placement_for(ifnames[i], &p);
+    placement_format_cpulist(&p.irq_cpus, irq_cpus, sizeof(irq_cpus));
+    placement_format_cpulist(&p.cpus, cpus, sizeof(cpus));
+    printf("%s: irqs=%d irq_cpus=%s cpus=%s node=%d\n",
+           ifnames[i], p.irqs, irq_cpus, cpus, p.node);
+  }
+  printf("%d s per mode, AP, bitrate and statistics per snapshot\n", seconds);
+  printf("%-9s %7s %10s %9s %8s %8s %9s %8s %8s\n", "mode", "workers",
+         "samples/s", "ioctl_us", "p50_us", "p99_us", "total_us", "p50_us", "p99_us");
+  bench_place_inline(ifnames, n, seconds);
+  if (bench_place_run(ifnames, n, seconds, 0) < 0 ||
+      bench_place_run(ifnames, n, seconds, 1) < 0)
+    return -1;
+  return 0;
+}
+
+/* Interface counts swept by the backend benchmark */
+static const int backend_sizes[] = { 1, 10, 100, 1000, 10000 };
+
+#define BACKEND_DGRAM    16384  /* dump datagrams, as the kernel fills them */
+#define BACKEND_LINK_LEN 1024   /* typical RTM_NEWLINK of a wireless device */
+#define BACKEND_GENL_ID  0x1c   /* family id the mock gives nl80211 */
+
+/*
+ * Mock kernel for the netlink paths, on the other end of a socket pair:
+ * answers an RTM_GETLINK dump with n prebuilt link messages and an
+ * nl80211 station dump with one station, each followed by NLMSG_DONE
+ */
+struct backend_mock {
+  int fd[2];                    /* [0] the client's, [1] the mock's */
+  pthread_t thread;
+  int n;
+  char *dump;                   /* link messages, BACKEND_DGRAM per datagram */
+  size_t *ends;                 /* where each datagram stops */
+  int dgrams;
+  char proc_path[64];           /* /proc/net/wireless listing of n interfaces */
+};
+
+/*
+ * Appends an attribute to a message being built
+ */
+static struct rtattr *backend_attr(struct nlmsghdr *n, int type,
+                                   const void *data, int len)
+{
+  struct rtattr *rta = (struct rtattr *)((char *)n + NLMSG_ALIGN(n->nlmsg_len));
+
+  rta->rta_type = type;
+  rta->rta_len = RTA_LENGTH(len);
+  if (data)
+    memcpy(RTA_DATA(rta), data, len);
+  else
+    memset(RTA_DATA(rta), 0, len);
+  n->nlmsg_len = NLMSG_ALIGN(n->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+  return rta;
+}
+
+/*
+ * Builds the station dump reply for one interface
+ */
+static size_t backend_station(char *buf, int ifindex)
+{
+  struct nlmsghdr *n = (struct nlmsghdr *)buf;
+  struct genlmsghdr *g = NLMSG_DATA(n);
+  struct rtattr *info;
+  unsigned char mac[6] = { 0x02, 0, 0, 0, 0, 1 };
+  __u32 u32 = 12;
+  __u8 signal = -56;
+  __u64 u64 = 123456;
+
+  memset(buf, 0, NLMSG_LENGTH(sizeof(*g)));
+  n->nlmsg_len = NLMSG_LENGTH(sizeof(*g));
+  n->nlmsg_type = BACKEND_GENL_ID;
+  n->nlmsg_flags = NLM_F_MULTI;
+  g->cmd = NL80211_CMD_NEW_STATION;
+  backend_attr(n, NL80211_ATTR_IFINDEX, &ifindex, sizeof(ifindex));
+  backend_attr(n, NL80211_ATTR_MAC, mac, sizeof(mac));
+  info = backend_attr(n, NL80211_ATTR_STA_INFO, NULL, 0);
+  backend_attr(n, NL80211_STA_INFO_INACTIVE_TIME, &u32, sizeof(u32));
+  backend_attr(n, NL80211_STA_INFO_RX_BYTES64, &u64, sizeof(u64));
+  backend_attr(n, NL80211_STA_INFO_TX_BYTES64, &u64, sizeof(u64));
+  backend_attr(n, NL80211_STA_INFO_RX_PACKETS, &u32, sizeof(u32));
+  backend_attr(n, NL80211_STA_INFO_TX_PACKETS, &u32, sizeof(u32));
+  backend_attr(n, NL80211_STA_INFO_TX_RETRIES, &u32, sizeof(u32));
+  backend_attr(n, NL80211_STA_INFO_TX_FAILED, &u32, sizeof(u32));
+  backend_attr(n, NL80211_STA_INFO_SIGNAL, &signal, sizeof(signal));
+  backend_attr(n, NL80211_STA_INFO_SIGNAL_AVG, &signal, sizeof(signal));
+  backend_attr(n, NL80211_STA_INFO_BEACON_LOSS, &u32, sizeof(u32));
+  info->rta_len = (char *)n + n->nlmsg_len - (char *)info;
+  return n->nlmsg_len;
+}
+
+/*
+ * Mock kernel thread: answers requests until the client shuts down
+ */
+static void *backend_mock_run(void *arg)
+{
+  struct backend_mock *m = arg;
+  char req[256], reply[512];
+  struct nlmsghdr *n = (struct nlmsghdr *)req, done;
+  struct rtattr *rta;
+  size_t start;
+  int i, ifindex;
+
+  memset(&done, 0, sizeof(done));
+  done.nlmsg_len = NLMSG_LENGTH(0);
+  done.nlmsg_type = NLMSG_DONE;
+  done.nlmsg_flags = NLM_F_MULTI;
+
+  while (recv(m->fd[1], req, sizeof(req), 0) > 0) {
+    if (n->nlmsg_type == RTM_GETLINK) {
+      for (i = 0, start = 0; i < m->dgrams; start = m->ends[i++])
+        send(m->fd[1], m->dump + start, m->ends[i] - start, 0);
+    } else {
+      rta = (struct rtattr *)((char *)NLMSG_DATA(n) + GENL_HDRLEN);
+      memcpy(&ifindex, RTA_DATA(rta), sizeof(ifindex));
+      send(m->fd[1], reply, backend_station(reply, ifindex), 0);
+    }
+    send(m->fd[1], &done, done.nlmsg_len, 0);
+  }
+  return NULL;
+}
+
+/*
+ * Prepares the mock data of n interfaces and starts the mock kernel
+ */
+static int backend_mock_start(struct backend_mock *m, int n)
+{
+  char msg[BACKEND_LINK_LEN], ifname[IFNAMSIZ];
+  struct nlmsghdr *h = (struct nlmsghdr *)msg;
+  struct ifinfomsg *ifi = NLMSG_DATA(h);
+  struct rtnl_link_stats64 stats;
+  size_t len = 0, dgram = 0;
+  __u8 operstate = IF_OPER_UP;
+  FILE *f;
+  int i, fd;
+
+  memset(m, 0, sizeof(*m));
+  m->n = n;
+  if ((m->dump = malloc((size_t)n * BACKEND_LINK_LEN)) == NULL ||
+      (m->ends = malloc((n + 1) * sizeof(*m->ends))) == NULL)
+    return -1;
+
+  memset(&stats, 0, sizeof(stats));
+  for (i = 0; i < n; i++) {
+    memset(msg, 0, sizeof(msg));
+    h->nlmsg_len = NLMSG_LENGTH(sizeof(*ifi));
+    h->nlmsg_type = RTM_NEWLINK;
+    h->nlmsg_flags = NLM_F_MULTI;
+    ifi->ifi_index = i + 1;
+    ifi->ifi_flags = IFF_UP | IFF_RUNNING;
+    snprintf(ifname, sizeof(ifname), "wlan%d", i);
+    backend_attr(h, IFLA_IFNAME, ifname, strlen(ifname) + 1);
+    backend_attr(h, IFLA_OPERSTATE, &operstate, sizeof(operstate));
+    backend_attr(h, IFLA_STATS64, &stats, sizeof(stats));
+    /* the qdisc, af_spec and the rest, as padding */
+    backend_attr(h, IFLA_PAD, NULL,
+                 BACKEND_LINK_LEN - NLMSG_ALIGN(h->nlmsg_len) - RTA_LENGTH(0));
+
+    if (len + h->nlmsg_len - dgram > BACKEND_DGRAM) {
+      m->ends[m->dgrams++] = len;
+      dgram = len;
+    }
+    memcpy(m->dump + len, msg, h->nlmsg_len);
+    len += h->nlmsg_len;
+  }
+  m->ends[m->dgrams++] = len;
+
+  snprintf(m->proc_path, sizeof(m->proc_path), "/tmp/wireless-bench-%d.proc",
+           (int)getpid());
+  if ((fd = open(m->proc_path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0 ||
+      (f = fdopen(fd, "w")) == NULL) {
+    perror(m->proc_path);
+    return -1;
+  }
+  fprintf(f, "Inter-| sta-|   Quality        |   Discarded packets               | Missed | WE\n"
+             " face | tus | link level noise |  nwid  crypt   frag  retry   misc | beacon | 22\n");
+  for (i = 0; i < n; i++)
+    fprintf(f, "%6s%d: %04x  %3d%c  %3d%c  %3d%c  %6d %6d %6d %6d %6d   %6d\n",
+            "wlan", i, 0, 54, '.', -56, '.', -95, '.', 0, 0, 0, i % 100, 0, 0);
+  fclose(f);
+
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, m->fd) < 0) {
+    perror("socketpair");
+    return -1;
+  }
+  return pthread_create(&m->thread, NULL, backend_mock_run, m) ? -1 : 0;
+}
+
+/*
+ * Stops the mock kernel and frees its data
+ */
+static void backend_mock_stop(struct backend_mock *m)
+{
+  shutdown(m->fd[0], SHUT_RDWR);
+  close(m->fd[0]);
+  pthread_join(m->thread, NULL);
+  close(m->fd[1]);
+  unlink(m->proc_path);
+  free(m->dump);
+  free(m->ends);
+}
+
+/*
+ * What one round of a backend read, to keep the work from being
+ * optimized away
+ */
+struct backend_round {
+  unsigned long syscalls;
+  long long sum;
+  int ifaces;
+};
+
+/*
+ * SIOCGIWSTATS for each interface in turn, on one socket.  Without
+ * hardware every ioctl goes to the same device, which costs the
+ * syscall and the device lookup but not the driver.
+ */
+static void backend_wext(struct backend_mock *m, int sock, const char *ifname,
+                         struct backend_round *r)
+{
+  struct iw_statistics stats;
+  struct iwreq wrq;
+  int i;
+
+  for (i = 0; i < m->n; i++) {
+    memset(&wrq, 0, sizeof(wrq));
+    strncpy(wrq.ifr_name, ifname, IFNAMSIZ - 1);
+    wrq.u.data.pointer = &stats;
+    wrq.u.data.length = sizeof(stats);
+    wrq.u.data.flags = 1;
+    if (ioctl(sock, SIOCGIWSTATS, &wrq) == 0)
+      r->sum += stats.qual.level;
+    r->syscalls++;
+    r->ifaces++;
+  }
+}
+
+/*
+ * Callback of the /proc read
+ */
+static void backend_proc_iface(const char *ifname,
+                               const struct wireless_snapshot *snap, void *arg)
+{
+  struct backend_round *r = arg;
+
+  r->sum += snap->level + snap->noise + snap->discard_retries;
+  r->ifaces++;
+}
+
+/*
+ * One read of the /proc/net/wireless listing
+ */
+static void backend_proc(struct backend_mock *m, struct backend_round *r)
+{
+  struct stat st;
+
+  wireless_proc_stats(m->proc_path, backend_proc_iface, r);
+  stat(m->proc_path, &st);
+  /* open, the reads of 64k and the empty one, close */
+  r->syscalls += 3 + st.st_size / 65535 + 1;
+}
+
+/*
+ * Receives and parses a dump up to NLMSG_DONE
+ */
+static void backend_recv_dump(struct backend_mock *m, struct backend_round *r,
+                              int genl)
+{
+  static char buf[BACKEND_DGRAM];
+  struct rtattr *tb[NL80211_ATTR_MAX + 1], *info[NL80211_STA_INFO_MAX + 1];
+  struct nlmsghdr *h;
+  int len;
+
+  for (;;) {
+    len = recv(m->fd[0], buf, sizeof(buf), 0);
+    r->syscalls++;
+    if (len <= 0)
+      return;
+    for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, (unsigned int)len);
+         h = NLMSG_NEXT(h, len)) {
+      if (h->nlmsg_type == NLMSG_DONE)
+        return;
+      if (!genl) {
+        struct ifinfomsg *ifi = NLMSG_DATA(h);
+
+        parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi),
+                     h->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi)));
+        if (tb[IFLA_IFNAME] && tb[IFLA_STATS64]) {
+          r->sum += rta_getattr_str(tb[IFLA_IFNAME])[0];
+          r->ifaces++;
+        }
+        continue;
+      }
+      parse_rtattr(tb, NL80211_ATTR_MAX,
+                   (struct rtattr *)((char *)NLMSG_DATA(h) + GENL_HDRLEN),
+                   h->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+      if (!tb[NL80211_ATTR_STA_INFO])
+        continue;
+      parse_rtattr(info, NL80211_STA_INFO_MAX, RTA_DATA(tb[NL80211_ATTR_STA_INFO]),
+                   RTA_PAYLOAD(tb[NL80211_ATTR_STA_INFO]));
+      if (info[NL80211_STA_INFO_SIGNAL] && info[NL80211_STA_INFO_TX_RETRIES]) {
+        r->sum += (__s8)rta_getattr_u8(info[NL80211_STA_INFO_SIGNAL]) +
+                  rta_getattr_u32(info[NL80211_STA_INFO_TX_RETRIES]);
+        r->ifaces++;
+      }
+    }
+  }
+}
+
+/*
+ * One RTM_GETLINK dump of every interface
+ */
+static void backend_rtnl(struct backend_mock *m, struct backend_round *r)
+{
+  struct {
+    struct nlmsghdr n;
+    struct ifinfomsg i;
+  } req;
+
+  memset(&req, 0, sizeof(req));
+  req.n.nlmsg_len = sizeof(req);
+  req.n.nlmsg_type = RTM_GETLINK;
+  req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  send(m->fd[0], &req, sizeof(req), 0);
+  r->syscalls++;
+  backend_recv_dump(m, r, 0);
+}
+
+/*
+ * An nl80211 station dump per interface, which is how nl80211 is
+ * asked for the signal and retries of an association
+ */
+static void backend_genl(struct backend_mock *m, struct backend_round *r)
+{
+  char buf[64];
+  struct nlmsghdr *n = (struct nlmsghdr *)buf;
+  struct genlmsghdr *g = NLMSG_DATA(n);
+  int i, ifindex;
+
+  for (i = 0; i < m->n; i++) {
+    memset(buf, 0, sizeof(buf));
+    n->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    n->nlmsg_type = BACKEND_GENL_ID;
+    n->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    g->cmd = NL80211_CMD_GET_STATION;
+    ifindex = i + 1;
+    backend_attr(n, NL80211_ATTR_IFINDEX, &ifindex, sizeof(ifindex));
+    send(m->fd[0], buf, n->nlmsg_len, 0);
+    r->syscalls++;
+    backend_recv_dump(m, r, 1);
+  }
+}
+
+/*
+ * The acquisition paths compared
+ */
+enum {
+  BACKEND_WEXT,
+  BACKEND_PROC,
+  BACKEND_RTNL,
+  BACKEND_GENL,
+  BACKEND_COUNT
+};
+
+static const char *backend_names[BACKEND_COUNT] = {
+  "wext", "proc", "rtnl", "genl"
+};
+
+/*
+ * Least squares fit of cost = fixed + per_iface * n, weighted by the
+ * inverse square of the cost so that small sweeps count as much as
+ * large ones
+ */
+static void backend_fit(const int *n, const double *cost, int points,
+                        double *fixed, double *per_iface)
+{
+  double sw = 0, swn = 0, swnn = 0, swc = 0, swnc = 0, w, det;
+  int i;
+
+  for (i = 0; i < points; i++) {
+    w = 1 / (cost[i] * cost[i]);
+    sw += w;
+    swn += w * n[i];
+    swnn += w * n[i] * n[i];
+    swc += w * cost[i];
+    swnc += w * n[i] * cost[i];
+  }
+  det = sw * swnn - swn * swn;
+  if (points < 2 || det == 0) {
+    *fixed = 0;
+    *per_iface = points ? cost[0] / n[0] : 0;
+    return;
+  }
+  *fixed = (swnn * swc - swn * swnc) / det;
+  *per_iface = (sw * swnc - swn * swc) / det;
+  if (*fixed < 0) {
+    /* no measurable fixed cost: fit through the origin */
+    *fixed = 0;
+    *per_iface = swnc / swnn;
+  }
+}
+
+/*
+ * Cost per sample and per interface of reading the statistics of every
+ * interface through each backend, swept over the interface count, and
+ * the linear cost model fitted to it
+ */
+static int bench_backend(int argc, char **argv)
+{
+  int max = argc > 0 ? atoi(argv[0]) : 10000;
+  int ms = argc > 1 ? atoi(argv[1]) : 200;
+  const char *ifname = argc > 2 ? argv[2] : "lo";
+  int sizes = sizeof(backend_sizes) / sizeof(backend_sizes[0]);
+  double cost[BACKEND_COUNT][sizeof(backend_sizes) / sizeof(backend_sizes[0])];
+  double fixed[BACKEND_COUNT], per[BACKEND_COUNT], best_cost, c;
+  int points = 0, b, i, j, best, sock;
+  struct backend_mock m;
+
+  if (max <= 0 || ms <= 0)
+    return -1;
+  if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+    perror("socket");
+    return -1;
+  }
+
+  printf("statistics of every interface, %d ms per point; wext ioctls go to %s,\n"
+         "proc reads a listing on disk, rtnl and genl talk to a mock kernel\n",
+         ms, ifname);
+  printf("%-8s %7s %8s %12s %12s %13s\n", "backend", "ifaces", "rounds",
+         "us/sample", "us/iface", "syscalls/iface");
+
+  for (i = 0; i < sizes && backend_sizes[i] <= max; i++, points++) {
+    if (backend_mock_start(&m, backend_sizes[i]) < 0)
+      return -1;
+    for (b = 0; b < BACKEND_COUNT; b++) {
+      struct backend_round r;
+      unsigned long long start = clock_monotonic_ns(), elapsed;
+      unsigned long rounds = 0;
+
+      memset(&r, 0, sizeof(r));
+      do {
+        switch (b) {
+          case BACKEND_WEXT: backend_wext(&m, sock, ifname, &r); break;
+          case BACKEND_PROC: backend_proc(&m, &r); break;
+          case BACKEND_RTNL: backend_rtnl(&m, &r); break;
+          case BACKEND_GENL: backend_genl(&m, &r); break;
+        }
+        rounds++;
+        elapsed = clock_monotonic_ns() - start;
+      } while (rounds < 3 || elapsed < ms * NSEC_PER_MSEC);
+
+      if (r.ifaces != (long long)rounds * m.n)
+        fprintf(stderr, "%s: %d of %llu interfaces read\n", backend_names[b],
+                r.ifaces, (unsigned long long)rounds * m.n);
+      cost[b][i] = (double)elapsed / rounds / NSEC_PER_USEC;
+      printf("%-8s %7d %8lu %12.2f %12.3f %13.2f\n", backend_names[b], m.n,
+             rounds, cost[b][i], cost[b][i] / m.n,
+             (double)r.syscalls / rounds / m.n);
+    }
+    backend_mock_stop(&m);
+  }
+  close(sock);
+
+  printf("\n");
+  for (b = 0; b < BACKEND_COUNT; b++) {
+    backend_fit(backend_sizes, cost[b], points, &fixed[b], &per[b]);
+    printf("model backend=%s fixed_us=%.2f per_iface_us=%.3f\n",
+           backend_names[b], fixed[b], per[b]);
+  }
+  for (b = 0; b < BACKEND_COUNT; b++)
+    for (j = b + 1; j < BACKEND_COUNT; j++)
+      if (per[b] != per[j] && (c = (fixed[j] - fixed[b]) / (per[b] - per[j])) >= 1)
+        printf("crossover %s=%s ifaces=%.0f\n", backend_names[b], backend_names[j], c);
+  for (i = 0; i < points; i++) {
+    best = 0;
+    best_cost = fixed[0] + per[0] * backend_sizes[i];
+    for (b = 1; b < BACKEND_COUNT; b++) {
+      c = fixed[b] + per[b] * backend_sizes[i];
+      if (c < best_cost) {
+        best = b;
+        best_cost = c;
+      }
+    }
+    printf("cheapest ifaces=%d backend=%s us=%.2f\n", backend_sizes[i],
+           backend_names[best], best_cost);
+  }
+  return 0;
+}
+
+/*
+ * Benchmark subcommands
+ */
+static const struct {
+  const char *name;
+  int (*run)(int argc, char **argv);
+  const char *args;
+} benches[] = {
+  { "wheel", bench_wheel, "[interfaces] [seconds]" },
+  { "loop", bench_loop, "[seconds]" },
+  { "place", bench_place, "[seconds] [ifname...]" },
+  { "backend", bench_backend, "[max_interfaces] [ms] [ifname]" },
+};
+
+/*
+ * Main application
+ */
+int main(int argc, char **argv)
+{
+  unsigned int i;
+
+  for (i = 0; argc > 1 && i < sizeof(benches) / sizeof(benches[0]); i++)
+    if (strcmp(argv[1], benches[i].name) == 0)
+      return benches[i].run(argc - 2, argv + 2) < 0 ? 1 : 0;
+
+  fprintf(stderr, "Usage:\n");
+  for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+    fprintf(stderr, "  %s %s %s\n", argv[0], benches[i].name, benches[i].args);
+  return 1;
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,972 @@
+/*
+    Byte-exact conformance harness for the monitor's text output
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Proves that the text wireless-info prints for interfaces and link
+ * events does not change, byte for byte, whichever way it is produced:
+ *
+ *   wireless-golden [-n runs] [-g expected] [fixture]
+ *   wireless-golden record [seconds] > fixture
+ *
+ * A fixture is what the monitor read: the replies to the wireless
+ * ioctls of each interface and the link messages, each with the time
+ * it arrived, one per line:
+ *
+ *   ioctl ifname request errno iwreq_data data
+ *   info sec.usec ifname
+ *   link sec.usec nlmsg
+ *
+ * with the request in hex, the reply's struct iwreq_data and what its
+ * pointer pointed at (or "-") in hex, and likewise the message.  An
+ * ioctl line answers that request from then on; an info line prints
+ * the interface's details as at startup, and a link line is received.
+ * record captures a fixture from the interfaces of this machine and
+ * the link messages of the next seconds (10).  Without a fixture a
+ * built-in one is used, which covers each case of the formatting code:
+ * no association, odd access points, each bitrate scale and kind of
+ * transmit power, invalid levels, failing queries, every operstate,
+ * deleted and nameless links.
+ *
+ * The fixture is replayed through wireless_info() and print_linkinfo()
+ * of wireless-info.c itself, included here, with its ioctls and clock
+ * answered from the fixture and the time zone set to UTC.  What each
+ * output path writes to stdout and stderr must be identical to what the
+ * legacy path writes, printf() into stdio's own buffer on fd 1, and its
+ * stdout to the expected output given to -g, which is written from the
+ * legacy path if it does not exist yet.  Each path then replays the
+ * fixture runs times (1000) into /dev/null for its throughput.  The
+ * exit status is 1 if any output differs.
+ *
+ * A new way of producing the text goes into golden_paths[], so that it
+ * is held to the legacy output from its first commit.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <net/if_arp.h>
+#include <linux/wireless.h>
+#include <linux/rtnetlink.h>
+
+/* wireless-info.c's queries and clock are answered from the fixture */
+#define ioctl golden_ioctl
+#define gettimeofday golden_gettimeofday
+#define main wireless_info_main
+static int golden_ioctl(int fd, unsigned long request, void *arg);
+static int golden_gettimeofday(struct timeval *tv, void *tz);
+#include "wireless-info.c"
+#undef ioctl
+#undef gettimeofday
+#undef main
+
+#define GOLDEN_REPLIES 4096
+#define GOLDEN_MSG_MAX 8192
+
+/*
+ * A driver's reply to one ioctl
+ */
+struct golden_reply {
+  char ifname[IFNAMSIZ];
+  unsigned long request;
+  int err;                      /* errno, 0 if it succeeded */
+  union iwreq_data u;
+  size_t len;                   /* of data */
+  unsigned char data[sizeof(struct iw_range)];
+};
+
+enum golden_kind {
+  GOLDEN_IOCTL,
+  GOLDEN_INFO,
+  GOLDEN_LINK
+};
+
+/*
+ * One line of a fixture
+ */
+struct golden_event {
+  int kind;
+  struct timeval tv;
+  char ifname[IFNAMSIZ];        /* GOLDEN_INFO */
+  struct nlmsghdr *msg;         /* GOLDEN_LINK */
+  struct golden_reply *reply;   /* GOLDEN_IOCTL */
+};
+
+/*
+ * A way of producing the text.  begin returns -1 if it is not
+ * available here; flush runs after each event, as the monitor's does
+ * after each dispatch.
+ */
+struct golden_path {
+  const char *name;
+  int (*begin)(void);
+  void (*flush)(void);
+  void (*end)(void);
+};
+
+/*
+ * The queries recorded, and their names in the built-in fixture
+ */
+static const struct {
+  unsigned long request;
+  const char *name;
+  size_t len;                   /* of the buffer its pointer points at */
+} golden_requests[] = {
+  { SIOCGIWNAME, "name", 0 },
+  { SIOCGIWESSID, "essid", IW_ESSID_MAX_SIZE + 2 },
+  { SIOCGIWAP, "ap", 0 },
+  { SIOCGIWRATE, "bitrate", 0 },
+  { SIOCGIWTXPOW, "txpower", 0 },
+  { SIOCGIWSTATS, "stats", sizeof(struct iw_statistics) },
+  { SIOCGIWRANGE, "range", sizeof(struct iw_range) },
+};
+
+#define GOLDEN_REQUESTS (sizeof(golden_requests) / sizeof(golden_requests[0]))
+
+static struct golden_event *golden_events;
+static size_t golden_event_count;
+static size_t golden_printed;           /* info and link events */
+
+/* Replies in force while replaying */
+static const struct golden_reply *golden_replies[GOLDEN_REPLIES];
+static int golden_reply_count;
+static int golden_replaying;
+static struct timeval golden_now;
+
+/*
+ * Whether a request's reply is read through its data pointer
+ */
+static int golden_pointer(unsigned long request)
+{
+  size_t i;
+
+  for (i = 0; i < GOLDEN_REQUESTS; i++)
+    if (golden_requests[i].request == request)
+      return golden_requests[i].len != 0;
+  return 0;
+}
+
+/*
+ * The ioctl as wireless-info.c sees it: while replaying, answered with
+ * the fixture's reply to the interface's request
+ */
+static int golden_ioctl(int fd, unsigned long request, void *arg)
+{
+  struct iwreq *wrq = arg;
+  const struct golden_reply *r = NULL;
+  void *pointer;
+  size_t room;
+  int i;
+
+  if (!golden_replaying)
+    return ioctl(fd, request, arg);
+
+  for (i = 0; i < golden_reply_count && !r; i++)
+    if (golden_replies[i]->request == request &&
+        strncmp(golden_replies[i]->ifname, wrq->ifr_name, IFNAMSIZ) == 0)
+      r = golden_replies[i];
+  if (!r) {
+    errno = ENODEV;
+    return -1;
+  }
+  if (r->err) {
+    errno = r->err;
+    return -1;
+  }
+  if (!golden_pointer(request)) {
+    wrq->u = r->u;
+    return 0;
+  }
+  pointer = wrq->u.data.pointer;
+  room = wrq->u.data.length;
+  wrq->u = r->u;
+  wrq->u.data.pointer = pointer;
+  memcpy(pointer, r->data, r->len < room ? r->len : room);
+  return 0;
+}
+
+/*
+ * The clock as wireless-info.c sees it: while replaying, the time the
+ * event being replayed arrived
+ */
+static int golden_gettimeofday(struct timeval *tv, void *tz)
+{
+  if (!golden_replaying)
+    return gettimeofday(tv, tz);
+  *tv = golden_now;
+  return 0;
+}
+
+/*
+ * Puts a reply in force in place of the interface's last to the request
+ */
+static void golden_answer(const struct golden_reply *r)
+{
+  int i;
+
+  for (i = 0; i < golden_reply_count; i++)
+    if (golden_replies[i]->request == r->request &&
+        strncmp(golden_replies[i]->ifname, r->ifname, IFNAMSIZ) == 0) {
+      golden_replies[i] = r;
+      return;
+    }
+  if (golden_reply_count < GOLDEN_REPLIES)
+    golden_replies[golden_reply_count++] = r;
+}
+
+/*
+ * Writes bytes in hex, or "-" if there are none
+ */
+static void golden_put_hex(FILE *fp, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+  size_t i;
+
+  if (!len)
+    fputc('-', fp);
+  for (i = 0; i < len; i++)
+    fprintf(fp, "%02x", p[i]);
+}
+
+/*
+ * Reads hex into buf; returns the number of bytes, -1 if it is not hex
+ * or does not fit
+ */
+static long golden_get_hex(const char *str, void *buf, size_t size)
+{
+  unsigned char *p = buf;
+  size_t len = strlen(str), i;
+  unsigned int byte;
+
+  if (strcmp(str, "-") == 0)
+    return 0;
+  if (len % 2 || len / 2 > size)
+    return -1;
+  for (i = 0; i < len / 2; i++) {
+    if (sscanf(str + 2 * i, "%2x", &byte) != 1)
+      return -1;
+    p[i] = byte;
+  }
+  return len / 2;
+}
+
+/*
+ * Writes an ioctl line
+ */
+static void golden_put_ioctl(FILE *fp, const char *ifname, unsigned long request,
+                             int err, const union iwreq_data *u,
+                             const void *data, size_t len)
+{
+  union iwreq_data v = *u;
+
+  if (golden_pointer(request))
+    v.data.pointer = NULL;
+  fprintf(fp, "ioctl %s %lx %d ", ifname, request, err);
+  golden_put_hex(fp, &v, sizeof(v));
+  fputc(' ', fp);
+  golden_put_hex(fp, data, len);
+  fputc('\n', fp);
+}
+
+/*
+ * Writes an info line
+ */
+static void golden_put_info(FILE *fp, const struct timeval *tv, const char *ifname)
+{
+  fprintf(fp, "info %ld.%06ld %s\n", (long)tv->tv_sec, (long)tv->tv_usec, ifname);
+}
+
+/*
+ * Writes a link line
+ */
+static void golden_put_link(FILE *fp, const struct timeval *tv, const struct nlmsghdr *n)
+{
+  fprintf(fp, "link %ld.%06ld ", (long)tv->tv_sec, (long)tv->tv_usec);
+  golden_put_hex(fp, n, n->nlmsg_len);
+  fputc('\n', fp);
+}
+
+/*
+ * Adds an event to the fixture
+ */
+static struct golden_event *golden_add(int kind)
+{
+  struct golden_event *e;
+
+  if ((golden_event_count & (golden_event_count - 1)) == 0) {
+    e = realloc(golden_events, (golden_event_count ? golden_event_count * 2 : 1) *
+                               sizeof(*e));
+    if (!e) {
+      perror("wireless-golden");
+      exit(1);
+    }
+    golden_events = e;
+  }
+  e = &golden_events[golden_event_count++];
+  memset(e, 0, sizeof(*e));
+  e->kind = kind;
+  golden_printed += kind != GOLDEN_IOCTL;
+  return e;
+}
+
+/*
+ * Reads "sec.usec"
+ */
+static int golden_get_time(const char *str, struct timeval *tv)
+{
+  long sec, usec;
+
+  if (!str || sscanf(str, "%ld.%ld", &sec, &usec) != 2 || usec < 0 || usec >= 1000000)
+    return -1;
+  tv->tv_sec = sec;
+  tv->tv_usec = usec;
+  return 0;
+}
+
+/*
+ * Reads a fixture
+ */
+static int golden_load(FILE *fp, const char *name)
+{
+  struct golden_event *e;
+  struct golden_reply *r;
+  char *line = NULL, *word[6], *save;
+  unsigned char msg[GOLDEN_MSG_MAX];
+  size_t size = 0;
+  long len;
+  int lineno = 0, n;
+
+  while (getline(&line, &size, fp) > 0) {
+    lineno++;
+    for (n = 0; n < 6; n++)
+      word[n] = strtok_r(n ? NULL : line, " \t\n", &save);
+    if (!word[0] || word[0][0] == '#')
+      continue;
+
+    if (strcmp(word[0], "ioctl") == 0 && word[5]) {
+      e = golden_add(GOLDEN_IOCTL);
+      if ((e->reply = r = calloc(1, sizeof(*r))) == NULL) {
+        perror("wireless-golden");
+        return -1;
+      }
+      strncpy(r->ifname, word[1], IFNAMSIZ - 1);
+      r->request = strtoul(word[2], NULL, 16);
+      r->err = atoi(word[3]);
+      if (golden_get_hex(word[4], &r->u, sizeof(r->u)) != sizeof(r->u) ||
+          (len = golden_get_hex(word[5], r->data, sizeof(r->data))) < 0)
+        goto bad;
+      r->len = len;
+    } else if (strcmp(word[0], "info") == 0 && word[2]) {
+      e = golden_add(GOLDEN_INFO);
+      strncpy(e->ifname, word[2], IFNAMSIZ - 1);
+      if (golden_get_time(word[1], &e->tv) < 0)
+        goto bad;
+    } else if (strcmp(word[0], "link") == 0 && word[2]) {
+      e = golden_add(GOLDEN_LINK);
+      if (golden_get_time(word[1], &e->tv) < 0 ||
+          (len = golden_get_hex(word[2], msg, sizeof(msg))) < (long)NLMSG_HDRLEN ||
+          ((struct nlmsghdr *)msg)->nlmsg_len != (unsigned long)len ||
+          (e->msg = malloc(len)) == NULL)
+        goto bad;
+      memcpy(e->msg, msg, len);
+    } else {
+      goto bad;
+    }
+  }
+  free(line);
+  return 0;
+
+bad:
+  fprintf(stderr, "%s:%d: not a fixture line\n", name, lineno);
+  free(line);
+  return -1;
+}
+
+/*
+ * Records the replies of an interface to each query
+ */
+static void golden_record_iface(FILE *fp, int sock, const char *ifname)
+{
+  unsigned char data[sizeof(struct iw_range)];
+  struct iwreq wrq;
+  size_t i, len;
+  int ret;
+
+  for (i = 0; i < GOLDEN_REQUESTS; i++) {
+    memset(&wrq, 0, sizeof(wrq));
+    memset(data, 0, sizeof(data));
+    strncpy(wrq.ifr_name, ifname, IFNAMSIZ - 1);
+    if (golden_requests[i].len) {
+      wrq.u.data.pointer = data;
+      wrq.u.data.length = golden_requests[i].len;
+      wrq.u.data.flags = golden_requests[i].request != SIOCGIWESSID;
+    }
+    ret = ioctl(sock, golden_requests[i].request, &wrq);
+    len = ret < 0 || !golden_requests[i].len ? 0 :
+          golden_requests[i].request == SIOCGIWESSID ? wrq.u.data.length :
+          golden_requests[i].len;
+    golden_put_ioctl(fp, ifname, golden_requests[i].request, ret < 0 ? errno : 0,
+                     &wrq.u, data, len);
+  }
+}
+
+/*
+ * Whether an interface answers wireless queries
+ */
+static int golden_wireless(int sock, const char *ifname)
+{
+  struct iwreq wrq;
+
+  memset(&wrq, 0, sizeof(wrq));
+  strncpy(wrq.ifr_name, ifname, IFNAMSIZ - 1);
+  return ioctl(sock, SIOCGIWNAME, &wrq) == 0;
+}
+
+/*
+ * Writes a fixture of the wireless interfaces here and the link
+ * messages of the next seconds; an interface coming up is queried
+ * again first, as the monitor would
+ */
+static int golden_record(int seconds)
+{
+  struct ifaddrs *ifaddr, *ifa;
+  struct rtnl_handle rth;
+  struct rtattr *tb[IFLA_MAX + 1];
+  struct ifinfomsg *ifi;
+  struct nlmsghdr *n;
+  struct timeval tv;
+  unsigned long long end;
+  char buf[GOLDEN_MSG_MAX];
+  struct pollfd pfd;
+  int sock, len;
+
+  if ((sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0 ||
+      getifaddrs(&ifaddr) < 0) {
+    perror("wireless-golden");
+    return 1;
+  }
+  printf("# wireless-golden fixture\n");
+  for (ifa = ifaddr; ifa; ifa = ifa->ifa_next) {
+    if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_PACKET ||
+        !golden_wireless(sock, ifa->ifa_name))
+      continue;
+    golden_record_iface(stdout, sock, ifa->ifa_name);
+    gettimeofday(&tv, NULL);
+    golden_put_info(stdout, &tv, ifa->ifa_name);
+  }
+  freeifaddrs(ifaddr);
+
+  if (rtnl_open(&rth, RTMGRP_LINK) < 0) {
+    close(sock);
+    return 1;
+  }
+  pfd.fd = rth.fd;
+  pfd.events = POLLIN;
+  end = clock_monotonic_ns() + seconds * NSEC_PER_SEC;
+  while (clock_monotonic_ns() < end) {
+    if (poll(&pfd, 1, (end - clock_monotonic_ns()) / NSEC_PER_MSEC + 1) <= 0 ||
+        (len = recv(rth.fd, buf, sizeof(buf), 0)) <= 0)
+      continue;
+    gettimeofday(&tv, NULL);
+    for (n = (struct nlmsghdr *)buf; NLMSG_OK(n, (unsigned)len); n = NLMSG_NEXT(n, len)) {
+      if (n->nlmsg_type != RTM_NEWLINK && n->nlmsg_type != RTM_DELLINK)
+        continue;
+      ifi = NLMSG_DATA(n);
+      parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi)));
+      if (n->nlmsg_type == RTM_NEWLINK && tb[IFLA_IFNAME] && tb[IFLA_OPERSTATE] &&
+          rta_getattr_u8(tb[IFLA_OPERSTATE]) == IF_OPER_UP &&
+          golden_wireless(sock, rta_getattr_str(tb[IFLA_IFNAME])))
+        golden_record_iface(stdout, sock, rta_getattr_str(tb[IFLA_IFNAME]));
+      golden_put_link(stdout, &tv, n);
+    }
+    fflush(stdout);
+  }
+  rtnl_close(&rth);
+  close(sock);
+  return 0;
+}
+
+/*
+ * An interface of the built-in fixture; levels in dBm
+ */
+struct golden_iface {
+  const char *ifname;
+  const char *essid;
+  unsigned char ap[6];
+  int bitrate;
+  struct iw_param txpower;
+  int qual, level, noise, updated;
+  int max_level, max_noise, range_updated;
+  const char *missing;          /* queries that fail */
+};
+
+static const struct golden_iface golden_ifaces[] = {
+  { "wlan0", "office", { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55 }, 300000000,
+    { .value = 20, .flags = IW_TXPOW_DBM }, 60, -50, -95,
+    IW_QUAL_ALL_UPDATED | IW_QUAL_DBM, -20, -90, 0, "" },
+  { "wlan1", "", { 0 }, 0,
+    { .disabled = 1 }, 0, 0, 0,
+    IW_QUAL_ALL_INVALID, 0, 0, IW_QUAL_LEVEL_INVALID | IW_QUAL_NOISE_INVALID, "" },
+  { "wlan2", "caf\xc3\xa9 guest 5G", { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }, 1500000000,
+    { .value = 7, .flags = IW_TXPOW_RELATIVE }, 0, -100, -100,
+    IW_QUAL_ALL_UPDATED | IW_QUAL_DBM, -1, -100, IW_QUAL_NOISE_INVALID, "" },
+  { "wlan3", "ABCDEFGHIJKLMNOPQRSTUVWXYZ012345", { 0x44, 0x44, 0x44, 0x44, 0x44, 0x44 }, 5500000,
+    { .value = 100, .flags = IW_TXPOW_MWATT }, 100, -1, 0,
+    IW_QUAL_NOISE_INVALID, 0, 0, IW_QUAL_LEVEL_INVALID, "" },
+  { "wlan4", "lab", { 0x02, 0x00, 0x5e, 0x10, 0x00, 0x01 }, 500000,
+    { .value = 1, .flags = IW_TXPOW_MWATT }, 35, -75, -92,
+    IW_QUAL_ALL_UPDATED | IW_QUAL_DBM, 0, 0, 0, "ap,stats,range" },
+  { "p2p-dev-wlan0", "", { 0 }, 0,
+    { 0 }, 0, 0, 0, 0, 0, 0, 0, "essid,ap,bitrate,txpower,stats,range" },
+};
+
+#define GOLDEN_IFACES (sizeof(golden_ifaces) / sizeof(golden_ifaces[0]))
+
+/*
+ * Writes the replies of a built-in interface to each query
+ */
+static void golden_builtin_iface(FILE *fp, const struct golden_iface *g, int index)
+{
+  struct iw_statistics stats;
+  struct iw_range range;
+  union iwreq_data u;
+  const void *data;
+  size_t i, len;
+
+  for (i = 0; i < GOLDEN_REQUESTS; i++) {
+    memset(&u, 0, sizeof(u));
+    data = NULL;
+    len = 0;
+    switch (golden_requests[i].request) {
+      case SIOCGIWNAME:
+        strcpy(u.name, "IEEE 802.11");
+        break;
+      case SIOCGIWESSID:
+        data = g->essid;
+        len = u.essid.length = strlen(g->essid);
+        u.essid.flags = len != 0;
+        break;
+      case SIOCGIWAP:
+        u.ap_addr.sa_family = ARPHRD_ETHER;
+        memcpy(u.ap_addr.sa_data, g->ap, sizeof(g->ap));
+        break;
+      case SIOCGIWRATE:
+        u.bitrate.value = g->bitrate;
+        break;
+      case SIOCGIWTXPOW:
+        u.txpower = g->txpower;
+        break;
+      case SIOCGIWSTATS:
+        memset(&stats, 0, sizeof(stats));
+        stats.status = index;
+        stats.qual.qual = g->qual;
+        stats.qual.level = g->level + 0x100;
+        stats.qual.noise = g->noise + 0x100;
+        stats.qual.updated = g->updated;
+        stats.discard.nwid = index;
+        stats.discard.code = 10 * index;
+        stats.discard.fragment = 100 * index;
+        stats.discard.retries = 1000 * index;
+        stats.discard.misc = 10000 * index;
+        stats.miss.beacon = 100000 * index;
+        data = &stats;
+        len = u.data.length = sizeof(stats);
+        break;
+      case SIOCGIWRANGE:
+        memset(&range, 0, sizeof(range));
+        range.max_qual.qual = 70;
+        range.max_qual.level = g->max_level + 0x100;
+        range.max_qual.noise = g->max_noise + 0x100;
+        range.max_qual.updated = g->range_updated;
+        range.avg_qual.qual = 35;
+        data = &range;
+        len = u.data.length = sizeof(range);
+        break;
+    }
+    golden_put_ioctl(fp, g->ifname, golden_requests[i].request,
+                     strstr(g->missing, golden_requests[i].name) ? EOPNOTSUPP : 0,
+                     &u, data, len);
+  }
+}
+
+/*
+ * Writes a link line for a message built from its parts: no name if
+ * ifname is NULL, no operstate if it is negative
+ */
+static void golden_builtin_link(FILE *fp, struct timeval *tv, int type, int index,
+                                const char *ifname, int operstate)
+{
+  char buf[256] __attribute__((aligned(NLMSG_ALIGNTO)));
+  struct nlmsghdr *n = (struct nlmsghdr *)buf;
+  struct ifinfomsg *ifi = NLMSG_DATA(n);
+
+  memset(buf, 0, sizeof(buf));
+  n->nlmsg_type = type;
+  n->nlmsg_len = NLMSG_LENGTH(sizeof(*ifi));
+  ifi->ifi_family = AF_UNSPEC;
+  ifi->ifi_type = ARPHRD_ETHER;
+  ifi->ifi_index = index;
+  ifi->ifi_flags = operstate == IF_OPER_UP ? IFF_UP | IFF_RUNNING : IFF_UP;
+  if (ifname)
+    addattr_l(n, sizeof(buf), IFLA_IFNAME, ifname, strlen(ifname) + 1);
+  if (operstate >= 0)
+    addattr8(n, sizeof(buf), IFLA_OPERSTATE, operstate);
+  golden_put_link(fp, tv, n);
+  tv->tv_usec += 48271;
+  tv->tv_sec += tv->tv_usec / 1000000;
+  tv->tv_usec %= 1000000;
+}
+
+/*
+ * Writes the built-in fixture
+ */
+static void golden_builtin(FILE *fp)
+{
+  static const int states[] = {
+    IF_OPER_DOWN, IF_OPER_LOWERLAYERDOWN, IF_OPER_TESTING, IF_OPER_DORMANT,
+    IF_OPER_NOTPRESENT, IF_OPER_UNKNOWN, 7, 0xff
+  };
+  struct golden_iface roam = golden_ifaces[0];
+  struct timeval tv = { 1413346447, 312 };
+  size_t i;
+
+  fprintf(fp, "# built-in wireless-golden fixture\n");
+  for (i = 0; i < GOLDEN_IFACES; i++) {
+    golden_builtin_iface(fp, &golden_ifaces[i], i);
+    golden_put_info(fp, &tv, golden_ifaces[i].ifname);
+    tv.tv_usec += 7;
+  }
+  for (i = 0; i < GOLDEN_IFACES; i++)
+    golden_builtin_link(fp, &tv, RTM_NEWLINK, 3 + i, golden_ifaces[i].ifname, IF_OPER_UP);
+  for (i = 0; i < sizeof(states) / sizeof(states[0]); i++)
+    golden_builtin_link(fp, &tv, RTM_NEWLINK, 4, "wlan1", states[i]);
+
+  /* a roam to a weaker access point */
+  roam.ap[5] = 0x66;
+  roam.level = -75;
+  roam.qual = 35;
+  roam.bitrate = 54000000;
+  golden_builtin_iface(fp, &roam, 0);
+  golden_builtin_link(fp, &tv, RTM_NEWLINK, 3, "wlan0", IF_OPER_UP);
+
+  golden_builtin_link(fp, &tv, RTM_NEWLINK, 5, "wlan2", -1);
+  golden_builtin_link(fp, &tv, RTM_DELLINK, 5, "wlan2", IF_OPER_DOWN);
+  golden_builtin_link(fp, &tv, RTM_DELLINK, 5, "wlan2", -1);
+  golden_builtin_link(fp, &tv, RTM_NEWLINK, 99, NULL, IF_OPER_DOWN);
+  golden_builtin_link(fp, &tv, RTM_NEWLINK, 99, NULL, -1);
+}
+
+/*
+ * Feeds the fixture to the formatting code once
+ */
+static void golden_replay(const struct golden_path *p)
+{
+  struct golden_event *e;
+  size_t i;
+
+  golden_reply_count = 0;
+  golden_replaying = 1;
+  for (i = 0; i < golden_event_count; i++) {
+    e = &golden_events[i];
+    switch (e->kind) {
+      case GOLDEN_IOCTL:
+        golden_answer(e->reply);
+        continue;
+      case GOLDEN_INFO:
+        golden_now = e->tv;
+        wireless_info(e->ifname);
+        break;
+      case GOLDEN_LINK:
+        golden_now = e->tv;
+        print_linkinfo(NULL, e->msg, stdout);
+        break;
+    }
+    if (p->flush)
+      p->flush();
+  }
+  golden_replaying = 0;
+}
+
+/*
+ * The legacy path: printf() into stdout's buffer, written as it fills
+ */
+static void golden_stdio_end(void)
+{
+  fflush(stdout);
+}
+
+/*
+ * The io_uring path: stdout queued on the loop, which writes it after
+ * each dispatch (-U)
+ */
+static int golden_uring_begin(void)
+{
+  if (!loop &&
+      (loop = wireless_loop_new_engine(SAMPLE_TICK_NS, 0, LOOP_ENGINE_URING)) == NULL)
+    return -1;
+  if (wireless_loop_engine(loop) != LOOP_ENGINE_URING)
+    return -1;
+  stdout_to_loop();
+  return real_stdout ? 0 : -1;
+}
+
+static void golden_uring_flush(void)
+{
+  fflush(stdout);
+  wireless_loop_flush(loop);
+}
+
+static void golden_uring_end(void)
+{
+  stdout_restore();
+}
+
+static const struct golden_path golden_paths[] = {
+  { "stdio", NULL, NULL, golden_stdio_end },
+  { "uring", golden_uring_begin, golden_uring_flush, golden_uring_end },
+};
+
+#define GOLDEN_PATHS (sizeof(golden_paths) / sizeof(golden_paths[0]))
+
+/*
+ * Replays the fixture runs times through a path with stdout and stderr
+ * on out and err; returns the time taken, 0 if the path is unavailable
+ */
+static unsigned long long golden_run(const struct golden_path *p, int runs,
+                                     int out, int err)
+{
+  unsigned long long start = 0, ns = 0;
+  int saved_out, saved_err, i;
+
+  fflush(stdout);
+  fflush(stderr);
+  saved_out = dup(STDOUT_FILENO);
+  saved_err = dup(STDERR_FILENO);
+  dup2(out, STDOUT_FILENO);
+  dup2(err, STDERR_FILENO);
+  if (!p->begin || p->begin() == 0) {
+    start = clock_monotonic_ns();
+    for (i = 0; i < runs; i++)
+      golden_replay(p);
+    p->end();
+    ns = clock_monotonic_ns() - start;
+    if (!ns)
+      ns = 1;
+  }
+  fflush(stderr);
+  dup2(saved_out, STDOUT_FILENO);
+  dup2(saved_err, STDERR_FILENO);
+  close(saved_out);
+  close(saved_err);
+  return ns;
+}
+
+/*
+ * Reads a whole file from its start; NULL on failure
+ */
+static char *golden_slurp(int fd, size_t *len)
+{
+  struct stat st;
+  char *buf;
+
+  if (fstat(fd, &st) < 0 || (buf = malloc(st.st_size + 1)) == NULL ||
+      pread(fd, buf, st.st_size, 0) != st.st_size) {
+    perror("wireless-golden");
+    return NULL;
+  }
+  *len = st.st_size;
+  return buf;
+}
+
+/*
+ * Compares output with what was expected, and says where it first
+ * differs; returns 0 if it is identical
+ */
+static int golden_compare(const char *path, const char *stream,
+                          const char *want, size_t want_len,
+                          const char *got, size_t got_len)
+{
+  size_t i, line = 1, start = 0, end;
+
+  for (i = 0; i < want_len && i < got_len && want[i] == got[i]; i++)
+    if (want[i] == '\n') {
+      line++;
+      start = i + 1;
+    }
+  if (i == want_len && i == got_len)
+    return 0;
+
+  printf("golden path=%s stream=%s differs at byte %zu, line %zu (%zu bytes, %zu expected)\n",
+         path, stream, i, line, got_len, want_len);
+  for (end = start; end < want_len && want[end] != '\n'; end++)
+    ;
+  printf("  expected: %.*s\n", (int)(end - start), want + start);
+  for (end = start; end < got_len && got[end] != '\n'; end++)
+    ;
+  printf("  got:      %.*s\n", (int)(end - start), got + start);
+  return -1;
+}
+
+/*
+ * Prints the usage; returns the exit status
+ */
+static int golden_usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-n runs] [-g expected] [fixture]\n"
+                  "       %s record [seconds] > fixture\n", prog, prog);
+  return 1;
+}
+
+/*
+ * Main application
+ */
+int main(int argc, char **argv)
+{
+  char *legacy[2] = { NULL, NULL }, *got[2], *want;
+  size_t legacy_len[2], got_len[2], want_len, bytes;
+  const char *expected = NULL, *streams[2] = { "stdout", "stderr" };
+  const struct golden_path *p;
+  unsigned long long ns;
+  FILE *fp, *tmp[2];
+  int runs = 1000, opt, fd[2], null, s, differs = 0;
+  size_t i;
+
+  if (argc > 1 && strcmp(argv[1], "record") == 0)
+    return argc > 3 ? golden_usage(argv[0]) : golden_record(argc == 3 ? atoi(argv[2]) : 10);
+
+  while ((opt = getopt(argc, argv, "n:g:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        runs = atoi(optarg);
+        break;
+      case 'g':
+        expected = optarg;
+        break;
+      default:
+        return golden_usage(argv[0]);
+    }
+  }
+  if (optind < argc - 1 || runs < 1)
+    return golden_usage(argv[0]);
+
+  if (optind == argc - 1) {
+    if ((fp = fopen(argv[optind], "r")) == NULL) {
+      perror(argv[optind]);
+      return 1;
+    }
+    s = golden_load(fp, argv[optind]);
+    fclose(fp);
+  } else {
+    char *text = NULL;
+    size_t text_len = 0;
+
+    if ((fp = open_memstream(&text, &text_len)) == NULL) {
+      perror("wireless-golden");
+      return 1;
+    }
+    golden_builtin(fp);
+    fclose(fp);
+    if ((fp = fmemopen(text, text_len, "r")) == NULL) {
+      perror("wireless-golden");
+      return 1;
+    }
+    s = golden_load(fp, "built-in");
+    fclose(fp);
+    free(text);
+  }
+  if (s < 0)
+    return 1;
+
+  setenv("TZ", "UTC", 1);
+  tzset();
+  setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+  if ((null = open("/dev/null", O_WRONLY | O_CLOEXEC)) < 0) {
+    perror("/dev/null");
+    return 1;
+  }
+
+  for (i = 0; i < GOLDEN_PATHS; i++) {
+    p = &golden_paths[i];
+    if ((tmp[0] = tmpfile()) == NULL || (tmp[1] = tmpfile()) == NULL) {
+      perror("wireless-golden");
+      return 1;
+    }
+    ns = golden_run(p, 1, fileno(tmp[0]), fileno(tmp[1]));
+    for (s = 0; s < 2 && ns; s++)
+      if ((got[s] = golden_slurp(fileno(tmp[s]), &got_len[s])) == NULL)
+        return 1;
+    fclose(tmp[0]);
+    fclose(tmp[1]);
+    if (!ns) {
+      printf("golden path=%s unavailable\n", p->name);
+      fflush(stdout);
+      continue;
+    }
+
+    if (i == 0) {
+      memcpy(legacy, got, sizeof(legacy));
+      memcpy(legacy_len, got_len, sizeof(legacy_len));
+      if (expected && (fd[0] = open(expected, O_RDONLY | O_CLOEXEC)) >= 0) {
+        if ((want = golden_slurp(fd[0], &want_len)) == NULL)
+          return 1;
+        close(fd[0]);
+        differs |= golden_compare(p->name, expected, want, want_len,
+                                  got[0], got_len[0]);
+        free(want);
+      } else if (expected) {
+        if ((fp = fopen(expected, "w")) == NULL ||
+            fwrite(got[0], 1, got_len[0], fp) != got_len[0] || fclose(fp) != 0) {
+          perror(expected);
+          return 1;
+        }
+        printf("golden expected=%s written bytes=%zu\n", expected, got_len[0]);
+      }
+    } else {
+      for (s = 0; s < 2; s++)
+        differs |= golden_compare(p->name, streams[s], legacy[s], legacy_len[s],
+                                  got[s], got_len[s]);
+      for (s = 0; s < 2; s++)
+        free(got[s]);
+    }
+
+    bytes = got_len[0];
+    ns = golden_run(p, runs, null, null);
+    printf("golden path=%s events=%zu bytes=%zu runs=%d us_per_run=%.1f "
+           "events_per_s=%.0f mb_per_s=%.1f\n", p->name, golden_printed, bytes,
+           runs, (double)ns / runs / NSEC_PER_USEC,
+           (double)golden_printed * runs * NSEC_PER_SEC / ns,
+           (double)bytes * runs * NSEC_PER_SEC / ns / (1 << 20));
+    fflush(stdout);
+  }
+  free(legacy[0]);
+  free(legacy[1]);
+  printf("golden %s\n", differs ? "FAILED: output differs" : "identical");
+  return differs ? 1 : 0;
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -27,6 +27,7 @@
     USA
 */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -36,9 +37,31 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <net/ethernet.h>
+#include <netpacket/packet.h>
 #include <linux/wireless.h>
 #include <libnetlink.h>
 #include <time.h>
+#include <math.h>
+#include <signal.h>
+#include <errno.h>
+#include <syslog.h>
+
+#include "clock.h"
+#include "sample.h"
+#include "iface.h"
+#include "journald.h"
+#include "loop.h"
+#include "governor.h"
+#include "samplelog.h"
+#include "flight.h"
+#include "rt.h"
+#include "trace.h"
+#include "query.h"
+#include "rtnlgate.h"
+#include "shmring.h"
+#include "worker.h"
+#include "mem.h"
+#include "ifmatch.h"
 
 /* Some usefull constants */
 #define KILO	1e3
@@ -51,6 +74,109 @@
 /* no libm */
 #define WE_NOLIBM
 
+/* Fields the periodic sampler reads for the session aggregates */
+#define SAMPLE_FIELDS (WS_ESSID | WS_AP | WS_BITRATE | WS_STATS)
+
+/* Sampling schedule granularity; slack (-S) is a multiple of it */
+#define SAMPLE_TICK_NS (10 * NSEC_PER_MSEC)
+
+/* Most per-interface intervals given with -i ifname=seconds */
+#define MAX_INTERVAL_RULES 32
+
+/*
+ * Sampling interval for one interface, from -i ifname=seconds
+ */
+struct interval_rule {
+  char ifname[IFNAMSIZ];
+  unsigned long long interval_ns;
+};
+
+static struct interval_rule interval_rules[MAX_INTERVAL_RULES];
+static int interval_rule_count;
+
+/* Interval for interfaces without a rule, from -i seconds */
+static unsigned long long default_interval_ns;
+
+#define MAX_ALERT_RULES 8
+
+/*
+ * An alert raised while its expression holds for an interface, from -E
+ */
+struct alert_rule {
+  const char *src;
+  struct expr expr;
+};
+
+static struct alert_rule alert_rules[MAX_ALERT_RULES];
+static int alert_rule_count;
+
+/* -Q: samples to print in monitor mode, or the query command's query */
+static struct query query;
+static int query_given;
+
+/* Rates of the query command need a second sample this much later */
+#define QUERY_GAP_NS NSEC_PER_SEC
+
+/* Set when any -i or -F was given: interfaces are tracked in monitor mode */
+static int sampling;
+
+/* Monitor event loop, also scheduling the samples */
+static struct wireless_loop *loop;
+
+/* Native journal sink, when enabled with -j */
+static struct journald *journal;
+
+/* Set from the signal handler to leave the monitor loop */
+static volatile sig_atomic_t monitor_stop;
+
+/* Acquisition skew of the sampled snapshots: all fields, and between
+   the AP and the signal statistics */
+static struct skew_hist skew_all;
+static struct skew_hist skew_ap_stats;
+
+/* Binary sample log, enabled with -w */
+static struct samplelog *samplelog;
+
+/* -F: flight recorder rate, 0 if off */
+static double flight_hz;
+
+/* -R: SCHED_FIFO priority of the real-time sampler, 0 if off */
+static int rt_priority;
+
+/* CPU budget governor, enabled with -C */
+static struct governor governor;
+static int governing;
+static struct loop_timer governor_timer;
+
+/* Timer slack from -S, the least the governor applies */
+static unsigned long long base_slack_ns;
+
+/* Loop engine, io_uring with -U */
+static enum loop_engine engine = LOOP_ENGINE_EPOLL;
+
+/* Set with -A: snapshots are taken by workers placed near the devices */
+static int placing;
+
+/* Interface name patterns from -I and -X */
+static struct ifmatch names;
+
+/* Set from SIGUSR1: print memory use at the next dispatch */
+static volatile sig_atomic_t mem_report;
+
+/* Samples skipped because the last one of the interface was still out */
+static unsigned long long sample_overruns;
+
+/* -L: share of time the monitor may hold RTNL, 0 if not bounded, and
+   how many of its operations may at once */
+static double rtnl_share;
+static int rtnl_concurrent = 1;
+
+/* Interfaces spread over their period so far, under -L */
+static unsigned int spread_count;
+
+/* The real stdout while monitor output is queued on the loop */
+static FILE *real_stdout;
+
 /*
  * Returns a socket to use for ioctl calls
  */ 
@@ -410,8 +536,8 @@ int wireless_range(const char *ifname)
 
   if (ioctl(sock, SIOCGIWRANGE, &wrq) < 0) {
     perror("Could not get range");
-    return 0;
     close(sock);
+    return 0;
   }
   close(sock);
  
@@ -495,6 +621,382 @@ int print_timestamp(FILE *fp)
   return 0;
 }
 
+/*
+ * Prints a closed session's summary and sends it to the journal
+ */
+static void emit_session(const char *ifname, const struct session *s,
+                         unsigned long long end_ns, void *arg)
+{
+  FILE *fp = arg;
+  char ap[32];
+
+  session_print(ifname, s, end_ns, fp);
+
+  if (!journal)
+    return;
+
+  iw_ether_ntop(&s->ap, ap);
+  journald_begin(journal, LOG_INFO, "%s left %s (%s) after %.0f s",
+                 ifname, ap, s->essid,
+                 (double)(end_ns - s->start_ns) / NSEC_PER_SEC);
+  journald_field(journal, "IFNAME", "%s", ifname);
+  journald_field(journal, "AP", "%s", ap);
+  journald_field(journal, "ESSID", "%s", s->essid);
+  journald_field(journal, "SESSION_DURATION_USEC", "%llu",
+                 (end_ns - s->start_ns) / NSEC_PER_USEC);
+  journald_field(journal, "SESSION_SAMPLES", "%lu", s->samples);
+  if (s->level_samples) {
+    journald_field(journal, "SIGNAL_DBM", "%.1f",
+                   (double)s->level_sum / s->level_samples);
+    journald_field(journal, "SIGNAL_MIN_DBM", "%d", s->level_min);
+  }
+  journald_field(journal, "RETRIES", "%llu", s->retries);
+  journald_end(journal);
+}
+
+/*
+ * Prints a shift found in one of an interface's series and sends it to
+ * the journal
+ */
+static void emit_change(const char *ifname, const struct change_event *ev,
+                        void *arg)
+{
+  FILE *fp = arg;
+  const char *series = change_series_name(ev->series);
+  struct iface *ifp;
+  unsigned long long onset;
+
+  change_print(ifname, ev, fp);
+  if ((ifp = iface_find(ifname)) != NULL)
+    flight_trigger(ifp->flight, SAMPLELOG_TRIGGER_ALERT);
+
+  if (!journal)
+    return;
+
+  onset = clock_realtime_ns() - (clock_monotonic_ns() - ev->onset_ns);
+  journald_begin(journal, LOG_NOTICE, "%s %s shifted %+.1f to %.1f",
+                 ifname, series, ev->after - ev->before, ev->after);
+  journald_field(journal, "IFNAME", "%s", ifname);
+  journald_field(journal, "CHANGE_SERIES", "%s", series);
+  journald_field(journal, "CHANGE_SHIFT", "%.1f", ev->after - ev->before);
+  journald_field(journal, "CHANGE_BEFORE", "%.1f", ev->before);
+  journald_field(journal, "CHANGE_AFTER", "%.1f", ev->after);
+  journald_field(journal, "CHANGE_ONSET_USEC", "%llu", onset / NSEC_PER_USEC);
+  journald_end(journal);
+}
+
+/*
+ * Sends a LINK message's interface and state to the journal
+ */
+static void journal_linkinfo(const char *ifname, int type, int operstate)
+{
+  char state[16];
+
+  if (type == RTM_DELLINK)
+    strcpy(state, "DELETED");
+  else if (operstate < 0)
+    strcpy(state, "UNKNOWN");
+  else if (operstate >= sizeof(oper_states)/sizeof(oper_states[0]))
+    sprintf(state, "%#x", operstate);
+  else
+    strcpy(state, oper_states[operstate]);
+
+  journald_begin(journal, LOG_INFO, "%s state %s", ifname, state);
+  journald_field(journal, "IFNAME", "%s", ifname);
+  journald_field(journal, "OPERSTATE", "%s", state);
+  journald_end(journal);
+}
+
+/*
+ * Sends one periodic sample to the journal
+ */
+static void journal_sample(const char *ifname,
+                           const struct wireless_snapshot *snap)
+{
+  char ap[32];
+
+  iw_ether_ntop(&snap->ap, ap);
+  if ((snap->valid & WS_STATS) && !(snap->updated & IW_QUAL_LEVEL_INVALID))
+    journald_begin(journal, LOG_DEBUG, "%s signal %d dBm", ifname, snap->level);
+  else
+    journald_begin(journal, LOG_DEBUG, "%s sample", ifname);
+  journald_field(journal, "IFNAME", "%s", ifname);
+  if ((snap->valid & WS_STATS) && !(snap->updated & IW_QUAL_LEVEL_INVALID))
+    journald_field(journal, "SIGNAL_DBM", "%d", snap->level);
+  if ((snap->valid & WS_STATS) && !(snap->updated & IW_QUAL_NOISE_INVALID))
+    journald_field(journal, "NOISE_DBM", "%d", snap->noise);
+  if ((snap->valid & WS_AP) && snap->associated)
+    journald_field(journal, "AP", "%s", ap);
+  if (snap->valid & WS_ESSID)
+    journald_field(journal, "ESSID", "%s", snap->essid);
+  if (snap->valid & WS_BITRATE)
+    journald_field(journal, "BITRATE", "%d", snap->bitrate);
+  journald_field(journal, "SKEW_USEC", "%llu", snap->skew_ns / NSEC_PER_USEC);
+  journald_end(journal);
+}
+
+/*
+ * Raises or clears each -E rule whose truth for an interface changed
+ * with its latest sample.  A rule raised also triggers the flight
+ * recorder.
+ */
+static void alert_check(struct iface *ifp, const struct expr_row *row, FILE *fp)
+{
+  const struct alert_rule *r;
+  int i, holds;
+
+  for (i = 0; i < alert_rule_count; i++) {
+    r = &alert_rules[i];
+    holds = expr_true(&r->expr, row);
+    if (holds == !!(ifp->alerting & (1u << i)))
+      continue;
+    ifp->alerting ^= 1u << i;
+    fprintf(fp, "alert ifname=%s rule=%d state=%s expr=\"%s\"\n",
+            ifp->name, i, holds ? "raised" : "cleared", r->src);
+    if (holds)
+      flight_trigger(ifp->flight, SAMPLELOG_TRIGGER_ALERT);
+    if (journal) {
+      journald_begin(journal, holds ? LOG_WARNING : LOG_NOTICE, "%s alert %s: %s",
+                     ifp->name, holds ? "raised" : "cleared", r->src);
+      journald_field(journal, "IFNAME", "%s", ifp->name);
+      journald_field(journal, "ALERT_RULE", "%s", r->src);
+      journald_field(journal, "ALERT_STATE", "%s", holds ? "raised" : "cleared");
+      journald_end(journal);
+    }
+  }
+}
+
+/*
+ * Feeds one interface's snapshot to the session aggregates and sinks,
+ * and reports fields whose backend the route it came through changed
+ */
+static void sample_record(struct iface *ifp, const struct wireless_snapshot *snap,
+                          struct route_table *route)
+{
+  long long skew;
+  FILE *fp = stdout;
+  unsigned long long traced = trace_begin(), step;
+
+  skew_hist_add(&skew_all, snap->skew_ns);
+  if ((skew = wireless_snapshot_skew(snap, WS_AP, WS_STATS)) >= 0)
+    skew_hist_add(&skew_ap_stats, skew);
+  if (journal) {
+    step = trace_begin();
+    journal_sample(ifp->name, snap);
+    trace_end(step, "format journal", ifp->name);
+  }
+  if (samplelog) {
+    step = trace_begin();
+    samplelog_sample(samplelog, ifp->name, ifp->ifindex, snap);
+    trace_end(step, "format samplelog", ifp->name);
+  }
+  if (shmring_active())
+    shmring_sample(ifp->name, ifp->ifindex, snap);
+  session_sample(&ifp->session, ifp->name, snap, clock_monotonic_ns(),
+                 emit_session, fp);
+  change_sample(&ifp->change, ifp->name, snap, clock_monotonic_ns(),
+                emit_change, fp);
+  if (route->changed) {
+    route_print(ifp->name, route, route->changed, fp);
+    route->changed = 0;
+  }
+  if (query_given || alert_rule_count) {
+    struct expr_row row;
+
+    expr_row_fill(&row, ifp->name, snap, &ifp->rate,
+                  snap->valid & WS_STATS ? snap->field_ns[WS_INDEX(WS_STATS)] :
+                                           clock_monotonic_ns());
+    if (query_given && query_match(&query, &row))
+      query_print_row(&query, &row, "match", fp);
+    alert_check(ifp, &row, fp);
+  }
+  trace_end(traced, "record", ifp->name);
+}
+
+/*
+ * A worker's snapshot of an interface came back
+ */
+static void sample_done(struct worker_job *job, void *arg)
+{
+  if (job->ret == 0)
+    sample_record(arg, &job->snap, &job->route);
+}
+
+/*
+ * Samples one interface when its timer fires, feeding the session
+ * aggregates, and schedules the next sample.  With -A the snapshot is
+ * only requested here and recorded when the worker posts it back.
+ */
+static void sample_iface(struct loop_timer *t, void *arg)
+{
+  struct iface *ifp = arg;
+  const struct governor_level *gl = governor_level(&governor);
+  struct wireless_snapshot snap;
+  unsigned long long now, interval = ifp->interval_ns * gl->stretch;
+  unsigned int fields = SAMPLE_FIELDS & ~gl->drop_fields;
+
+  if (rtnlgate_admit() < 0) {
+    /* over the -L budget; counted there */
+  } else if (ifp->job) {
+    if (worker_submit(ifp->job, fields) < 0)
+      sample_overruns++;
+  } else if (route_snapshot(&ifp->route, ifp->name, fields, &snap) == 0) {
+    sample_record(ifp, &snap, &ifp->route);
+  }
+
+  /* keep to the interval's grid rather than drifting by the sampling time */
+  now = clock_monotonic_ns();
+  ifp->next_ns += interval;
+  if (ifp->next_ns <= now)
+    ifp->next_ns = now + interval;
+  wireless_loop_timer_add(loop, t, ifp->next_ns);
+}
+
+/*
+ * Records what the real-time sampler queued, on the loop thread
+ */
+static void sample_rt(const struct rt_sample *s, void *arg)
+{
+  struct iface *ifp;
+
+  if ((ifp = iface_find(s->ifname)) != NULL)
+    sample_record(ifp, &s->snap, &ifp->route);
+}
+
+/*
+ * Gives an interface a job on the worker placed for its device
+ */
+static void place_iface(struct iface *ifp)
+{
+  struct placement p;
+  struct worker *w;
+  char irq_cpus[256], cpus[256];
+
+  if (placement_for(ifp->name, &p) < 0 || (w = worker_get(loop, &p)) == NULL)
+    return;
+  if ((ifp->job = worker_job_new(w, ifp->name, &ifp->mem, sample_done, ifp)) == NULL)
+    return;
+  ifp->job->routed = 1;
+  ifp->job->route = ifp->route;
+  /* the worker's, which may be shared from another placement */
+  placement_format_cpulist(&p.irq_cpus, irq_cpus, sizeof(irq_cpus));
+  placement_format_cpulist(&worker_placement(w)->cpus, cpus, sizeof(cpus));
+  printf("placement ifname=%s irqs=%d irq_cpus=%s cpus=%s node=%d\n",
+         ifp->name, p.irqs, irq_cpus, cpus, worker_placement(w)->node);
+}
+
+/*
+ * Measures the monitor's CPU use once per window and applies the
+ * governor's level when it changes
+ */
+static void governor_tick(struct loop_timer *t, void *arg)
+{
+  FILE *fp = stdout;
+  unsigned long long now = clock_monotonic_ns();
+
+  if (governor_update(&governor, now)) {
+    const struct governor_level *gl = governor_level(&governor);
+
+    wireless_loop_set_slack(loop, gl->slack_ns > base_slack_ns ?
+                                  gl->slack_ns : base_slack_ns);
+    fprintf(fp, "governor level=%d cpu_pct=%.1f budget_pct=%.1f\n",
+            governor.level, governor.share * 100, governor.budget * 100);
+    if (journal) {
+      journald_begin(journal, LOG_NOTICE, "governor level %d", governor.level);
+      journald_field(journal, "GOVERNOR_LEVEL", "%d", governor.level);
+      journald_field(journal, "CPU_PCT", "%.1f", governor.share * 100);
+      journald_end(journal);
+    }
+  }
+  wireless_loop_timer_add(loop, t, now + GOVERNOR_WINDOW_NS);
+}
+/*
+ * Sampling interval configured for an interface, 0 if not sampled
+ */
+static unsigned long long interval_for(const char *ifname)
+{
+  int i;
+
+  for (i = 0; i < interval_rule_count; i++)
+    if (strncmp(interval_rules[i].ifname, ifname, IFNAMSIZ) == 0)
+      return interval_rules[i].interval_ns;
+  return default_interval_ns;
+}
+
+/*
+ * Starts tracking an interface and schedules its first sample
+ */
+static struct iface *track_iface(const char *ifname, int ifindex)
+{
+  struct iface *ifp;
+
+  if ((ifp = iface_get(ifname)) == NULL)
+    return NULL;
+  ifp->ifindex = ifindex;
+  ifp->down = 0;
+  if (loop && flight_hz && !ifp->flight)
+    ifp->flight = flight_new(ifname, ifindex);
+  if (loop && rt_priority && !ifp->rt) {
+    ifp->interval_ns = interval_for(ifname);
+    if (ifp->interval_ns)
+      ifp->rt = rt_add(ifname, ifp->interval_ns);
+  }
+
+  if (loop && !ifp->rt && !wireless_loop_timer_pending(&ifp->timer)) {
+    ifp->interval_ns = interval_for(ifname);
+    if (ifp->interval_ns) {
+      ifp->timer.fn = sample_iface;
+      ifp->timer.arg = ifp;
+      if (placing && !ifp->job)
+        place_iface(ifp);
+      ifp->next_ns = clock_monotonic_ns();
+      /* under -L, the golden ratio keeps any number of them apart */
+      if (rtnl_share)
+        ifp->next_ns += ifp->interval_ns * fmod(spread_count++ * 0.6180339887, 1.0);
+      wireless_loop_timer_add(loop, &ifp->timer, ifp->next_ns);
+    }
+  }
+  return ifp;
+}
+
+/*
+ * Keeps the tracked interface table in step with a LINK message.
+ * Leaving IF_OPER_UP or being deleted ends the open session.
+ */
+static void track_linkinfo(const char *ifname, int ifindex, int type,
+                           __u8 operstate, FILE *fp)
+{
+  struct iface *ifp;
+
+  if (!sampling)
+    return;
+
+  if (type == RTM_DELLINK) {
+    if ((ifp = iface_find(ifname)) != NULL) {
+      session_close(&ifp->session, ifname, clock_monotonic_ns(),
+                    emit_session, fp);
+      wireless_loop_timer_del(loop, &ifp->timer);
+      worker_job_free(ifp->job);
+      rt_remove(ifp->rt);
+      flight_trigger(ifp->flight, SAMPLELOG_TRIGGER_LINK);
+      flight_release(ifp->flight);
+      iface_remove(ifp);
+    }
+    return;
+  }
+
+  if (operstate == IF_OPER_UP) {
+    if (check_wireless(ifname, NULL))
+      track_iface(ifname, ifindex);
+  } else if ((ifp = iface_find(ifname)) != NULL) {
+    session_close(&ifp->session, ifname, clock_monotonic_ns(),
+                  emit_session, fp);
+    if (!ifp->down)
+      flight_trigger(ifp->flight, SAMPLELOG_TRIGGER_LINK);
+    ifp->down = 1;
+  }
+}
+
 /*
  * Prints some basic info from a LINK message
  */
@@ -505,6 +1007,7 @@ int print_linkinfo(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 	struct ifinfomsg *ifi = NLMSG_DATA(n);
 	struct rtattr * tb[IFLA_MAX+1];
   char b1[IFNAMSIZ];
+  unsigned long long traced = trace_begin();
   
   print_timestamp(fp);
   printf(" - ");
@@ -527,12 +1030,33 @@ int print_linkinfo(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
     print_operstate(fp, rta_getattr_u8(tb[IFLA_OPERSTATE]));
     printf("\n");
   
-    if (rta_getattr_u8(tb[IFLA_OPERSTATE]) == IF_OPER_UP) {
+    if (rta_getattr_u8(tb[IFLA_OPERSTATE]) == IF_OPER_UP &&
+        governor_level(&governor)->link_details) {
       wireless_info(rta_getattr_str(tb[IFLA_IFNAME]));
     }
   } else {
     printf("\n");
   }
+  trace_end(traced, "format link", tb[IFLA_IFNAME] ? rta_getattr_str(tb[IFLA_IFNAME]) : NULL);
+
+  if (tb[IFLA_IFNAME] && journal)
+    journal_linkinfo(rta_getattr_str(tb[IFLA_IFNAME]), n->nlmsg_type,
+                     tb[IFLA_OPERSTATE] ? rta_getattr_u8(tb[IFLA_OPERSTATE]) : -1);
+
+  if (tb[IFLA_IFNAME] && samplelog)
+    samplelog_link(samplelog, rta_getattr_str(tb[IFLA_IFNAME]), ifi->ifi_index,
+                   n->nlmsg_type == RTM_DELLINK ? SAMPLELOG_DELLINK : SAMPLELOG_LINK,
+                   tb[IFLA_OPERSTATE] ? rta_getattr_u8(tb[IFLA_OPERSTATE]) : IF_OPER_UNKNOWN);
+
+  if (tb[IFLA_IFNAME] && shmring_active())
+    shmring_link(rta_getattr_str(tb[IFLA_IFNAME]), ifi->ifi_index,
+                 n->nlmsg_type == RTM_DELLINK ? SAMPLELOG_DELLINK : SAMPLELOG_LINK,
+                 tb[IFLA_OPERSTATE] ? rta_getattr_u8(tb[IFLA_OPERSTATE]) : IF_OPER_UNKNOWN);
+
+  if (tb[IFLA_IFNAME])
+    track_linkinfo(rta_getattr_str(tb[IFLA_IFNAME]), ifi->ifi_index, n->nlmsg_type,
+                   tb[IFLA_OPERSTATE] ? rta_getattr_u8(tb[IFLA_OPERSTATE]) : IF_OPER_UNKNOWN,
+                   fp);
 }
 
 /*
@@ -568,12 +1092,546 @@ int accept_msg(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 	}
 }
 
+/*
+ * Closes every open session, emitting the summaries
+ */
+static void close_sessions(FILE *fp)
+{
+  struct iface *ifp;
+
+  iface_foreach(ifp)
+    session_close(&ifp->session, ifp->name, clock_monotonic_ns(),
+                  emit_session, fp);
+}
+
+/*
+ * Frees interfaces whose link is down to make room under the cap on
+ * interface memory; they are tracked again when they come back up
+ */
+static size_t evict_ifaces(size_t need, void *arg)
+{
+  struct iface *ifp, *next;
+  size_t freed = 0;
+
+  for (ifp = iface_first(); ifp != NULL && freed < need; ifp = next) {
+    next = ifp->list_next;
+    if (!ifp->down)
+      continue;
+    freed += sizeof(*ifp);
+    wireless_loop_timer_del(loop, &ifp->timer);
+    worker_job_free(ifp->job);
+    rt_remove(ifp->rt);
+    flight_release(ifp->flight);
+    iface_remove(ifp);
+  }
+  return freed;
+}
+
+/*
+ * Prints memory use per subsystem and per tracked interface
+ */
+static void print_memory(FILE *fp)
+{
+  struct iface *ifp;
+
+  mem_print(fp);
+  iface_foreach(ifp)
+    fprintf(fp, "memory ifname=%s bytes=%zu objects=%zu\n",
+            ifp->name, ifp->mem.bytes, ifp->mem.objects);
+}
+
+/*
+ * Asks for a memory report; the loop prints it when it next dispatches
+ */
+static void memory_signal(int sig)
+{
+  mem_report = 1;
+  if (loop)
+    wireless_loop_wake(loop);
+}
+
+/*
+ * Asks the monitor loop to finish
+ */
+static void monitor_signal(int sig)
+{
+  monitor_stop = 1;
+}
+
+/*
+ * Queues a journal record on the loop
+ */
+static int journal_send(int fd, const void *data, size_t len,
+                        const struct sockaddr *addr, socklen_t addrlen,
+                        void *arg)
+{
+  return wireless_loop_sendto(arg, fd, data, len, addr, addrlen);
+}
+
+/*
+ * Queues sample log records on the loop
+ */
+static int samplelog_send(int fd, const void *data, size_t len, void *arg)
+{
+  return wireless_loop_write(arg, fd, data, len);
+}
+
+/*
+ * Sends what the journal and sample log sinks batched during one
+ * dispatch, after recording what the real-time sampler queued, and
+ * wakes ring consumers waiting for what was published.  With
+ * the io_uring engine stdout and both sinks are queued
+ * on the loop, which writes them with its next submission.
+ */
+static void flush_output(void *arg)
+{
+  unsigned long long traced;
+
+  if (rt_priority)
+    rt_drain(sample_rt, NULL);
+  if (mem_report) {
+    mem_report = 0;
+    print_memory(stdout);
+  }
+  shmring_wake();
+  traced = trace_begin();
+  if (wireless_loop_engine(loop) == LOOP_ENGINE_URING) {
+    fflush(stdout);
+    if (journal)
+      journald_drain(journal, journal_send, loop);
+    if (samplelog)
+      samplelog_drain(samplelog, samplelog_send, loop);
+    trace_end(traced, "flush", NULL);
+    return;
+  }
+  if (journal) {
+    journald_flush(journal);
+    trace_end(traced, "flush journal", NULL);
+  }
+  if (samplelog) {
+    traced = trace_begin();
+    samplelog_flush(samplelog);
+    trace_end(traced, "flush samplelog", NULL);
+  }
+}
+
+/*
+ * Write function of the stdout stream that queues on the loop
+ */
+static ssize_t loop_stdout_write(void *cookie, const char *buf, size_t len)
+{
+  return wireless_loop_write(cookie, STDOUT_FILENO, buf, len) < 0 ? -1 : (ssize_t)len;
+}
+
+/*
+ * Points stdout at the loop for the io_uring engine
+ */
+static void stdout_to_loop(void)
+{
+  cookie_io_functions_t io = { .write = loop_stdout_write };
+  FILE *f;
+
+  fflush(stdout);
+  if ((f = fopencookie(loop, "w", io)) == NULL)
+    return;
+  setvbuf(f, NULL, _IOFBF, 65536);
+  real_stdout = stdout;
+  stdout = f;
+}
+
+/*
+ * Puts the real stdout back and waits for queued output.  Link messages
+ * reaped meanwhile are not handled: the handler prints to the stream
+ * being closed.
+ */
+static void stdout_restore(void)
+{
+  if (!real_stdout)
+    return;
+  wireless_loop_on_message(loop, NULL, NULL);
+  fclose(stdout);
+  stdout = real_stdout;
+  real_stdout = NULL;
+  wireless_loop_flush(loop);
+}
+
+/*
+ * A flight recorder ring was written to the sample log
+ */
+static void flight_dumped(const struct flight_dump *d, void *arg)
+{
+  FILE *fp = stdout;
+
+  flight_print(d, fp);
+  if (journal) {
+    journald_begin(journal, LOG_NOTICE, "%s flight recorder dumped on %s",
+                   d->ifname, samplelog_trigger_name(d->reason));
+    journald_field(journal, "IFNAME", "%s", d->ifname);
+    journald_field(journal, "FLIGHT_TRIGGER", "%s", samplelog_trigger_name(d->reason));
+    journald_field(journal, "FLIGHT_RECORDS", "%zu", d->pre + d->post);
+    journald_end(journal);
+  }
+}
+
+/*
+ * Prints how long events of each dispatch lane waited and how many
+ * queued up at once
+ */
+static void print_lanes(const struct wireless_loop_stats *st, FILE *fp)
+{
+  const struct loop_lane_stats *ls;
+  int i;
+
+  for (i = 0; i < LOOP_LANES; i++) {
+    ls = &st->lanes[i];
+    if (!ls->events)
+      continue;
+    fprintf(fp, "lane name=%s events=%llu max_depth=%llu mean_wait_us=%.1f "
+            "max_wait_us=%.1f\n", wireless_loop_lane_name(i), ls->events,
+            ls->max_depth, (double)ls->wait_ns / ls->events / NSEC_PER_USEC,
+            (double)ls->max_wait_ns / NSEC_PER_USEC);
+  }
+  if (st->yields)
+    fprintf(fp, "%llu times routine work stopped for link messages\n",
+            st->yields);
+}
+
+/*
+ * Waits for link events and, when an interval is set, samples the
+ * tracked interfaces periodically until interrupted
+ */
+static int monitor(FILE *fp)
+{
+  struct wireless_loop_stats st;
+  struct iface *ifp;
+  int ret;
+
+  trace_thread("loop");
+  signal(SIGINT, monitor_signal);
+  signal(SIGTERM, monitor_signal);
+  signal(SIGUSR1, memory_signal);
+  mem_on_evict(MEM_IFACE, evict_ifaces, NULL);
+
+  wireless_loop_filter(loop, &names);
+  wireless_loop_on_message(loop, accept_msg, fp);
+  wireless_loop_on_dispatch(loop, flush_output, NULL);
+  if (governing) {
+    governor_init(&governor, governor.budget, clock_monotonic_ns());
+    governor_timer.fn = governor_tick;
+    wireless_loop_timer_add(loop, &governor_timer,
+                            clock_monotonic_ns() + GOVERNOR_WINDOW_NS);
+  }
+  ret = wireless_loop_run(loop, &monitor_stop);
+  worker_stop_all();
+  rt_stop();
+  rt_drain(sample_rt, NULL);
+  flight_stop();
+  iface_foreach(ifp)
+    ifp->flight = NULL;
+
+  close_sessions(fp);
+  if (sampling) {
+    skew_hist_print(&skew_all, "all", fp);
+    skew_hist_print(&skew_ap_stats, "ap,stats", fp);
+  }
+  if (rt_priority)
+    rt_print(fp);
+  rtnlgate_print(fp);
+  shmring_print(fp);
+  if (sample_overruns)
+    fprintf(fp, "%llu samples skipped, the previous one still out\n",
+            sample_overruns);
+  wireless_loop_stats(loop, &st);
+  if (st.filtered)
+    fprintf(fp, "%llu link messages for other interfaces ignored\n",
+            st.filtered);
+  print_lanes(&st, fp);
+  return ret;
+}
+
+/*
+ * Answers the -Q query once over every wireless interface.  When the
+ * query reads a rate each is sampled twice, QUERY_GAP_NS apart.
+ */
+static int run_query(FILE *fp)
+{
+  struct ifaddrs *ifaddr, *ifa;
+  struct wireless_snapshot snap;
+  struct expr_row *rows;
+  struct expr_rate *rates;
+  size_t n = 0, max = 0, i;
+  int pass, passes = query.fields & (1u << EXPR_RETRY_RATE) ? 2 : 1;
+  struct timespec gap = { QUERY_GAP_NS / NSEC_PER_SEC, QUERY_GAP_NS % NSEC_PER_SEC };
+
+  if (getifaddrs(&ifaddr) == -1) {
+    perror("getifaddrs");
+    return -1;
+  }
+  for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next)
+    max++;
+  rows = calloc(max + 1, sizeof(*rows));
+  rates = calloc(max + 1, sizeof(*rates));
+  if (!rows || !rates) {
+    perror("query");
+    free(rows);
+    free(rates);
+    freeifaddrs(ifaddr);
+    return -1;
+  }
+
+  for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
+    if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_PACKET ||
+        !ifmatch_name(&names, ifa->ifa_name, strlen(ifa->ifa_name)) ||
+        !check_wireless(ifa->ifa_name, NULL))
+      continue;
+    strncpy(rows[n++].ifname, ifa->ifa_name, sizeof(rows[0].ifname) - 1);
+  }
+  freeifaddrs(ifaddr);
+
+  for (pass = 0; pass < passes; pass++) {
+    if (pass)
+      nanosleep(&gap, NULL);
+    for (i = 0; i < n; i++) {
+      char name[IFNAMSIZ];
+
+      memcpy(name, rows[i].ifname, sizeof(name));
+      wireless_snapshot(name, WS_ALL, &snap);
+      expr_row_fill(&rows[i], name, &snap, &rates[i],
+                    snap.field_ns[WS_INDEX(WS_STATS)]);
+    }
+  }
+  query_run(&query, rows, n, fp);
+  free(rows);
+  free(rates);
+  return 0;
+}
+
+/*
+ * Prints command line help
+ */
+static void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-i [ifname=]interval]... [-S slack] [-j socket] [-C percent] [-w file] [-F hz] [-R prio] [-T file] [-Q query] [-E rule]... [-L percent[/ops]] [-P ring] [-U] [-A] [-M subsys=bytes]... [-I pattern]... [-X pattern]... [monitor | query]\n", prog);
+  fprintf(stderr, "  -i interval  in monitor mode, sample every interval seconds\n"
+                  "               and print a summary per association; with\n"
+                  "               ifname= only for that interface\n"
+                  "  -S slack     milliseconds a sample may be delayed so that\n"
+                  "               interfaces due close together share a wakeup\n"
+                  "  -j socket    also send monitor events to the journal over its\n"
+                  "               native socket (normally " JOURNALD_SOCKET ")\n"
+                  "  -C percent   keep the monitor under this share of one CPU by\n"
+                  "               sampling less often and reading fewer fields\n"
+                  "  -w file      append samples and link events to a binary log\n"
+                  "               for wireless-analyze\n"
+                  "  -F hz        sample every interface hz times a second into\n"
+                  "               memory, and write the 10 s before and 5 s after\n"
+                  "               a signal drop, AP change, link loss or shift\n"
+                  "               to the -w log\n"
+                  "  -R prio      take the -i samples on a thread of this\n"
+                  "               SCHED_FIFO priority, with all memory locked\n"
+                  "               and output left to the main thread, and print\n"
+                  "               how late it woke on exit\n"
+                  "  -T file      record where each thread spends its time and\n"
+                  "               write it on exit as a Chrome JSON trace, or a\n"
+                  "               Perfetto one if file ends in .pftrace\n"
+                  "  -Q query     with query, print the wireless interfaces the\n"
+                  "               query picks; in monitor mode, print every\n"
+                  "               sample its where clause holds for, e.g.\n"
+                  "               'level < -70 and retry_rate > 10 sort noise'\n"
+                  "  -E rule      in monitor mode, raise an alert while the\n"
+                  "               expression holds for an interface's samples\n"
+                  "  -L percent[/ops]\n"
+                  "               hold the kernel's RTNL lock at most this share\n"
+                  "               of the time, for at most ops ioctls at once\n"
+                  "               (1), skipping samples over the budget\n"
+                  "  -P ring      publish samples and link events into a shared\n"
+                  "               memory ring file that wireless-analyze -f and\n"
+                  "               other local collectors read in place\n"
+                  "  -U           receive and write through io_uring instead of\n"
+                  "               a syscall per message and per flush\n"
+                  "  -A           take samples on worker threads pinned near\n"
+                  "               each device's interrupts\n"
+                  "  -M subsys=bytes\n"
+                  "               cap the memory of iface, worker, loop, uring,\n"
+                  "               journal, samplelog, cache, flight or trace (k, m,\n"
+                  "               g suffixes); the use of each is printed on SIGUSR1\n"
+                  "  -I pattern   only look at interfaces whose name matches\n"
+                  "               the pattern, e.g. 'wlan*', 'wlp*s*', 'ath[0-9]'\n"
+                  "  -X pattern   ignore interfaces whose name matches\n");
+}
+
+/*
+ * Parses -i [ifname=]seconds
+ */
+static int parse_interval(const char *arg)
+{
+  const char *eq = strchr(arg, '=');
+  const char *value = eq ? eq + 1 : arg;
+  char *end;
+  double seconds = strtod(value, &end);
+
+  if (end == value || *end || seconds < 0)
+    return -1;
+
+  if (!eq) {
+    default_interval_ns = seconds * NSEC_PER_SEC;
+  } else {
+    struct interval_rule *rule;
+
+    if (interval_rule_count == MAX_INTERVAL_RULES || eq == arg ||
+        eq - arg >= IFNAMSIZ)
+      return -1;
+    rule = &interval_rules[interval_rule_count++];
+    memcpy(rule->ifname, arg, eq - arg);
+    rule->interval_ns = seconds * NSEC_PER_SEC;
+  }
+  sampling = 1;
+  return 0;
+}
+
 /*
  * Main application
  */ 
-int main(int argc, char const *argv[]) 
+int main(int argc, char * const argv[]) 
 {
   struct ifaddrs *ifaddr, *ifa;
+  unsigned long long slack_ns = 0;
+  char err[128], *end;
+  int monitoring;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "i:S:j:C:w:F:R:T:Q:E:L:P:UAM:I:X:h")) != -1) {
+    switch (opt) {
+      case 'i':
+        if (parse_interval(optarg) < 0) {
+          usage(argv[0]);
+          return -1;
+        }
+        break;
+      case 'S':
+        slack_ns = strtoull(optarg, NULL, 10) * NSEC_PER_MSEC;
+        base_slack_ns = slack_ns;
+        break;
+      case 'j':
+        if ((journal = journald_open(optarg)) == NULL)
+          return -1;
+        break;
+      case 'C':
+        governor.budget = strtod(optarg, NULL) / 100;
+        if (governor.budget <= 0) {
+          usage(argv[0]);
+          return -1;
+        }
+        governing = 1;
+        break;
+      case 'w':
+        if ((samplelog = samplelog_open(optarg)) == NULL)
+          return -1;
+        break;
+      case 'F':
+        flight_hz = strtod(optarg, NULL);
+        if (flight_hz <= 0) {
+          usage(argv[0]);
+          return -1;
+        }
+        sampling = 1;
+        break;
+      case 'R':
+        rt_priority = atoi(optarg);
+        if (rt_priority <= 0) {
+          usage(argv[0]);
+          return -1;
+        }
+        break;
+      case 'T':
+        if (trace_open(optarg) < 0)
+          return -1;
+        break;
+      case 'Q':
+        if (query_compile(&query, optarg, err, sizeof(err)) < 0) {
+          fprintf(stderr, "bad query: %s\n", err);
+          return -1;
+        }
+        query_given = 1;
+        break;
+      case 'E':
+        if (alert_rule_count == MAX_ALERT_RULES) {
+          fprintf(stderr, "at most %d alert rules\n", MAX_ALERT_RULES);
+          return -1;
+        }
+        if (expr_compile(&alert_rules[alert_rule_count].expr, optarg, NULL,
+                         err, sizeof(err)) < 0) {
+          fprintf(stderr, "bad alert rule: %s\n", err);
+          return -1;
+        }
+        alert_rules[alert_rule_count++].src = optarg;
+        break;
+      case 'L':
+        rtnl_share = strtod(optarg, &end) / 100;
+        if (*end == '/')
+          rtnl_concurrent = atoi(end + 1);
+        if (rtnl_share <= 0 || rtnl_concurrent < 1) {
+          usage(argv[0]);
+          return -1;
+        }
+        break;
+      case 'P':
+        if (shmring_open(optarg) < 0)
+          return -1;
+        break;
+      case 'U':
+        engine = LOOP_ENGINE_URING;
+        break;
+      case 'A':
+        placing = 1;
+        break;
+      case 'M':
+        if (mem_parse_cap(optarg) < 0) {
+          usage(argv[0]);
+          return -1;
+        }
+        break;
+      case 'I':
+      case 'X':
+        if (ifmatch_add(&names, optarg, opt == 'X') < 0) {
+          fprintf(stderr, "bad interface pattern: %s\n", optarg);
+          return -1;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+ 
+  /* optionally monitor for events
+     use "monitor" as the parameter after any options */
+  monitoring = optind == argc - 1 && strcmp(argv[optind], "monitor") == 0;
+  if (rtnl_share && rtnlgate_init(rtnl_share, rtnl_concurrent) < 0)
+    return -1;
+  if (optind == argc - 1 && strcmp(argv[optind], "query") == 0) {
+    if (!query_given) {
+      fprintf(stderr, "query needs a query to answer (-Q)\n");
+      return -1;
+    }
+    return run_query(stdout);
+  }
+  if (query_given && (query.sorted || query.limit || query.aggregate)) {
+    fprintf(stderr, "sort, limit and aggregates need the query command\n");
+    return -1;
+  }
+  if (flight_hz && !samplelog) {
+    fprintf(stderr, "-F needs a sample log to write to (-w)\n");
+    return -1;
+  }
+  if (monitoring &&
+      (loop = wireless_loop_new_engine(SAMPLE_TICK_NS, slack_ns, engine)) == NULL)
+    return -1;
+  if (loop && flight_hz &&
+      flight_start(loop, samplelog, flight_hz, flight_dumped, NULL) < 0)
+    return -1;
+  if (loop && rt_priority && rt_start(loop, rt_priority, SAMPLE_FIELDS) < 0)
+    return -1;
  
   if (getifaddrs(&ifaddr) == -1) {
     perror("getifaddrs");
@@ -587,10 +1645,15 @@ int main(int argc, char const *argv[])
  
     if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_PACKET) 
       continue;
+    if (!ifmatch_name(&names, ifa->ifa_name, strlen(ifa->ifa_name)))
+      continue;
  
     if (check_wireless(ifa->ifa_name, protocol)) {
       printf("Interface %s is wireless: %s\n", ifa->ifa_name, protocol);
       wireless_info(ifa->ifa_name);
+      if (sampling)
+        track_iface(ifa->ifa_name,
+                    ((struct sockaddr_ll *)ifa->ifa_addr)->sll_ifindex);
     } else {
       printf("interface %s is not wireless\n", ifa->ifa_name);
     }
@@ -600,25 +1663,29 @@ int main(int argc, char const *argv[])
  
   freeifaddrs(ifaddr);
 
-  /* optionally monitor for events
-     use "monitor" as only parameter */
-  if (argc == 2 && strcmp(argv[1], "monitor") == 0) {
+  if (monitoring) {
+    int ret;
+
     printf("Listening for wireless events...\n");
 
-    struct rtnl_handle rth;
-    unsigned int groups = RTNLGRP_LINK;
-   
-    if (rtnl_open(&rth, groups) < 0)
-    {
-      printf("rtnl_open() failed in %s %s\n",__FUNCTION__,__FILE__);
-      return -1;
-    }
-    if (rtnl_listen(&rth, accept_msg, stdout) > 0)
+    if (wireless_loop_engine(loop) == LOOP_ENGINE_URING)
+      stdout_to_loop();
+    ret = monitor(stdout);
+    stdout_restore();
+    trace_write(stdout);
+
+    if (ret < 0)
     {
-      printf("failed in rtnl_listen()\n");
+      printf("failed in monitor()\n");
       return -1;
     }
+    wireless_loop_free(loop);
   }
+
+  trace_write(stdout);
+  journald_close(journal);
+  samplelog_close(samplelog);
+  shmring_close();
     
   return 0;
 }
@@ -0,0 +1,835 @@
+/*
+    LD_PRELOAD interposer presenting a synthetic wireless world
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Load-tests an unmodified wireless-info binary.  Preloaded, this
+ * library answers SIOCGIW* ioctls for N synthetic interfaces, adds
+ * them to getifaddrs(), and replaces rtnetlink sockets with a local
+ * datagram socket fed by a generator thread that flaps the synthetic
+ * links at a chosen rate.  Everything else goes to the real libc.
+ *
+ *   WI_FAKE_IFACES=N      synthetic interfaces (default 4)
+ *   WI_FAKE_PREFIX=name   interface name prefix (default "wlan")
+ *   WI_FAKE_RATE=n        link events per second (default 0, none)
+ *   WI_FAKE_TRACE=file    signal trace, one "dBm [ap]" per line
+ *   WI_FAKE_STEP_MS=n     time per trace line (default 1000)
+ *   WI_FAKE_MISSING=list  queries the driver lacks: essid, ap, bitrate,
+ *                         txpower, stats, range, or proc for the
+ *                         /proc/net/wireless listing
+ *   WI_FAKE_SLOW=list     name:us pairs, queries that take that long
+ *
+ * Interface i reads the trace starting at line i, so interfaces differ
+ * while sharing a script; a change of the ap column is a roam.  Opening
+ * /proc/net/wireless lists the synthetic interfaces.  On exit
+ * the number of generated and dropped events is printed to stderr.
+ *
+ *   gcc -shared -fPIC -o libwireless-preload.so wireless-preload.c -ldl -lpthread
+ *   WI_FAKE_IFACES=1000 WI_FAKE_RATE=500 \
+ *     LD_PRELOAD=./libwireless-preload.so ./wireless-info -i 1 monitor
+ */
+
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ifaddrs.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netpacket/packet.h>
+#include <net/if_arp.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/wireless.h>
+#include <linux/sockios.h>
+
+#include "clock.h"
+
+#define FAKE_IFINDEX_BASE 1000
+#define FAKE_MAX_SOCKETS  16
+#define FAKE_MAX_TRACE    4096
+
+/*
+ * One line of the signal trace
+ */
+struct fake_step {
+  int level;
+  int ap;
+};
+
+/*
+ * A replaced rtnetlink socket: the application holds fd, the generator
+ * writes into peer
+ */
+struct fake_socket {
+  int fd;
+  int peer;
+  unsigned int groups;
+  int overrun;                  /* report ENOBUFS on next receive */
+};
+
+/*
+ * Driver quirks, by query
+ */
+struct fake_query {
+  const char *name;
+  unsigned long request;        /* 0 for the proc listing */
+  int missing;
+  unsigned int delay_us;
+};
+
+static struct fake_query fake_queries[] = {
+  { "essid", SIOCGIWESSID },
+  { "ap", SIOCGIWAP },
+  { "bitrate", SIOCGIWRATE },
+  { "txpower", SIOCGIWTXPOW },
+  { "stats", SIOCGIWSTATS },
+  { "range", SIOCGIWRANGE },
+  { "proc", 0 },
+};
+
+#define FAKE_QUERIES (sizeof(fake_queries) / sizeof(fake_queries[0]))
+
+static int (*real_socket)(int, int, int);
+static int (*real_ioctl)(int, unsigned long, ...);
+static int (*real_close)(int);
+static int (*real_bind)(int, const struct sockaddr *, socklen_t);
+static int (*real_getsockname)(int, struct sockaddr *, socklen_t *);
+static int (*real_setsockopt)(int, int, int, const void *, socklen_t);
+static ssize_t (*real_recvmsg)(int, struct msghdr *, int);
+static ssize_t (*real_sendmsg)(int, const struct msghdr *, int);
+static ssize_t (*real_sendto)(int, const void *, size_t, int,
+                              const struct sockaddr *, socklen_t);
+static int (*real_open)(const char *, int, ...);
+static int (*real_open64)(const char *, int, ...);
+static int (*real_getifaddrs)(struct ifaddrs **);
+static void (*real_freeifaddrs)(struct ifaddrs *);
+
+static int fake_count = 4;
+static char fake_prefix[8] = "wlan";
+static double fake_rate;
+static unsigned long long fake_step_ns = NSEC_PER_SEC;
+static unsigned long long fake_start_ns;
+static struct fake_step fake_trace[FAKE_MAX_TRACE];
+static int fake_trace_len;
+
+/* per interface IF_OPER_* flipped by the generator */
+static unsigned char *fake_operstate;
+
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fake_socket fake_sockets[FAKE_MAX_SOCKETS];
+static unsigned long long fake_events, fake_dropped;
+
+/*
+ * Reads the trace file, one "dBm [ap]" per line
+ */
+static void fake_load_trace(const char *path)
+{
+  char line[128];
+  FILE *f;
+
+  if ((f = fopen(path, "r")) == NULL) {
+    perror(path);
+    return;
+  }
+  while (fake_trace_len < FAKE_MAX_TRACE && fgets(line, sizeof(line), f)) {
+    struct fake_step *st = &fake_trace[fake_trace_len];
+
+    st->ap = 0;
+    if (line[0] == '#' || sscanf(line, "%d %d", &st->level, &st->ap) < 1)
+      continue;
+    fake_trace_len++;
+  }
+  fclose(f);
+}
+
+/*
+ * Looks up a query by name
+ */
+static struct fake_query *fake_query_named(const char *name, size_t len)
+{
+  unsigned int i;
+
+  for (i = 0; i < FAKE_QUERIES; i++)
+    if (strlen(fake_queries[i].name) == len &&
+        strncmp(fake_queries[i].name, name, len) == 0)
+      return &fake_queries[i];
+  fprintf(stderr, "wireless-preload: no query %.*s\n", (int)len, name);
+  return NULL;
+}
+
+/*
+ * Parses WI_FAKE_MISSING or WI_FAKE_SLOW
+ */
+static void fake_load_quirks(const char *list, int slow)
+{
+  struct fake_query *q;
+  const char *p, *end, *colon;
+
+  for (p = list; *p; p = *end ? end + 1 : end) {
+    if ((end = strchr(p, ',')) == NULL)
+      end = p + strlen(p);
+    colon = slow ? memchr(p, ':', end - p) : NULL;
+    if ((q = fake_query_named(p, (colon ? colon : end) - p)) == NULL)
+      continue;
+    if (!slow)
+      q->missing = 1;
+    else if (colon)
+      q->delay_us = atoi(colon + 1);
+  }
+}
+
+/*
+ * Quirks of an ioctl, or of the proc listing for request 0
+ */
+static const struct fake_query *fake_query_for(unsigned long request)
+{
+  unsigned int i;
+
+  for (i = 0; i < FAKE_QUERIES; i++)
+    if (fake_queries[i].request == request)
+      return &fake_queries[i];
+  return NULL;
+}
+
+/*
+ * Spins for a slow query; sleeping would not cost the caller CPU as a
+ * slow driver does
+ */
+static void fake_delay(unsigned int us)
+{
+  unsigned long long end = clock_monotonic_ns() + us * NSEC_PER_USEC;
+
+  while (us && clock_monotonic_ns() < end)
+    ;
+}
+
+/*
+ * Index of a synthetic interface name, -1 for anything else
+ */
+static int fake_index(const char *name)
+{
+  size_t plen = strlen(fake_prefix);
+  char *end;
+  long i;
+
+  if (strncmp(name, fake_prefix, plen) || !name[plen])
+    return -1;
+  i = strtol(name + plen, &end, 10);
+  if (*end || i < 0 || i >= fake_count)
+    return -1;
+  return i;
+}
+
+/*
+ * Name of synthetic interface i
+ */
+static void fake_name(char *name, int i)
+{
+  char buf[32];
+
+  snprintf(buf, sizeof(buf), "%s%d", fake_prefix, i);
+  snprintf(name, IFNAMSIZ, "%.*s", IFNAMSIZ - 1, buf);
+}
+
+/*
+ * Signal and AP of an interface now, from the trace or a triangle wave
+ */
+static struct fake_step fake_state(int i)
+{
+  unsigned long long step = (clock_monotonic_ns() - fake_start_ns) / fake_step_ns;
+  struct fake_step st;
+
+  if (fake_trace_len)
+    return fake_trace[(step + i) % fake_trace_len];
+
+  st.level = -45 - (int)((step + i) % 40 < 20 ? (step + i) % 20 : 20 - (step + i) % 20);
+  st.ap = 0;
+  return st;
+}
+
+/*
+ * Looks up a replaced rtnetlink socket
+ */
+static struct fake_socket *fake_socket_find(int fd)
+{
+  int i;
+
+  if (fd < 0)
+    return NULL;
+  for (i = 0; i < FAKE_MAX_SOCKETS; i++)
+    if (fake_sockets[i].fd == fd)
+      return &fake_sockets[i];
+  return NULL;
+}
+
+/*
+ * Builds an RTM_NEWLINK for a synthetic interface, returns its length
+ */
+static int fake_linkmsg(char *buf, int i, int flags, unsigned int seq)
+{
+  struct nlmsghdr *n = (struct nlmsghdr *)buf;
+  struct ifinfomsg *ifi = NLMSG_DATA(n);
+  struct rtattr *rta;
+  char name[IFNAMSIZ];
+
+  fake_name(name, i);
+  memset(buf, 0, NLMSG_SPACE(sizeof(*ifi)));
+  n->nlmsg_type = RTM_NEWLINK;
+  n->nlmsg_flags = flags;
+  n->nlmsg_seq = seq;
+  n->nlmsg_len = NLMSG_LENGTH(sizeof(*ifi));
+  ifi->ifi_family = AF_UNSPEC;
+  ifi->ifi_type = ARPHRD_ETHER;
+  ifi->ifi_index = FAKE_IFINDEX_BASE + i;
+  ifi->ifi_flags = fake_operstate[i] == IF_OPER_UP ? IFF_UP | IFF_RUNNING : IFF_UP;
+
+  rta = (struct rtattr *)(buf + NLMSG_ALIGN(n->nlmsg_len));
+  rta->rta_type = IFLA_IFNAME;
+  rta->rta_len = RTA_LENGTH(strlen(name) + 1);
+  strcpy(RTA_DATA(rta), name);
+  n->nlmsg_len = NLMSG_ALIGN(n->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+
+  rta = (struct rtattr *)(buf + n->nlmsg_len);
+  rta->rta_type = IFLA_OPERSTATE;
+  rta->rta_len = RTA_LENGTH(1);
+  *(unsigned char *)RTA_DATA(rta) = fake_operstate[i];
+  n->nlmsg_len += RTA_ALIGN(rta->rta_len);
+  return n->nlmsg_len;
+}
+
+/*
+ * Sends a datagram to a replaced socket without blocking; a full
+ * receive queue is an overrun, as on a real netlink socket
+ */
+static void fake_deliver(struct fake_socket *fs, const void *buf, int len)
+{
+  if (send(fs->peer, buf, len, MSG_DONTWAIT) < 0) {
+    fake_dropped++;
+    fs->overrun = 1;
+  }
+}
+
+/*
+ * Generator thread: flaps random synthetic links at the chosen rate
+ */
+static void *fake_generator(void *arg)
+{
+  unsigned long long period = NSEC_PER_SEC / fake_rate;
+  unsigned long long next = clock_monotonic_ns();
+  unsigned int seed = 1;
+  char buf[256];
+
+  for (;;) {
+    unsigned long long now = clock_monotonic_ns();
+    struct timespec ts;
+
+    while (next <= now) {
+      int i = rand_r(&seed) % fake_count, j, len;
+
+      pthread_mutex_lock(&fake_lock);
+      fake_operstate[i] = fake_operstate[i] == IF_OPER_UP ? IF_OPER_DOWN : IF_OPER_UP;
+      len = fake_linkmsg(buf, i, 0, 0);
+      for (j = 0; j < FAKE_MAX_SOCKETS; j++)
+        if (fake_sockets[j].fd >= 0 && (fake_sockets[j].groups & RTMGRP_LINK))
+          fake_deliver(&fake_sockets[j], buf, len);
+      fake_events++;
+      pthread_mutex_unlock(&fake_lock);
+      next += period;
+    }
+
+    ts.tv_sec = (next - now) / NSEC_PER_SEC;
+    ts.tv_nsec = (next - now) % NSEC_PER_SEC;
+    nanosleep(&ts, NULL);
+  }
+  return arg;
+}
+
+/*
+ * Resolves the real functions and reads the configuration
+ */
+__attribute__((constructor))
+static void fake_init(void)
+{
+  const char *env;
+  pthread_t thread;
+  int i;
+
+  real_socket = dlsym(RTLD_NEXT, "socket");
+  real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+  real_close = dlsym(RTLD_NEXT, "close");
+  real_bind = dlsym(RTLD_NEXT, "bind");
+  real_getsockname = dlsym(RTLD_NEXT, "getsockname");
+  real_setsockopt = dlsym(RTLD_NEXT, "setsockopt");
+  real_recvmsg = dlsym(RTLD_NEXT, "recvmsg");
+  real_sendmsg = dlsym(RTLD_NEXT, "sendmsg");
+  real_sendto = dlsym(RTLD_NEXT, "sendto");
+  real_open = dlsym(RTLD_NEXT, "open");
+  real_open64 = dlsym(RTLD_NEXT, "open64");
+  real_getifaddrs = dlsym(RTLD_NEXT, "getifaddrs");
+  real_freeifaddrs = dlsym(RTLD_NEXT, "freeifaddrs");
+
+  for (i = 0; i < FAKE_MAX_SOCKETS; i++)
+    fake_sockets[i].fd = fake_sockets[i].peer = -1;
+
+  if ((env = getenv("WI_FAKE_IFACES")) != NULL)
+    fake_count = atoi(env);
+  if ((env = getenv("WI_FAKE_PREFIX")) != NULL)
+    snprintf(fake_prefix, sizeof(fake_prefix), "%s", env);
+  if ((env = getenv("WI_FAKE_RATE")) != NULL)
+    fake_rate = atof(env);
+  if ((env = getenv("WI_FAKE_STEP_MS")) != NULL && atoi(env) > 0)
+    fake_step_ns = atoi(env) * NSEC_PER_MSEC;
+  if ((env = getenv("WI_FAKE_TRACE")) != NULL)
+    fake_load_trace(env);
+  if ((env = getenv("WI_FAKE_MISSING")) != NULL)
+    fake_load_quirks(env, 0);
+  if ((env = getenv("WI_FAKE_SLOW")) != NULL)
+    fake_load_quirks(env, 1);
+
+  if (fake_count < 0)
+    fake_count = 0;
+  if (fake_count > 999999)
+    fake_count = 999999;
+  fake_operstate = malloc(fake_count + 1);
+  memset(fake_operstate, IF_OPER_UP, fake_count + 1);
+  fake_start_ns = clock_monotonic_ns();
+
+  if (fake_rate > 0 && fake_count > 0 &&
+      pthread_create(&thread, NULL, fake_generator, NULL) == 0)
+    pthread_detach(thread);
+}
+
+/*
+ * Reports what the generator did
+ */
+__attribute__((destructor))
+static void fake_fini(void)
+{
+  if (fake_rate > 0)
+    fprintf(stderr, "wireless-preload: %llu link events, %llu dropped\n",
+            fake_events, fake_dropped);
+}
+
+/*
+ * Replaces rtnetlink sockets; everything else is real
+ */
+int socket(int domain, int type, int protocol)
+{
+  int sv[2], i;
+
+  if (domain != AF_NETLINK || protocol != NETLINK_ROUTE)
+    return real_socket(domain, type, protocol);
+
+  if (socketpair(AF_UNIX, SOCK_DGRAM | (type & (SOCK_CLOEXEC | SOCK_NONBLOCK)),
+                 0, sv) < 0)
+    return -1;
+
+  pthread_mutex_lock(&fake_lock);
+  for (i = 0; i < FAKE_MAX_SOCKETS && fake_sockets[i].fd >= 0; i++)
+    ;
+  if (i == FAKE_MAX_SOCKETS) {
+    pthread_mutex_unlock(&fake_lock);
+    real_close(sv[0]);
+    real_close(sv[1]);
+    errno = EMFILE;
+    return -1;
+  }
+  fake_sockets[i].fd = sv[0];
+  fake_sockets[i].peer = sv[1];
+  fake_sockets[i].groups = 0;
+  fake_sockets[i].overrun = 0;
+  pthread_mutex_unlock(&fake_lock);
+  return sv[0];
+}
+
+int close(int fd)
+{
+  struct fake_socket *fs;
+
+  pthread_mutex_lock(&fake_lock);
+  if ((fs = fake_socket_find(fd)) != NULL) {
+    real_close(fs->peer);
+    fs->fd = fs->peer = -1;
+  }
+  pthread_mutex_unlock(&fake_lock);
+  return real_close(fd);
+}
+
+int bind(int fd, const struct sockaddr *addr, socklen_t len)
+{
+  struct fake_socket *fs = fake_socket_find(fd);
+
+  if (!fs)
+    return real_bind(fd, addr, len);
+  if (len >= sizeof(struct sockaddr_nl))
+    fs->groups = ((const struct sockaddr_nl *)addr)->nl_groups;
+  return 0;
+}
+
+int getsockname(int fd, struct sockaddr *addr, socklen_t *len)
+{
+  struct fake_socket *fs = fake_socket_find(fd);
+  struct sockaddr_nl nl;
+
+  if (!fs)
+    return real_getsockname(fd, addr, len);
+
+  memset(&nl, 0, sizeof(nl));
+  nl.nl_family = AF_NETLINK;
+  nl.nl_pid = getpid();
+  nl.nl_groups = fs->groups;
+  memcpy(addr, &nl, *len < sizeof(nl) ? *len : sizeof(nl));
+  *len = sizeof(nl);
+  return 0;
+}
+
+int setsockopt(int fd, int level, int name, const void *val, socklen_t len)
+{
+  if (fake_socket_find(fd) && level != SOL_SOCKET)
+    return 0;
+  return real_setsockopt(fd, level, name, val, len);
+}
+
+ssize_t recvmsg(int fd, struct msghdr *msg, int flags)
+{
+  struct fake_socket *fs = fake_socket_find(fd);
+  ssize_t ret;
+
+  if (!fs)
+    return real_recvmsg(fd, msg, flags);
+
+  if (fs->overrun) {
+    fs->overrun = 0;
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  if ((ret = real_recvmsg(fd, msg, flags)) >= 0 && msg->msg_name) {
+    struct sockaddr_nl nl;
+
+    /* messages come from the kernel */
+    memset(&nl, 0, sizeof(nl));
+    nl.nl_family = AF_NETLINK;
+    memcpy(msg->msg_name, &nl, msg->msg_namelen < sizeof(nl) ? msg->msg_namelen : sizeof(nl));
+    msg->msg_namelen = sizeof(nl);
+  }
+  return ret;
+}
+
+/*
+ * Answers a request sent to a replaced socket: an RTM_GETLINK dump
+ * gets every synthetic link, anything else an empty acknowledgement
+ */
+static void fake_request(struct fake_socket *fs, const void *buf, size_t len)
+{
+  const struct nlmsghdr *req = buf;
+  char msg[8192];
+  int off = 0, i;
+
+  if (len < sizeof(*req))
+    return;
+
+  pthread_mutex_lock(&fake_lock);
+  if (req->nlmsg_type == RTM_GETLINK && (req->nlmsg_flags & NLM_F_DUMP)) {
+    for (i = 0; i < fake_count; i++) {
+      if (off + 256 > (int)sizeof(msg)) {
+        fake_deliver(fs, msg, off);
+        off = 0;
+      }
+      off += NLMSG_ALIGN(fake_linkmsg(msg + off, i, NLM_F_MULTI, req->nlmsg_seq));
+    }
+  }
+
+  {
+    struct nlmsghdr *n = (struct nlmsghdr *)(msg + off);
+
+    memset(n, 0, NLMSG_SPACE(sizeof(int)));
+    n->nlmsg_type = (req->nlmsg_flags & NLM_F_DUMP) ? NLMSG_DONE : NLMSG_ERROR;
+    n->nlmsg_flags = (req->nlmsg_flags & NLM_F_DUMP) ? NLM_F_MULTI : 0;
+    n->nlmsg_seq = req->nlmsg_seq;
+    n->nlmsg_len = NLMSG_LENGTH(n->nlmsg_type == NLMSG_ERROR ?
+                                sizeof(struct nlmsgerr) : sizeof(int));
+    off += NLMSG_ALIGN(n->nlmsg_len);
+  }
+  fake_deliver(fs, msg, off);
+  pthread_mutex_unlock(&fake_lock);
+}
+
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+  struct fake_socket *fs = fake_socket_find(fd);
+
+  if (!fs)
+    return real_sendmsg(fd, msg, flags);
+  if (msg->msg_iovlen)
+    fake_request(fs, msg->msg_iov[0].iov_base, msg->msg_iov[0].iov_len);
+  return msg->msg_iovlen ? (ssize_t)msg->msg_iov[0].iov_len : 0;
+}
+
+ssize_t sendto(int fd, const void *buf, size_t len, int flags,
+               const struct sockaddr *addr, socklen_t alen)
+{
+  struct fake_socket *fs = fake_socket_find(fd);
+
+  if (!fs)
+    return real_sendto(fd, buf, len, flags, addr, alen);
+  fake_request(fs, buf, len);
+  return len;
+}
+
+ssize_t send(int fd, const void *buf, size_t len, int flags)
+{
+  return sendto(fd, buf, len, flags, NULL, 0);
+}
+
+/*
+ * Answers a wireless ioctl for synthetic interface i
+ */
+static int fake_wireless_ioctl(int i, unsigned long request, struct iwreq *wrq)
+{
+  struct fake_step st = fake_state(i);
+  int up = fake_operstate[i] == IF_OPER_UP;
+  const struct fake_query *q = fake_query_for(request);
+
+  if (q) {
+    fake_delay(q->delay_us);
+    if (q->missing) {
+      errno = EOPNOTSUPP;
+      return -1;
+    }
+  }
+
+  switch (request) {
+    case SIOCGIWNAME:
+      strcpy(wrq->u.name, "IEEE 802.11");
+      return 0;
+    case SIOCGIWESSID:
+      if (wrq->u.essid.pointer && wrq->u.essid.length >= 16) {
+        wrq->u.essid.length = sprintf(wrq->u.essid.pointer, up ? "synthetic" : "");
+        wrq->u.essid.flags = up;
+      }
+      return 0;
+    case SIOCGIWAP:
+      memset(&wrq->u.ap_addr, 0, sizeof(wrq->u.ap_addr));
+      wrq->u.ap_addr.sa_family = ARPHRD_ETHER;
+      if (up) {
+        unsigned char *a = (unsigned char *)wrq->u.ap_addr.sa_data;
+        a[0] = 0x02;
+        a[4] = st.ap;
+        a[5] = i & 0xff;
+      }
+      return 0;
+    case SIOCGIWRATE:
+      wrq->u.bitrate.value = up ? (st.level > -60 ? 300000000 : 54000000) : 0;
+      return 0;
+    case SIOCGIWTXPOW:
+      wrq->u.txpower.value = 20;
+      wrq->u.txpower.flags = IW_TXPOW_DBM;
+      return 0;
+    case SIOCGIWSTATS:
+      if (wrq->u.data.pointer && wrq->u.data.length >= sizeof(struct iw_statistics)) {
+        struct iw_statistics *stats = wrq->u.data.pointer;
+
+        memset(stats, 0, sizeof(*stats));
+        stats->qual.qual = st.level + 110 > 70 ? 70 : st.level + 110;
+        stats->qual.level = st.level + 0x100;
+        stats->qual.noise = -95 + 0x100;
+        stats->qual.updated = IW_QUAL_DBM | IW_QUAL_ALL_UPDATED;
+        stats->discard.retries = (clock_monotonic_ns() - fake_start_ns) / fake_step_ns * (i % 4);
+      }
+      return 0;
+    case SIOCGIWRANGE:
+      if (wrq->u.data.pointer && wrq->u.data.length >= sizeof(struct iw_range)) {
+        struct iw_range *range = wrq->u.data.pointer;
+
+        memset(range, 0, sizeof(*range));
+        range->max_qual.qual = 70;
+        range->max_qual.updated = IW_QUAL_LEVEL_INVALID | IW_QUAL_NOISE_INVALID;
+        range->avg_qual.qual = 35;
+      }
+      return 0;
+  }
+  errno = EOPNOTSUPP;
+  return -1;
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+  va_list ap;
+  void *arg;
+  int i;
+
+  va_start(ap, request);
+  arg = va_arg(ap, void *);
+  va_end(ap);
+
+  if (arg && request >= SIOCIWFIRST && request <= SIOCIWLAST &&
+      (i = fake_index(((struct iwreq *)arg)->ifr_name)) >= 0)
+    return fake_wireless_ioctl(i, request, arg);
+
+  if (arg && request == SIOCGIFINDEX &&
+      (i = fake_index(((struct ifreq *)arg)->ifr_name)) >= 0) {
+    ((struct ifreq *)arg)->ifr_ifindex = FAKE_IFINDEX_BASE + i;
+    return 0;
+  }
+
+  return real_ioctl(fd, request, arg);
+}
+
+/*
+ * The /proc/net/wireless listing of the synthetic interfaces, in a
+ * memory file, as the statistics ioctl would report them
+ */
+static int fake_proc_wireless(void)
+{
+  const struct fake_query *q = fake_query_for(0);
+  unsigned long long step = (clock_monotonic_ns() - fake_start_ns) / fake_step_ns;
+  char name[IFNAMSIZ];
+  FILE *f;
+  int fd, i;
+
+  fake_delay(q->delay_us);
+  if (q->missing) {
+    errno = ENOENT;
+    return -1;
+  }
+  if ((fd = memfd_create("wireless", MFD_CLOEXEC)) < 0 ||
+      (f = fdopen(dup(fd), "w")) == NULL)
+    return -1;
+
+  fprintf(f, "Inter-| sta-|   Quality        |   Discarded packets               | Missed | WE\n"
+             " face | tus | link level noise |  nwid  crypt   frag  retry   misc | beacon | 22\n");
+  for (i = 0; i < fake_count; i++) {
+    struct fake_step st = fake_state(i);
+
+    fake_name(name, i);
+    fprintf(f, "%6s: %04x  %3d.  %3d.  %3d.  %6d %6d %6d %6d %6d   %6d\n",
+            name, 0, st.level + 110 > 70 ? 70 : st.level + 110, st.level, -95,
+            0, 0, 0, (int)(step * (i % 4)), 0, 0);
+  }
+  fclose(f);
+  lseek(fd, 0, SEEK_SET);
+  return fd;
+}
+
+int open(const char *path, int flags, ...)
+{
+  va_list ap;
+  mode_t mode;
+
+  va_start(ap, flags);
+  mode = va_arg(ap, mode_t);
+  va_end(ap);
+
+  if (fake_count > 0 && strcmp(path, "/proc/net/wireless") == 0)
+    return fake_proc_wireless();
+  return real_open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+  va_list ap;
+  mode_t mode;
+
+  va_start(ap, flags);
+  mode = va_arg(ap, mode_t);
+  va_end(ap);
+
+  if (fake_count > 0 && strcmp(path, "/proc/net/wireless") == 0)
+    return fake_proc_wireless();
+  return real_open64(path, flags, mode);
+}
+
+/*
+ * getifaddrs() result with the synthetic interfaces in front of the
+ * real ones; freeifaddrs() recognises it by its first entry
+ */
+struct fake_ifaddrs {
+  struct ifaddrs *real;
+  struct ifaddrs ifa[];
+};
+
+/*
+ * Per synthetic interface storage behind its ifaddrs entry
+ */
+struct fake_ifaddr_data {
+  char name[IFNAMSIZ];
+  struct sockaddr_ll addr;
+};
+
+int getifaddrs(struct ifaddrs **ifap)
+{
+  struct fake_ifaddrs *fi;
+  struct fake_ifaddr_data *data;
+  int i;
+
+  if (real_getifaddrs(ifap) < 0)
+    return -1;
+  if (!fake_count)
+    return 0;
+
+  fi = calloc(1, sizeof(*fi) + fake_count * (sizeof(struct ifaddrs) +
+                                             sizeof(struct fake_ifaddr_data)));
+  if (fi == NULL)
+    return 0;
+  fi->real = *ifap;
+  data = (struct fake_ifaddr_data *)&fi->ifa[fake_count];
+
+  for (i = 0; i < fake_count; i++) {
+    fake_name(data[i].name, i);
+    data[i].addr.sll_family = AF_PACKET;
+    data[i].addr.sll_ifindex = FAKE_IFINDEX_BASE + i;
+    data[i].addr.sll_hatype = ARPHRD_ETHER;
+    fi->ifa[i].ifa_name = data[i].name;
+    fi->ifa[i].ifa_flags = IFF_UP | IFF_RUNNING;
+    fi->ifa[i].ifa_addr = (struct sockaddr *)&data[i].addr;
+    fi->ifa[i].ifa_next = i + 1 < fake_count ? &fi->ifa[i + 1] : fi->real;
+  }
+  *ifap = fi->ifa;
+  return 0;
+}
+
+void freeifaddrs(struct ifaddrs *ifa)
+{
+  struct fake_ifaddrs *fi;
+
+  if (ifa && fake_count && ifa->ifa_name &&
+      fake_index(ifa->ifa_name) == 0 && ifa->ifa_addr &&
+      ifa->ifa_addr->sa_family == AF_PACKET) {
+    fi = (struct fake_ifaddrs *)((char *)ifa - offsetof(struct fake_ifaddrs, ifa));
+    real_freeifaddrs(fi->real);
+    free(fi);
+    return;
+  }
+  real_freeifaddrs(ifa);
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
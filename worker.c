@@ -0,0 +1,328 @@
+/*
+    Sampling worker threads placed near the devices
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+/*
+ * Moves the ioctls of periodic sampling off the loop thread onto one
+ * worker thread per placement, pinned to the CPUs that share a cache
+ * with the device's interrupts.  The driver state a query touches is
+ * then already warm in that cache, and the jobs the worker fills in
+ * come from memory bound to the device's node.  Only the snapshot runs
+ * on the worker; the result is posted back and everything else about a
+ * sample still happens on the loop thread.
+ *
+ * So the per-interface state the worker touches is the job: its
+ * snapshot and its own copy of the route table.  struct iface, with the
+ * route table the loop keeps, stays in ordinary memory.  Only the loop
+ * thread uses it, and binding it to the device's node would move it away
+ * from that thread.
+ *
+ * Jobs are allocated and freed on the loop thread only, so the free
+ * lists need no lock; the queue between the loop and a worker has one.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "clock.h"
+#include "worker.h"
+#include "mem.h"
+#include "trace.h"
+
+/*
+ * Chunk of node-local jobs
+ */
+struct worker_slab {
+  struct worker_slab *next;
+  struct worker_job jobs[WORKER_SLAB_JOBS];
+};
+
+struct worker {
+  struct placement placement;
+  struct wireless_loop *loop;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct worker_job *head;
+  struct worker_job **tail;
+  int stop;
+
+  struct worker_slab *slabs;
+  struct worker_job *free_jobs;
+};
+
+static struct worker *workers[WORKER_MAX];
+static int worker_count;
+
+/*
+ * Lane to post a finished job in: a snapshot that found the interface
+ * joined, left or changed its access point goes ahead of routine ones
+ */
+static enum loop_lane worker_lane(struct worker_job *job)
+{
+  enum loop_lane lane = LOOP_LANE_WORK;
+
+  if (job->ret != 0 || !(job->snap.valid & WS_AP))
+    return lane;
+  if (job->ap_seen && (job->associated != job->snap.associated ||
+                       memcmp(&job->ap, &job->snap.ap, sizeof(job->ap))))
+    lane = LOOP_LANE_LINK;
+  job->ap_seen = 1;
+  job->associated = job->snap.associated;
+  job->ap = job->snap.ap;
+  return lane;
+}
+
+/*
+ * Worker thread: pins itself, then takes snapshots as they are queued
+ */
+static void *worker_run(void *arg)
+{
+  struct worker *w = arg;
+  struct worker_job *job;
+
+  trace_thread("worker");
+  if (pthread_setaffinity_np(pthread_self(), sizeof(w->placement.cpus),
+                             &w->placement.cpus) != 0)
+    fprintf(stderr, "worker: could not pin to its placement\n");
+
+  pthread_mutex_lock(&w->lock);
+  for (;;) {
+    while (!w->head && !w->stop)
+      pthread_cond_wait(&w->cond, &w->lock);
+    if (w->stop)
+      break;
+    job = w->head;
+    if ((w->head = job->next) == NULL)
+      w->tail = &w->head;
+    pthread_mutex_unlock(&w->lock);
+
+    job->start_ns = clock_monotonic_ns();
+    if (job->routed)
+      job->ret = route_snapshot(&job->route, job->ifname, job->fields, &job->snap);
+    else
+      job->ret = wireless_snapshot(job->ifname, job->fields, &job->snap);
+    job->end_ns = clock_monotonic_ns();
+    trace_span("snapshot", job->ifname, job->start_ns, job->end_ns);
+    wireless_loop_post_lane(w->loop, &job->done, worker_lane(job));
+
+    pthread_mutex_lock(&w->lock);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+/*
+ * Finds the worker for a placement, starting one if there is none yet.
+ * With WORKER_MAX running, shares one on the same node, or returns NULL
+ * so that the interface is sampled on the loop thread.
+ */
+struct worker *worker_get(struct wireless_loop *loop, const struct placement *p)
+{
+  struct worker *w;
+  int i;
+
+  for (i = 0; i < worker_count; i++) {
+    w = workers[i];
+    if (w->loop == loop && w->placement.node == p->node &&
+        CPU_EQUAL(&w->placement.cpus, &p->cpus))
+      return w;
+  }
+  if (worker_count == WORKER_MAX) {
+    for (i = 0; i < worker_count; i++) {
+      w = workers[i];
+      if (w->loop == loop && p->node >= 0 && w->placement.node == p->node)
+        break;
+    }
+    if (i == worker_count) {
+      fprintf(stderr, "worker: all %d in use and none on node %d, "
+                      "sampling on the loop\n", WORKER_MAX, p->node);
+      return NULL;
+    }
+    fprintf(stderr, "worker: all %d in use, sharing one on node %d\n",
+            WORKER_MAX, p->node);
+    return w;
+  }
+
+  if ((w = mem_alloc(MEM_WORKER, sizeof(*w))) == NULL) {
+    perror("worker");
+    return NULL;
+  }
+  w->placement = *p;
+  w->loop = loop;
+  w->tail = &w->head;
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->cond, NULL);
+  if (pthread_create(&w->thread, NULL, worker_run, w) != 0) {
+    perror("pthread_create");
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    mem_free(w);
+    return NULL;
+  }
+  workers[worker_count++] = w;
+  return w;
+}
+
+/*
+ * Placement a worker runs with
+ */
+const struct placement *worker_placement(const struct worker *w)
+{
+  return &w->placement;
+}
+
+/*
+ * Loop side of a finished job
+ */
+static void worker_job_done(void *arg)
+{
+  struct worker_job *job = arg;
+
+  job->busy = 0;
+  if (job->fn)
+    job->fn(job, job->arg);
+  else
+    worker_job_free(job);
+}
+
+/*
+ * Takes a job from the worker's free list, adding a slab bound to its
+ * node when the list is empty.  Slabs are accounted to the workers,
+ * each job in use also to its owner.
+ */
+struct worker_job *worker_job_new(struct worker *w, const char *ifname,
+                                  struct mem_owner *owner,
+                                  worker_done_t fn, void *arg)
+{
+  struct worker_job *job;
+  int i;
+
+  if (!w->free_jobs) {
+    struct worker_slab *slab;
+
+    if (mem_charge(MEM_WORKER, NULL, sizeof(*slab), 1) < 0)
+      return NULL;
+    slab = mmap(NULL, sizeof(*slab), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slab == MAP_FAILED) {
+      perror("worker");
+      mem_charge(MEM_WORKER, NULL, -(long long)sizeof(*slab), -1);
+      return NULL;
+    }
+    /* before the first touch, which is what places the pages */
+    placement_bind(slab, sizeof(*slab), w->placement.node);
+    for (i = 0; i < WORKER_SLAB_JOBS; i++) {
+      slab->jobs[i].next = w->free_jobs;
+      w->free_jobs = &slab->jobs[i];
+    }
+    slab->next = w->slabs;
+    w->slabs = slab;
+  }
+
+  job = w->free_jobs;
+  w->free_jobs = job->next;
+  memset(job, 0, sizeof(*job));
+  job->worker = w;
+  job->done.fn = worker_job_done;
+  job->done.arg = job;
+  job->fn = fn;
+  job->arg = arg;
+  job->owner = owner;
+  mem_owner_charge(owner, sizeof(*job), 1);
+  strncpy(job->ifname, ifname, sizeof(job->ifname) - 1);
+  return job;
+}
+
+/*
+ * Returns a job to its worker; a busy one goes when it comes back
+ */
+void worker_job_free(struct worker_job *job)
+{
+  if (!job)
+    return;
+  mem_owner_charge(job->owner, -(long long)sizeof(*job), -1);
+  job->owner = NULL;
+  if (job->busy) {
+    job->fn = NULL;
+    return;
+  }
+  job->next = job->worker->free_jobs;
+  job->worker->free_jobs = job;
+}
+
+/*
+ * Queues a snapshot of the given fields.  Returns -1 if the job's last
+ * snapshot has not come back yet.
+ */
+int worker_submit(struct worker_job *job, unsigned int fields)
+{
+  struct worker *w = job->worker;
+
+  if (job->busy)
+    return -1;
+  job->busy = 1;
+  job->fields = fields;
+  job->submit_ns = clock_monotonic_ns();
+  job->next = NULL;
+
+  pthread_mutex_lock(&w->lock);
+  *w->tail = job;
+  w->tail = &job->next;
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+  return 0;
+}
+
+/*
+ * Stops and frees every worker.  Jobs still queued are dropped, and
+ * completions already posted must not be dispatched afterwards.
+ */
+void worker_stop_all(void)
+{
+  int i;
+
+  for (i = 0; i < worker_count; i++) {
+    struct worker *w = workers[i];
+    struct worker_slab *slab, *next;
+
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    for (slab = w->slabs; slab != NULL; slab = next) {
+      next = slab->next;
+      munmap(slab, sizeof(*slab));
+      mem_charge(MEM_WORKER, NULL, -(long long)sizeof(*slab), -1);
+    }
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    mem_free(w);
+  }
+  worker_count = 0;
+}
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */
@@ -0,0 +1,83 @@
+/*
+    Sampling worker threads placed near the devices
+
+    Copyright (C) 2014 Doug Reese
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+    USA
+*/
+
+#ifndef WORKER_H
+#define WORKER_H
+
+#include "loop.h"
+#include "sample.h"
+#include "placement.h"
+#include "mem.h"
+#include "route.h"
+
+/* Most workers, one per distinct placement */
+#define WORKER_MAX       64
+
+/* Jobs carved from each node-local chunk */
+#define WORKER_SLAB_JOBS 64
+
+struct worker;
+struct worker_job;
+
+typedef void (*worker_done_t)(struct worker_job *job, void *arg);
+
+/*
+ * One interface's sampling request.  The loop thread owns it except
+ * while busy, when the worker fills in ret, the times and snap and then
+ * posts done back to the loop.
+ */
+struct worker_job {
+  struct worker_job *next;      /* worker queue, or free list */
+  struct loop_work done;
+  struct worker *worker;
+  worker_done_t fn;             /* NULL once freed while busy */
+  void *arg;
+  struct mem_owner *owner;      /* charged for the job, may be NULL */
+  int routed;                   /* read through route, not wext alone */
+  int busy;
+
+  char ifname[IFNAMSIZ];
+  unsigned int fields;
+  int ret;
+  unsigned long long submit_ns;
+  unsigned long long start_ns;  /* taken off the queue */
+  unsigned long long end_ns;    /* snapshot complete */
+  struct wireless_snapshot snap;
+  struct route_table route;     /* its own: the job may outlive its owner */
+
+  /* association last seen by the worker, to post changes as urgent */
+  int ap_seen;
+  int associated;
+  struct ether_addr ap;
+};
+
+struct worker *worker_get(struct wireless_loop *loop, const struct placement *p);
+const struct placement *worker_placement(const struct worker *w);
+struct worker_job *worker_job_new(struct worker *w, const char *ifname,
+                                  struct mem_owner *owner,
+                                  worker_done_t fn, void *arg);
+void worker_job_free(struct worker_job *job);
+int worker_submit(struct worker_job *job, unsigned int fields);
+void worker_stop_all(void);
+
+#endif /* WORKER_H */
+
+/* vim: set expandtab tabstop=2 shiftwidth=2 softtabstop=2 autoindent smartindent: */